@@ -0,0 +1,151 @@
+/*
+Implementation file for the drive event queue
+*/
+
+
+//! Includes
+#include "drive_event_queue.h"
+#include <algorithm>
+
+
+namespace
+{
+	size_t RoundUpToPowerOfTwo(size_t nValue)
+	{
+		size_t nResult = 2;
+		while (nResult < nValue)
+			nResult <<= 1;
+		return nResult;
+	}
+}
+
+
+CDriveEventQueue::CDriveEventQueue(size_t nCapacity, EQueueOverflowPolicy eOverflowPolicy)
+	: m_nMask(RoundUpToPowerOfTwo(nCapacity) - 1), m_eOverflowPolicy(eOverflowPolicy), m_arrCells(new SCell[m_nMask + 1]),
+	m_nEnqueuePos(0), m_nDequeuePos(0), m_nMaxDepth(0), m_nPushed(0), m_nDropped(0)
+{
+	for (size_t i = 0; i <= m_nMask; i++)
+		m_arrCells[i].nSequence.store(i, std::memory_order_relaxed);
+}
+
+bool CDriveEventQueue::Push(const SDriveEvent& oEvent)
+{
+	bool bPushed = TryPush(oEvent);
+	if (!bPushed && m_eOverflowPolicy == EQueueOverflowPolicy::DropOldest)
+	{
+		// Make room, the consumers may free it first
+		SDriveEvent oOldest;
+		while (!bPushed)
+		{
+			if (TryPop(oOldest))
+				m_nDropped.fetch_add(1, std::memory_order_relaxed);
+			bPushed = TryPush(oEvent);
+		}
+	}
+
+	if (!bPushed)
+	{
+		m_nDropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	m_nPushed.fetch_add(1, std::memory_order_relaxed);
+	const size_t nDepth = GetDepth();
+	size_t nMaxDepth = m_nMaxDepth.load(std::memory_order_relaxed);
+	while (nDepth > nMaxDepth && !m_nMaxDepth.compare_exchange_weak(nMaxDepth, nDepth, std::memory_order_relaxed))
+		;
+	return true;
+}
+
+size_t CDriveEventQueue::PopBatch(SDriveEvent* arrEvents, size_t nMaxCount)
+{
+	size_t nCount = 0;
+	while (nCount < nMaxCount && TryPop(arrEvents[nCount]))
+		nCount++;
+	return nCount;
+}
+
+size_t CDriveEventQueue::GetDepth() const
+{
+	// The positions are read apart, the difference may be off while the queue changes
+	const size_t nDequeuePos = m_nDequeuePos.load(std::memory_order_acquire);
+	const size_t nEnqueuePos = m_nEnqueuePos.load(std::memory_order_acquire);
+	if (nEnqueuePos <= nDequeuePos)
+		return 0;
+	return std::min(nEnqueuePos - nDequeuePos, GetCapacity());
+}
+
+size_t CDriveEventQueue::GetMaxDepth() const
+{
+	return m_nMaxDepth.load(std::memory_order_relaxed);
+}
+
+size_t CDriveEventQueue::GetCapacity() const
+{
+	return m_nMask + 1;
+}
+
+EQueueOverflowPolicy CDriveEventQueue::GetOverflowPolicy() const
+{
+	return m_eOverflowPolicy;
+}
+
+uint64_t CDriveEventQueue::GetPushedCount() const
+{
+	return m_nPushed.load(std::memory_order_relaxed);
+}
+
+uint64_t CDriveEventQueue::GetDroppedCount() const
+{
+	return m_nDropped.load(std::memory_order_relaxed);
+}
+
+bool CDriveEventQueue::TryPush(const SDriveEvent& oEvent)
+{
+	size_t nPos = m_nEnqueuePos.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		SCell& oCell = m_arrCells[nPos & m_nMask];
+		const size_t nSequence = oCell.nSequence.load(std::memory_order_acquire);
+		const intptr_t nDiff = static_cast<intptr_t>(nSequence) - static_cast<intptr_t>(nPos);
+		if (nDiff == 0)
+		{
+			// The cell is free, claim the position
+			if (m_nEnqueuePos.compare_exchange_weak(nPos, nPos + 1, std::memory_order_relaxed))
+			{
+				oCell.oEvent = oEvent;
+				oCell.nSequence.store(nPos + 1, std::memory_order_release);
+				return true;
+			}
+		}
+		else if (nDiff < 0)
+			return false;	// Full: the cell still holds the event of the previous lap
+		else
+			nPos = m_nEnqueuePos.load(std::memory_order_relaxed);
+	}
+}
+
+bool CDriveEventQueue::TryPop(SDriveEvent& oEvent)
+{
+	size_t nPos = m_nDequeuePos.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		SCell& oCell = m_arrCells[nPos & m_nMask];
+		const size_t nSequence = oCell.nSequence.load(std::memory_order_acquire);
+		const intptr_t nDiff = static_cast<intptr_t>(nSequence) - static_cast<intptr_t>(nPos + 1);
+		if (nDiff == 0)
+		{
+			// The cell is filled, claim the position
+			if (m_nDequeuePos.compare_exchange_weak(nPos, nPos + 1, std::memory_order_relaxed))
+			{
+				oEvent = oCell.oEvent;
+				oCell.nSequence.store(nPos + m_nMask + 1, std::memory_order_release);
+				return true;
+			}
+		}
+		else if (nDiff < 0)
+			return false;	// Empty: the cell waits for the producer
+		else
+			nPos = m_nDequeuePos.load(std::memory_order_relaxed);
+	}
+}
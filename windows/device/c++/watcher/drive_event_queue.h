@@ -0,0 +1,76 @@
+/*
+Declaration file for the drive event queue
+Bounded lock-free queue of the events between the sources and the dispatcher threads
+*/
+
+
+//! Include guard
+#pragma once
+
+
+//! Includes
+#include "drive_event_source.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+
+//! What Push does when the queue is full
+enum class EQueueOverflowPolicy
+{
+	DropNewest,		// The new event is dropped, the queued ones are kept
+	DropOldest		// The oldest queued event is dropped to make room for the new one
+};
+
+
+//! Class CDriveEventQueue
+// Ring of preallocated records, each one with a sequence number telling whether it's free or filled
+// (D. Vyukov's bounded queue): any number of threads push and pop without locks and no memory
+// is allocated after the construction
+class CDriveEventQueue
+{
+public: //! Constructors and destructor
+	// The capacity is rounded up to a power of two
+	CDriveEventQueue(size_t nCapacity, EQueueOverflowPolicy eOverflowPolicy);
+	CDriveEventQueue(const CDriveEventQueue&) = delete;
+	CDriveEventQueue& operator=(const CDriveEventQueue&) = delete;
+
+public: //! Interface
+	// Queues the event applying the overflow policy, returns false if it is dropped
+	bool Push(const SDriveEvent& oEvent);
+	// Moves up to nMaxCount oldest events to arrEvents, returns their number
+	size_t PopBatch(SDriveEvent* arrEvents, size_t nMaxCount);
+
+	// Returns the number of the queued events
+	size_t GetDepth() const;
+	// Returns the largest depth reached
+	size_t GetMaxDepth() const;
+	size_t GetCapacity() const;
+	EQueueOverflowPolicy GetOverflowPolicy() const;
+
+	// Returns the number of the events queued and dropped by the overflow policy
+	uint64_t GetPushedCount() const;
+	uint64_t GetDroppedCount() const;
+
+private: //! Implementation
+	bool TryPush(const SDriveEvent& oEvent);
+	bool TryPop(SDriveEvent& oEvent);
+
+private: //! Types
+	struct SCell
+	{
+		std::atomic<size_t>	nSequence;		// Position the cell is free for, plus one once it's filled
+		SDriveEvent			oEvent;
+	};
+
+private: //! Members
+	const size_t					m_nMask;			// Capacity - 1
+	const EQueueOverflowPolicy		m_eOverflowPolicy;
+	std::unique_ptr<SCell[]>		m_arrCells;
+	alignas(64) std::atomic<size_t>	m_nEnqueuePos;		// The producers and the consumers don't share cache lines
+	alignas(64) std::atomic<size_t>	m_nDequeuePos;
+	alignas(64) std::atomic<size_t>	m_nMaxDepth;
+	std::atomic<uint64_t>			m_nPushed;
+	std::atomic<uint64_t>			m_nDropped;
+};
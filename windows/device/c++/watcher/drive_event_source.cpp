@@ -0,0 +1,24 @@
+/*
+Implementation file for the drive event source
+*/
+
+
+//! Includes
+#include "drive_event_source.h"
+#ifdef _WIN32
+#include "wmi_drive_event_source.h"
+#elif defined(__linux__)
+#include "uevent_drive_event_source.h"
+#endif
+
+
+IDriveEventSourcePtr CreateDriveEventSource()
+{
+#ifdef _WIN32
+	return IDriveEventSourcePtr(new CWmiDriveEventSource());
+#elif defined(__linux__)
+	return IDriveEventSourcePtr(new CUeventDriveEventSource());
+#else
+	return nullptr;
+#endif
+}
@@ -0,0 +1,68 @@
+/*
+Declaration file for the drive event source
+Interface of the backends that tell the drive watcher about the arrived drives
+*/
+
+
+//! Include guard
+#pragma once
+
+
+//! Includes
+#include <memory>
+
+
+//! Drive event type
+enum class EDriveEventType
+{
+	Invalid,
+	DriveArrival
+};
+
+
+//! Struct SDriveEvent
+struct SDriveEvent
+{
+	EDriveEventType		eType = EDriveEventType::Invalid;
+	char				chDriveLetter = '\n';	// Windows: letter of the drive
+	char				szDevice[32] = {};		// Name of the drive: "E:" on Windows, the kernel name ("sdb1") on Linux
+};
+
+
+//! Type declarations
+class IDriveEventSource;
+typedef std::shared_ptr<IDriveEventSource> IDriveEventSourcePtr;
+
+
+//! Interface IDriveEventSource
+class IDriveEventSource
+{
+public: //! Type definitions
+	// Receiver of the events, called on the thread of the source
+	class IEventSink
+	{
+	public:
+		virtual ~IEventSink() = default;
+		virtual void OnDriveEvent(const SDriveEvent& oEvent) = 0;
+	};
+
+public: //! Constructors and destructor
+	virtual ~IDriveEventSource() = default;
+
+public: //! Interface
+	// Acquires the resources of the source
+	virtual bool Init() = 0;
+	// Releases them, fails while the source is active
+	virtual bool Reset() = 0;
+
+	// Starts delivering the events to the sink
+	virtual bool Start(IEventSink* pSink) = 0;
+	// Stops delivering, no event comes to the sink once it returns
+	virtual bool Stop() = 0;
+	// Returns true if the source is active
+	virtual bool IsActive() const = 0;
+};
+
+
+//! Creates the source of the platform: WMI on Windows, kernel uevents on Linux (nullptr elsewhere)
+IDriveEventSourcePtr CreateDriveEventSource();
@@ -5,93 +5,259 @@ Implementation file for the drive watcher
 
 //! Includes
 #include "drive_watcher.h"
-#include <string>
-#include <comutil.h>
+#include <algorithm>
 
 
 CDriveWatcher::CDriveWatcher()
-	: m_pListener()
+	: CDriveWatcher(CreateDriveEventSource())
 {
 }
 
+CDriveWatcher::CDriveWatcher(IDriveEventSourcePtr pSource)
+	: m_pSource(pSource), m_pListeners(new TListenerList()), m_nDelivering(0), m_bDispatching(false), m_nWaiting(0), m_nDelivered(0), m_nBatches(0)
+{
+	SetDispatchOptions(m_oOptions);
+}
+
 CDriveWatcher::~CDriveWatcher()
 {
+	Stop();
 	Reset();
+	delete m_pListeners.load();
 }
 
 bool CDriveWatcher::Init()
 {
-	return Base::Init();
+	if (m_pSource == nullptr)
+		return false;
+	return m_pSource->Init();
 }
 
 void CDriveWatcher::Reset()
 {
-	m_pListener.reset();
-	Base::Reset();
+	SetNotificationListener(nullptr);
+	if (m_pSource != nullptr)
+		m_pSource->Reset();
 }
 
 bool CDriveWatcher::Start()
 {
-	std::string sQueryString("SELECT * FROM __InstanceCreationEvent WITHIN 0.1 WHERE TargetInstance ISA 'Win32_LogicalDisk'");
-	return Base::StartListening(sQueryString);
+	if (m_pSource == nullptr || IsActive())
+		return false;
+
+	if (m_pQueue != nullptr)
+	{
+		m_bDispatching = true;
+		for (size_t i = 0; i < m_oOptions.nThreadCount; i++)
+			m_vecDispatchers.emplace_back(&CDriveWatcher::Dispatch, this);
+	}
+
+	if (!m_pSource->Start(this))
+	{
+		StopDispatchers();
+		return false;
+	}
+	return true;
 }
 
 void CDriveWatcher::Stop()
 {
-	Base::StopListening();
+	if (m_pSource != nullptr)
+		m_pSource->Stop();
+	StopDispatchers();
+
+	// No delivery is left, the listeners that unregistered themselves are released now
+	std::lock_guard<std::mutex> oLock(m_mtxListeners);
+	FreeRetiredListeners();
 }
 
 bool CDriveWatcher::IsActive() const
 {
-	return Base::IsListening();
+	return m_pSource != nullptr && m_pSource->IsActive();
+}
+
+bool CDriveWatcher::RegisterListener(INotificationListenerPtr pListener)
+{
+	if (pListener == nullptr)
+		return false;
+
+	std::lock_guard<std::mutex> oLock(m_mtxListeners);
+	const TListenerList& lstCurrent = *m_pListeners.load();
+	if (std::find(lstCurrent.begin(), lstCurrent.end(), pListener) != lstCurrent.end())
+		return false;
+
+	std::unique_ptr<TListenerList> pNew(new TListenerList(lstCurrent));
+	pNew->push_back(pListener);
+	PublishListeners(pNew.release());
+	return true;
+}
+
+bool CDriveWatcher::UnregisterListener(const INotificationListenerPtr& pListener)
+{
+	std::lock_guard<std::mutex> oLock(m_mtxListeners);
+	const TListenerList& lstCurrent = *m_pListeners.load();
+	auto it = std::find(lstCurrent.begin(), lstCurrent.end(), pListener);
+	if (it == lstCurrent.end())
+		return false;
+
+	std::unique_ptr<TListenerList> pNew(new TListenerList(lstCurrent.begin(), it));
+	pNew->insert(pNew->end(), it + 1, lstCurrent.end());
+	PublishListeners(pNew.release());
+	return true;
+}
+
+size_t CDriveWatcher::GetListenerCount() const
+{
+	std::lock_guard<std::mutex> oLock(m_mtxListeners);
+	return m_pListeners.load()->size();
 }
 
 void CDriveWatcher::SetNotificationListener(INotificationListenerPtr pListener)
 {
-	m_pListener = pListener;
+	std::lock_guard<std::mutex> oLock(m_mtxListeners);
+	std::unique_ptr<TListenerList> pNew(new TListenerList());
+	if (pListener != nullptr)
+		pNew->push_back(pListener);
+	PublishListeners(pNew.release());
 }
 
 CDriveWatcher::INotificationListenerPtr CDriveWatcher::GetNotificationListener()
 {
-	return m_pListener;
+	std::lock_guard<std::mutex> oLock(m_mtxListeners);
+	const TListenerList& lstCurrent = *m_pListeners.load();
+	return lstCurrent.empty() ? nullptr : lstCurrent.front();
+}
+
+bool CDriveWatcher::SetDispatchOptions(const SDispatchOptions& oOptions)
+{
+	if (IsActive() || !m_vecDispatchers.empty())
+		return false;
+
+	m_oOptions = oOptions;
+	m_oOptions.nThreadCount = std::max<size_t>(m_oOptions.nThreadCount, 1);
+	m_oOptions.nBatchSize = std::max<size_t>(m_oOptions.nBatchSize, 1);
+	if (m_oOptions.nQueueCapacity == 0)
+		m_pQueue.reset();
+	else
+		m_pQueue.reset(new CDriveEventQueue(m_oOptions.nQueueCapacity, m_oOptions.eOverflowPolicy));
+	return true;
+}
+
+CDriveWatcher::SDispatchOptions CDriveWatcher::GetDispatchOptions() const
+{
+	return m_oOptions;
+}
+
+CDriveWatcher::SDispatchStats CDriveWatcher::GetDispatchStats() const
+{
+	SDispatchStats oStats;
+	oStats.nDelivered = m_nDelivered.load(std::memory_order_relaxed);
+	oStats.nBatches = m_nBatches.load(std::memory_order_relaxed);
+	oStats.eOverflowPolicy = m_oOptions.eOverflowPolicy;
+	if (m_pQueue != nullptr)
+	{
+		oStats.nCapacity = m_pQueue->GetCapacity();
+		oStats.nDepth = m_pQueue->GetDepth();
+		oStats.nMaxDepth = m_pQueue->GetMaxDepth();
+		oStats.nQueued = m_pQueue->GetPushedCount();
+		oStats.nDropped = m_pQueue->GetDroppedCount();
+	}
+	return oStats;
 }
 
-void CDriveWatcher::NotificationQueryCallbackFunc(int nObjectCount, IWbemClassObject** arrObject)
+void CDriveWatcher::OnDriveEvent(const SDriveEvent& oEvent)
 {
-	if (m_pListener == nullptr || nObjectCount < 1 || arrObject == nullptr)
+	if (m_pQueue == nullptr)
+	{
+		Deliver(&oEvent, 1);
 		return;
+	}
 
-	for (int i = 0; i < nObjectCount; i++)
+	if (!m_pQueue->Push(oEvent))
+		return;
+
+	// Pairs with the fence of a dispatcher going to sleep: either it sees the event or it's seen waiting
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (m_nWaiting.load() > 0)
+	{
+		std::lock_guard<std::mutex> oLock(m_mtxWakeUp);
+		m_cvWakeUp.notify_one();
+	}
+}
+
+void CDriveWatcher::Deliver(const SDriveEvent* arrEvents, size_t nCount)
+{
+	// Counted before the list is read: a registration that sees no delivery may free the replaced lists
+	m_nDelivering.fetch_add(1);
+	const TListenerList& lstListeners = *m_pListeners.load();
+	for (size_t i = 0; i < nCount; i++)
+	{
+		for (const INotificationListenerPtr& pListener : lstListeners)
+			pListener->Notify(arrEvents[i]);
+	}
+	// The last delivery out frees the lists replaced meanwhile (a listener may have unregistered itself),
+	// unless a registration holds the lock, then it's left to the next one
+	if (m_nDelivering.fetch_sub(1) == 1 && m_mtxListeners.try_lock())
+	{
+		FreeRetiredListeners();
+		m_mtxListeners.unlock();
+	}
+
+	m_nDelivered.fetch_add(nCount, std::memory_order_relaxed);
+	m_nBatches.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CDriveWatcher::Dispatch()
+{
+	std::vector<SDriveEvent> vecBatch(m_oOptions.nBatchSize);
+	for (;;)
 	{
-		IWbemClassObject* pObject = arrObject[i];
-		// Get instance
-		_variant_t instance;
-		HRESULT hResult = pObject->Get(TEXT("TargetInstance"), 0, &instance, NULL, NULL);
-		if (SUCCEEDED(hResult) && instance.vt != VT_NULL && instance.vt != VT_EMPTY)
+		const size_t nCount = m_pQueue->PopBatch(vecBatch.data(), vecBatch.size());
+		if (nCount > 0)
 		{
-			// Query instance interface
-			IUnknown* pInstance = instance;
-			IWbemClassObject* pDrive = nullptr;
-			hResult = pInstance->QueryInterface(IID_IWbemClassObject, reinterpret_cast<void**>(&pDrive));
-			if (SUCCEEDED(hResult) && pDrive != nullptr)
-			{
-				// Get drive letter
-				_variant_t driveLetter;
-				hResult = pDrive->Get(TEXT("Name"), 0, &driveLetter, NULL, NULL);
-				if (SUCCEEDED(hResult) && driveLetter.vt != VT_NULL && driveLetter.vt != VT_EMPTY)
-				{
-					std::string sDriveLetter = driveLetter.operator _bstr_t().operator const char* ();
-					if (!sDriveLetter.empty())
-					{
-						// Notify
-						SNotification oNotification;
-						oNotification.eType = ENotificationType::DriveArrival;
-						oNotification.chDriveLetter = sDriveLetter[0];
-						m_pListener->Notify(oNotification);
-					}
-				}
-				pDrive->Release();
-			}
+			Deliver(vecBatch.data(), nCount);
+			continue;
 		}
+
+		std::unique_lock<std::mutex> oLock(m_mtxWakeUp);
+		if (!m_bDispatching)
+		{
+			// Stop has cleared the flag after the source had stopped, no more events come
+			if (m_pQueue->GetDepth() == 0)
+				break;
+			continue;
+		}
+
+		m_nWaiting.fetch_add(1);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (m_pQueue->GetDepth() == 0)
+			m_cvWakeUp.wait(oLock);
+		m_nWaiting.fetch_sub(1);
+	}
+}
+
+void CDriveWatcher::StopDispatchers()
+{
+	{
+		std::lock_guard<std::mutex> oLock(m_mtxWakeUp);
+		m_bDispatching = false;
+		m_cvWakeUp.notify_all();
 	}
-}
\ No newline at end of file
+
+	for (std::thread& oThread : m_vecDispatchers)
+		oThread.join();
+	m_vecDispatchers.clear();
+}
+
+void CDriveWatcher::PublishListeners(TListenerList* pListeners)
+{
+	m_vecRetired.emplace_back(m_pListeners.exchange(pListeners));
+	FreeRetiredListeners();
+}
+
+void CDriveWatcher::FreeRetiredListeners()
+{
+	// A delivery that started later reads the current list
+	if (m_nDelivering.load() == 0)
+		m_vecRetired.clear();
+}
@@ -1,6 +1,6 @@
 /*
 Declaration file for the drive watcher
-Requirements: COM library initialization
+Requirements: COM library initialization (Windows)
 */
 
 
@@ -9,21 +9,54 @@ Requirements: COM library initialization
 
 
 //! Includes
-#include "wbem_notification.h"
+#include "drive_event_queue.h"
+#include "drive_event_source.h"
+#include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 
 //! Class CDriveWatcher
-class CDriveWatcher : private CWbemNotificationAsyncQueryAbstract
+// The listeners are kept in a copy-on-write list: the events are delivered without locks, while
+// a registration publishes a new list, the replaced ones are freed by the last delivery out.
+// The source only queues the events, the dispatcher threads deliver them in batches, so a slow
+// listener doesn't hold up the source (the events beyond the queue capacity are dropped)
+class CDriveWatcher : private IDriveEventSource::IEventSink
 {
-	typedef CWbemNotificationAsyncQueryAbstract Base;
-
 public: //! Type declarations
 	class INotificationListener;
 	typedef std::shared_ptr<INotificationListener> INotificationListenerPtr;
 
+	// Delivery setup
+	struct SDispatchOptions
+	{
+		size_t					nQueueCapacity = 256;	// Events waiting for delivery, zero delivers on the thread of the source
+		size_t					nThreadCount = 1;		// Dispatcher threads, more than one notify concurrently and out of order
+		size_t					nBatchSize = 32;		// Events taken from the queue at once
+		EQueueOverflowPolicy	eOverflowPolicy = EQueueOverflowPolicy::DropNewest;
+	};
+
+	// Event queue state, the counters cover the whole life of the watcher
+	struct SDispatchStats
+	{
+		size_t					nCapacity = 0;
+		size_t					nDepth = 0;				// Queued events
+		size_t					nMaxDepth = 0;			// Largest depth reached
+		uint64_t				nQueued = 0;
+		uint64_t				nDropped = 0;			// Events dropped by the overflow policy
+		uint64_t				nDelivered = 0;
+		uint64_t				nBatches = 0;
+		EQueueOverflowPolicy	eOverflowPolicy = EQueueOverflowPolicy::DropNewest;
+	};
+
 public: //! Constructors and destructor
+	// Watches with the source of the platform (see CreateDriveEventSource)
 	CDriveWatcher();
+	// Watches with the given source
+	explicit CDriveWatcher(IDriveEventSourcePtr pSource);
 	~CDriveWatcher();
 
 public: //! Interface
@@ -34,30 +67,35 @@ public: //! Interface
 
 	// Starts watching
 	bool Start();
-	// Stops watching
+	// Stops watching, the queued events are delivered before it returns (not to be called from a listener)
 	void Stop();
 	// Returns true is the watcher is active
 	bool IsActive() const;
 
-	// Registers notification listener (currently may notify only one listener)
+	// Adds the listener, fails if it's null or already registered
+	bool RegisterListener(INotificationListenerPtr pListener);
+	// Removes the listener, fails if it's not registered. A delivery in progress may still notify it
+	bool UnregisterListener(const INotificationListenerPtr& pListener);
+	// Returns the number of the registered listeners
+	size_t GetListenerCount() const;
+
+	// Replaces all the listeners with the given one (null removes them)
 	void SetNotificationListener(INotificationListenerPtr pListener);
-	// Returns listener
+	// Returns the first registered listener
 	INotificationListenerPtr GetNotificationListener();
 
+	// Sets up the delivery of the next Start, fails while the watcher is active
+	bool SetDispatchOptions(const SDispatchOptions& oOptions);
+	SDispatchOptions GetDispatchOptions() const;
+	// Returns the state of the event queue
+	SDispatchStats GetDispatchStats() const;
+
 public: //! Type definitions
 	// Notification type
-	enum class ENotificationType
-	{
-		Invalid,
-		DriveArrival
-	};
+	typedef EDriveEventType ENotificationType;
 
 	// Notification info
-	struct SNotification
-	{
-		ENotificationType	eType = ENotificationType::Invalid;
-		char				chDriveLetter = '\n';
-	};
+	typedef SDriveEvent SNotification;
 
 	// Notification listener interface
 	class INotificationListener
@@ -68,9 +106,38 @@ public: //! Type definitions
 
 
 protected: //! Implementation
-	// Notification query callback function
-	void NotificationQueryCallbackFunc(int nObjectCount, IWbemClassObject** arrObject) override;
+	// Event sink function
+	void OnDriveEvent(const SDriveEvent& oEvent) override;
+
+private: //! Listener list
+	typedef std::vector<INotificationListenerPtr> TListenerList;
+
+	// Publishes the new list, the replaced one is freed once no delivery reads it (under m_mtxListeners)
+	void PublishListeners(TListenerList* pListeners);
+	// Frees the replaced lists if no delivery is in progress (under m_mtxListeners)
+	void FreeRetiredListeners();
+	// Notifies all the listeners of the events
+	void Deliver(const SDriveEvent* arrEvents, size_t nCount);
+
+private: //! Dispatch
+	// Dispatcher thread function, delivers the queued events until Stop and the queue is empty
+	void Dispatch();
+	void StopDispatchers();
 
 private: //! Members
-	INotificationListenerPtr	m_pListener;	// Notification Listener
-};
\ No newline at end of file
+	IDriveEventSourcePtr						m_pSource;			// Source of the events
+	mutable std::mutex							m_mtxListeners;		// Serializes the registrations, the deliveries only try it
+	std::atomic<TListenerList*>					m_pListeners;		// Current list, never changed once published
+	std::atomic<size_t>							m_nDelivering;		// Deliveries reading a list
+	std::vector<std::unique_ptr<TListenerList>>	m_vecRetired;		// Replaced lists the deliveries may still read
+
+	SDispatchOptions							m_oOptions;
+	std::unique_ptr<CDriveEventQueue>			m_pQueue;			// Null if the events are delivered on the thread of the source
+	std::vector<std::thread>					m_vecDispatchers;
+	std::atomic<bool>							m_bDispatching;		// Cleared by Stop, the dispatchers exit once the queue is empty
+	std::atomic<size_t>							m_nWaiting;			// Dispatchers asleep, the source wakes them up only then
+	std::mutex									m_mtxWakeUp;
+	std::condition_variable						m_cvWakeUp;
+	std::atomic<uint64_t>						m_nDelivered;
+	std::atomic<uint64_t>						m_nBatches;
+};
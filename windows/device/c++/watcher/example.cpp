@@ -1,13 +1,20 @@
 
 
 #include "drive_watcher.h"
+#include <chrono>
 #include <iostream>
+#include <thread>
+#ifdef _WIN32
+#include <windows.h>
+#endif
 
 
+#ifdef _WIN32
 // Link to library
 #pragma comment(lib, "Wbemuuid.lib")
 #pragma comment(lib, "Cfgmgr32.lib")
 #pragma comment(lib, "Setupapi.lib")
+#endif
 
 
 // Notification listener
@@ -17,13 +24,18 @@ public:
 	void Notify(const CDriveWatcher::SNotification& oNotification) override
 	{
 		if (oNotification.eType == CDriveWatcher::ENotificationType::DriveArrival)
+#ifdef _WIN32
 			std::cout << "Drive arrived: " << oNotification.chDriveLetter << std::endl;
+#else
+			std::cout << "Drive arrived: " << oNotification.szDevice << std::endl;
+#endif
 	}
 };
 
 
 int main()
 {
+#ifdef _WIN32
 	// Initialize COM API
 	HRESULT hResult = CoInitializeEx(NULL, COINIT_MULTITHREADED);
 	if (FAILED(hResult))
@@ -36,6 +48,7 @@ int main()
 		CoUninitialize();
 		return -1;
 	}
+#endif
 
 
 	// Init watcher
@@ -44,14 +57,14 @@ int main()
 
 	// Set listener
 	CDriveWatcher::INotificationListenerPtr pListener = CDriveWatcher::INotificationListenerPtr(new CNotificationListener);
-	oWatcher.SetNotificationListener(pListener);
+	oWatcher.RegisterListener(pListener);
 	oWatcher.Start(); // Starts asynchronously 
 
-	Sleep(10000);
+	std::this_thread::sleep_for(std::chrono::seconds(10));
 
 	// Clear
 	oWatcher.Stop();
 	oWatcher.Reset();
 
 	return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,61 @@
+/*
+Implementation file for the injected drive event source
+*/
+
+
+//! Includes
+#include "injected_drive_event_source.h"
+
+
+CInjectedDriveEventSource::CInjectedDriveEventSource()
+	: m_mtxSink(), m_pEventSink(nullptr)
+{
+}
+
+CInjectedDriveEventSource::~CInjectedDriveEventSource()
+{
+	Stop();
+}
+
+bool CInjectedDriveEventSource::Init()
+{
+	return true;
+}
+
+bool CInjectedDriveEventSource::Reset()
+{
+	return !IsActive();
+}
+
+bool CInjectedDriveEventSource::Start(IEventSink* pSink)
+{
+	std::lock_guard<std::mutex> oLock(m_mtxSink);
+	if (m_pEventSink != nullptr || pSink == nullptr)
+		return false;
+
+	m_pEventSink = pSink;
+	return true;
+}
+
+bool CInjectedDriveEventSource::Stop()
+{
+	std::lock_guard<std::mutex> oLock(m_mtxSink);
+	m_pEventSink = nullptr;
+	return true;
+}
+
+bool CInjectedDriveEventSource::IsActive() const
+{
+	std::lock_guard<std::mutex> oLock(m_mtxSink);
+	return m_pEventSink != nullptr;
+}
+
+bool CInjectedDriveEventSource::Inject(const SDriveEvent& oEvent)
+{
+	std::lock_guard<std::mutex> oLock(m_mtxSink);
+	if (m_pEventSink == nullptr)
+		return false;
+
+	m_pEventSink->OnDriveEvent(oEvent);
+	return true;
+}
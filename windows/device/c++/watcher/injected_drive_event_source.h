@@ -0,0 +1,37 @@
+/*
+Declaration file for the injected drive event source
+Delivers the events given by the application: tests, simulation, a platform without its own source
+*/
+
+
+//! Include guard
+#pragma once
+
+
+//! Includes
+#include "drive_event_source.h"
+#include <mutex>
+
+
+//! Class CInjectedDriveEventSource
+class CInjectedDriveEventSource : public IDriveEventSource
+{
+public: //! Constructors and destructor
+	CInjectedDriveEventSource();
+	~CInjectedDriveEventSource();
+
+public: //! Interface (overrides base interface)
+	bool Init() override;
+	bool Reset() override;
+	bool Start(IEventSink* pSink) override;
+	bool Stop() override;
+	bool IsActive() const override;
+
+public: //! Injection
+	// Delivers the event to the sink on the calling thread, fails if the source is not active
+	bool Inject(const SDriveEvent& oEvent);
+
+private: //! Members
+	mutable std::mutex	m_mtxSink;		// Stop waits for the injections in progress
+	IEventSink*			m_pEventSink;	// Receiver of the events, null when stopped
+};
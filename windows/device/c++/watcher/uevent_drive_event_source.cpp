@@ -0,0 +1,223 @@
+/*
+Implementation file for the uevent drive event source
+*/
+
+
+//! Includes
+#include "uevent_drive_event_source.h"
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+CUeventDriveEventSource::CUeventDriveEventSource()
+	: m_nSocket(-1), m_nWakeup(-1), m_oThread(), m_bActive(false), m_pEventSink(nullptr)
+{
+}
+
+CUeventDriveEventSource::~CUeventDriveEventSource()
+{
+	Stop();
+	Reset();
+}
+
+bool CUeventDriveEventSource::Init()
+{
+	if (m_nSocket >= 0)
+		return true;
+
+	int nSocket = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+	if (nSocket < 0)
+		return false;
+
+	// Larger buffer, the rest of the socket is the default one if it's not allowed
+	int nBufferSize = c_nReceiveBufferSize;
+	setsockopt(nSocket, SOL_SOCKET, SO_RCVBUF, &nBufferSize, sizeof(nBufferSize));
+
+	// Kernel multicast group
+	sockaddr_nl oAddress = {};
+	oAddress.nl_family = AF_NETLINK;
+	oAddress.nl_groups = 1;
+	if (bind(nSocket, reinterpret_cast<sockaddr*>(&oAddress), sizeof(oAddress)) != 0)
+	{
+		close(nSocket);
+		return false;
+	}
+
+	int nWakeup = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (nWakeup < 0)
+	{
+		close(nSocket);
+		return false;
+	}
+
+	m_nSocket = nSocket;
+	m_nWakeup = nWakeup;
+	return true;
+}
+
+bool CUeventDriveEventSource::Reset()
+{
+	if (m_oThread.joinable())
+		return false;
+
+	if (m_nSocket >= 0)
+	{
+		close(m_nSocket);
+		m_nSocket = -1;
+	}
+	if (m_nWakeup >= 0)
+	{
+		close(m_nWakeup);
+		m_nWakeup = -1;
+	}
+	return true;
+}
+
+bool CUeventDriveEventSource::Start(IEventSink* pSink)
+{
+	if (m_oThread.joinable() || m_nSocket < 0 || pSink == nullptr)
+		return false;
+
+	// Drop the signal of the previous Stop
+	uint64_t nValue = 0;
+	while (read(m_nWakeup, &nValue, sizeof(nValue)) > 0)
+		;
+
+	m_pEventSink = pSink;
+	m_bActive = true;
+	m_oThread = std::thread(&CUeventDriveEventSource::Listen, this);
+	return true;
+}
+
+bool CUeventDriveEventSource::Stop()
+{
+	if (!m_oThread.joinable())
+		return true;
+
+	// The wakeup ends the poll at once, if it fails the thread sees the flag on the poll timeout
+	m_bActive = false;
+	uint64_t nValue = 1;
+	const ssize_t nWritten = write(m_nWakeup, &nValue, sizeof(nValue));
+	(void)nWritten;
+
+	m_oThread.join();
+	m_pEventSink = nullptr;
+	return true;
+}
+
+bool CUeventDriveEventSource::IsActive() const
+{
+	return m_bActive;
+}
+
+bool CUeventDriveEventSource::ParseEvent(const char* pMessage, size_t nSize, SDriveEvent& oEvent)
+{
+	if (pMessage == nullptr || nSize == 0)
+		return false;
+
+	// The udev daemon rebroadcasts with its own header, the kernel messages start with "action@devpath"
+	if (memchr(pMessage, '@', strnlen(pMessage, nSize)) == nullptr)
+		return false;
+
+	const char* pAction = nullptr;
+	const char* pSubsystem = nullptr;
+	const char* pDevType = nullptr;
+	const char* pDevName = nullptr;
+
+	// Keys after the header, each one zero terminated
+	const char* pEnd = pMessage + nSize;
+	for (const char* pKey = pMessage + strnlen(pMessage, nSize) + 1; pKey < pEnd; )
+	{
+		const size_t nLength = strnlen(pKey, pEnd - pKey);
+		if (pKey + nLength == pEnd)
+			break;	// Not terminated
+
+		if (strncmp(pKey, "ACTION=", 7) == 0)
+			pAction = pKey + 7;
+		else if (strncmp(pKey, "SUBSYSTEM=", 10) == 0)
+			pSubsystem = pKey + 10;
+		else if (strncmp(pKey, "DEVTYPE=", 8) == 0)
+			pDevType = pKey + 8;
+		else if (strncmp(pKey, "DEVNAME=", 8) == 0)
+			pDevName = pKey + 8;
+		pKey += nLength + 1;
+	}
+
+	if (pAction == nullptr || pSubsystem == nullptr || pDevType == nullptr || pDevName == nullptr)
+		return false;
+	if (strcmp(pAction, "add") != 0 || strcmp(pSubsystem, "block") != 0)
+		return false;
+	if (strcmp(pDevType, "disk") != 0 && strcmp(pDevType, "partition") != 0)
+		return false;
+	if (strncmp(pDevName, "loop", 4) == 0 || strncmp(pDevName, "ram", 3) == 0 || strncmp(pDevName, "zram", 4) == 0)
+		return false;
+
+	const size_t nNameLength = strlen(pDevName);
+	if (nNameLength == 0 || nNameLength >= sizeof(oEvent.szDevice))
+		return false;
+
+	oEvent = SDriveEvent();
+	oEvent.eType = EDriveEventType::DriveArrival;
+	memcpy(oEvent.szDevice, pDevName, nNameLength);
+	return true;
+}
+
+void CUeventDriveEventSource::Listen()
+{
+	char szMessage[c_nMessageSize];
+	pollfd arrPoll[2] = {};
+	arrPoll[0].fd = m_nSocket;
+	arrPoll[0].events = POLLIN;
+	arrPoll[1].fd = m_nWakeup;
+	arrPoll[1].events = POLLIN;
+
+	while (m_bActive)
+	{
+		if (poll(arrPoll, 2, c_nStopCheckMs) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (arrPoll[1].revents != 0)
+			break;
+		if ((arrPoll[0].revents & POLLIN) == 0)
+			continue;
+
+		// Read everything that came, the sender must be the kernel
+		for (;;)
+		{
+			sockaddr_nl oSender = {};
+			iovec oVector = { szMessage, sizeof(szMessage) };
+			msghdr oHeader = {};
+			oHeader.msg_name = &oSender;
+			oHeader.msg_namelen = sizeof(oSender);
+			oHeader.msg_iov = &oVector;
+			oHeader.msg_iovlen = 1;
+
+			const ssize_t nSize = recvmsg(m_nSocket, &oHeader, MSG_DONTWAIT);
+			if (nSize < 0)
+			{
+				// ENOBUFS: the buffer overflowed and the events in it are lost, the next ones still come
+				if (errno == EINTR || errno == ENOBUFS)
+					continue;
+				break;
+			}
+			if (nSize == 0 || oSender.nl_pid != 0 || (oHeader.msg_flags & MSG_TRUNC) != 0)
+				continue;
+
+			SDriveEvent oEvent;
+			if (ParseEvent(szMessage, static_cast<size_t>(nSize), oEvent))
+				m_pEventSink->OnDriveEvent(oEvent);
+		}
+	}
+
+	// Also after a poll failure, Stop still joins the thread
+	m_bActive = false;
+}
@@ -0,0 +1,56 @@
+/*
+Declaration file for the uevent drive event source
+Linux only: listens to the kernel uevents on a netlink socket
+*/
+
+
+//! Include guard
+#pragma once
+
+
+//! Includes
+#include "drive_event_source.h"
+#include <atomic>
+#include <cstddef>
+#include <thread>
+
+
+//! Class CUeventDriveEventSource
+// Block devices added by the kernel (disks and partitions, loop and ram devices aside).
+// The thread sleeps in poll until a uevent or Stop comes, the timeout only backs up the wakeup of Stop
+class CUeventDriveEventSource : public IDriveEventSource
+{
+public: //! Constants
+	static const int	c_nReceiveBufferSize = 1024 * 1024;	// Socket buffer, absorbs the bursts of the hubs
+	static const size_t	c_nMessageSize = 8192;				// Largest uevent message
+	static const int	c_nStopCheckMs = 500;				// Poll timeout
+
+public: //! Constructors and destructor
+	CUeventDriveEventSource();
+	~CUeventDriveEventSource();
+	CUeventDriveEventSource(const CUeventDriveEventSource&) = delete;
+	CUeventDriveEventSource& operator=(const CUeventDriveEventSource&) = delete;
+
+public: //! Interface (overrides base interface)
+	bool Init() override;
+	bool Reset() override;
+	bool Start(IEventSink* pSink) override;
+	bool Stop() override;
+	bool IsActive() const override;
+
+public: //! Helpers
+	// Decodes the kernel uevent message ("add@/devices/...\0ACTION=add\0SUBSYSTEM=block\0..."),
+	// returns false if it's not an arrival of a drive
+	static bool ParseEvent(const char* pMessage, size_t nSize, SDriveEvent& oEvent);
+
+private: //! Implementation
+	// Thread function, receives the uevents until Stop
+	void Listen();
+
+private: //! Members
+	int					m_nSocket;		// Netlink socket (NETLINK_KOBJECT_UEVENT)
+	int					m_nWakeup;		// Event descriptor signaled by Stop
+	std::thread			m_oThread;
+	std::atomic<bool>	m_bActive;		// Cleared by Stop, the thread may outlive it until joined
+	IEventSink*			m_pEventSink;	// Receiver of the events, used by the thread only
+};
@@ -0,0 +1,97 @@
+/*
+Implementation file for the WMI drive event source
+*/
+
+
+//! Includes
+#include "wmi_drive_event_source.h"
+#include <string>
+#include <comutil.h>
+
+
+CWmiDriveEventSource::CWmiDriveEventSource()
+	: m_pEventSink(nullptr)
+{
+}
+
+CWmiDriveEventSource::~CWmiDriveEventSource()
+{
+	Stop();
+	Reset();
+}
+
+bool CWmiDriveEventSource::Init()
+{
+	return Base::Init();
+}
+
+bool CWmiDriveEventSource::Reset()
+{
+	return Base::Reset();
+}
+
+bool CWmiDriveEventSource::Start(IEventSink* pSink)
+{
+	{
+		std::lock_guard<std::mutex> oLock(m_mtxSink);
+		m_pEventSink = pSink;
+	}
+
+	std::string sQueryString("SELECT * FROM __InstanceCreationEvent WITHIN 0.1 WHERE TargetInstance ISA 'Win32_LogicalDisk'");
+	return Base::StartListening(sQueryString);
+}
+
+bool CWmiDriveEventSource::Stop()
+{
+	const bool bStopped = Base::StopListening();
+	std::lock_guard<std::mutex> oLock(m_mtxSink);
+	m_pEventSink = nullptr;
+	return bStopped;
+}
+
+bool CWmiDriveEventSource::IsActive() const
+{
+	return Base::IsListening();
+}
+
+void CWmiDriveEventSource::NotificationQueryCallbackFunc(int nObjectCount, IWbemClassObject** arrObject)
+{
+	std::lock_guard<std::mutex> oLock(m_mtxSink);
+	if (m_pEventSink == nullptr || nObjectCount < 1 || arrObject == nullptr)
+		return;
+
+	for (int i = 0; i < nObjectCount; i++)
+	{
+		IWbemClassObject* pObject = arrObject[i];
+		// Get instance
+		_variant_t instance;
+		HRESULT hResult = pObject->Get(TEXT("TargetInstance"), 0, &instance, NULL, NULL);
+		if (SUCCEEDED(hResult) && instance.vt != VT_NULL && instance.vt != VT_EMPTY)
+		{
+			// Query instance interface
+			IUnknown* pInstance = instance;
+			IWbemClassObject* pDrive = nullptr;
+			hResult = pInstance->QueryInterface(IID_IWbemClassObject, reinterpret_cast<void**>(&pDrive));
+			if (SUCCEEDED(hResult) && pDrive != nullptr)
+			{
+				// Get drive letter
+				_variant_t driveLetter;
+				hResult = pDrive->Get(TEXT("Name"), 0, &driveLetter, NULL, NULL);
+				if (SUCCEEDED(hResult) && driveLetter.vt != VT_NULL && driveLetter.vt != VT_EMPTY)
+				{
+					std::string sDriveLetter = driveLetter.operator _bstr_t().operator const char* ();
+					if (!sDriveLetter.empty())
+					{
+						// Notify
+						SDriveEvent oEvent;
+						oEvent.eType = EDriveEventType::DriveArrival;
+						oEvent.chDriveLetter = sDriveLetter[0];
+						sDriveLetter.copy(oEvent.szDevice, sizeof(oEvent.szDevice) - 1);
+						m_pEventSink->OnDriveEvent(oEvent);
+					}
+				}
+				pDrive->Release();
+			}
+		}
+	}
+}
@@ -0,0 +1,41 @@
+/*
+Declaration file for the WMI drive event source
+Requirements: COM library initialization
+*/
+
+
+//! Include guard
+#pragma once
+
+
+//! Includes
+#include "drive_event_source.h"
+#include "wbem_notification.h"
+#include <mutex>
+
+
+//! Class CWmiDriveEventSource
+// Creations of Win32_LogicalDisk instances reported by the WMI service
+class CWmiDriveEventSource : public IDriveEventSource, private CWbemNotificationAsyncQueryAbstract
+{
+	typedef CWbemNotificationAsyncQueryAbstract Base;
+
+public: //! Constructors and destructor
+	CWmiDriveEventSource();
+	~CWmiDriveEventSource();
+
+public: //! Interface (overrides base interface)
+	bool Init() override;
+	bool Reset() override;
+	bool Start(IEventSink* pSink) override;
+	bool Stop() override;
+	bool IsActive() const override;
+
+protected: //! Implementation
+	// Notification query callback function
+	void NotificationQueryCallbackFunc(int nObjectCount, IWbemClassObject** arrObject) override;
+
+private: //! Members
+	std::mutex		m_mtxSink;			// Stop waits for the callback in progress
+	IEventSink*		m_pEventSink;		// Receiver of the events, null when stopped
+};
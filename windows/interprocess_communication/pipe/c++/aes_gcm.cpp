@@ -0,0 +1,696 @@
+/*
+Implementation file for the AES-GCM authenticated encryption
+*/
+
+
+//! Includes
+#include "aes_gcm.h"
+#include <cstring>
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define AES_GCM_X86
+#include <smmintrin.h>
+#include <wmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+
+namespace
+{
+	const size_t c_nBlockSize = CAesGcm::c_nBlockSize;
+
+	// Lookup tables of the portable cipher, built once
+	struct STables
+	{
+		uint8_t		arrSbox[256];
+		uint32_t	arrRound[4][256];	// SubBytes and MixColumns of a byte of row k, big-endian column
+	};
+
+	// Reduction of the 4 bits shifted out of the GHASH table product
+	const uint64_t c_arrReduce[16] =
+	{
+		0x0000, 0x1C20, 0x3840, 0x2460, 0x7080, 0x6CA0, 0x48C0, 0x54E0,
+		0xE100, 0xFD20, 0xD940, 0xC560, 0x9180, 0x8DA0, 0xA9C0, 0xB5E0
+	};
+
+	uint8_t MultiplyByX(uint8_t nValue)
+	{
+		return uint8_t((nValue << 1) ^ ((nValue & 0x80) ? 0x1B : 0));
+	}
+
+	uint8_t RotateLeft(uint8_t nValue, int nBits)
+	{
+		return uint8_t((nValue << nBits) | (nValue >> (8 - nBits)));
+	}
+
+	uint32_t RotateRight(uint32_t nValue, int nBits)
+	{
+		return (nBits == 0) ? nValue : (nValue >> nBits) | (nValue << (32 - nBits));
+	}
+
+	uint32_t LoadBigEndian32(const uint8_t* pData)
+	{
+		return (uint32_t(pData[0]) << 24) | (uint32_t(pData[1]) << 16) | (uint32_t(pData[2]) << 8) | uint32_t(pData[3]);
+	}
+
+	void StoreBigEndian32(uint8_t* pData, uint32_t nValue)
+	{
+		pData[0] = uint8_t(nValue >> 24);
+		pData[1] = uint8_t(nValue >> 16);
+		pData[2] = uint8_t(nValue >> 8);
+		pData[3] = uint8_t(nValue);
+	}
+
+	uint64_t LoadBigEndian64(const uint8_t* pData)
+	{
+		return (uint64_t(LoadBigEndian32(pData)) << 32) | LoadBigEndian32(pData + 4);
+	}
+
+	void StoreBigEndian64(uint8_t* pData, uint64_t nValue)
+	{
+		StoreBigEndian32(pData, uint32_t(nValue >> 32));
+		StoreBigEndian32(pData + 4, uint32_t(nValue));
+	}
+
+	// Counter blocks count in their last 32 bits only
+	void IncrementCounter(uint8_t* pCounter)
+	{
+		StoreBigEndian32(pCounter + 12, LoadBigEndian32(pCounter + 12) + 1);
+	}
+
+	void XorBlock(uint8_t* pTarget, const uint8_t* pSource)
+	{
+		for (size_t i = 0; i < c_nBlockSize; ++i)
+			pTarget[i] ^= pSource[i];
+	}
+
+	// Zeroes the key material, the writes are not optimized away
+	void Wipe(void* pData, size_t nSize)
+	{
+		volatile uint8_t* pBytes = static_cast<volatile uint8_t*>(pData);
+		while (nSize-- > 0)
+			*pBytes++ = 0;
+	}
+
+	STables BuildTables()
+	{
+		STables oTables;
+
+		// p walks the multiplicative group by 3, q by its inverse, so q = 1 / p
+		uint8_t p = 1;
+		uint8_t q = 1;
+		do
+		{
+			p = p ^ MultiplyByX(p);
+			q ^= uint8_t(q << 1);
+			q ^= uint8_t(q << 2);
+			q ^= uint8_t(q << 4);
+			if (q & 0x80)
+				q ^= 0x09;
+			oTables.arrSbox[p] = q ^ RotateLeft(q, 1) ^ RotateLeft(q, 2) ^ RotateLeft(q, 3) ^ RotateLeft(q, 4) ^ 0x63;
+		} while (p != 1);
+		oTables.arrSbox[0] = 0x63;
+
+		for (int i = 0; i < 256; ++i)
+		{
+			const uint8_t s = oTables.arrSbox[i];
+			const uint32_t nColumn = (uint32_t(MultiplyByX(s)) << 24) | (uint32_t(s) << 16) | (uint32_t(s) << 8) | uint32_t(MultiplyByX(s) ^ s);
+			for (int k = 0; k < 4; ++k)
+				oTables.arrRound[k][i] = RotateRight(nColumn, 8 * k);
+		}
+
+		return oTables;
+	}
+
+	const STables& GetTables()
+	{
+		static const STables s_oTables = BuildTables();
+		return s_oTables;
+	}
+
+
+	//! Portable kernel
+	void EncryptTable(const uint32_t* pWords, int nRounds, const uint8_t* pIn, uint8_t* pOut)
+	{
+		const STables& oTables = GetTables();
+		const uint32_t (&arrRound)[4][256] = oTables.arrRound;
+		uint32_t s0 = LoadBigEndian32(pIn) ^ pWords[0];
+		uint32_t s1 = LoadBigEndian32(pIn + 4) ^ pWords[1];
+		uint32_t s2 = LoadBigEndian32(pIn + 8) ^ pWords[2];
+		uint32_t s3 = LoadBigEndian32(pIn + 12) ^ pWords[3];
+		for (int nRound = 1; nRound < nRounds; ++nRound)
+		{
+			pWords += 4;
+			const uint32_t t0 = arrRound[0][s0 >> 24] ^ arrRound[1][(s1 >> 16) & 0xFF] ^ arrRound[2][(s2 >> 8) & 0xFF] ^ arrRound[3][s3 & 0xFF] ^ pWords[0];
+			const uint32_t t1 = arrRound[0][s1 >> 24] ^ arrRound[1][(s2 >> 16) & 0xFF] ^ arrRound[2][(s3 >> 8) & 0xFF] ^ arrRound[3][s0 & 0xFF] ^ pWords[1];
+			const uint32_t t2 = arrRound[0][s2 >> 24] ^ arrRound[1][(s3 >> 16) & 0xFF] ^ arrRound[2][(s0 >> 8) & 0xFF] ^ arrRound[3][s1 & 0xFF] ^ pWords[2];
+			const uint32_t t3 = arrRound[0][s3 >> 24] ^ arrRound[1][(s0 >> 16) & 0xFF] ^ arrRound[2][(s1 >> 8) & 0xFF] ^ arrRound[3][s2 & 0xFF] ^ pWords[3];
+			s0 = t0;
+			s1 = t1;
+			s2 = t2;
+			s3 = t3;
+		}
+
+		// The last round has no MixColumns
+		pWords += 4;
+		const uint8_t* arrSbox = oTables.arrSbox;
+		const uint32_t arrState[4] = { s0, s1, s2, s3 };
+		for (int i = 0; i < 4; ++i)
+		{
+			const uint32_t nWord = (uint32_t(arrSbox[arrState[i] >> 24]) << 24) | (uint32_t(arrSbox[(arrState[(i + 1) & 3] >> 16) & 0xFF]) << 16) |
+				(uint32_t(arrSbox[(arrState[(i + 2) & 3] >> 8) & 0xFF]) << 8) | uint32_t(arrSbox[arrState[(i + 3) & 3] & 0xFF]);
+			StoreBigEndian32(pOut + 4 * i, nWord ^ pWords[i]);
+		}
+	}
+
+	void BuildHashTable(const uint8_t* pKey, uint64_t (&arrTable)[2][16])
+	{
+		// Entry i holds i * H, the bits of i are the coefficients of x^3..x^0
+		uint64_t nHigh = LoadBigEndian64(pKey);
+		uint64_t nLow = LoadBigEndian64(pKey + 8);
+		arrTable[0][0] = arrTable[1][0] = 0;
+		arrTable[0][8] = nHigh;
+		arrTable[1][8] = nLow;
+		for (int i = 4; i > 0; i >>= 1)
+		{
+			const uint64_t nCarry = (nLow & 1) ? 0xE100000000000000ULL : 0;
+			nLow = (nHigh << 63) | (nLow >> 1);
+			nHigh = (nHigh >> 1) ^ nCarry;
+			arrTable[0][i] = nHigh;
+			arrTable[1][i] = nLow;
+		}
+		for (int i = 2; i <= 8; i *= 2)
+			for (int j = 1; j < i; ++j)
+			{
+				arrTable[0][i + j] = arrTable[0][i] ^ arrTable[0][j];
+				arrTable[1][i + j] = arrTable[1][i] ^ arrTable[1][j];
+			}
+	}
+
+	// Multiplies the hash by H, four bits at a time
+	void MultiplyTable(const uint64_t (&arrTable)[2][16], uint8_t* pHash)
+	{
+		uint64_t nHigh = 0;
+		uint64_t nLow = 0;
+		for (int i = 15; i >= 0; --i)
+		{
+			for (int nShift = 0; nShift <= 4; nShift += 4)
+			{
+				if (i != 15 || nShift != 0)
+				{
+					const uint64_t nRemainder = nLow & 0xF;
+					nLow = (nHigh << 60) | (nLow >> 4);
+					nHigh = (nHigh >> 4) ^ (c_arrReduce[nRemainder] << 48);
+				}
+				const uint8_t nNibble = (pHash[i] >> nShift) & 0xF;
+				nHigh ^= arrTable[0][nNibble];
+				nLow ^= arrTable[1][nNibble];
+			}
+		}
+		StoreBigEndian64(pHash, nHigh);
+		StoreBigEndian64(pHash + 8, nLow);
+	}
+
+	void HashTable(const uint64_t (&arrTable)[2][16], uint8_t* pHash, const uint8_t* pData, size_t nBlocks)
+	{
+		for (; nBlocks > 0; --nBlocks, pData += c_nBlockSize)
+		{
+			XorBlock(pHash, pData);
+			MultiplyTable(arrTable, pHash);
+		}
+	}
+
+	void CryptTable(const uint32_t* pWords, int nRounds, const uint64_t (&arrTable)[2][16], uint8_t* pCounter, uint8_t* pHash,
+		const uint8_t* pIn, uint8_t* pOut, size_t nBlocks, bool bEncrypt)
+	{
+		for (; nBlocks > 0; --nBlocks, pIn += c_nBlockSize, pOut += c_nBlockSize)
+		{
+			// The input is read before the output is written, so they may overlap
+			uint8_t arrBlock[c_nBlockSize];
+			uint8_t arrKeystream[c_nBlockSize];
+			memcpy(arrBlock, pIn, c_nBlockSize);
+			EncryptTable(pWords, nRounds, pCounter, arrKeystream);
+			IncrementCounter(pCounter);
+			if (!bEncrypt)
+				XorBlock(pHash, arrBlock);
+			XorBlock(arrBlock, arrKeystream);
+			if (bEncrypt)
+				XorBlock(pHash, arrBlock);
+			MultiplyTable(arrTable, pHash);
+			memcpy(pOut, arrBlock, c_nBlockSize);
+		}
+	}
+
+
+	//! x86 kernel
+#ifdef AES_GCM_X86
+#if defined(__GNUC__) || defined(__clang__)
+#define AES_GCM_TARGET __attribute__((target("aes,pclmul,sse4.1")))
+#else
+#define AES_GCM_TARGET
+#endif
+// The eight blocks stay in registers only if their loops are unrolled
+#if defined(__clang__)
+#define AES_GCM_UNROLL _Pragma("unroll")
+#elif defined(__GNUC__)
+#define AES_GCM_UNROLL _Pragma("GCC unroll 8")
+#else
+#define AES_GCM_UNROLL
+#endif
+
+	// GHASH works on bit-reflected values, the bytes are reversed so PCLMULQDQ sees them in order
+	AES_GCM_TARGET inline __m128i Reflect(__m128i nValue)
+	{
+		return _mm_shuffle_epi8(nValue, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+	}
+
+	// Adds a * b to the unreduced 256-bit sum (low, middle and high products)
+	AES_GCM_TARGET inline void MultiplyAdd(__m128i nA, __m128i nB, __m128i& nLow, __m128i& nMiddle, __m128i& nHigh)
+	{
+		nLow = _mm_xor_si128(nLow, _mm_clmulepi64_si128(nA, nB, 0x00));
+		nHigh = _mm_xor_si128(nHigh, _mm_clmulepi64_si128(nA, nB, 0x11));
+		nMiddle = _mm_xor_si128(nMiddle, _mm_xor_si128(_mm_clmulepi64_si128(nA, nB, 0x01), _mm_clmulepi64_si128(nA, nB, 0x10)));
+	}
+
+	// Reduces the sum modulo x^128 + x^7 + x^2 + x + 1 (Intel GCM white paper, algorithm 5).
+	// Both steps are linear, so the sum of several products is reduced once
+	AES_GCM_TARGET inline __m128i Reduce(__m128i nLow, __m128i nMiddle, __m128i nHigh)
+	{
+		__m128i t3 = _mm_xor_si128(nLow, _mm_slli_si128(nMiddle, 8));
+		__m128i t6 = _mm_xor_si128(nHigh, _mm_srli_si128(nMiddle, 8));
+
+		// Shift the 256-bit product left by one bit (reflection)
+		__m128i t7 = _mm_srli_epi32(t3, 31);
+		__m128i t8 = _mm_srli_epi32(t6, 31);
+		t3 = _mm_slli_epi32(t3, 1);
+		t6 = _mm_slli_epi32(t6, 1);
+		__m128i t9 = _mm_srli_si128(t7, 12);
+		t8 = _mm_slli_si128(t8, 4);
+		t7 = _mm_slli_si128(t7, 4);
+		t3 = _mm_or_si128(t3, t7);
+		t6 = _mm_or_si128(t6, t8);
+		t6 = _mm_or_si128(t6, t9);
+
+		// First phase
+		t7 = _mm_slli_epi32(t3, 31);
+		t8 = _mm_slli_epi32(t3, 30);
+		t9 = _mm_slli_epi32(t3, 25);
+		t7 = _mm_xor_si128(t7, _mm_xor_si128(t8, t9));
+		t8 = _mm_srli_si128(t7, 4);
+		t7 = _mm_slli_si128(t7, 12);
+		t3 = _mm_xor_si128(t3, t7);
+
+		// Second phase
+		__m128i t2 = _mm_srli_epi32(t3, 1);
+		__m128i t4 = _mm_srli_epi32(t3, 2);
+		__m128i t5 = _mm_srli_epi32(t3, 7);
+		t2 = _mm_xor_si128(t2, _mm_xor_si128(t4, t5));
+		t2 = _mm_xor_si128(t2, t8);
+		t3 = _mm_xor_si128(t3, t2);
+		return _mm_xor_si128(t6, t3);
+	}
+
+	AES_GCM_TARGET inline __m128i Multiply(__m128i nA, __m128i nB)
+	{
+		__m128i nLow = _mm_setzero_si128();
+		__m128i nMiddle = _mm_setzero_si128();
+		__m128i nHigh = _mm_setzero_si128();
+		MultiplyAdd(nA, nB, nLow, nMiddle, nHigh);
+		return Reduce(nLow, nMiddle, nHigh);
+	}
+
+	// Folds eight blocks into the hash: (X + C0) * H^8 + C1 * H^7 + ... + C7 * H
+	AES_GCM_TARGET inline __m128i HashEight(__m128i nHash, const __m128i* arrPowers, const __m128i* arrBlocks)
+	{
+		__m128i nLow = _mm_setzero_si128();
+		__m128i nMiddle = _mm_setzero_si128();
+		__m128i nHigh = _mm_setzero_si128();
+		MultiplyAdd(_mm_xor_si128(nHash, Reflect(arrBlocks[0])), arrPowers[7], nLow, nMiddle, nHigh);
+		AES_GCM_UNROLL
+		for (int j = 1; j < 8; ++j)
+			MultiplyAdd(Reflect(arrBlocks[j]), arrPowers[7 - j], nLow, nMiddle, nHigh);
+		return Reduce(nLow, nMiddle, nHigh);
+	}
+
+	AES_GCM_TARGET void EncryptAesNi(const uint8_t* pRoundKeys, int nRounds, const uint8_t* pIn, uint8_t* pOut)
+	{
+		const __m128i* arrKeys = reinterpret_cast<const __m128i*>(pRoundKeys);
+		__m128i nBlock = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pIn)), _mm_load_si128(arrKeys));
+		for (int nRound = 1; nRound < nRounds; ++nRound)
+			nBlock = _mm_aesenc_si128(nBlock, _mm_load_si128(arrKeys + nRound));
+		nBlock = _mm_aesenclast_si128(nBlock, _mm_load_si128(arrKeys + nRounds));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(pOut), nBlock);
+	}
+
+	AES_GCM_TARGET void BuildPowersAesNi(const uint8_t* pKey, uint8_t* pPowers)
+	{
+		__m128i* arrPowers = reinterpret_cast<__m128i*>(pPowers);
+		const __m128i nKey = Reflect(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pKey)));
+		__m128i nPower = nKey;
+		_mm_store_si128(arrPowers, nPower);
+		for (int i = 1; i < 8; ++i)
+		{
+			nPower = Multiply(nPower, nKey);
+			_mm_store_si128(arrPowers + i, nPower);
+		}
+	}
+
+	AES_GCM_TARGET void HashAesNi(const uint8_t* pPowers, uint8_t* pHash, const uint8_t* pData, size_t nBlocks)
+	{
+		const __m128i* arrPowers = reinterpret_cast<const __m128i*>(pPowers);
+		__m128i nHash = Reflect(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pHash)));
+		for (; nBlocks >= 8; nBlocks -= 8, pData += 8 * c_nBlockSize)
+		{
+			__m128i arrBlocks[8];
+			AES_GCM_UNROLL
+			for (int j = 0; j < 8; ++j)
+				arrBlocks[j] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pData) + j);
+			nHash = HashEight(nHash, arrPowers, arrBlocks);
+		}
+		for (; nBlocks > 0; --nBlocks, pData += c_nBlockSize)
+			nHash = Multiply(_mm_xor_si128(nHash, Reflect(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pData)))), arrPowers[0]);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(pHash), Reflect(nHash));
+	}
+
+	AES_GCM_TARGET void CryptAesNi(const uint8_t* pRoundKeys, int nRounds, const uint8_t* pPowers, uint8_t* pCounter, uint8_t* pHash,
+		const uint8_t* pIn, uint8_t* pOut, size_t nBlocks, bool bEncrypt)
+	{
+		const __m128i* arrKeys = reinterpret_cast<const __m128i*>(pRoundKeys);
+		const __m128i* arrPowers = reinterpret_cast<const __m128i*>(pPowers);
+		const __m128i* pSource = reinterpret_cast<const __m128i*>(pIn);
+		__m128i* pTarget = reinterpret_cast<__m128i*>(pOut);
+		// Reflected, the 32-bit big-endian counter is the lowest lane
+		__m128i nCounter = Reflect(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pCounter)));
+		__m128i nHash = Reflect(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pHash)));
+		const __m128i nFirstKey = _mm_load_si128(arrKeys);
+		const __m128i nLastKey = _mm_load_si128(arrKeys + nRounds);
+
+		// Eight counter blocks go through the rounds together, the hash of eight blocks overlaps them
+		for (; nBlocks >= 8; nBlocks -= 8, pSource += 8, pTarget += 8)
+		{
+			__m128i arrBlocks[8];
+			AES_GCM_UNROLL
+			for (int j = 0; j < 8; ++j)
+				arrBlocks[j] = _mm_xor_si128(Reflect(_mm_add_epi32(nCounter, _mm_set_epi32(0, 0, 0, j))), nFirstKey);
+			nCounter = _mm_add_epi32(nCounter, _mm_set_epi32(0, 0, 0, 8));
+			for (int nRound = 1; nRound < nRounds; ++nRound)
+			{
+				const __m128i nKey = _mm_load_si128(arrKeys + nRound);
+				AES_GCM_UNROLL
+				for (int j = 0; j < 8; ++j)
+					arrBlocks[j] = _mm_aesenc_si128(arrBlocks[j], nKey);
+			}
+
+			// The input is read before the output is written, so they may overlap
+			__m128i arrInput[8];
+			AES_GCM_UNROLL
+			for (int j = 0; j < 8; ++j)
+				arrInput[j] = _mm_loadu_si128(pSource + j);
+			AES_GCM_UNROLL
+			for (int j = 0; j < 8; ++j)
+			{
+				arrBlocks[j] = _mm_xor_si128(_mm_aesenclast_si128(arrBlocks[j], nLastKey), arrInput[j]);
+				_mm_storeu_si128(pTarget + j, arrBlocks[j]);
+			}
+			nHash = HashEight(nHash, arrPowers, bEncrypt ? arrBlocks : arrInput);
+		}
+
+		for (; nBlocks > 0; --nBlocks, ++pSource, ++pTarget)
+		{
+			__m128i nBlock = _mm_xor_si128(Reflect(nCounter), nFirstKey);
+			nCounter = _mm_add_epi32(nCounter, _mm_set_epi32(0, 0, 0, 1));
+			for (int nRound = 1; nRound < nRounds; ++nRound)
+				nBlock = _mm_aesenc_si128(nBlock, _mm_load_si128(arrKeys + nRound));
+			const __m128i nInput = _mm_loadu_si128(pSource);
+			const __m128i nOutput = _mm_xor_si128(_mm_aesenclast_si128(nBlock, nLastKey), nInput);
+			_mm_storeu_si128(pTarget, nOutput);
+			nHash = Multiply(_mm_xor_si128(nHash, Reflect(bEncrypt ? nOutput : nInput)), arrPowers[0]);
+		}
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(pCounter), Reflect(nCounter));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(pHash), Reflect(nHash));
+	}
+
+	bool HasAesNi()
+	{
+#ifdef _MSC_VER
+		int arrInfo[4] = {};
+		__cpuid(arrInfo, 1);
+		return (arrInfo[2] & (1 << 25)) != 0 && (arrInfo[2] & (1 << 1)) != 0 && (arrInfo[2] & (1 << 19)) != 0;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+#endif
+	}
+#endif
+
+	EAesGcmKernel SelectKernel()
+	{
+		// The tables are built before the first key, so no call pays for them
+		GetTables();
+#ifdef AES_GCM_X86
+		if (HasAesNi())
+			return EAesGcmKernel::AesNi;
+#endif
+		return EAesGcmKernel::Table;
+	}
+
+	EAesGcmKernel GetKernel()
+	{
+		static const EAesGcmKernel s_eKernel = SelectKernel();
+		return s_eKernel;
+	}
+}
+
+
+CAesGcm::CAesGcm()
+	: m_nRounds(0)
+{
+}
+
+CAesGcm::~CAesGcm()
+{
+	Clear();
+}
+
+bool CAesGcm::SetKey(const void* pKey, size_t nKeySize)
+{
+	if (pKey == nullptr || (nKeySize != 16 && nKeySize != 32))
+		return false;
+
+	// FIPS 197 key expansion, done once per key so it stays portable
+	const uint8_t* arrSbox = GetTables().arrSbox;
+	const size_t nKeyWords = nKeySize / 4;
+	const size_t nWords = 4 * (nKeyWords + 7);
+	uint8_t* pKeys = m_arrRoundKeys;
+	memcpy(pKeys, pKey, nKeySize);
+	uint8_t nRoundConstant = 1;
+	for (size_t i = nKeyWords; i < nWords; ++i)
+	{
+		uint8_t arrWord[4];
+		memcpy(arrWord, pKeys + 4 * (i - 1), 4);
+		if (i % nKeyWords == 0)
+		{
+			const uint8_t nFirst = arrWord[0];
+			arrWord[0] = arrSbox[arrWord[1]] ^ nRoundConstant;
+			arrWord[1] = arrSbox[arrWord[2]];
+			arrWord[2] = arrSbox[arrWord[3]];
+			arrWord[3] = arrSbox[nFirst];
+			nRoundConstant = MultiplyByX(nRoundConstant);
+		}
+		else if (nKeyWords > 6 && i % nKeyWords == 4)
+		{
+			for (int k = 0; k < 4; ++k)
+				arrWord[k] = arrSbox[arrWord[k]];
+		}
+		for (int k = 0; k < 4; ++k)
+			pKeys[4 * i + k] = pKeys[4 * (i - nKeyWords) + k] ^ arrWord[k];
+	}
+	for (size_t i = 0; i < nWords; ++i)
+		m_arrWords[i] = LoadBigEndian32(pKeys + 4 * i);
+	m_nRounds = int(nKeyWords) + 6;
+
+	// The hash key is the encrypted zero block
+	uint8_t arrHashKey[c_nBlockSize] = {};
+	EncryptBlock(arrHashKey, arrHashKey);
+#ifdef AES_GCM_X86
+	if (GetKernel() == EAesGcmKernel::AesNi)
+		BuildPowersAesNi(arrHashKey, m_arrPowers);
+	else
+#endif
+		BuildHashTable(arrHashKey, m_arrTable);
+	Wipe(arrHashKey, sizeof(arrHashKey));
+
+	return true;
+}
+
+bool CAesGcm::HasKey() const
+{
+	return (m_nRounds != 0);
+}
+
+void CAesGcm::Clear()
+{
+	Wipe(m_arrRoundKeys, sizeof(m_arrRoundKeys));
+	Wipe(m_arrPowers, sizeof(m_arrPowers));
+	Wipe(m_arrTable, sizeof(m_arrTable));
+	Wipe(m_arrWords, sizeof(m_arrWords));
+	m_nRounds = 0;
+}
+
+void CAesGcm::EncryptBlock(const uint8_t* pIn, uint8_t* pOut) const
+{
+#ifdef AES_GCM_X86
+	if (GetKernel() == EAesGcmKernel::AesNi)
+		return EncryptAesNi(m_arrRoundKeys, m_nRounds, pIn, pOut);
+#endif
+	EncryptTable(m_arrWords, m_nRounds, pIn, pOut);
+}
+
+void CAesGcm::Begin(SState& oState, const uint8_t* pNonce, const void* pAad, size_t nAadSize) const
+{
+	// The first counter block masks the tag, the message starts from the second one
+	memcpy(oState.arrCounter, pNonce, c_nNonceSize);
+	StoreBigEndian32(oState.arrCounter + c_nNonceSize, 1);
+	EncryptBlock(oState.arrCounter, oState.arrMask);
+	IncrementCounter(oState.arrCounter);
+
+	memset(oState.arrHash, 0, c_nBlockSize);
+	HashPadded(oState.arrHash, static_cast<const uint8_t*>(pAad), nAadSize);
+	oState.nAadSize = nAadSize;
+	oState.nSize = 0;
+}
+
+void CAesGcm::Encrypt(SState& oState, const void* pIn, void* pOut, size_t nSize) const
+{
+	Process(oState, static_cast<const uint8_t*>(pIn), static_cast<uint8_t*>(pOut), nSize, true);
+}
+
+void CAesGcm::Decrypt(SState& oState, const void* pIn, void* pOut, size_t nSize) const
+{
+	Process(oState, static_cast<const uint8_t*>(pIn), static_cast<uint8_t*>(pOut), nSize, false);
+}
+
+void CAesGcm::Finish(SState& oState, uint8_t* pTag) const
+{
+	const size_t nOffset = size_t(oState.nSize % c_nBlockSize);
+	if (nOffset > 0)
+	{
+		memset(oState.arrPartial + nOffset, 0, c_nBlockSize - nOffset);
+		Hash(oState.arrHash, oState.arrPartial, 1);
+	}
+
+	uint8_t arrLengths[c_nBlockSize];
+	StoreBigEndian64(arrLengths, oState.nAadSize * 8);
+	StoreBigEndian64(arrLengths + 8, oState.nSize * 8);
+	Hash(oState.arrHash, arrLengths, 1);
+	for (size_t i = 0; i < c_nTagSize; ++i)
+		pTag[i] = oState.arrHash[i] ^ oState.arrMask[i];
+}
+
+bool CAesGcm::Verify(SState& oState, const uint8_t* pTag) const
+{
+	uint8_t arrTag[c_nTagSize];
+	Finish(oState, arrTag);
+
+	// No early exit, the time doesn't tell how many bytes match
+	uint8_t nDifference = 0;
+	for (size_t i = 0; i < c_nTagSize; ++i)
+		nDifference |= uint8_t(arrTag[i] ^ pTag[i]);
+	return (nDifference == 0);
+}
+
+void CAesGcm::Seal(const uint8_t* pNonce, const void* pAad, size_t nAadSize, const void* pIn, void* pOut, size_t nSize, uint8_t* pTag) const
+{
+	SState oState;
+	Begin(oState, pNonce, pAad, nAadSize);
+	Encrypt(oState, pIn, pOut, nSize);
+	Finish(oState, pTag);
+}
+
+bool CAesGcm::Open(const uint8_t* pNonce, const void* pAad, size_t nAadSize, const void* pIn, void* pOut, size_t nSize, const uint8_t* pTag) const
+{
+	SState oState;
+	Begin(oState, pNonce, pAad, nAadSize);
+	Decrypt(oState, pIn, pOut, nSize);
+	return Verify(oState, pTag);
+}
+
+void CAesGcm::Process(SState& oState, const uint8_t* pIn, uint8_t* pOut, size_t nSize, bool bEncrypt) const
+{
+	// The partial block left by the previous part is finished first
+	size_t nOffset = size_t(oState.nSize % c_nBlockSize);
+	oState.nSize += nSize;
+	if (nOffset > 0)
+	{
+		for (; nOffset < c_nBlockSize && nSize > 0; ++nOffset, --nSize)
+		{
+			const uint8_t nInput = *pIn++;
+			const uint8_t nOutput = nInput ^ oState.arrKeystream[nOffset];
+			oState.arrPartial[nOffset] = bEncrypt ? nOutput : nInput;
+			*pOut++ = nOutput;
+		}
+		if (nOffset < c_nBlockSize)
+			return;
+		Hash(oState.arrHash, oState.arrPartial, 1);
+	}
+
+	const size_t nBlocks = nSize / c_nBlockSize;
+	if (nBlocks > 0)
+	{
+#ifdef AES_GCM_X86
+		if (GetKernel() == EAesGcmKernel::AesNi)
+			CryptAesNi(m_arrRoundKeys, m_nRounds, m_arrPowers, oState.arrCounter, oState.arrHash, pIn, pOut, nBlocks, bEncrypt);
+		else
+#endif
+			CryptTable(m_arrWords, m_nRounds, m_arrTable, oState.arrCounter, oState.arrHash, pIn, pOut, nBlocks, bEncrypt);
+		pIn += nBlocks * c_nBlockSize;
+		pOut += nBlocks * c_nBlockSize;
+		nSize -= nBlocks * c_nBlockSize;
+	}
+
+	// The keystream of the last partial block is kept for the next part
+	if (nSize > 0)
+	{
+		EncryptBlock(oState.arrCounter, oState.arrKeystream);
+		IncrementCounter(oState.arrCounter);
+		for (size_t i = 0; i < nSize; ++i)
+		{
+			const uint8_t nInput = pIn[i];
+			const uint8_t nOutput = nInput ^ oState.arrKeystream[i];
+			oState.arrPartial[i] = bEncrypt ? nOutput : nInput;
+			pOut[i] = nOutput;
+		}
+	}
+}
+
+void CAesGcm::Hash(uint8_t* pHash, const uint8_t* pData, size_t nBlocks) const
+{
+#ifdef AES_GCM_X86
+	if (GetKernel() == EAesGcmKernel::AesNi)
+		return HashAesNi(m_arrPowers, pHash, pData, nBlocks);
+#endif
+	HashTable(m_arrTable, pHash, pData, nBlocks);
+}
+
+void CAesGcm::HashPadded(uint8_t* pHash, const uint8_t* pData, size_t nSize) const
+{
+	const size_t nBlocks = nSize / c_nBlockSize;
+	if (nBlocks > 0)
+		Hash(pHash, pData, nBlocks);
+
+	const size_t nRest = nSize % c_nBlockSize;
+	if (nRest > 0)
+	{
+		uint8_t arrBlock[c_nBlockSize] = {};
+		memcpy(arrBlock, pData + nBlocks * c_nBlockSize, nRest);
+		Hash(pHash, arrBlock, 1);
+	}
+}
+
+
+EAesGcmKernel GetAesGcmKernel()
+{
+	return GetKernel();
+}
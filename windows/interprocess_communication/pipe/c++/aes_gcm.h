@@ -0,0 +1,95 @@
+/*
+Declaration file for the AES-GCM authenticated encryption
+
+The kernel is chosen once at run time: AES-NI rounds with the PCLMULQDQ multiplication on x86,
+a portable T-table cipher and 4-bit GHASH table otherwise. The x86 kernel runs eight counter
+blocks in flight and hashes eight ciphertext blocks per reduction, so the two units overlap.
+Messages may be processed in parts of any size; the output matches NIST SP 800-38D.
+*/
+
+
+//! Include guard
+#pragma once
+
+
+//! Includes
+#include <cstddef>
+#include <cstdint>
+
+
+//! Kernel of CAesGcm
+enum class EAesGcmKernel
+{
+	Table,		// Portable T-table cipher and GHASH table
+	AesNi		// x86 AES-NI and PCLMULQDQ
+};
+
+
+//! Class CAesGcm
+class CAesGcm
+{
+public: //! Constants
+	static const size_t c_nBlockSize = 16;		// Cipher block
+	static const size_t c_nNonceSize = 12;		// Nonce (IV) size
+	static const size_t c_nTagSize = 16;		// Authentication tag size
+
+public: //! Types
+	// State of one message being sealed or opened
+	struct SState
+	{
+		uint8_t		arrCounter[c_nBlockSize];		// Next counter block
+		uint8_t		arrHash[c_nBlockSize];			// GHASH accumulator
+		uint8_t		arrMask[c_nBlockSize];			// Encrypted first counter block, masks the tag
+		uint8_t		arrKeystream[c_nBlockSize];		// Keystream of the partial block
+		uint8_t		arrPartial[c_nBlockSize];		// Ciphertext of the partial block
+		uint64_t	nAadSize;
+		uint64_t	nSize;							// Bytes processed so far
+	};
+
+public: //! Constructors and destructor
+	CAesGcm();
+	~CAesGcm();
+
+public: //! Interface
+	// Sets the 16 or 32 byte key (AES-128 or AES-256), returns false for another size
+	bool SetKey(const void* pKey, size_t nKeySize);
+	// Returns true if the key is set
+	bool HasKey() const;
+	// Forgets the key
+	void Clear();
+	// Encrypts one block by the raw cipher (key derivation)
+	void EncryptBlock(const uint8_t* pIn, uint8_t* pOut) const;
+
+	// Starts the message, the additional authenticated data is passed whole
+	void Begin(SState& oState, const uint8_t* pNonce, const void* pAad, size_t nAadSize) const;
+	// Encrypts or decrypts the next part of the message, pOut may be pIn or lie before it
+	void Encrypt(SState& oState, const void* pIn, void* pOut, size_t nSize) const;
+	void Decrypt(SState& oState, const void* pIn, void* pOut, size_t nSize) const;
+	// Writes the tag of the message
+	void Finish(SState& oState, uint8_t* pTag) const;
+	// Returns true if the tag matches the message (compared in constant time)
+	bool Verify(SState& oState, const uint8_t* pTag) const;
+
+	// Whole message helpers
+	void Seal(const uint8_t* pNonce, const void* pAad, size_t nAadSize, const void* pIn, void* pOut, size_t nSize, uint8_t* pTag) const;
+	bool Open(const uint8_t* pNonce, const void* pAad, size_t nAadSize, const void* pIn, void* pOut, size_t nSize, const uint8_t* pTag) const;
+
+private: //! Implementation
+	void Process(SState& oState, const uint8_t* pIn, uint8_t* pOut, size_t nSize, bool bEncrypt) const;
+	// Hashes the whole blocks
+	void Hash(uint8_t* pHash, const uint8_t* pData, size_t nBlocks) const;
+	// Hashes the data padded to the blocks
+	void HashPadded(uint8_t* pHash, const uint8_t* pData, size_t nSize) const;
+
+private: //! Members
+	alignas(16) uint8_t	m_arrRoundKeys[15 * c_nBlockSize];	// Expanded key, FIPS 197 byte order
+	alignas(16) uint8_t	m_arrPowers[8 * c_nBlockSize];		// H^1..H^8 of the x86 kernel (byte-reflected)
+	uint64_t			m_arrTable[2][16];					// Multiples of H of the table kernel (high, low halves)
+	uint32_t			m_arrWords[15 * 4];					// Round keys of the table kernel, big-endian words
+	int					m_nRounds;							// 10 or 14, 0 without the key
+};
+
+
+//! Functions
+// Returns the kernel the processor runs
+EAesGcmKernel GetAesGcmKernel();
@@ -0,0 +1,1023 @@
+/*
+Implementation file for the asynchronous pipe
+*/
+
+
+//! Includes
+#include "async_pipe.h"
+#include <algorithm>
+#include <cstring>
+#ifndef _WIN32
+#include "posix_pipe_transport.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+
+//! Pipe constants
+static const size_t		c_nReadChunk = 64 * 1024;		// Bytes received per read
+#ifdef _WIN32
+static const DWORD		c_nPipeBufferSize = 64 * 1024;	// Kernel buffer of the pipe
+static const size_t		c_nCoalesceLimit = 64 * 1024;	// Queued frames up to this size are staged to go by a single write
+#else
+static const int		c_nMaxGather = 32;				// Buffers written per call
+#endif
+
+
+#ifndef _WIN32
+//! Fills the socket address of the pipe endpoint
+static bool GetEndpointAddress(const std::string& sName, sockaddr_un& oAddress)
+{
+	const std::string sPath = CPosixPipeTransport::GetEndpointPath(sName);
+	oAddress = sockaddr_un();
+	oAddress.sun_family = AF_UNIX;
+	if (sPath.size() >= sizeof(oAddress.sun_path))
+		return false;
+	memcpy(oAddress.sun_path, sPath.c_str(), sPath.size() + 1);
+
+	return true;
+}
+#endif
+
+
+CAsyncPipePtr CAsyncPipe::Create(CIoLoopPtr pLoop, const std::string& sName, EPipeMode eMode)
+{
+	return CAsyncPipePtr(new CAsyncPipe(pLoop, sName, eMode));
+}
+
+CAsyncPipe::CAsyncPipe(CIoLoopPtr pLoop, const std::string& sName, EPipeMode eMode)
+	: m_pLoop(pLoop),
+	  m_sName(sName),
+	  m_eMode(eMode),
+	  m_nMaxMessageSize(c_nFrameDefaultMaxLength),
+	  m_bOpen(false),
+	  m_pBufferPool(CBufferPool::Create()),
+	  m_nNextOpId(0),
+	  m_bConnected(false),
+	  m_nConnectionId(0)
+#ifdef _WIN32
+	  , m_hPipe(INVALID_HANDLE_VALUE),
+	  m_nRegistrationId(0),
+	  m_bConnectPending(false),
+	  m_bReadPending(false),
+	  m_bWritePending(false),
+	  m_nWriteFrames(0),
+	  m_nStaleConnects(0),
+	  m_nStaleReads(0),
+	  m_nStaleWrites(0)
+#else
+	  , m_nListener(-1),
+	  m_nSocket(-1),
+	  m_nListenerId(0),
+	  m_nSocketId(0)
+#endif
+{
+#ifdef _WIN32
+	memset(&m_oConnectOverlapped, 0, sizeof(m_oConnectOverlapped));
+	memset(&m_oReadOverlapped, 0, sizeof(m_oReadOverlapped));
+	memset(&m_oWriteOverlapped, 0, sizeof(m_oWriteOverlapped));
+#endif
+	EncodeCredit(m_arrCredit, c_nUnlimitedCredit);
+}
+
+CAsyncPipe::~CAsyncPipe()
+{
+	// The loop holds the registered pipes, so nothing is registered here any more
+	CloseHandles();
+}
+
+bool CAsyncPipe::Open()
+{
+	if (m_pLoop == nullptr || !m_pLoop->IsRunning() || m_sName.empty() || m_bOpen.exchange(true))
+		return false;
+
+	m_oAssembler = CFrameAssembler(m_nMaxMessageSize);
+	bool bOk = false;
+#ifdef _WIN32
+	std::string sPath = R"(\\.\pipe\)" + m_sName;
+	if (m_eMode == EPipeMode::Read)
+	{
+		CPipeSecurity oSecurity;
+		SECURITY_ATTRIBUTES* pAttributes = oSecurity.GetAttributes();
+		if (pAttributes != nullptr)
+			m_hPipe = CreateNamedPipeA(sPath.c_str(), PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT,
+				1, c_nPipeBufferSize, c_nPipeBufferSize, NMPWAIT_USE_DEFAULT_WAIT, pAttributes);
+	}
+	else
+	{
+		m_hPipe = CreateFileA(sPath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+		// The instance is busy, wait a bit for the reader to free it
+		if (m_hPipe == INVALID_HANDLE_VALUE && GetLastError() == ERROR_PIPE_BUSY && WaitNamedPipeA(sPath.c_str(), NMPWAIT_USE_DEFAULT_WAIT))
+			m_hPipe = CreateFileA(sPath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+	}
+	bOk = (m_hPipe != INVALID_HANDLE_VALUE);
+#else
+	sockaddr_un oAddress;
+	if (GetEndpointAddress(m_sName, oAddress))
+	{
+		if (m_eMode == EPipeMode::Read)
+		{
+			m_nListener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+			bOk = (m_nListener >= 0 && CPosixPipeTransport::Listen(m_nListener, oAddress, SOMAXCONN));
+		}
+		else
+		{
+			// Connecting to a local socket doesn't wait for the reader to accept
+			m_nSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+			bOk = (m_nSocket >= 0 && connect(m_nSocket, reinterpret_cast<sockaddr*>(&oAddress), sizeof(oAddress)) == 0 &&
+				fcntl(m_nSocket, F_SETFL, fcntl(m_nSocket, F_GETFL) | O_NONBLOCK) == 0);
+		}
+	}
+#endif
+	if (!bOk)
+	{
+		CloseHandles();
+		m_bOpen = false;
+		return false;
+	}
+
+	CAsyncPipePtr pThis = shared_from_this();
+	m_pLoop->Post([pThis]() { pThis->Attach(); });
+
+	return true;
+}
+
+void CAsyncPipe::Close()
+{
+	// A stopped loop has closed its pipes already
+	if (!m_pLoop->IsRunning())
+		return;
+
+	CAsyncPipePtr pThis = shared_from_this();
+	m_pLoop->Post([pThis]()
+	{
+		pThis->CloseHandles();
+		pThis->m_bOpen = false;
+		pThis->FailReceives(EPipeError::Cancelled);
+		pThis->FailSends(EPipeError::Cancelled);
+	});
+}
+
+bool CAsyncPipe::IsOpen() const
+{
+	return m_bOpen;
+}
+
+void CAsyncPipe::SetMaxMessageSize(uint32_t nMaxSize)
+{
+	m_nMaxMessageSize = nMaxSize;
+}
+
+bool CAsyncPipe::SetEncryption(const void* pKey, size_t nKeySize)
+{
+	// The cipher belongs to the loop thread once opened
+	if (m_bOpen)
+		return false;
+
+	return m_oCipher.SetKey(pKey, nKeySize);
+}
+
+bool CAsyncPipe::EnableMetrics(bool bEnable)
+{
+	// The loop thread records without a lock once opened
+	if (m_bOpen)
+		return false;
+
+	m_pMetrics = bEnable ? CPipeMetrics::Create() : nullptr;
+	return true;
+}
+
+bool CAsyncPipe::GetMetrics(SPipeMetrics& oMetrics) const
+{
+	CPipeMetricsPtr pMetrics = m_pMetrics;
+	if (pMetrics == nullptr)
+		return false;
+
+	oMetrics = pMetrics->Snapshot();
+	return true;
+}
+
+void CAsyncPipe::ReceiveAsync(TReceiveCallback fnCallback, uint32_t nTimeoutMs)
+{
+	if (!m_pLoop->IsRunning())
+	{
+		SReceiveResult oResult;
+		oResult.eError = EPipeError::Cancelled;
+		fnCallback(std::move(oResult));
+		return;
+	}
+
+	CAsyncPipePtr pThis = shared_from_this();
+	m_pLoop->Post([pThis, fnCallback, nTimeoutMs]()
+	{
+		SReceiveOp oOp;
+		oOp.fnCallback = fnCallback;
+		pThis->StartReceive(oOp, nTimeoutMs);
+	});
+}
+
+std::future<CAsyncPipe::SReceiveResult> CAsyncPipe::ReceiveAsync(uint32_t nTimeoutMs)
+{
+	std::shared_ptr<std::promise<SReceiveResult>> pPromise = std::make_shared<std::promise<SReceiveResult>>();
+	std::future<SReceiveResult> oFuture = pPromise->get_future();
+	ReceiveAsync([pPromise](SReceiveResult&& oResult) { pPromise->set_value(std::move(oResult)); }, nTimeoutMs);
+
+	return oFuture;
+}
+
+void CAsyncPipe::SendAsync(const void* pData, size_t nSize, TSendCallback fnCallback, uint32_t nTimeoutMs)
+{
+	SendFrameAsync(uint16_t(EFrameType::Data), pData, nSize, fnCallback, nTimeoutMs);
+}
+
+std::future<CAsyncPipe::EPipeError> CAsyncPipe::SendAsync(const void* pData, size_t nSize, uint32_t nTimeoutMs)
+{
+	std::shared_ptr<std::promise<EPipeError>> pPromise = std::make_shared<std::promise<EPipeError>>();
+	std::future<EPipeError> oFuture = pPromise->get_future();
+	SendAsync(pData, nSize, [pPromise](EPipeError eError) { pPromise->set_value(eError); }, nTimeoutMs);
+
+	return oFuture;
+}
+
+void CAsyncPipe::SendFrameAsync(uint16_t nType, const void* pData, size_t nSize, TSendCallback fnCallback, uint32_t nTimeoutMs,
+	uint64_t nConnectionId)
+{
+	if (!m_pLoop->IsRunning())
+	{
+		fnCallback(EPipeError::Cancelled);
+		return;
+	}
+
+	CAsyncPipePtr pThis = shared_from_this();
+	m_pLoop->Post([pThis, nType, pData, nSize, fnCallback, nTimeoutMs, nConnectionId]()
+	{
+		SSendOp oOp;
+		oOp.fnCallback = fnCallback;
+		oOp.pData = static_cast<const byte*>(pData);
+		oOp.nSize = nSize;
+		pThis->StartSend(oOp, nType, nTimeoutMs, nConnectionId);
+	});
+}
+
+void CAsyncPipe::Cancel()
+{
+	CAsyncPipePtr pThis = shared_from_this();
+	m_pLoop->Post([pThis]() { pThis->CancelAll(); });
+}
+
+void CAsyncPipe::OnStop()
+{
+	// The registrations are gone with the loop
+#ifdef _WIN32
+	m_nRegistrationId = 0;
+#else
+	m_nListenerId = m_nSocketId = 0;
+#endif
+	CloseHandles();
+	m_bOpen = false;
+	FailReceives(EPipeError::Cancelled);
+	FailSends(EPipeError::Cancelled);
+}
+
+void CAsyncPipe::Attach()
+{
+	CAsyncPipePtr pThis = shared_from_this();
+#ifdef _WIN32
+	m_nStaleConnects = m_nStaleReads = m_nStaleWrites = 0;
+	m_nRegistrationId = m_pLoop->Register(m_hPipe, pThis);
+	const bool bOk = (m_nRegistrationId != 0);
+#else
+	bool bOk = false;
+	if (m_eMode == EPipeMode::Read)
+		bOk = ((m_nListenerId = m_pLoop->Register(m_nListener, pThis)) != 0);
+	else
+		bOk = ((m_nSocketId = m_pLoop->Register(m_nSocket, pThis)) != 0);
+#endif
+	if (!bOk)
+	{
+		CloseHandles();
+		m_bOpen = false;
+		FailReceives(EPipeError::IoFailure);
+		FailSends(EPipeError::IoFailure);
+		return;
+	}
+
+	if (m_eMode == EPipeMode::Write)
+	{
+		BeginConnection();
+		return;
+	}
+#ifdef _WIN32
+	IssueConnect();
+#else
+	AcceptWriter();
+#endif
+}
+
+void CAsyncPipe::StartReceive(SReceiveOp& oOp, uint32_t nTimeoutMs)
+{
+	if (!m_bOpen)
+	{
+		SReceiveResult oResult;
+		oResult.eError = EPipeError::NotOpen;
+		oOp.fnCallback(std::move(oResult));
+		return;
+	}
+
+	oOp.nId = ++m_nNextOpId;
+	if (nTimeoutMs > 0)
+	{
+		CAsyncPipePtr pThis = shared_from_this();
+		const uint64_t nId = oOp.nId;
+		oOp.nTimerId = m_pLoop->AddTimer(nTimeoutMs, [pThis, nId]() { pThis->OnTimeout(nId, false); });
+	}
+	m_deqReceives.push_back(std::move(oOp));
+	ProcessReceives();
+}
+
+void CAsyncPipe::StartSend(SSendOp& oOp, uint16_t nType, uint32_t nTimeoutMs, uint64_t nConnectionId)
+{
+	const bool bSeal = m_oCipher.IsEnabled() && CFrameCipher::IsSealedType(nType);
+	EPipeError eError = EPipeError::None;
+	if (!m_bOpen)
+		eError = EPipeError::NotOpen;
+	else if (oOp.nSize > m_nMaxMessageSize)
+		eError = EPipeError::FrameTooLarge;
+	else if (nConnectionId != 0 && (!m_bConnected || nConnectionId != m_nConnectionId))
+		eError = EPipeError::Disconnected;
+	else if (bSeal && !m_oCipher.HasSession())
+		eError = EPipeError::Disconnected;
+	if (eError != EPipeError::None)
+	{
+		CountFailure(eError);
+		oOp.fnCallback(eError);
+		return;
+	}
+	if (m_pMetrics != nullptr)
+	{
+		oOp.nStart = CPipeMetrics::Now();
+		oOp.nMessageSize = oOp.nSize;
+	}
+
+	SFrameHeader oHeader;
+	oHeader.nType = nType;
+	oHeader.nFlags = bSeal ? uint16_t(FrameFlagEncrypted) : uint16_t(FrameFlagNone);
+	oHeader.nLength = uint32_t(oOp.nSize + (bSeal ? c_nFrameCipherOverhead : 0));
+	oHeader.Encode(oOp.arrHeader);
+	if (bSeal)
+	{
+		// Sealed in the order of the sends, the caller's buffer is free once the call returns
+		oOp.oOwned = m_pBufferPool->Acquire(oHeader.nLength);
+		m_oCipher.Seal(oOp.arrHeader, oOp.pData, oOp.nSize, oOp.oOwned.GetData());
+		oOp.pData = oOp.oOwned.GetData();
+		oOp.nSize = oHeader.nLength;
+	}
+
+	oOp.nId = ++m_nNextOpId;
+	if (nTimeoutMs > 0)
+	{
+		CAsyncPipePtr pThis = shared_from_this();
+		const uint64_t nId = oOp.nId;
+		oOp.nTimerId = m_pLoop->AddTimer(nTimeoutMs, [pThis, nId]() { pThis->OnTimeout(nId, true); });
+	}
+	CountQueued(oOp, 1);
+	m_deqSends.push_back(std::move(oOp));
+	ProcessSends();
+}
+
+void CAsyncPipe::BeginConnection()
+{
+	m_bConnected = true;
+	++m_nConnectionId;
+	if (m_pMetrics != nullptr && m_eMode == EPipeMode::Read)
+	{
+		m_pMetrics->Add(EPipeCounter::Connections);
+		m_pMetrics->SetGauge(EPipeGauge::ActiveConnections, 1);
+	}
+	// Every connection has its own session, started by the writer
+	if (m_oCipher.IsEnabled())
+	{
+		if (m_eMode == EPipeMode::Write)
+			SendSession();
+		else
+			m_oCipher.EndSession();
+	}
+	ProcessReceives();
+	ProcessSends();
+}
+
+void CAsyncPipe::SendSession()
+{
+	byte arrSession[c_nSessionFrameSize];
+	m_oCipher.StartSession(arrSession);
+	SSendOp oOp;
+	oOp.nId = ++m_nNextOpId;
+	oOp.fnCallback = [](EPipeError) {};
+	memcpy(oOp.arrHeader, arrSession, c_nFrameHeaderSize);
+	oOp.oOwned = m_pBufferPool->Acquire(c_nSessionSaltSize);
+	memcpy(oOp.oOwned.GetData(), arrSession + c_nFrameHeaderSize, c_nSessionSaltSize);
+	oOp.pData = oOp.oOwned.GetData();
+	oOp.nSize = c_nSessionSaltSize;
+	CountQueued(oOp, 1);
+	m_deqSends.push_front(std::move(oOp));
+}
+
+void CAsyncPipe::SendCredit()
+{
+	// Queued like any frame, so it never cuts into a partially written one
+	SSendOp oOp;
+	oOp.nId = ++m_nNextOpId;
+	oOp.fnCallback = [](EPipeError) {};
+	memcpy(oOp.arrHeader, m_arrCredit, c_nFrameHeaderSize);
+	oOp.pData = m_arrCredit + c_nFrameHeaderSize;
+	oOp.nSize = c_nCreditFrameSize - c_nFrameHeaderSize;
+	CountQueued(oOp, 1);
+	m_deqSends.push_back(std::move(oOp));
+	ProcessSends();
+}
+
+CFrameAssembler::EResult CAsyncPipe::DeliverFrame(EPipeError& eError)
+{
+	SFrameHeader oHeader;
+	const uint8_t* pPayload = nullptr;
+	CFrameAssembler::EResult eResult = m_oAssembler.Next(oHeader, pPayload);
+	if (eResult != CFrameAssembler::EResult::Frame)
+		return eResult;
+	if (oHeader.nType == uint16_t(EFrameType::FlowControl))
+	{
+		SendCredit();
+		return eResult;
+	}
+	if (oHeader.nType == uint16_t(EFrameType::Session))
+	{
+		// The pipe without the key ignores the session, the sealed frames that follow fail
+		if (m_oCipher.IsEnabled() && !m_oCipher.AcceptSession(oHeader, pPayload))
+			eError = EPipeError::InvalidFrame;
+		return eResult;
+	}
+	const bool bSealed = (oHeader.nFlags & FrameFlagEncrypted) != 0;
+	if (bSealed ? !m_oCipher.HasSession() : (m_oCipher.IsEnabled() && CFrameCipher::IsSealedType(oHeader.nType)))
+	{
+		eError = EPipeError::AuthenticationFailed;
+		return eResult;
+	}
+
+	// The sealed payload is opened while it's copied out of the assembler
+	CPooledBuffer oPayload = m_pBufferPool->Acquire(oHeader.GetPayloadSize());
+	if (bSealed)
+	{
+		byte arrHeader[c_nFrameHeaderSize];
+		oHeader.Encode(arrHeader);
+		if (!m_oCipher.Open(arrHeader, pPayload, oHeader.nLength, oPayload.GetData()))
+		{
+			eError = EPipeError::AuthenticationFailed;
+			return eResult;
+		}
+		oHeader.nFlags &= uint16_t(~FrameFlagEncrypted);
+		oHeader.nLength = uint32_t(oPayload.GetSize());
+	}
+	else if (oHeader.nLength > 0)
+		memcpy(oPayload.GetData(), pPayload, oHeader.nLength);
+
+	SReceiveOp oOp = std::move(m_deqReceives.front());
+	m_deqReceives.pop_front();
+	m_pLoop->CancelTimer(oOp.nTimerId);
+	if (m_pMetrics != nullptr)
+	{
+		m_pMetrics->Add(EPipeCounter::MessagesReceived);
+		m_pMetrics->Add(EPipeCounter::BytesReceived, oHeader.nLength);
+	}
+
+	SReceiveResult oResult;
+	oResult.oHeader = oHeader;
+	oResult.nConnectionId = m_nConnectionId;
+	oResult.oPayload = std::move(oPayload);
+	oOp.fnCallback(std::move(oResult));
+
+	return eResult;
+}
+
+void CAsyncPipe::AdvanceSends(size_t nSent)
+{
+	while (!m_deqSends.empty())
+	{
+		SSendOp& oOp = m_deqSends.front();
+		const size_t nRemaining = c_nFrameHeaderSize + oOp.nSize - oOp.nOffset;
+		if (nSent < nRemaining)
+		{
+			oOp.nOffset += nSent;
+			return;
+		}
+		nSent -= nRemaining;
+
+		SSendOp oDone = std::move(oOp);
+		m_deqSends.pop_front();
+		m_pLoop->CancelTimer(oDone.nTimerId);
+		CountQueued(oDone, -1);
+		if (m_pMetrics != nullptr && oDone.nStart != 0)
+		{
+			m_pMetrics->Add(EPipeCounter::MessagesSent);
+			m_pMetrics->Add(EPipeCounter::BytesSent, oDone.nMessageSize);
+			m_pMetrics->Record(EPipeLatency::Send, oDone.nStart);
+		}
+		oDone.fnCallback(EPipeError::None);
+	}
+}
+
+void CAsyncPipe::FailReceives(EPipeError eError)
+{
+	std::deque<SReceiveOp> deqFailed;
+	deqFailed.swap(m_deqReceives);
+	for (SReceiveOp& oOp : deqFailed)
+	{
+		m_pLoop->CancelTimer(oOp.nTimerId);
+		SReceiveResult oResult;
+		oResult.eError = eError;
+		oOp.fnCallback(std::move(oResult));
+	}
+}
+
+void CAsyncPipe::FailSends(EPipeError eError)
+{
+	std::deque<SSendOp> deqFailed;
+	deqFailed.swap(m_deqSends);
+	for (SSendOp& oOp : deqFailed)
+	{
+		m_pLoop->CancelTimer(oOp.nTimerId);
+		CountQueued(oOp, -1);
+		oOp.fnCallback(oOp.eAbort != EPipeError::None ? oOp.eAbort : eError);
+	}
+}
+
+void CAsyncPipe::OnTimeout(uint64_t nOpId, bool bSend)
+{
+	if (!bSend)
+	{
+		auto itOp = std::find_if(m_deqReceives.begin(), m_deqReceives.end(), [nOpId](const SReceiveOp& oOp) { return oOp.nId == nOpId; });
+		if (itOp == m_deqReceives.end())
+			return;
+
+		// Partially received frame stays in the assembler for the next receive
+		SReceiveOp oOp = std::move(*itOp);
+		m_deqReceives.erase(itOp);
+		SReceiveResult oResult;
+		oResult.eError = EPipeError::TimedOut;
+		oOp.fnCallback(std::move(oResult));
+		return;
+	}
+
+	auto itOp = std::find_if(m_deqSends.begin(), m_deqSends.end(), [nOpId](const SSendOp& oOp) { return oOp.nId == nOpId; });
+	if (itOp == m_deqSends.end())
+		return;
+
+	itOp->nTimerId = 0;
+	if (IsSendStarted(size_t(itOp - m_deqSends.begin())))
+	{
+		itOp->eAbort = EPipeError::TimedOut;
+		DropConnection(EPipeError::Disconnected);
+		return;
+	}
+
+	SSendOp oOp = std::move(*itOp);
+	m_deqSends.erase(itOp);
+	CountQueued(oOp, -1);
+	CountFailure(EPipeError::TimedOut);
+	oOp.fnCallback(EPipeError::TimedOut);
+}
+
+void CAsyncPipe::CancelAll()
+{
+	FailReceives(EPipeError::Cancelled);
+	if (!m_deqSends.empty() && IsSendStarted(0))
+		DropConnection(EPipeError::Cancelled);
+	else
+		FailSends(EPipeError::Cancelled);
+}
+
+bool CAsyncPipe::IsSendStarted(size_t nIndex) const
+{
+	if (nIndex == 0 && !m_deqSends.empty() && m_deqSends.front().nOffset > 0)
+		return true;
+#ifdef _WIN32
+	return (m_bWritePending && nIndex < m_nWriteFrames);
+#else
+	return false;
+#endif
+}
+
+void CAsyncPipe::DropConnection(EPipeError eError)
+{
+	CountFailure(eError);
+	if (m_pMetrics != nullptr)
+	{
+		m_pMetrics->Add(EPipeCounter::Disconnects);
+		if (m_eMode == EPipeMode::Read)
+			m_pMetrics->SetGauge(EPipeGauge::ActiveConnections, 0);
+	}
+	if (m_eMode == EPipeMode::Write)
+	{
+		CloseHandles();
+		m_bOpen = false;
+		FailReceives(eError);
+		FailSends(eError);
+		return;
+	}
+
+	// The rest of the broken stream is of no use
+	m_bConnected = false;
+	m_oAssembler.Reset();
+#ifdef _WIN32
+	AbortIo();
+	DisconnectNamedPipe(m_hPipe);
+	FailReceives(eError);
+	FailSends(eError);
+	IssueConnect();
+#else
+	m_pLoop->Unregister(m_nSocketId);
+	close(m_nSocket);
+	m_nSocket = -1;
+	m_nSocketId = 0;
+	FailReceives(eError);
+	FailSends(eError);
+	AcceptWriter();
+#endif
+}
+
+void CAsyncPipe::CountQueued(const SSendOp& oOp, int64_t nSign)
+{
+	if (m_pMetrics == nullptr)
+		return;
+
+	m_pMetrics->AddGauge(EPipeGauge::QueuedFrames, nSign);
+	m_pMetrics->AddGauge(EPipeGauge::QueuedBytes, nSign * int64_t(c_nFrameHeaderSize + oOp.nSize));
+}
+
+void CAsyncPipe::CountFailure(EPipeError eError)
+{
+	if (m_pMetrics == nullptr)
+		return;
+
+	m_pMetrics->Add(EPipeCounter::Failures);
+	if (eError == EPipeError::ChecksumMismatch)
+		m_pMetrics->Add(EPipeCounter::ChecksumFailures);
+	else if (eError == EPipeError::AuthenticationFailed)
+		m_pMetrics->Add(EPipeCounter::AuthenticationFailures);
+}
+
+void CAsyncPipe::CloseHandles()
+{
+	m_bConnected = false;
+	m_oAssembler.Reset();
+#ifdef _WIN32
+	if (m_hPipe != INVALID_HANDLE_VALUE)
+	{
+		AbortIo();
+		CloseHandle(m_hPipe);
+		m_hPipe = INVALID_HANDLE_VALUE;
+	}
+	// Completions queued for the closed handle are ignored by the loop
+	if (m_nRegistrationId != 0)
+		m_pLoop->Unregister(m_nRegistrationId);
+	m_nRegistrationId = 0;
+#else
+	if (m_nSocketId != 0)
+		m_pLoop->Unregister(m_nSocketId);
+	if (m_nSocket >= 0)
+		close(m_nSocket);
+	if (m_nListenerId != 0)
+		m_pLoop->Unregister(m_nListenerId);
+	if (m_nListener >= 0)
+	{
+		close(m_nListener);
+		unlink(CPosixPipeTransport::GetEndpointPath(m_sName).c_str());
+	}
+	m_nSocket = m_nListener = -1;
+	m_nSocketId = m_nListenerId = 0;
+#endif
+}
+
+#ifdef _WIN32
+
+void CAsyncPipe::OnComplete(OVERLAPPED* pOverlapped, DWORD nBytes, DWORD nError)
+{
+	if (pOverlapped == &m_oConnectOverlapped)
+	{
+		if (m_nStaleConnects > 0)
+		{
+			--m_nStaleConnects;
+			return;
+		}
+		m_bConnectPending = false;
+		if (nError != 0 && nError != ERROR_PIPE_CONNECTED)
+		{
+			// The writer has gone before being accepted
+			DisconnectNamedPipe(m_hPipe);
+			IssueConnect();
+			return;
+		}
+		BeginConnection();
+	}
+	else if (pOverlapped == &m_oReadOverlapped)
+	{
+		if (m_nStaleReads > 0)
+		{
+			--m_nStaleReads;
+			return;
+		}
+		m_bReadPending = false;
+		if (nError != 0 || nBytes == 0)
+		{
+			DropConnection(EPipeError::Disconnected);
+			return;
+		}
+		m_oAssembler.CommitWrite(nBytes);
+		ProcessReceives();
+	}
+	else if (pOverlapped == &m_oWriteOverlapped)
+	{
+		if (m_nStaleWrites > 0)
+		{
+			--m_nStaleWrites;
+			return;
+		}
+		m_bWritePending = false;
+		if (nError != 0)
+		{
+			DropConnection(EPipeError::Disconnected);
+			return;
+		}
+		AdvanceSends(nBytes);
+		ProcessSends();
+	}
+}
+
+void CAsyncPipe::ProcessReceives()
+{
+	while (!m_deqReceives.empty())
+	{
+		EPipeError eError = EPipeError::None;
+		CFrameAssembler::EResult eResult = DeliverFrame(eError);
+		if (eError != EPipeError::None)
+		{
+			DropConnection(eError);
+			return;
+		}
+		if (eResult == CFrameAssembler::EResult::Frame)
+			continue;
+		if (eResult == CFrameAssembler::EResult::Invalid || eResult == CFrameAssembler::EResult::Corrupted)
+		{
+			DropConnection(eResult == CFrameAssembler::EResult::Invalid ? EPipeError::InvalidFrame : EPipeError::ChecksumMismatch);
+			return;
+		}
+
+		// One read at a time, it lands in the assembler
+		if (m_bConnected && !m_bReadPending)
+			IssueRead();
+		return;
+	}
+}
+
+void CAsyncPipe::ProcessSends()
+{
+	if (m_bWritePending || !m_bConnected || m_deqSends.empty())
+		return;
+
+	SSendOp& oOp = m_deqSends.front();
+	const void* pBuffer = nullptr;
+	size_t nChunk = 0;
+	m_nWriteFrames = 1;
+	if (oOp.nOffset == 0 && c_nFrameHeaderSize + oOp.nSize <= c_nCoalesceLimit)
+	{
+		// Pipes have no gather write, so the small frames are copied to go by a single WriteFile
+		m_vecSendBuffer.clear();
+		m_nWriteFrames = 0;
+		for (const SSendOp& oNext : m_deqSends)
+		{
+			if (m_nWriteFrames > 0 && m_vecSendBuffer.size() + c_nFrameHeaderSize + oNext.nSize > c_nCoalesceLimit)
+				break;
+			m_vecSendBuffer.insert(m_vecSendBuffer.end(), oNext.arrHeader, oNext.arrHeader + c_nFrameHeaderSize);
+			m_vecSendBuffer.insert(m_vecSendBuffer.end(), oNext.pData, oNext.pData + oNext.nSize);
+			++m_nWriteFrames;
+		}
+		pBuffer = m_vecSendBuffer.data();
+		nChunk = m_vecSendBuffer.size();
+	}
+	else if (oOp.nOffset < c_nFrameHeaderSize)
+	{
+		pBuffer = oOp.arrHeader + oOp.nOffset;
+		nChunk = c_nFrameHeaderSize - oOp.nOffset;
+	}
+	else
+	{
+		const size_t nPayloadOffset = oOp.nOffset - c_nFrameHeaderSize;
+		pBuffer = oOp.pData + nPayloadOffset;
+		nChunk = (std::min)(oOp.nSize - nPayloadOffset, size_t(MAXDWORD));
+	}
+
+	memset(&m_oWriteOverlapped, 0, sizeof(m_oWriteOverlapped));
+	if (!WriteFile(m_hPipe, pBuffer, DWORD(nChunk), NULL, &m_oWriteOverlapped) && GetLastError() != ERROR_IO_PENDING)
+	{
+		DropConnection(EPipeError::Disconnected);
+		return;
+	}
+	m_bWritePending = true;
+}
+
+void CAsyncPipe::IssueConnect()
+{
+	memset(&m_oConnectOverlapped, 0, sizeof(m_oConnectOverlapped));
+	BOOL bResult = ConnectNamedPipe(m_hPipe, &m_oConnectOverlapped);
+	DWORD nError = bResult ? 0 : GetLastError();
+	if (nError == ERROR_IO_PENDING)
+	{
+		m_bConnectPending = true;
+		return;
+	}
+	// The writer may be already connected, then no completion is queued
+	if (bResult || nError == ERROR_PIPE_CONNECTED)
+	{
+		BeginConnection();
+		return;
+	}
+
+	// The endpoint is broken
+	CloseHandles();
+	m_bOpen = false;
+	FailReceives(EPipeError::IoFailure);
+}
+
+void CAsyncPipe::IssueRead()
+{
+	memset(&m_oReadOverlapped, 0, sizeof(m_oReadOverlapped));
+	byte* pBuffer = m_oAssembler.GetWriteBuffer(c_nReadChunk);
+	if (!ReadFile(m_hPipe, pBuffer, DWORD(c_nReadChunk), NULL, &m_oReadOverlapped) && GetLastError() != ERROR_IO_PENDING)
+	{
+		DropConnection(EPipeError::Disconnected);
+		return;
+	}
+	m_bReadPending = true;
+}
+
+void CAsyncPipe::AbortIo()
+{
+	// The completions are still queued to the port, they are counted to be skipped
+	DWORD nBytes = 0;
+	if (m_bConnectPending)
+	{
+		CancelIoEx(m_hPipe, &m_oConnectOverlapped);
+		GetOverlappedResult(m_hPipe, &m_oConnectOverlapped, &nBytes, TRUE);
+		m_bConnectPending = false;
+		++m_nStaleConnects;
+	}
+	if (m_bReadPending)
+	{
+		CancelIoEx(m_hPipe, &m_oReadOverlapped);
+		GetOverlappedResult(m_hPipe, &m_oReadOverlapped, &nBytes, TRUE);
+		m_bReadPending = false;
+		++m_nStaleReads;
+	}
+	if (m_bWritePending)
+	{
+		CancelIoEx(m_hPipe, &m_oWriteOverlapped);
+		GetOverlappedResult(m_hPipe, &m_oWriteOverlapped, &nBytes, TRUE);
+		m_bWritePending = false;
+		++m_nStaleWrites;
+	}
+}
+
+#else
+
+void CAsyncPipe::OnReady(int nFd, uint32_t /*nEvents*/)
+{
+	// Edge-triggered, so every ready descriptor is drained as far as the pending operations need
+	if (nFd == m_nListener)
+		AcceptWriter();
+	else if (nFd == m_nSocket)
+	{
+		ProcessReceives();
+		ProcessSends();
+	}
+}
+
+void CAsyncPipe::ProcessReceives()
+{
+	while (!m_deqReceives.empty())
+	{
+		EPipeError eError = EPipeError::None;
+		CFrameAssembler::EResult eResult = DeliverFrame(eError);
+		if (eError != EPipeError::None)
+		{
+			DropConnection(eError);
+			return;
+		}
+		if (eResult == CFrameAssembler::EResult::Frame)
+			continue;
+		if (eResult == CFrameAssembler::EResult::Invalid || eResult == CFrameAssembler::EResult::Corrupted)
+		{
+			DropConnection(eResult == CFrameAssembler::EResult::Invalid ? EPipeError::InvalidFrame : EPipeError::ChecksumMismatch);
+			return;
+		}
+		if (m_nSocket < 0)
+			return;
+
+		byte* pBuffer = m_oAssembler.GetWriteBuffer(c_nReadChunk);
+		ssize_t nRead = read(m_nSocket, pBuffer, c_nReadChunk);
+		if (nRead > 0)
+		{
+			m_oAssembler.CommitWrite(size_t(nRead));
+			continue;
+		}
+		if (nRead < 0 && errno == EINTR)
+			continue;
+		if (nRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+
+		// End of stream or error
+		DropConnection(EPipeError::Disconnected);
+		return;
+	}
+}
+
+void CAsyncPipe::ProcessSends()
+{
+	while (!m_deqSends.empty() && m_nSocket >= 0)
+	{
+		// All the queued frames go by one call as far as the socket takes them
+		iovec arrVectors[c_nMaxGather];
+		int nVectors = 0;
+		for (auto itOp = m_deqSends.begin(); itOp != m_deqSends.end() && nVectors + 2 <= c_nMaxGather; ++itOp)
+		{
+			if (itOp->nOffset < c_nFrameHeaderSize)
+			{
+				arrVectors[nVectors].iov_base = itOp->arrHeader + itOp->nOffset;
+				arrVectors[nVectors].iov_len = c_nFrameHeaderSize - itOp->nOffset;
+				++nVectors;
+			}
+			const size_t nPayloadOffset = itOp->nOffset > c_nFrameHeaderSize ? itOp->nOffset - c_nFrameHeaderSize : 0;
+			if (nPayloadOffset < itOp->nSize)
+			{
+				arrVectors[nVectors].iov_base = const_cast<byte*>(itOp->pData + nPayloadOffset);
+				arrVectors[nVectors].iov_len = itOp->nSize - nPayloadOffset;
+				++nVectors;
+			}
+		}
+
+		msghdr oMessage = {};
+		oMessage.msg_iov = arrVectors;
+		oMessage.msg_iovlen = size_t(nVectors);
+		ssize_t nSent = sendmsg(m_nSocket, &oMessage, MSG_NOSIGNAL);
+		if (nSent >= 0 && m_pMetrics != nullptr)
+		{
+			size_t nGathered = 0;
+			for (int i = 0; i < nVectors; ++i)
+				nGathered += arrVectors[i].iov_len;
+			if (size_t(nSent) < nGathered)
+				m_pMetrics->Add(EPipeCounter::PartialWrites);
+		}
+		if (nSent < 0 && errno == EINTR)
+			continue;
+		if (nSent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		if (nSent < 0)
+		{
+			DropConnection(EPipeError::Disconnected);
+			return;
+		}
+		AdvanceSends(size_t(nSent));
+	}
+}
+
+void CAsyncPipe::AcceptWriter()
+{
+	if (m_nSocket >= 0 || m_nListener < 0)
+		return;
+
+	for (;;)
+	{
+		int nSocket = accept4(m_nListener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (nSocket < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			return;
+		}
+
+		m_nSocketId = m_pLoop->Register(nSocket, shared_from_this());
+		if (m_nSocketId == 0)
+		{
+			close(nSocket);
+			continue;
+		}
+		m_nSocket = nSocket;
+		break;
+	}
+
+	BeginConnection();
+}
+
+#endif
@@ -0,0 +1,308 @@
+/*
+Declaration file for the asynchronous pipe
+
+Non-blocking counterpart of CNamedPipe (same frames on the wire, so both may talk to each
+other). All the pipes of one CIoLoop are driven by its thread: overlapped I/O on Win32,
+non-blocking Unix domain sockets on Linux. Completion callbacks run on the loop thread and
+must not block; the futures and the coroutine awaiters are built on top of them.
+The connection is duplex: the writer may receive and the reader may send to the connected writer.
+*/
+
+
+//! Include guard
+#pragma once
+
+
+//! Includes
+#include "buffer_pool.h"
+#include "frame_cipher.h"
+#include "io_loop.h"
+#include "named_pipe.h"
+#include "pipe_frame.h"
+#include "pipe_metrics.h"
+#include <deque>
+#include <future>
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#define ASYNC_PIPE_COROUTINES
+#endif
+#endif
+
+
+//! Type declarations
+class CAsyncPipe;
+typedef std::shared_ptr<CAsyncPipe> CAsyncPipePtr;
+
+
+//! Class CAsyncPipe
+// The reader accepts the writers one by one, like CNamedPipe in the session mode
+class CAsyncPipe : public CIoLoop::IHandler, public std::enable_shared_from_this<CAsyncPipe>
+{
+public: //! Types
+	typedef CNamedPipe::EPipeError EPipeError;
+
+	struct SReceiveResult
+	{
+		EPipeError		eError = EPipeError::None;
+		SFrameHeader	oHeader;
+		CPooledBuffer	oPayload;
+		uint64_t		nConnectionId = 0;	// Connection the frame came by
+	};
+
+	typedef std::function<void(SReceiveResult&& oResult)> TReceiveCallback;
+	typedef std::function<void(EPipeError eError)> TSendCallback;
+
+#ifdef ASYNC_PIPE_COROUTINES
+	class CReceiveAwaiter;
+	class CSendAwaiter;
+#endif
+
+public: //! Constructors and destructor
+	static CAsyncPipePtr Create(CIoLoopPtr pLoop, const std::string& sName, EPipeMode eMode);
+	~CAsyncPipe();
+
+public: //! Interface
+	// Reader creates the endpoint, writer connects to the endpoint (the loop must be running)
+	bool Open();
+	// Closes the pipe, the pending operations complete with EPipeError::Cancelled
+	void Close();
+	// Returns true if the pipe is opened
+	bool IsOpen() const;
+	// Sets the maximum accepted payload size (applies to the next Open)
+	void SetMaxMessageSize(uint32_t nMaxSize);
+	// Seals the frames by the shared key like CNamedPipe::SetEncryption (applies to the next Open).
+	// The reader sends to the writer once it has got the writer's session
+	bool SetEncryption(const void* pKey, size_t nKeySize);
+	// Metrics like CNamedPipe::EnableMetrics, the send latency runs from the call until the frame is written.
+	// Fails while open
+	bool EnableMetrics(bool bEnable);
+	// Returns the metrics recorded since they were enabled (any thread), false if they are disabled
+	bool GetMetrics(SPipeMetrics& oMetrics) const;
+
+	// Receives the next frame, zero timeout waits forever. A timed out or cancelled receive
+	// doesn't lose any data, the next one continues the stream
+	void ReceiveAsync(TReceiveCallback fnCallback, uint32_t nTimeoutMs = 0);
+	std::future<SReceiveResult> ReceiveAsync(uint32_t nTimeoutMs = 0);
+	// Sends one data frame, the buffer must stay valid until the operation completes.
+	// A frame cut by the timeout or cancellation breaks the stream, so the writer is closed then
+	void SendAsync(const void* pData, size_t nSize, TSendCallback fnCallback, uint32_t nTimeoutMs = 0);
+	std::future<EPipeError> SendAsync(const void* pData, size_t nSize, uint32_t nTimeoutMs = 0);
+	// Sends one frame of the given type. Non-zero connection id sends only over that connection,
+	// the frame fails with EPipeError::Disconnected once it's gone (reader replies to the writer)
+	void SendFrameAsync(uint16_t nType, const void* pData, size_t nSize, TSendCallback fnCallback, uint32_t nTimeoutMs = 0,
+		uint64_t nConnectionId = 0);
+	// Cancels all the pending operations
+	void Cancel();
+
+#ifdef ASYNC_PIPE_COROUTINES
+	// co_await pPipe->CoReceive() and co_await pPipe->CoSend(...), resumed on the loop thread
+	CReceiveAwaiter CoReceive(uint32_t nTimeoutMs = 0);
+	CSendAwaiter CoSend(const void* pData, size_t nSize, uint32_t nTimeoutMs = 0);
+#endif
+
+protected: //! CIoLoop::IHandler
+#ifdef _WIN32
+	void OnComplete(OVERLAPPED* pOverlapped, DWORD nBytes, DWORD nError) override;
+#else
+	void OnReady(int nFd, uint32_t nEvents) override;
+#endif
+	void OnStop() override;
+
+private: //! Types
+	struct SReceiveOp
+	{
+		uint64_t			nId = 0;
+		uint64_t			nTimerId = 0;
+		TReceiveCallback	fnCallback;
+	};
+
+	struct SSendOp
+	{
+		uint64_t			nId = 0;
+		uint64_t			nTimerId = 0;
+		TSendCallback		fnCallback;
+		byte				arrHeader[c_nFrameHeaderSize];
+		const byte*			pData = nullptr;
+		size_t				nSize = 0;
+		CPooledBuffer		oOwned;						// Payload of the frame made by the pipe (sealed, session)
+		size_t				nOffset = 0;				// Bytes of the header and the payload sent
+		EPipeError			eAbort = EPipeError::None;	// Result if the frame is cut
+		size_t				nMessageSize = 0;			// Caller's payload size (metrics)
+		uint64_t			nStart = 0;					// When the caller sent it, zero for the pipe's own frames (metrics)
+	};
+
+private: //! Implementation
+	CAsyncPipe(CIoLoopPtr pLoop, const std::string& sName, EPipeMode eMode);
+
+	// Loop thread only
+	void Attach();
+	void StartReceive(SReceiveOp& oOp, uint32_t nTimeoutMs);
+	void StartSend(SSendOp& oOp, uint16_t nType, uint32_t nTimeoutMs, uint64_t nConnectionId);
+	// Starts the I/O of the new connection
+	void BeginConnection();
+	// Completes the receives by the assembled frames and reads more while any is pending
+	void ProcessReceives();
+	// Writes the queued frames
+	void ProcessSends();
+	// Completes the first receive by the next assembled frame, eError is set if the writer has to be dropped
+	CFrameAssembler::EResult DeliverFrame(EPipeError& eError);
+	// Writer: queues the session frame ahead of the others
+	void SendSession();
+	// Answers the flow control request of the writer, the asynchronous pipe doesn't limit it
+	void SendCredit();
+	// Accounts the written bytes to the queued frames and completes the whole ones
+	void AdvanceSends(size_t nSent);
+	void FailReceives(EPipeError eError);
+	void FailSends(EPipeError eError);
+	void OnTimeout(uint64_t nOpId, bool bSend);
+	void CancelAll();
+	// Returns true if the queued frame is partially written or its write is in flight
+	bool IsSendStarted(size_t nIndex) const;
+	// Reader: drops the writer and waits for the next one, writer: closes the pipe
+	void DropConnection(EPipeError eError);
+	// Adds the frame to the queue gauges (nSign 1) or removes it (-1) if the metrics are enabled
+	void CountQueued(const SSendOp& oOp, int64_t nSign);
+	// Counts the failure and its reason if the metrics are enabled
+	void CountFailure(EPipeError eError);
+	// Releases all the system resources
+	void CloseHandles();
+#ifdef _WIN32
+	void IssueConnect();
+	void IssueRead();
+	// Cancels the pending I/O and waits until the system releases the buffers
+	void AbortIo();
+#else
+	void AcceptWriter();
+#endif
+
+private: //! Members
+	CIoLoopPtr					m_pLoop;
+	std::string					m_sName;
+	EPipeMode					m_eMode;
+	uint32_t					m_nMaxMessageSize;
+	std::atomic<bool>			m_bOpen;
+	CBufferPoolPtr				m_pBufferPool;		// Payloads of the received frames
+	// Loop thread state
+	CFrameAssembler				m_oAssembler;
+	std::deque<SReceiveOp>		m_deqReceives;
+	std::deque<SSendOp>			m_deqSends;
+	uint64_t					m_nNextOpId;
+	bool						m_bConnected;		// Writer is connected to the reader
+	uint64_t					m_nConnectionId;	// Counts the connections
+	CFrameCipher				m_oCipher;			// Seals and opens the frames when the key is set
+	CPipeMetricsPtr				m_pMetrics;			// Null unless enabled
+	byte						m_arrCredit[c_nCreditFrameSize];
+#ifdef _WIN32
+	HANDLE						m_hPipe;
+	uint64_t					m_nRegistrationId;
+	OVERLAPPED					m_oConnectOverlapped;
+	OVERLAPPED					m_oReadOverlapped;
+	OVERLAPPED					m_oWriteOverlapped;
+	bool						m_bConnectPending;
+	bool						m_bReadPending;
+	bool						m_bWritePending;
+	size_t						m_nWriteFrames;		// Queued frames covered by the pending write
+	size_t						m_nStaleConnects;	// Completions of the aborted operations still queued
+	size_t						m_nStaleReads;
+	size_t						m_nStaleWrites;
+	std::vector<byte>			m_vecSendBuffer;	// Small frames are staged to go by a single write
+#else
+	int							m_nListener;		// Reader's listening socket
+	int							m_nSocket;			// Connection
+	uint64_t					m_nListenerId;
+	uint64_t					m_nSocketId;
+#endif
+};
+
+
+#ifdef ASYNC_PIPE_COROUTINES
+
+//! Class CAsyncPipe::CReceiveAwaiter
+class CAsyncPipe::CReceiveAwaiter
+{
+public:
+	CReceiveAwaiter(CAsyncPipePtr pPipe, uint32_t nTimeoutMs)
+		: m_pPipe(pPipe),
+		  m_nTimeoutMs(nTimeoutMs)
+	{
+	}
+
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> hCoroutine)
+	{
+		m_pPipe->ReceiveAsync([this, hCoroutine](SReceiveResult&& oResult)
+		{
+			m_oResult = std::move(oResult);
+			hCoroutine.resume();
+		}, m_nTimeoutMs);
+	}
+
+	SReceiveResult await_resume()
+	{
+		return std::move(m_oResult);
+	}
+
+private:
+	CAsyncPipePtr	m_pPipe;
+	uint32_t		m_nTimeoutMs;
+	SReceiveResult	m_oResult;
+};
+
+
+//! Class CAsyncPipe::CSendAwaiter
+class CAsyncPipe::CSendAwaiter
+{
+public:
+	CSendAwaiter(CAsyncPipePtr pPipe, const void* pData, size_t nSize, uint32_t nTimeoutMs)
+		: m_pPipe(pPipe),
+		  m_pData(pData),
+		  m_nSize(nSize),
+		  m_nTimeoutMs(nTimeoutMs),
+		  m_eResult(EPipeError::None)
+	{
+	}
+
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> hCoroutine)
+	{
+		m_pPipe->SendAsync(m_pData, m_nSize, [this, hCoroutine](EPipeError eError)
+		{
+			m_eResult = eError;
+			hCoroutine.resume();
+		}, m_nTimeoutMs);
+	}
+
+	EPipeError await_resume() const
+	{
+		return m_eResult;
+	}
+
+private:
+	CAsyncPipePtr	m_pPipe;
+	const void*		m_pData;
+	size_t			m_nSize;
+	uint32_t		m_nTimeoutMs;
+	EPipeError		m_eResult;
+};
+
+
+inline CAsyncPipe::CReceiveAwaiter CAsyncPipe::CoReceive(uint32_t nTimeoutMs)
+{
+	return CReceiveAwaiter(shared_from_this(), nTimeoutMs);
+}
+
+inline CAsyncPipe::CSendAwaiter CAsyncPipe::CoSend(const void* pData, size_t nSize, uint32_t nTimeoutMs)
+{
+	return CSendAwaiter(shared_from_this(), pData, nSize, nTimeoutMs);
+}
+
+#endif
@@ -0,0 +1,865 @@
+/*
+Implementation file for the broadcast pipe
+*/
+
+
+//! Includes
+#include "broadcast_pipe.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <new>
+#ifndef _WIN32
+#include <cerrno>
+#include <climits>
+#include <ctime>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+
+//! Segment constants
+static const uint32_t	c_nBroadcastMagic = 0x5342434C;		// "LCBS"
+static const uint32_t	c_nBroadcastVersion = 1;
+static const size_t		c_nCacheLineSize = 64;
+static const size_t		c_nRecordAlignment = 16;			// Records start at this alignment, a padding record always fits
+static const size_t		c_nSyncPoints = 16;					// Ring parts remembering their first record
+static const uint32_t	c_nLivenessCheckMs = 100;			// Sleepers check the other side at this interval
+static const uint64_t	c_nNoCursor = UINT64_MAX;			// Slot cursor while the subscriber joins or leaves
+
+
+//! Signals the sides sleep on
+enum ESignal
+{
+	SignalData,			// Subscribers wait for the next message
+	SignalSpace,		// Blocking publisher waits for the slowest subscriber
+	SignalCount
+};
+
+
+//! Record types
+enum ERecordType : uint32_t
+{
+	RecordData = 1,
+	RecordPadding = 2	// Fills the end of the ring, the next record starts at its beginning
+};
+
+
+namespace
+{
+	//! Sleeper registration, lives in its own cache line
+	struct alignas(c_nCacheLineSize) SSignalWord
+	{
+		std::atomic<uint32_t>	nSequence;		// Futex word, bumped on every wake
+		std::atomic<uint32_t>	nWaiting;		// Number of the sleepers
+	};
+
+	//! Subscriber registration, written by its subscriber only
+	struct alignas(c_nCacheLineSize) SSlot
+	{
+		std::atomic<uint32_t>	nProcessId;		// Owner, zero if free
+		std::atomic<uint32_t>	nSleeping;		// Non-zero while the subscriber sleeps (Win32 wakes it by its event)
+		std::atomic<uint64_t>	nCursor;		// Start of the next record it reads
+		std::atomic<uint64_t>	nLost;			// Messages lost by the overruns
+	};
+}
+
+
+//! Record header, the payload follows it
+struct CBroadcastPipe::SRecordHeader
+{
+	uint32_t	nLength;		// Payload bytes
+	uint32_t	nType;			// ERecordType
+	uint64_t	nSequence;		// Message number from one, zero in the padding
+};
+
+
+//! Segment header, the ring data follows it
+struct CBroadcastPipe::SSegment
+{
+	alignas(c_nCacheLineSize) std::atomic<uint32_t>	nMagic;			// Set last, when the segment is ready
+	uint32_t										nVersion;
+	uint64_t										nCapacity;		// Bytes of the ring
+	std::atomic<uint32_t>							nPublisherPid;
+	std::atomic<uint32_t>							nClosed;		// Publisher has closed
+	std::atomic<uint32_t>							nBlocking;		// Publisher waits for the subscribers, they wake it
+
+	// Seqlock positions: the publisher moves the intent before it overwrites any byte and the tail after
+	// the whole message, a subscriber's copy is good if the intent hasn't passed its record by a ring
+	alignas(c_nCacheLineSize) std::atomic<uint64_t>	nTailIntent;	// End of the message being written
+	std::atomic<uint64_t>							nTail;			// End of the last whole message
+	std::atomic<uint64_t>							nLatest;		// Start of the last whole message
+	std::atomic<uint64_t>							arrSyncPoints[c_nSyncPoints];	// Start of the first record in each part
+
+	SSignalWord										arrSignals[SignalCount];
+	SSlot											arrSlots[CBroadcastPipe::c_nMaxSubscribers];
+};
+
+
+//! Helpers
+static size_t RoundUpToPowerOfTwo(size_t nValue)
+{
+	size_t nResult = 4096;
+	while (nResult < nValue)
+		nResult <<= 1;
+
+	return nResult;
+}
+
+static size_t AlignRecord(size_t nSize)
+{
+	return (nSize + c_nRecordAlignment - 1) & ~(c_nRecordAlignment - 1);
+}
+
+static uint32_t GetProcessId()
+{
+#ifdef _WIN32
+	return uint32_t(GetCurrentProcessId());
+#else
+	return uint32_t(getpid());
+#endif
+}
+
+static bool IsProcessAlive(uint32_t nPid)
+{
+	if (nPid == 0)
+		return true;
+#ifdef _WIN32
+	HANDLE hProcess = OpenProcess(SYNCHRONIZE, FALSE, DWORD(nPid));
+	if (hProcess == NULL)
+		return (GetLastError() == ERROR_ACCESS_DENIED);
+	bool bAlive = (WaitForSingleObject(hProcess, 0) == WAIT_TIMEOUT);
+	CloseHandle(hProcess);
+	return bAlive;
+#else
+	return (kill(pid_t(nPid), 0) == 0 || errno == EPERM);
+#endif
+}
+
+static std::string GetSegmentName(const std::string& sName)
+{
+#ifdef _WIN32
+	return "Local\\libx-bcast-" + sName;
+#else
+	return "/libx-bcast-" + sName;
+#endif
+}
+
+
+CBroadcastPipe::CBroadcastPipe(const std::string& sName, EPipeMode eMode, size_t nCapacity)
+	: m_sName(sName),
+	  m_eMode(eMode),
+	  m_nCapacity(RoundUpToPowerOfTwo(nCapacity)),
+	  m_pSegment(nullptr),
+	  m_nSegmentSize(0),
+	  m_pData(nullptr),
+	  m_eLastError(EPipeError::None),
+	  m_eOverrunPolicy(EOverrunPolicy::Overwrite),
+	  m_nBlockTimeoutMs(1000),
+	  m_eCatchUpPolicy(ECatchUpPolicy::Oldest),
+	  m_nSlowThreshold(0),
+	  m_nTail(0),
+	  m_nSequence(1),
+	  m_nSlowestCursor(0),
+	  m_nSlot(c_nMaxSubscribers),
+	  m_nCursor(0),
+	  m_nNextSequence(0),
+	  m_nLost(0)
+#ifdef _WIN32
+	  , m_hMapping(NULL),
+	  m_hSpaceEvent(NULL)
+#endif
+{
+#ifdef _WIN32
+	for (uint32_t i = 0; i < c_nMaxSubscribers; ++i)
+		m_arrDataEvents[i] = NULL;
+#endif
+}
+
+CBroadcastPipe::~CBroadcastPipe()
+{
+	if (IsOpen())
+		Close();
+}
+
+bool CBroadcastPipe::IsOpen() const
+{
+	return (m_pSegment != nullptr);
+}
+
+bool CBroadcastPipe::Open()
+{
+	if (IsOpen() || m_sName.empty())
+		return Fail(EPipeError::InvalidMode);
+
+	if (m_eMode == EPipeMode::Write)
+		return CreateSegment() || Fail(EPipeError::IoFailure);
+
+	if (!AttachSegment())
+		return Fail(EPipeError::IoFailure);
+	if (!IsPublisherAlive() || !ClaimSlot())
+	{
+		ReleaseSegment();
+		return Fail(EPipeError::Disconnected);
+	}
+
+	return true;
+}
+
+bool CBroadcastPipe::Close()
+{
+	if (!IsOpen())
+		return false;
+
+	if (m_eMode == EPipeMode::Write)
+	{
+		m_pSegment->nClosed.store(1);
+		Notify(SignalData);
+	}
+	else
+		ReleaseSlot();
+	ReleaseSegment();
+
+	return true;
+}
+
+bool CBroadcastPipe::SendData(const std::vector<byte>& vecData)
+{
+	return SendData(vecData.data(), vecData.size());
+}
+
+bool CBroadcastPipe::SendData(const void* pData, size_t nSize)
+{
+	if (!IsOpen())
+		return Fail(EPipeError::NotOpen);
+	if (m_eMode != EPipeMode::Write)
+		return Fail(EPipeError::InvalidMode);
+	if (nSize > GetMaxMessageSize())
+		return Fail(EPipeError::FrameTooLarge);
+	const uint64_t nStart = (m_pMetrics != nullptr) ? CPipeMetrics::Now() : 0;
+
+	const uint64_t nMask = m_nCapacity - 1;
+	const size_t nRecordSize = AlignRecord(sizeof(SRecordHeader) + nSize);
+	const size_t nToEnd = m_nCapacity - size_t(m_nTail & nMask);
+	const size_t nPadding = (nToEnd < nRecordSize) ? nToEnd : 0;
+	const uint64_t nEnd = m_nTail + nPadding + nRecordSize;
+	if (m_eOverrunPolicy == EOverrunPolicy::Block)
+		WaitForSpace(nEnd);
+
+	// The intent is visible before any overwritten byte (pairs with the subscriber's fence before its check)
+	m_pSegment->nTailIntent.store(nEnd, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	uint64_t nPosition = m_nTail;
+	if (nPadding != 0)
+	{
+		const SRecordHeader oPadding = { uint32_t(nPadding - sizeof(SRecordHeader)), RecordPadding, 0 };
+		memcpy(m_pData + size_t(nPosition & nMask), &oPadding, sizeof(oPadding));
+		nPosition += nPadding;
+	}
+	const SRecordHeader oHeader = { uint32_t(nSize), RecordData, m_nSequence++ };
+	byte* pRecord = m_pData + size_t(nPosition & nMask);
+	memcpy(pRecord, &oHeader, sizeof(oHeader));
+	if (nSize != 0)
+		memcpy(pRecord + sizeof(oHeader), pData, nSize);
+
+	// The first record starting in a part of the ring is where an overrun subscriber may resume
+	const uint64_t nPartSize = m_nCapacity / c_nSyncPoints;
+	if (nPosition / nPartSize != m_pSegment->nLatest.load(std::memory_order_relaxed) / nPartSize)
+		m_pSegment->arrSyncPoints[(nPosition / nPartSize) % c_nSyncPoints].store(nPosition, std::memory_order_relaxed);
+	m_pSegment->nLatest.store(nPosition, std::memory_order_relaxed);
+	m_nTail = nEnd;
+	m_pSegment->nTail.store(m_nTail, std::memory_order_release);
+	Notify(SignalData);
+
+	if (m_pMetrics != nullptr)
+	{
+		m_pMetrics->Add(EPipeCounter::MessagesSent);
+		m_pMetrics->Add(EPipeCounter::BytesSent, nSize);
+		m_pMetrics->Record(EPipeLatency::Send, nStart);
+	}
+	return true;
+}
+
+bool CBroadcastPipe::ReceiveData(std::vector<byte>& vecData, uint32_t nTimeoutMs)
+{
+	if (!IsOpen())
+		return Fail(EPipeError::NotOpen);
+	if (m_eMode != EPipeMode::Read)
+		return Fail(EPipeError::InvalidMode);
+
+	const uint64_t nMask = m_nCapacity - 1;
+	for (;;)
+	{
+		uint64_t nTail = m_pSegment->nTail.load(std::memory_order_acquire);
+		if (nTail == m_nCursor)
+		{
+			m_oWaiter.Prepare();
+			bool bReady = WaitFor(SignalData, nTimeoutMs, [&]()
+			{
+				nTail = m_pSegment->nTail.load(std::memory_order_acquire);
+				return (nTail != m_nCursor);
+			}, [this]() { return IsPublisherAlive(); });
+			if (!bReady)
+				return Fail(IsPublisherAlive() ? EPipeError::TimedOut : EPipeError::Disconnected);
+		}
+
+		// Copy the record, then check the publisher hasn't started overwriting it meanwhile
+		SRecordHeader oHeader;
+		const size_t nOffset = size_t(m_nCursor & nMask);
+		memcpy(&oHeader, m_pData + nOffset, sizeof(oHeader));
+		const bool bValid = (oHeader.nType == RecordData || oHeader.nType == RecordPadding) &&
+			(oHeader.nLength <= m_nCapacity - nOffset - sizeof(oHeader));
+		if (bValid && oHeader.nType == RecordData)
+		{
+			vecData.resize(oHeader.nLength);
+			if (oHeader.nLength != 0)
+				memcpy(vecData.data(), m_pData + nOffset + sizeof(oHeader), oHeader.nLength);
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (!bValid || m_pSegment->nTailIntent.load(std::memory_order_relaxed) - m_nCursor > m_nCapacity)
+		{
+			CatchUp();
+			if (m_eCatchUpPolicy == ECatchUpPolicy::Fail)
+				return Fail(EPipeError::Overrun);
+			continue;
+		}
+
+		m_nCursor += AlignRecord(sizeof(oHeader) + oHeader.nLength);
+		if (oHeader.nType == RecordPadding)
+			continue;
+
+		// A gap in the numbers is what the overruns took
+		SSlot& oSlot = m_pSegment->arrSlots[m_nSlot];
+		if (m_nNextSequence != 0 && oHeader.nSequence != m_nNextSequence)
+		{
+			const uint64_t nLost = oHeader.nSequence - m_nNextSequence;
+			m_nLost.fetch_add(nLost, std::memory_order_relaxed);
+			oSlot.nLost.store(m_nLost.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			if (m_pMetrics != nullptr)
+				m_pMetrics->Add(EPipeCounter::FramesDropped, nLost);
+		}
+		m_nNextSequence = oHeader.nSequence + 1;
+		oSlot.nCursor.store(m_nCursor, std::memory_order_release);
+		if (m_pSegment->nBlocking.load(std::memory_order_relaxed) != 0)
+			Notify(SignalSpace);
+
+		if (m_pMetrics != nullptr)
+		{
+			m_pMetrics->Add(EPipeCounter::MessagesReceived);
+			m_pMetrics->Add(EPipeCounter::BytesReceived, oHeader.nLength);
+		}
+		return true;
+	}
+}
+
+void CBroadcastPipe::SetOverrunPolicy(EOverrunPolicy ePolicy, uint32_t nBlockTimeoutMs)
+{
+	m_eOverrunPolicy = ePolicy;
+	m_nBlockTimeoutMs = nBlockTimeoutMs;
+	if (IsOpen() && m_eMode == EPipeMode::Write)
+		m_pSegment->nBlocking.store((ePolicy == EOverrunPolicy::Block) ? 1 : 0);
+}
+
+void CBroadcastPipe::SetCatchUpPolicy(ECatchUpPolicy ePolicy)
+{
+	m_eCatchUpPolicy = ePolicy;
+}
+
+void CBroadcastPipe::SetSlowThreshold(size_t nBytes)
+{
+	m_nSlowThreshold = nBytes;
+}
+
+void CBroadcastPipe::SetWaitStrategy(const SWaitStrategy& oStrategy)
+{
+	m_oWaiter.SetStrategy(oStrategy);
+}
+
+bool CBroadcastPipe::GetSubscribers(std::vector<SSubscriberInfo>& vecSubscribers) const
+{
+	vecSubscribers.clear();
+	if (!IsOpen() || m_eMode != EPipeMode::Write)
+		return false;
+
+	const uint64_t nTail = m_pSegment->nTail.load(std::memory_order_acquire);
+	const uint64_t nSlowThreshold = (m_nSlowThreshold != 0) ? m_nSlowThreshold : m_nCapacity / 2;
+	for (uint32_t i = 0; i < c_nMaxSubscribers; ++i)
+	{
+		const SSlot& oSlot = m_pSegment->arrSlots[i];
+		SSubscriberInfo oInfo;
+		oInfo.nProcessId = oSlot.nProcessId.load(std::memory_order_acquire);
+		const uint64_t nCursor = oSlot.nCursor.load(std::memory_order_acquire);
+		if (oInfo.nProcessId == 0 || nCursor == c_nNoCursor)
+			continue;
+		oInfo.nSlot = i;
+		oInfo.nLag = (nTail > nCursor) ? nTail - nCursor : 0;
+		oInfo.nLost = oSlot.nLost.load(std::memory_order_relaxed);
+		oInfo.bSlow = (oInfo.nLag > nSlowThreshold);
+		vecSubscribers.push_back(oInfo);
+	}
+
+	return true;
+}
+
+uint64_t CBroadcastPipe::GetLag() const
+{
+	if (!IsOpen() || m_eMode != EPipeMode::Read)
+		return 0;
+
+	const uint64_t nTail = m_pSegment->nTail.load(std::memory_order_acquire);
+	const uint64_t nCursor = m_pSegment->arrSlots[m_nSlot].nCursor.load(std::memory_order_acquire);
+	return (nTail > nCursor) ? nTail - nCursor : 0;
+}
+
+uint64_t CBroadcastPipe::GetLostCount() const
+{
+	return m_nLost.load(std::memory_order_relaxed);
+}
+
+size_t CBroadcastPipe::GetMaxMessageSize() const
+{
+	return m_nCapacity / 4 - sizeof(SRecordHeader);
+}
+
+bool CBroadcastPipe::EnableMetrics(bool bEnable)
+{
+	if (IsOpen())
+		return Fail(EPipeError::InvalidMode);
+
+	m_pMetrics = bEnable ? CPipeMetrics::Create() : nullptr;
+	return true;
+}
+
+bool CBroadcastPipe::GetMetrics(SPipeMetrics& oMetrics) const
+{
+	CPipeMetricsPtr pMetrics = m_pMetrics;
+	if (pMetrics == nullptr)
+		return false;
+
+	oMetrics = pMetrics->Snapshot();
+	std::vector<SSubscriberInfo> vecSubscribers;
+	if (GetSubscribers(vecSubscribers))
+		oMetrics.arrGauges[size_t(EPipeGauge::ActiveConnections)] = int64_t(vecSubscribers.size());
+	return true;
+}
+
+CBroadcastPipe::EPipeError CBroadcastPipe::GetLastPipeError() const
+{
+	return m_eLastError;
+}
+
+bool CBroadcastPipe::CreateSegment()
+{
+	m_nSegmentSize = GetDataOffset() + m_nCapacity;
+	const std::string sSegment = GetSegmentName(m_sName);
+
+#ifdef _WIN32
+	m_hMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, DWORD(uint64_t(m_nSegmentSize) >> 32), DWORD(m_nSegmentSize), sSegment.c_str());
+	if (m_hMapping == NULL)
+		return false;
+	void* pAddress = MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, m_nSegmentSize);
+	if (pAddress == NULL)
+	{
+		CloseHandle(m_hMapping);
+		m_hMapping = NULL;
+		return false;
+	}
+#else
+	// Replace the segment left by the previous publisher, its subscribers keep the old one until they reopen
+	shm_unlink(sSegment.c_str());
+	// Owner only, the subscribers of other users could read the messages and corrupt the slots
+	int nDescriptor = shm_open(sSegment.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (nDescriptor < 0)
+		return false;
+	void* pAddress = MAP_FAILED;
+	if (ftruncate(nDescriptor, off_t(m_nSegmentSize)) == 0)
+		pAddress = mmap(nullptr, m_nSegmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, nDescriptor, 0);
+	close(nDescriptor);
+	if (pAddress == MAP_FAILED)
+	{
+		shm_unlink(sSegment.c_str());
+		return false;
+	}
+#endif
+
+	m_pSegment = new (pAddress) SSegment();
+	m_pData = static_cast<byte*>(pAddress) + GetDataOffset();
+	m_pSegment->nVersion = c_nBroadcastVersion;
+	m_pSegment->nCapacity = m_nCapacity;
+	m_pSegment->nPublisherPid.store(GetProcessId());
+	m_pSegment->nClosed.store(0);
+	m_pSegment->nBlocking.store((m_eOverrunPolicy == EOverrunPolicy::Block) ? 1 : 0);
+	m_pSegment->nTailIntent.store(0);
+	m_pSegment->nTail.store(0);
+	m_pSegment->nLatest.store(0);
+	for (size_t i = 0; i < c_nSyncPoints; ++i)
+		m_pSegment->arrSyncPoints[i].store(0);
+	for (int i = 0; i < SignalCount; ++i)
+	{
+		m_pSegment->arrSignals[i].nSequence.store(0);
+		m_pSegment->arrSignals[i].nWaiting.store(0);
+	}
+	for (uint32_t i = 0; i < c_nMaxSubscribers; ++i)
+	{
+		m_pSegment->arrSlots[i].nProcessId.store(0);
+		m_pSegment->arrSlots[i].nSleeping.store(0);
+		m_pSegment->arrSlots[i].nCursor.store(c_nNoCursor);
+		m_pSegment->arrSlots[i].nLost.store(0);
+	}
+	m_nTail = 0;
+	m_nSequence = 1;
+	m_nSlowestCursor = 0;
+
+#ifdef _WIN32
+	m_hSpaceEvent = CreateEventA(NULL, FALSE, FALSE, (sSegment + "-space").c_str());
+	for (uint32_t i = 0; i < c_nMaxSubscribers; ++i)
+		m_arrDataEvents[i] = CreateEventA(NULL, FALSE, FALSE, (sSegment + "-" + std::to_string(i)).c_str());
+#endif
+
+	m_pSegment->nMagic.store(c_nBroadcastMagic, std::memory_order_release);
+
+	return true;
+}
+
+bool CBroadcastPipe::AttachSegment()
+{
+	const std::string sSegment = GetSegmentName(m_sName);
+
+#ifdef _WIN32
+	m_hMapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, sSegment.c_str());
+	if (m_hMapping == NULL)
+		return false;
+	// Map the header first to learn the capacity chosen by the publisher
+	SSegment* pHeader = static_cast<SSegment*>(MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(SSegment)));
+	if (pHeader == NULL || pHeader->nMagic.load(std::memory_order_acquire) != c_nBroadcastMagic || pHeader->nVersion != c_nBroadcastVersion)
+	{
+		if (pHeader != NULL)
+			UnmapViewOfFile(pHeader);
+		CloseHandle(m_hMapping);
+		m_hMapping = NULL;
+		return false;
+	}
+	m_nCapacity = size_t(pHeader->nCapacity);
+	UnmapViewOfFile(pHeader);
+
+	m_nSegmentSize = GetDataOffset() + m_nCapacity;
+	void* pAddress = MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, m_nSegmentSize);
+	if (pAddress == NULL)
+	{
+		CloseHandle(m_hMapping);
+		m_hMapping = NULL;
+		return false;
+	}
+	m_hSpaceEvent = CreateEventA(NULL, FALSE, FALSE, (sSegment + "-space").c_str());
+#else
+	int nDescriptor = shm_open(sSegment.c_str(), O_RDWR | O_CLOEXEC, 0);
+	if (nDescriptor < 0)
+		return false;
+	struct stat oStat;
+	void* pAddress = MAP_FAILED;
+	if (fstat(nDescriptor, &oStat) == 0 && size_t(oStat.st_size) > GetDataOffset())
+	{
+		m_nSegmentSize = size_t(oStat.st_size);
+		pAddress = mmap(nullptr, m_nSegmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, nDescriptor, 0);
+	}
+	close(nDescriptor);
+	if (pAddress == MAP_FAILED)
+		return false;
+
+	SSegment* pHeader = static_cast<SSegment*>(pAddress);
+	if (pHeader->nMagic.load(std::memory_order_acquire) != c_nBroadcastMagic || pHeader->nVersion != c_nBroadcastVersion ||
+		m_nSegmentSize != GetDataOffset() + size_t(pHeader->nCapacity))
+	{
+		munmap(pAddress, m_nSegmentSize);
+		return false;
+	}
+	m_nCapacity = size_t(pHeader->nCapacity);
+#endif
+
+	m_pSegment = static_cast<SSegment*>(pAddress);
+	m_pData = static_cast<byte*>(pAddress) + GetDataOffset();
+
+	return true;
+}
+
+void CBroadcastPipe::ReleaseSegment()
+{
+	if (m_pSegment == nullptr)
+		return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(m_pSegment);
+	CloseHandle(m_hMapping);
+	m_hMapping = NULL;
+	if (m_hSpaceEvent != NULL)
+		CloseHandle(m_hSpaceEvent);
+	m_hSpaceEvent = NULL;
+	for (uint32_t i = 0; i < c_nMaxSubscribers; ++i)
+	{
+		if (m_arrDataEvents[i] != NULL)
+			CloseHandle(m_arrDataEvents[i]);
+		m_arrDataEvents[i] = NULL;
+	}
+#else
+	munmap(m_pSegment, m_nSegmentSize);
+	if (m_eMode == EPipeMode::Write)
+		shm_unlink(GetSegmentName(m_sName).c_str());
+#endif
+
+	m_pSegment = nullptr;
+	m_pData = nullptr;
+}
+
+size_t CBroadcastPipe::GetDataOffset()
+{
+	// Ring data starts at the page boundary after the header
+	return (sizeof(SSegment) + 4095) & ~size_t(4095);
+}
+
+bool CBroadcastPipe::ClaimSlot()
+{
+	const uint32_t nPid = GetProcessId();
+	for (uint32_t i = 0; i < c_nMaxSubscribers; ++i)
+	{
+		// Free slot, or the one of a subscriber that died without closing
+		SSlot& oSlot = m_pSegment->arrSlots[i];
+		uint32_t nOwner = oSlot.nProcessId.load();
+		if (nOwner != 0 && (nOwner == nPid || IsProcessAlive(nOwner)))
+			continue;
+		if (!oSlot.nProcessId.compare_exchange_strong(nOwner, nPid))
+			continue;
+
+		m_nSlot = i;
+		m_nCursor = m_pSegment->nTail.load(std::memory_order_acquire);
+		m_nNextSequence = (m_nCursor == 0) ? 1 : 0;
+		// Numbers the messages from the one after the newest, so the losses count from the join
+		const uint64_t nLatest = m_pSegment->nLatest.load(std::memory_order_relaxed);
+		if (nLatest < m_nCursor)
+		{
+			SRecordHeader oHeader;
+			memcpy(&oHeader, m_pData + size_t(nLatest & (m_nCapacity - 1)), sizeof(oHeader));
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (m_pSegment->nTailIntent.load(std::memory_order_relaxed) - nLatest <= m_nCapacity && oHeader.nType == RecordData &&
+				nLatest + AlignRecord(sizeof(oHeader) + oHeader.nLength) == m_nCursor)
+				m_nNextSequence = oHeader.nSequence + 1;
+		}
+		m_nLost.store(0);
+		oSlot.nSleeping.store(0);
+		oSlot.nLost.store(0);
+		oSlot.nCursor.store(m_nCursor, std::memory_order_release);
+#ifdef _WIN32
+		m_arrDataEvents[i] = CreateEventA(NULL, FALSE, FALSE, (GetSegmentName(m_sName) + "-" + std::to_string(i)).c_str());
+#endif
+		return true;
+	}
+
+	return false;
+}
+
+void CBroadcastPipe::ReleaseSlot()
+{
+	SSlot& oSlot = m_pSegment->arrSlots[m_nSlot];
+	oSlot.nCursor.store(c_nNoCursor, std::memory_order_release);
+	oSlot.nProcessId.store(0);
+	m_nSlot = c_nMaxSubscribers;
+	// The publisher may be waiting for this subscriber
+	if (m_pSegment->nBlocking.load(std::memory_order_relaxed) != 0)
+		Notify(SignalSpace);
+}
+
+bool CBroadcastPipe::WaitForSpace(uint64_t nEnd)
+{
+	// The slowest cursor only grows, so the one seen last is enough until the ring wraps over it
+	if (nEnd - m_nSlowestCursor <= m_nCapacity)
+		return true;
+	m_nSlowestCursor = GetSlowestCursor();
+	if (nEnd - m_nSlowestCursor <= m_nCapacity)
+		return true;
+
+	if (m_pMetrics != nullptr)
+		m_pMetrics->Add(EPipeCounter::CreditWaits);
+	// Gives up on the timeout, the slow subscribers are overrun
+	return WaitFor(SignalSpace, m_nBlockTimeoutMs, [&]()
+	{
+		m_nSlowestCursor = GetSlowestCursor();
+		return (nEnd - m_nSlowestCursor <= m_nCapacity);
+	}, [this]()
+	{
+		ReleaseDeadSlots();
+		return true;
+	});
+}
+
+uint64_t CBroadcastPipe::GetSlowestCursor() const
+{
+	// The subscribers the ring has already passed are overrun anyway, waiting for them gains nothing
+	const uint64_t nIntent = m_pSegment->nTailIntent.load(std::memory_order_relaxed);
+	uint64_t nSlowest = m_nTail;
+	for (uint32_t i = 0; i < c_nMaxSubscribers; ++i)
+	{
+		const SSlot& oSlot = m_pSegment->arrSlots[i];
+		if (oSlot.nProcessId.load(std::memory_order_relaxed) == 0)
+			continue;
+		const uint64_t nCursor = oSlot.nCursor.load(std::memory_order_acquire);
+		if (nCursor == c_nNoCursor || nIntent - nCursor > m_nCapacity)
+			continue;
+		nSlowest = (std::min)(nSlowest, nCursor);
+	}
+
+	return nSlowest;
+}
+
+void CBroadcastPipe::CatchUp()
+{
+	m_nCursor = FindResumePosition(m_eCatchUpPolicy == ECatchUpPolicy::Newest);
+	m_pSegment->arrSlots[m_nSlot].nCursor.store(m_nCursor, std::memory_order_release);
+}
+
+uint64_t CBroadcastPipe::FindResumePosition(bool bNewest) const
+{
+	// Any remembered record start within the last ring is a whole record: the latest one,
+	// or the earliest of the parts. The tail (next message) if none is left
+	const uint64_t nTail = m_pSegment->nTail.load(std::memory_order_acquire);
+	const uint64_t nIntent = m_pSegment->nTailIntent.load(std::memory_order_acquire);
+	const uint64_t nFirst = (nIntent > m_nCapacity) ? nIntent - m_nCapacity : 0;
+	const uint64_t nLatest = m_pSegment->nLatest.load(std::memory_order_relaxed);
+	uint64_t nResult = (nLatest >= nFirst && nLatest < nTail) ? nLatest : nTail;
+	if (bNewest)
+		return nResult;
+	for (size_t i = 0; i < c_nSyncPoints; ++i)
+	{
+		const uint64_t nPosition = m_pSegment->arrSyncPoints[i].load(std::memory_order_relaxed);
+		if (nPosition >= nFirst && nPosition < nResult)
+			nResult = nPosition;
+	}
+
+	return nResult;
+}
+
+bool CBroadcastPipe::IsPublisherAlive() const
+{
+	return (m_pSegment->nClosed.load(std::memory_order_relaxed) == 0 && IsProcessAlive(m_pSegment->nPublisherPid.load()));
+}
+
+void CBroadcastPipe::ReleaseDeadSlots()
+{
+	for (uint32_t i = 0; i < c_nMaxSubscribers; ++i)
+	{
+		SSlot& oSlot = m_pSegment->arrSlots[i];
+		uint32_t nOwner = oSlot.nProcessId.load();
+		if (nOwner != 0 && !IsProcessAlive(nOwner) && oSlot.nProcessId.compare_exchange_strong(nOwner, 0))
+			oSlot.nCursor.store(c_nNoCursor, std::memory_order_release);
+	}
+}
+
+template <class TReady, class TAlive>
+bool CBroadcastPipe::WaitFor(int nSignal, uint32_t nTimeoutMs, TReady fnReady, TAlive fnAlive)
+{
+	SSignalWord& oSignal = m_pSegment->arrSignals[nSignal];
+	SSlot* pSlot = (nSignal == SignalData) ? &m_pSegment->arrSlots[m_nSlot] : nullptr;
+	const std::chrono::steady_clock::time_point tpDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(nTimeoutMs);
+	for (;;)
+	{
+		// Polling doesn't register as sleeper, so the publisher makes no wake call
+		if (fnReady() || m_oWaiter.Spin(fnReady, c_nLivenessCheckMs * 1000))
+			return true;
+
+		uint32_t nWaitMs = c_nLivenessCheckMs;
+		if (nTimeoutMs != 0)
+		{
+			const std::chrono::steady_clock::time_point tpNow = std::chrono::steady_clock::now();
+			if (tpNow >= tpDeadline)
+				return fnReady();
+			nWaitMs = (std::min)(nWaitMs, uint32_t(std::chrono::duration_cast<std::chrono::milliseconds>(tpDeadline - tpNow).count()) + 1);
+		}
+		if (!fnAlive())
+			return fnReady();
+		if (m_oWaiter.IsBusyPoll())
+			continue;
+
+		// Register as sleeper, then check again: either we see the progress or the other side sees us
+		uint32_t nSequence = oSignal.nSequence.load(std::memory_order_acquire);
+		oSignal.nWaiting.fetch_add(1);
+		if (pSlot != nullptr)
+			pSlot->nSleeping.store(1);
+		const bool bReady = fnReady();
+		if (!bReady)
+			PlatformWait(nSignal, nSequence, nWaitMs);
+		if (pSlot != nullptr)
+			pSlot->nSleeping.store(0, std::memory_order_relaxed);
+		oSignal.nWaiting.fetch_sub(1, std::memory_order_relaxed);
+		if (bReady)
+			return true;
+	}
+}
+
+void CBroadcastPipe::Notify(int nSignal)
+{
+	// Pairs with the sleeper registration, the fast path is one fence and one load whatever the number of subscribers
+	SSignalWord& oSignal = m_pSegment->arrSignals[nSignal];
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (oSignal.nWaiting.load(std::memory_order_relaxed) == 0)
+		return;
+
+	oSignal.nSequence.fetch_add(1, std::memory_order_release);
+	PlatformWake(nSignal);
+}
+
+void CBroadcastPipe::PlatformWait(int nSignal, uint32_t nSequence, uint32_t nTimeoutMs)
+{
+#ifdef _WIN32
+	(void)nSequence;
+	WaitForSingleObject((nSignal == SignalSpace) ? m_hSpaceEvent : m_arrDataEvents[m_nSlot], nTimeoutMs);
+#elif defined(__linux__)
+	timespec oTimeout = { time_t(nTimeoutMs / 1000), long(nTimeoutMs % 1000) * 1000000 };
+	syscall(SYS_futex, &m_pSegment->arrSignals[nSignal].nSequence, FUTEX_WAIT, nSequence, &oTimeout, nullptr, 0);
+#else
+	(void)nSignal;
+	(void)nSequence;
+	(void)nTimeoutMs;
+	timespec oDelay = { 0, 50 * 1000 };
+	nanosleep(&oDelay, nullptr);
+#endif
+}
+
+void CBroadcastPipe::PlatformWake(int nSignal)
+{
+#ifdef _WIN32
+	// One event per subscriber, only the sleeping ones are set
+	if (nSignal == SignalSpace)
+		SetEvent(m_hSpaceEvent);
+	else
+	{
+		for (uint32_t i = 0; i < c_nMaxSubscribers; ++i)
+		{
+			if (m_pSegment->arrSlots[i].nSleeping.load(std::memory_order_relaxed) != 0)
+				SetEvent(m_arrDataEvents[i]);
+		}
+	}
+#elif defined(__linux__)
+	// One futex word for all the subscribers, one call wakes them all
+	syscall(SYS_futex, &m_pSegment->arrSignals[nSignal].nSequence, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#else
+	(void)nSignal;
+#endif
+}
+
+bool CBroadcastPipe::Fail(EPipeError eError)
+{
+	m_eLastError = eError;
+	if (m_pMetrics != nullptr)
+	{
+		m_pMetrics->Add(EPipeCounter::Failures);
+		if (eError == EPipeError::Disconnected)
+			m_pMetrics->Add(EPipeCounter::Disconnects);
+	}
+	return false;
+}
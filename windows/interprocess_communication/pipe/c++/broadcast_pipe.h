@@ -0,0 +1,174 @@
+/*
+Declaration file for the broadcast pipe
+
+One publisher, any number of subscribers on the same host. The publisher (write mode) creates a
+named shared memory ring and writes every message into it once; each subscriber (read mode) reads
+the ring at its own cursor, so the publishing cost doesn't grow with the subscribers. The publisher
+never waits for the subscribers by default: a subscriber that falls a whole ring behind is overrun,
+detects it by the positions and resumes by its catch-up policy, the messages it missed are counted
+by their sequence numbers. The blocking policy makes the publisher wait for the slowest one instead.
+*/
+
+
+//! Include guard
+#pragma once
+
+
+//! Includes
+#include "named_pipe.h"
+#include "pipe_metrics.h"
+#include "spin_waiter.h"
+#include <atomic>
+#include <string>
+#include <vector>
+
+
+//! Class CBroadcastPipe
+class CBroadcastPipe
+{
+public: //! Types
+	typedef CNamedPipe::EPipeError EPipeError;
+
+	// What the publisher does when the ring is full of the messages a subscriber hasn't read
+	enum class EOverrunPolicy
+	{
+		Overwrite,			// Never waits, the late subscriber loses the overwritten messages
+		Block				// Waits for the slowest subscriber (at most the block timeout), then overwrites
+	};
+
+	// Where the overrun subscriber resumes
+	enum class ECatchUpPolicy
+	{
+		Oldest,				// Oldest message still in the ring, only the overwritten ones are lost
+		Newest,				// Newest message in the ring, the backlog before it is dropped
+		Fail				// Fails the receive with EPipeError::Overrun, the next one resumes at the oldest message
+	};
+
+	// Subscriber seen by the publisher
+	struct SSubscriberInfo
+	{
+		uint32_t	nSlot = 0;
+		uint32_t	nProcessId = 0;
+		uint64_t	nLag = 0;			// Bytes published and not read yet
+		uint64_t	nLost = 0;			// Messages lost by the overruns
+		bool		bSlow = false;		// The lag exceeds the slow threshold
+	};
+
+public: //! Constants
+	static const size_t		c_nDefaultCapacity = 4 * 1024 * 1024;	// Bytes of the ring
+	static const uint32_t	c_nMaxSubscribers = 64;
+
+public: //! Constructors and destructor
+	// The capacity is rounded up to the power of two, the subscribers take it from the segment
+	CBroadcastPipe(const std::string& sName, EPipeMode eMode, size_t nCapacity = c_nDefaultCapacity);
+	~CBroadcastPipe();
+	CBroadcastPipe(const CBroadcastPipe&) = delete;
+	CBroadcastPipe& operator=(const CBroadcastPipe&) = delete;
+
+public: //! Interface
+	// Returns true if the pipe is opened and ready to use
+	bool IsOpen() const;
+	// Publisher: creates the ring (replaces the one of a previous publisher).
+	// Subscriber: joins the ring at the next message, fails if there is no publisher or no free slot
+	bool Open();
+	// Closes pipe, the subscribers read the rest of the ring and then report EPipeError::Disconnected
+	bool Close();
+
+	// Publisher: writes the message once for all the subscribers
+	bool SendData(const std::vector<byte>& vecData);
+	bool SendData(const void* pData, size_t nSize);
+	// Subscriber: waits for the next message (zero timeout waits forever, then EPipeError::TimedOut).
+	// Reports EPipeError::Disconnected once the publisher has gone and the ring is read to its end
+	bool ReceiveData(std::vector<byte>& vecData, uint32_t nTimeoutMs = 0);
+
+	// Publisher: sets what happens to the subscribers that can't keep up
+	void SetOverrunPolicy(EOverrunPolicy ePolicy, uint32_t nBlockTimeoutMs = 1000);
+	// Subscriber: sets where it resumes after an overrun
+	void SetCatchUpPolicy(ECatchUpPolicy ePolicy);
+	// Lag in bytes beyond which a subscriber is reported slow (half of the ring by default)
+	void SetSlowThreshold(size_t nBytes);
+	// Subscriber: the polling waits read the ring position and don't make the publisher wake the subscriber
+	void SetWaitStrategy(const SWaitStrategy& oStrategy);
+
+	// Publisher: returns the attached subscribers
+	bool GetSubscribers(std::vector<SSubscriberInfo>& vecSubscribers) const;
+	// Subscriber: returns the bytes published and not read yet
+	uint64_t GetLag() const;
+	// Subscriber: returns the messages lost by the overruns so far
+	uint64_t GetLostCount() const;
+	// Returns the largest message the ring takes (a quarter of its capacity)
+	size_t GetMaxMessageSize() const;
+
+	// Counters of the sent, received and lost messages and the send latency (see CNamedPipe::EnableMetrics)
+	bool EnableMetrics(bool bEnable);
+	bool GetMetrics(SPipeMetrics& oMetrics) const;
+
+	// Returns the reason of the last failure
+	EPipeError GetLastPipeError() const;
+
+private: //! Types
+	struct SSegment;
+	struct SRecordHeader;
+
+private: //! Implementation
+	bool CreateSegment();
+	bool AttachSegment();
+	void ReleaseSegment();
+	static size_t GetDataOffset();
+	bool ClaimSlot();
+	void ReleaseSlot();
+
+	// Publisher: waits until the subscribers have read the ring up to nEnd - capacity, returns false on timeout
+	bool WaitForSpace(uint64_t nEnd);
+	// Publisher: returns the cursor of the slowest subscriber that hasn't been overrun yet
+	uint64_t GetSlowestCursor() const;
+	// Subscriber: moves the cursor past the overrun by the catch-up policy
+	void CatchUp();
+	// Subscriber: returns the start of the newest or the oldest message still in the ring
+	uint64_t FindResumePosition(bool bNewest) const;
+	// Subscriber: returns true if the publisher hasn't closed or died
+	bool IsPublisherAlive() const;
+	// Publisher: frees the slots of the subscribers that died without closing
+	void ReleaseDeadSlots();
+
+	// Blocks on the signal until fnReady returns true (zero timeout waits forever). fnAlive is called at
+	// the liveness check interval, the wait gives up once it returns false
+	template <class TReady, class TAlive>
+	bool WaitFor(int nSignal, uint32_t nTimeoutMs, TReady fnReady, TAlive fnAlive);
+	// Wakes the other side if it sleeps on the signal
+	void Notify(int nSignal);
+	void PlatformWait(int nSignal, uint32_t nSequence, uint32_t nTimeoutMs);
+	void PlatformWake(int nSignal);
+
+	// Remembers the failure reason and returns false
+	bool Fail(EPipeError eError);
+
+private: //! Members
+	std::string				m_sName;
+	EPipeMode				m_eMode;
+	size_t					m_nCapacity;
+	SSegment*				m_pSegment;			// Mapped segment
+	size_t					m_nSegmentSize;
+	byte*					m_pData;			// Ring data in the segment
+	std::atomic<EPipeError>	m_eLastError;
+	EOverrunPolicy			m_eOverrunPolicy;
+	uint32_t				m_nBlockTimeoutMs;
+	ECatchUpPolicy			m_eCatchUpPolicy;
+	size_t					m_nSlowThreshold;	// Zero: half of the ring
+	CSpinWaiter				m_oWaiter;
+	CPipeMetricsPtr			m_pMetrics;
+	// Publisher
+	uint64_t				m_nTail;			// End of the last message
+	uint64_t				m_nSequence;		// Sequence number of the next message
+	uint64_t				m_nSlowestCursor;	// Cursor of the slowest subscriber seen last (blocking policy)
+	// Subscriber
+	uint32_t				m_nSlot;			// Claimed slot, c_nMaxSubscribers if none
+	uint64_t				m_nCursor;			// Start of the next message to read
+	uint64_t				m_nNextSequence;	// Sequence number expected next, zero until the first message
+	std::atomic<uint64_t>	m_nLost;
+#ifdef _WIN32
+	HANDLE					m_hMapping;
+	HANDLE					m_hSpaceEvent;
+	HANDLE					m_arrDataEvents[c_nMaxSubscribers];
+#endif
+};
@@ -0,0 +1,198 @@
+/*
+Implementation file for the pooled message buffers
+*/
+
+
+//! Includes
+#include "buffer_pool.h"
+
+
+CPooledBuffer::CPooledBuffer()
+	: m_pData(nullptr),
+	  m_nSize(0),
+	  m_nCapacity(0)
+{
+}
+
+CPooledBuffer::CPooledBuffer(CBufferPoolPtr pPool, byte* pData, size_t nSize, size_t nCapacity)
+	: m_pPool(pPool),
+	  m_pData(pData),
+	  m_nSize(nSize),
+	  m_nCapacity(nCapacity)
+{
+}
+
+CPooledBuffer::CPooledBuffer(CPooledBuffer&& oOther)
+	: m_pPool(std::move(oOther.m_pPool)),
+	  m_pData(oOther.m_pData),
+	  m_nSize(oOther.m_nSize),
+	  m_nCapacity(oOther.m_nCapacity)
+{
+	oOther.m_pData = nullptr;
+	oOther.m_nSize = 0;
+	oOther.m_nCapacity = 0;
+}
+
+CPooledBuffer& CPooledBuffer::operator=(CPooledBuffer&& oOther)
+{
+	if (this != &oOther)
+	{
+		Release();
+		m_pPool = std::move(oOther.m_pPool);
+		m_pData = oOther.m_pData;
+		m_nSize = oOther.m_nSize;
+		m_nCapacity = oOther.m_nCapacity;
+		oOther.m_pData = nullptr;
+		oOther.m_nSize = 0;
+		oOther.m_nCapacity = 0;
+	}
+
+	return *this;
+}
+
+CPooledBuffer::~CPooledBuffer()
+{
+	Release();
+}
+
+bool CPooledBuffer::IsValid() const
+{
+	return (m_pData != nullptr);
+}
+
+byte* CPooledBuffer::GetData()
+{
+	return m_pData;
+}
+
+const byte* CPooledBuffer::GetData() const
+{
+	return m_pData;
+}
+
+size_t CPooledBuffer::GetSize() const
+{
+	return m_nSize;
+}
+
+size_t CPooledBuffer::GetCapacity() const
+{
+	return m_nCapacity;
+}
+
+bool CPooledBuffer::SetSize(size_t nSize)
+{
+	if (nSize > m_nCapacity)
+		return false;
+
+	m_nSize = nSize;
+	return true;
+}
+
+SByteSpan CPooledBuffer::GetSpan() const
+{
+	SByteSpan oSpan;
+	oSpan.pData = m_pData;
+	oSpan.nSize = m_nSize;
+
+	return oSpan;
+}
+
+void CPooledBuffer::Release()
+{
+	if (m_pData == nullptr)
+		return;
+
+	if (m_pPool != nullptr)
+		m_pPool->Release(m_pData, m_nCapacity);
+	else
+		delete[] m_pData;
+
+	m_pPool.reset();
+	m_pData = nullptr;
+	m_nSize = 0;
+	m_nCapacity = 0;
+}
+
+
+CBufferPoolPtr CBufferPool::Create(size_t nSlabsPerClass)
+{
+	return CBufferPoolPtr(new CBufferPool(nSlabsPerClass));
+}
+
+CBufferPool::CBufferPool(size_t nSlabsPerClass)
+	: m_nSlabsPerClass(nSlabsPerClass)
+{
+}
+
+CBufferPool::~CBufferPool()
+{
+	for (std::vector<byte*>& vecSlabs : m_arrSlabs)
+	{
+		for (byte* pSlab : vecSlabs)
+			delete[] pSlab;
+	}
+}
+
+CPooledBuffer CBufferPool::Acquire(size_t nSize)
+{
+	const size_t nClass = GetClass(nSize);
+	if (nClass >= c_nClassCount)
+		return CPooledBuffer(nullptr, new byte[nSize], nSize, nSize);
+
+	const size_t nCapacity = c_nMinSlabSize << nClass;
+	byte* pSlab = nullptr;
+	{
+		std::lock_guard<std::mutex> oLock(m_mtxSlabs);
+		if (!m_arrSlabs[nClass].empty())
+		{
+			pSlab = m_arrSlabs[nClass].back();
+			m_arrSlabs[nClass].pop_back();
+		}
+	}
+	if (pSlab == nullptr)
+		pSlab = new byte[nCapacity];
+
+	return CPooledBuffer(shared_from_this(), pSlab, nSize, nCapacity);
+}
+
+size_t CBufferPool::GetCachedCount() const
+{
+	std::lock_guard<std::mutex> oLock(m_mtxSlabs);
+	size_t nCount = 0;
+	for (const std::vector<byte*>& vecSlabs : m_arrSlabs)
+		nCount += vecSlabs.size();
+
+	return nCount;
+}
+
+void CBufferPool::Release(byte* pData, size_t nCapacity)
+{
+	const size_t nClass = GetClass(nCapacity);
+	{
+		std::lock_guard<std::mutex> oLock(m_mtxSlabs);
+		if (nClass < c_nClassCount && m_arrSlabs[nClass].size() < m_nSlabsPerClass)
+		{
+			// Reserved up front, so keeping the slab never allocates
+			if (m_arrSlabs[nClass].capacity() < m_nSlabsPerClass)
+				m_arrSlabs[nClass].reserve(m_nSlabsPerClass);
+			m_arrSlabs[nClass].push_back(pData);
+			return;
+		}
+	}
+
+	delete[] pData;
+}
+
+size_t CBufferPool::GetClass(size_t nSize)
+{
+	size_t nClass = 0;
+	size_t nCapacity = c_nMinSlabSize;
+	while (nCapacity < nSize && nClass < c_nClassCount)
+	{
+		nCapacity <<= 1;
+		++nClass;
+	}
+
+	return nClass;
+}
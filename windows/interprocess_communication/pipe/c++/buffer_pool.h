@@ -0,0 +1,101 @@
+/*
+Declaration file for the pooled message buffers
+*/
+
+
+//! Include guard
+#pragma once
+
+
+//! Includes
+#include "pipe_transport.h"
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+//! Struct SByteSpan (non-owning view of bytes)
+struct SByteSpan
+{
+	const byte*	pData = nullptr;
+	size_t		nSize = 0;
+};
+
+
+//! Type declarations
+class CBufferPool;
+typedef std::shared_ptr<CBufferPool> CBufferPoolPtr;
+
+
+//! Class CPooledBuffer
+// Owns one slab of the pool, gives it back when released or destroyed (move-only)
+class CPooledBuffer
+{
+public: //! Constructors and destructor
+	CPooledBuffer();
+	CPooledBuffer(CPooledBuffer&& oOther);
+	CPooledBuffer& operator=(CPooledBuffer&& oOther);
+	CPooledBuffer(const CPooledBuffer&) = delete;
+	CPooledBuffer& operator=(const CPooledBuffer&) = delete;
+	~CPooledBuffer();
+
+public: //! Interface
+	// Returns true if the buffer holds a slab
+	bool IsValid() const;
+	byte* GetData();
+	const byte* GetData() const;
+	// Returns the size of the data
+	size_t GetSize() const;
+	// Returns the size of the slab
+	size_t GetCapacity() const;
+	// Sets the size of the data (up to the capacity)
+	bool SetSize(size_t nSize);
+	// Returns the view of the data
+	SByteSpan GetSpan() const;
+	// Gives the slab back to the pool
+	void Release();
+
+private: //! Implementation
+	friend class CBufferPool;
+	CPooledBuffer(CBufferPoolPtr pPool, byte* pData, size_t nSize, size_t nCapacity);
+
+private: //! Members
+	CBufferPoolPtr	m_pPool;
+	byte*			m_pData;
+	size_t			m_nSize;
+	size_t			m_nCapacity;
+};
+
+
+//! Class CBufferPool
+// Slabs are power of two sized, the released ones are kept per size class and reused,
+// so a steady message flow doesn't touch the heap. Buffers may be released on any thread
+class CBufferPool : public std::enable_shared_from_this<CBufferPool>
+{
+public: //! Constants
+	static const size_t c_nMinSlabSize = 256;
+	static const size_t c_nMaxSlabSize = 64 * 1024 * 1024;	// Larger buffers are not kept
+
+public: //! Constructors and destructor
+	// Keeps up to nSlabsPerClass released slabs of each size
+	static CBufferPoolPtr Create(size_t nSlabsPerClass = 4);
+	~CBufferPool();
+
+public: //! Interface
+	// Returns the buffer of at least nSize bytes with the data size set to nSize
+	CPooledBuffer Acquire(size_t nSize);
+	// Returns the number of slabs kept for reuse
+	size_t GetCachedCount() const;
+
+private: //! Implementation
+	explicit CBufferPool(size_t nSlabsPerClass);
+	friend class CPooledBuffer;
+	void Release(byte* pData, size_t nCapacity);
+	static size_t GetClass(size_t nSize);
+
+private: //! Members
+	static const size_t					c_nClassCount = 19;	// 256 B to 64 MB
+	mutable std::mutex					m_mtxSlabs;
+	std::vector<byte*>					m_arrSlabs[c_nClassCount];
+	size_t								m_nSlabsPerClass;
+};
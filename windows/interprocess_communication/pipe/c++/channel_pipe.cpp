@@ -0,0 +1,218 @@
+/*
+Implementation file for the channel pipe
+*/
+
+
+//! Includes
+#include "channel_pipe.h"
+#include <algorithm>
+
+
+//! Channel constants
+static const size_t		c_nDefaultChunkSize = 64 * 1024;	// Longest wait of a higher priority message
+
+
+CChannelPipe::CChannelPipe(const std::string& sName, EMode eMode)
+	: m_oPipe(sName, eMode)
+{
+	Init();
+}
+
+CChannelPipe::CChannelPipe(ITransportPtr pTransport)
+	: m_oPipe(pTransport)
+{
+	Init();
+}
+
+CChannelPipe::~CChannelPipe()
+{
+}
+
+void CChannelPipe::Init()
+{
+	m_nMaxMessageSize = c_nFrameDefaultMaxLength;
+	m_eLastError = EPipeError::None;
+	m_nChunkSize = c_nDefaultChunkSize;
+	m_bWriting = false;
+	m_nNextSequence = 0;
+	// The chunks of a message must come by one connection
+	m_oPipe.SetSessionMode(true);
+}
+
+bool CChannelPipe::IsOpen()
+{
+	return m_oPipe.IsOpen();
+}
+
+bool CChannelPipe::Open()
+{
+	m_mapPartials.clear();
+	return m_oPipe.Open();
+}
+
+bool CChannelPipe::Close()
+{
+	return m_oPipe.Close();
+}
+
+bool CChannelPipe::Send(uint16_t nChannel, const void* pData, size_t nSize)
+{
+	if (nSize > m_nMaxMessageSize)
+		return Fail(EPipeError::FrameTooLarge);
+
+	SMessage oMessage;
+	oMessage.nChannel = nChannel;
+	oMessage.pData = static_cast<const byte*>(pData);
+	oMessage.nSize = nSize;
+
+	std::unique_lock<std::mutex> oLock(m_mtxSend);
+	oMessage.nSequence = m_nNextSequence++;
+	m_mapQueues[nChannel].push_back(&oMessage);
+	while (!oMessage.bDone)
+	{
+		if (m_bWriting)
+		{
+			m_cvSend.wait(oLock);
+			continue;
+		}
+
+		// The free sender writes the next chunk, which may be of a message of another sender
+		SMessage* pNext = PickNext();
+		const size_t nChunk = (std::min)(m_nChunkSize, pNext->nSize - pNext->nOffset);
+		const bool bLast = (pNext->nOffset + nChunk == pNext->nSize);
+		uint16_t nFlags = bLast ? uint16_t(FrameFlagNone) : uint16_t(FrameFlagMore);
+		if (pNext->nOffset > 0)
+			nFlags |= FrameFlagContinued;
+		m_bWriting = true;
+		oLock.unlock();
+
+		const bool bOk = m_oPipe.SendFrame(uint16_t(EFrameType::Data), nFlags, pNext->pData + pNext->nOffset, nChunk, pNext->nChannel);
+		const EPipeError eError = bOk ? EPipeError::None : m_oPipe.GetLastPipeError();
+
+		oLock.lock();
+		m_bWriting = false;
+		pNext->nOffset += nChunk;
+		if (!bOk || bLast)
+		{
+			pNext->bDone = true;
+			pNext->eError = eError;
+			auto itQueue = m_mapQueues.find(pNext->nChannel);
+			itQueue->second.pop_front();
+			if (itQueue->second.empty())
+				m_mapQueues.erase(itQueue);
+		}
+		m_cvSend.notify_all();
+	}
+	oLock.unlock();
+
+	return (oMessage.eError == EPipeError::None) ? true : Fail(oMessage.eError);
+}
+
+bool CChannelPipe::Send(uint16_t nChannel, const std::vector<byte>& vecData)
+{
+	return Send(nChannel, vecData.data(), vecData.size());
+}
+
+void CChannelPipe::SetChannelPriority(uint16_t nChannel, int nPriority)
+{
+	std::lock_guard<std::mutex> oLock(m_mtxSend);
+	m_mapPriorities[nChannel] = nPriority;
+}
+
+void CChannelPipe::SetChunkSize(size_t nChunkSize)
+{
+	std::lock_guard<std::mutex> oLock(m_mtxSend);
+	m_nChunkSize = (std::max)(nChunkSize, size_t(1));
+}
+
+bool CChannelPipe::Receive(uint16_t& nChannel, std::vector<byte>& vecData)
+{
+	for (;;)
+	{
+		SFrameHeader oHeader;
+		if (!m_oPipe.ReceiveFrame(oHeader, m_vecChunk))
+		{
+			// The rest of the cut messages won't come
+			m_mapPartials.clear();
+			return Fail(m_oPipe.GetLastPipeError());
+		}
+		if (oHeader.nType != uint16_t(EFrameType::Data))
+			continue;
+
+		SPartial& oPartial = m_mapPartials[oHeader.nChannel];
+		const bool bMore = (oHeader.nFlags & FrameFlagMore) != 0;
+		const bool bContinued = (oHeader.nFlags & FrameFlagContinued) != 0;
+		if (bContinued != oPartial.bStarted)
+		{
+			// Start of the message is lost (the writer has reconnected) or its end is, drop the cut one
+			oPartial.bStarted = false;
+			oPartial.vecData.clear();
+			if (bContinued)
+				continue;
+		}
+		if (oPartial.vecData.size() + m_vecChunk.size() > m_nMaxMessageSize)
+		{
+			// The rest of the message is dropped as continuing no started one
+			oPartial.bStarted = false;
+			oPartial.vecData.clear();
+			return Fail(EPipeError::FrameTooLarge);
+		}
+
+		nChannel = oHeader.nChannel;
+		if (!bMore && !bContinued)
+		{
+			// Single chunk message needs no joining
+			vecData.swap(m_vecChunk);
+			return true;
+		}
+		oPartial.bStarted = true;
+		oPartial.vecData.insert(oPartial.vecData.end(), m_vecChunk.begin(), m_vecChunk.end());
+		if (bMore)
+			continue;
+
+		vecData.swap(oPartial.vecData);
+		oPartial.vecData.clear();
+		oPartial.bStarted = false;
+		return true;
+	}
+}
+
+void CChannelPipe::SetMaxMessageSize(uint32_t nMaxSize)
+{
+	m_nMaxMessageSize = nMaxSize;
+}
+
+CChannelPipe::EPipeError CChannelPipe::GetLastPipeError() const
+{
+	return m_eLastError;
+}
+
+CNamedPipe& CChannelPipe::GetPipe()
+{
+	return m_oPipe;
+}
+
+CChannelPipe::SMessage* CChannelPipe::PickNext()
+{
+	SMessage* pBest = nullptr;
+	int nBestPriority = 0;
+	for (auto& prQueue : m_mapQueues)
+	{
+		auto itPriority = m_mapPriorities.find(prQueue.first);
+		const int nPriority = (itPriority != m_mapPriorities.end()) ? itPriority->second : 0;
+		SMessage* pMessage = prQueue.second.front();
+		if (pBest == nullptr || nPriority > nBestPriority || (nPriority == nBestPriority && pMessage->nSequence < pBest->nSequence))
+		{
+			pBest = pMessage;
+			nBestPriority = nPriority;
+		}
+	}
+
+	return pBest;
+}
+
+bool CChannelPipe::Fail(EPipeError eError)
+{
+	m_eLastError = eError;
+	return false;
+}
@@ -0,0 +1,102 @@
+/*
+Declaration file for the channel pipe
+
+Logical channels with priorities over one CNamedPipe connection. The writer cuts every message
+into chunks and picks the next chunk from the channel of the highest priority, so a message
+waits behind one chunk of a lower channel at most. The chunks carry the channel in the frame
+header and are joined back into whole messages by the reader.
+*/
+
+
+//! Include guard
+#pragma once
+
+
+//! Includes
+#include "named_pipe.h"
+#include <map>
+
+
+//! Class CChannelPipe
+class CChannelPipe
+{
+public: //! Types
+	typedef CNamedPipe::EMode EMode;
+	typedef CNamedPipe::EPipeError EPipeError;
+
+public: //! Constructors and destructor
+	CChannelPipe(const std::string& sName, EMode eMode);
+	// Uses the specified transport instead of the default one of the platform
+	explicit CChannelPipe(ITransportPtr pTransport);
+	~CChannelPipe();
+
+public: //! Interface
+	// Returns true if the pipe is opened and ready to use
+	bool IsOpen();
+	// Opens pipe and get ready to use
+	bool Open();
+	// Closes pipe
+	bool Close();
+
+	// Writer: sends the message on the channel, blocks until it's written. Any number of threads may send
+	// at once, the messages of one channel go in order
+	bool Send(uint16_t nChannel, const void* pData, size_t nSize);
+	bool Send(uint16_t nChannel, const std::vector<byte>& vecData);
+	// Writer: sets the priority of the channel, higher goes first (zero by default)
+	void SetChannelPriority(uint16_t nChannel, int nPriority);
+	// Writer: sets the largest chunk the messages are cut into
+	void SetChunkSize(size_t nChunkSize);
+
+	// Reader: waits until a whole message of any channel will be received
+	bool Receive(uint16_t& nChannel, std::vector<byte>& vecData);
+
+	// Sets the maximum accepted message size
+	void SetMaxMessageSize(uint32_t nMaxSize);
+	// Returns the reason of the last failure
+	EPipeError GetLastPipeError() const;
+	// Returns the underlying pipe (batching, flow control, reconnect settings)
+	CNamedPipe& GetPipe();
+
+private: //! Types
+	// Message being sent, owned by the sending thread
+	struct SMessage
+	{
+		uint16_t		nChannel = 0;
+		const byte*		pData = nullptr;
+		size_t			nSize = 0;
+		size_t			nOffset = 0;		// Bytes sent
+		uint64_t		nSequence = 0;		// Orders the messages of equal priority
+		bool			bDone = false;
+		EPipeError		eError = EPipeError::None;
+	};
+
+	// Message being received
+	struct SPartial
+	{
+		bool				bStarted = false;
+		std::vector<byte>	vecData;
+	};
+
+private: //! Implementation
+	void Init();
+	// Returns the first message of the channel of the highest priority (called under m_mtxSend)
+	SMessage* PickNext();
+	// Remembers the failure reason and returns false
+	bool Fail(EPipeError eError);
+
+private: //! Members
+	CNamedPipe								m_oPipe;
+	uint32_t								m_nMaxMessageSize;
+	std::atomic<EPipeError>					m_eLastError;
+	// Writer
+	size_t									m_nChunkSize;
+	std::mutex								m_mtxSend;
+	std::condition_variable					m_cvSend;
+	bool									m_bWriting;			// Some sender is writing a chunk
+	uint64_t								m_nNextSequence;
+	std::map<uint16_t, int>					m_mapPriorities;
+	std::map<uint16_t, std::deque<SMessage*>>	m_mapQueues;	// Messages waiting on each channel
+	// Reader
+	std::vector<byte>						m_vecChunk;
+	std::map<uint16_t, SPartial>			m_mapPartials;
+};
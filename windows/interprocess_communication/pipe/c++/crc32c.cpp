@@ -0,0 +1,242 @@
+/*
+Implementation file for the CRC32C (Castagnoli) checksum
+*/
+
+
+//! Includes
+#include "crc32c.h"
+#include <cstring>
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CRC32C_X86
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__ARM_FEATURE_CRC32)
+#define CRC32C_ARMV8
+#include <arm_acle.h>
+#endif
+
+
+namespace
+{
+	const uint32_t	c_nPolynomial = 0x82F63B78;		// Castagnoli polynomial, bit-reflected
+	const size_t	c_nLaneSize = 4096;				// Bytes per lane of the interleaved kernels
+
+	// Lookup tables, built once
+	struct STables
+	{
+		uint32_t	arrSlices[8][256];		// Slicing-by-8: the byte k positions before the end
+		uint32_t	arrLaneShift[4][256];	// Multiplication of the register by x^(8 * c_nLaneSize), per byte
+	};
+
+	typedef uint32_t (*TUpdate)(uint32_t nCrc, const uint8_t* pData, size_t nSize);
+
+	struct SKernel
+	{
+		ECrc32cKernel	eKernel = ECrc32cKernel::Table;
+		TUpdate			fnUpdate = nullptr;
+	};
+
+	uint32_t LoadUInt32(const uint8_t* pData)
+	{
+		return uint32_t(pData[0]) | (uint32_t(pData[1]) << 8) | (uint32_t(pData[2]) << 16) | (uint32_t(pData[3]) << 24);
+	}
+
+	uint64_t LoadUInt64(const uint8_t* pData)
+	{
+		uint64_t nValue = 0;
+		memcpy(&nValue, pData, sizeof(nValue));
+		return nValue;
+	}
+
+	// Returns a * b modulo the polynomial, both in the bit-reflected form (x^0 is the top bit)
+	uint32_t MultiplyModP(uint32_t nA, uint32_t nB)
+	{
+		uint32_t nProduct = 0;
+		for (uint32_t nMask = 0x80000000; nMask != 0; nMask >>= 1)
+		{
+			if (nA & nMask)
+				nProduct ^= nB;
+			nB = (nB & 1) ? (nB >> 1) ^ c_nPolynomial : (nB >> 1);
+		}
+		return nProduct;
+	}
+
+	STables BuildTables()
+	{
+		STables oTables;
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			uint32_t nCrc = i;
+			for (int nBit = 0; nBit < 8; ++nBit)
+				nCrc = (nCrc & 1) ? (nCrc >> 1) ^ c_nPolynomial : (nCrc >> 1);
+			oTables.arrSlices[0][i] = nCrc;
+		}
+		for (uint32_t i = 0; i < 256; ++i)
+			for (int k = 1; k < 8; ++k)
+				oTables.arrSlices[k][i] = (oTables.arrSlices[k - 1][i] >> 8) ^ oTables.arrSlices[0][oTables.arrSlices[k - 1][i] & 0xFF];
+
+		// x^(8 * c_nLaneSize): the register of a lane moved past the bytes of the next lane
+		uint32_t nShift = 0x80000000;
+		for (size_t i = 0; i < 8 * c_nLaneSize; ++i)
+			nShift = (nShift & 1) ? (nShift >> 1) ^ c_nPolynomial : (nShift >> 1);
+		for (uint32_t i = 0; i < 256; ++i)
+			for (int k = 0; k < 4; ++k)
+				oTables.arrLaneShift[k][i] = MultiplyModP(nShift, i << (8 * k));
+
+		return oTables;
+	}
+
+	const STables& GetTables()
+	{
+		static const STables s_oTables = BuildTables();
+		return s_oTables;
+	}
+
+	// Moves the register of a lane past the next lane (the multiplication is linear, so four lookups do it)
+	uint32_t ShiftLane(const STables& oTables, uint32_t nCrc)
+	{
+		return oTables.arrLaneShift[0][nCrc & 0xFF] ^ oTables.arrLaneShift[1][(nCrc >> 8) & 0xFF] ^
+			oTables.arrLaneShift[2][(nCrc >> 16) & 0xFF] ^ oTables.arrLaneShift[3][nCrc >> 24];
+	}
+
+	uint32_t UpdateTable(uint32_t nCrc, const uint8_t* pData, size_t nSize)
+	{
+		const STables& oTables = GetTables();
+		const uint32_t (&arrSlices)[8][256] = oTables.arrSlices;
+		while (nSize >= 8)
+		{
+			const uint32_t nLow = LoadUInt32(pData) ^ nCrc;
+			const uint32_t nHigh = LoadUInt32(pData + 4);
+			nCrc = arrSlices[7][nLow & 0xFF] ^ arrSlices[6][(nLow >> 8) & 0xFF] ^ arrSlices[5][(nLow >> 16) & 0xFF] ^ arrSlices[4][nLow >> 24] ^
+				arrSlices[3][nHigh & 0xFF] ^ arrSlices[2][(nHigh >> 8) & 0xFF] ^ arrSlices[1][(nHigh >> 16) & 0xFF] ^ arrSlices[0][nHigh >> 24];
+			pData += 8;
+			nSize -= 8;
+		}
+		while (nSize-- > 0)
+			nCrc = arrSlices[0][(nCrc ^ *pData++) & 0xFF] ^ (nCrc >> 8);
+
+		return nCrc;
+	}
+
+#ifdef CRC32C_X86
+#if defined(__GNUC__) || defined(__clang__)
+	__attribute__((target("sse4.2")))
+#endif
+	uint32_t UpdateSse42(uint32_t nCrc, const uint8_t* pData, size_t nSize)
+	{
+#if defined(_M_X64) || defined(__x86_64__)
+		// Three lanes in flight hide the latency of the instruction, the later ones start from zero
+		const STables& oTables = GetTables();
+		while (nSize >= 3 * c_nLaneSize)
+		{
+			uint64_t nCrc0 = nCrc;
+			uint64_t nCrc1 = 0;
+			uint64_t nCrc2 = 0;
+			for (size_t i = 0; i < c_nLaneSize; i += 8)
+			{
+				nCrc0 = _mm_crc32_u64(nCrc0, LoadUInt64(pData + i));
+				nCrc1 = _mm_crc32_u64(nCrc1, LoadUInt64(pData + c_nLaneSize + i));
+				nCrc2 = _mm_crc32_u64(nCrc2, LoadUInt64(pData + 2 * c_nLaneSize + i));
+			}
+			nCrc = ShiftLane(oTables, uint32_t(nCrc0)) ^ uint32_t(nCrc1);
+			nCrc = ShiftLane(oTables, nCrc) ^ uint32_t(nCrc2);
+			pData += 3 * c_nLaneSize;
+			nSize -= 3 * c_nLaneSize;
+		}
+
+		uint64_t nCrc64 = nCrc;
+		for (; nSize >= 8; pData += 8, nSize -= 8)
+			nCrc64 = _mm_crc32_u64(nCrc64, LoadUInt64(pData));
+		nCrc = uint32_t(nCrc64);
+#else
+		for (; nSize >= 4; pData += 4, nSize -= 4)
+			nCrc = _mm_crc32_u32(nCrc, LoadUInt32(pData));
+#endif
+		for (; nSize > 0; --nSize)
+			nCrc = _mm_crc32_u8(nCrc, *pData++);
+
+		return nCrc;
+	}
+
+	bool HasSse42()
+	{
+#ifdef _MSC_VER
+		int arrInfo[4] = {};
+		__cpuid(arrInfo, 1);
+		return (arrInfo[2] & (1 << 20)) != 0;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("sse4.2") != 0;
+#endif
+	}
+#endif
+
+#ifdef CRC32C_ARMV8
+	uint32_t UpdateArmv8(uint32_t nCrc, const uint8_t* pData, size_t nSize)
+	{
+		const STables& oTables = GetTables();
+		while (nSize >= 3 * c_nLaneSize)
+		{
+			uint32_t nCrc0 = nCrc;
+			uint32_t nCrc1 = 0;
+			uint32_t nCrc2 = 0;
+			for (size_t i = 0; i < c_nLaneSize; i += 8)
+			{
+				nCrc0 = __crc32cd(nCrc0, LoadUInt64(pData + i));
+				nCrc1 = __crc32cd(nCrc1, LoadUInt64(pData + c_nLaneSize + i));
+				nCrc2 = __crc32cd(nCrc2, LoadUInt64(pData + 2 * c_nLaneSize + i));
+			}
+			nCrc = ShiftLane(oTables, nCrc0) ^ nCrc1;
+			nCrc = ShiftLane(oTables, nCrc) ^ nCrc2;
+			pData += 3 * c_nLaneSize;
+			nSize -= 3 * c_nLaneSize;
+		}
+		for (; nSize >= 8; pData += 8, nSize -= 8)
+			nCrc = __crc32cd(nCrc, LoadUInt64(pData));
+		for (; nSize > 0; --nSize)
+			nCrc = __crc32cb(nCrc, *pData++);
+
+		return nCrc;
+	}
+#endif
+
+	SKernel SelectKernel()
+	{
+		// The tables are built before the first checksum, so no call pays for them
+		GetTables();
+
+		SKernel oKernel;
+		oKernel.fnUpdate = UpdateTable;
+#if defined(CRC32C_X86)
+		if (HasSse42())
+		{
+			oKernel.eKernel = ECrc32cKernel::Sse42;
+			oKernel.fnUpdate = UpdateSse42;
+		}
+#elif defined(CRC32C_ARMV8)
+		oKernel.eKernel = ECrc32cKernel::Armv8;
+		oKernel.fnUpdate = UpdateArmv8;
+#endif
+		return oKernel;
+	}
+
+	const SKernel& GetKernel()
+	{
+		static const SKernel s_oKernel = SelectKernel();
+		return s_oKernel;
+	}
+}
+
+
+uint32_t Crc32c(uint32_t nCrc, const void* pData, size_t nSize)
+{
+	// The register starts from all ones and is inverted at the end, so the checksums chain
+	return ~GetKernel().fnUpdate(~nCrc, static_cast<const uint8_t*>(pData), nSize);
+}
+
+ECrc32cKernel GetCrc32cKernel()
+{
+	return GetKernel().eKernel;
+}
@@ -0,0 +1,33 @@
+/*
+Declaration file for the CRC32C (Castagnoli) checksum
+
+The kernel is chosen once at run time: the SSE4.2 crc32 instruction on x86, the CRC32 extension
+on ARMv8, a slicing-by-8 table otherwise. Large blocks are run through three independent lanes,
+so the instruction latency is hidden, and the lanes are combined by the multiplication modulo the
+polynomial. All the kernels give the same value, which matches the iSCSI / ext4 CRC32C.
+*/
+
+
+//! Include guard
+#pragma once
+
+
+//! Includes
+#include <cstddef>
+#include <cstdint>
+
+
+//! Kernel of Crc32c
+enum class ECrc32cKernel
+{
+	Table,		// Portable slicing-by-8
+	Sse42,		// x86 crc32 instruction
+	Armv8		// ARMv8 crc32c instructions
+};
+
+
+//! Functions
+// Returns the checksum of the bytes continuing the one of the preceding bytes (zero for none)
+uint32_t Crc32c(uint32_t nCrc, const void* pData, size_t nSize);
+// Returns the kernel the processor runs
+ECrc32cKernel GetCrc32cKernel();
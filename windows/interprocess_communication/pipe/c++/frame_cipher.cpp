@@ -0,0 +1,205 @@
+/*
+Implementation file for the frame cipher
+*/
+
+
+//! Includes
+#include "frame_cipher.h"
+#include <cstring>
+#include <random>
+
+
+//! Cipher constants
+static const uint32_t	c_nWriterDirection = 1;		// Writer to reader
+static const uint32_t	c_nReaderDirection = 2;		// Reader to writer
+static const size_t		c_nAadSize = c_nFrameHeaderSize + c_nFrameSequenceSize;
+
+
+namespace
+{
+	void PutUInt64(uint8_t* pBuffer, uint64_t nValue)
+	{
+		for (int i = 0; i < 8; ++i)
+			pBuffer[i] = uint8_t(nValue >> (8 * i));
+	}
+
+	uint64_t GetUInt64(const uint8_t* pBuffer)
+	{
+		uint64_t nValue = 0;
+		for (int i = 7; i >= 0; --i)
+			nValue = (nValue << 8) | pBuffer[i];
+		return nValue;
+	}
+}
+
+
+CFrameCipher::CFrameCipher()
+	: m_nKeySize(0),
+	  m_arrSalt(),
+	  m_bSession(false),
+	  m_bInitiator(false),
+	  m_nSendSequence(0),
+	  m_nReceiveSequence(0)
+{
+}
+
+bool CFrameCipher::SetKey(const void* pKey, size_t nKeySize)
+{
+	EndSession();
+	if (pKey == nullptr)
+	{
+		m_oKey.Clear();
+		m_nKeySize = 0;
+		return true;
+	}
+
+	if (!m_oKey.SetKey(pKey, nKeySize))
+		return false;
+	m_nKeySize = nKeySize;
+	return true;
+}
+
+bool CFrameCipher::IsEnabled() const
+{
+	return m_oKey.HasKey();
+}
+
+bool CFrameCipher::HasSession() const
+{
+	return m_bSession;
+}
+
+bool CFrameCipher::IsSealedType(uint16_t nType)
+{
+	return (nType != uint16_t(EFrameType::FlowControl) && nType != uint16_t(EFrameType::Credit) &&
+		nType != uint16_t(EFrameType::Session));
+}
+
+void CFrameCipher::StartSession(uint8_t* pFrame)
+{
+	// random_device draws from the system generator (getrandom, rand_s)
+	std::random_device oRandom;
+	for (size_t i = 0; i < c_nSessionSaltSize; i += 4)
+	{
+		const uint32_t nValue = oRandom();
+		memcpy(m_arrSalt + i, &nValue, 4);
+	}
+	m_bInitiator = true;
+	DeriveKeys();
+	::EncodeSession(pFrame, m_arrSalt);
+}
+
+bool CFrameCipher::AcceptSession(const SFrameHeader& oHeader, const uint8_t* pPayload)
+{
+	if (!IsEnabled() || !DecodeSession(oHeader, pPayload, m_arrSalt))
+		return false;
+
+	m_bInitiator = false;
+	DeriveKeys();
+	return true;
+}
+
+void CFrameCipher::EndSession()
+{
+	m_oSendKey.Clear();
+	m_oReceiveKey.Clear();
+	m_bSession = false;
+	m_nSendSequence = 0;
+	m_nReceiveSequence = 0;
+}
+
+void CFrameCipher::Seal(const uint8_t* arrHeader, const void* pData, size_t nSize, uint8_t* pOut)
+{
+	PutUInt64(pOut, ++m_nSendSequence);
+	CAesGcm::SState oState;
+	BeginMessage(m_oSendKey, m_bInitiator ? c_nWriterDirection : c_nReaderDirection, arrHeader, pOut, oState);
+	m_oSendKey.Encrypt(oState, pData, pOut + c_nFrameSequenceSize, nSize);
+	m_oSendKey.Finish(oState, pOut + c_nFrameSequenceSize + nSize);
+}
+
+bool CFrameCipher::Open(const uint8_t* arrHeader, const uint8_t* pPayload, size_t nSize, uint8_t* pOut)
+{
+	if (nSize < c_nFrameCipherOverhead)
+		return false;
+
+	// The tag is copied first, the decrypted bytes may overwrite it
+	const size_t nDataSize = nSize - c_nFrameCipherOverhead;
+	uint8_t arrTag[c_nFrameTagSize];
+	memcpy(arrTag, pPayload + c_nFrameSequenceSize + nDataSize, c_nFrameTagSize);
+	SOpenState oState;
+	if (!BeginOpen(arrHeader, pPayload, oState))
+		return false;
+	m_oReceiveKey.Decrypt(oState.oGcm, pPayload + c_nFrameSequenceSize, pOut, nDataSize);
+	if (EndOpen(oState, arrTag))
+		return true;
+
+	// Nothing of the forged frame is left readable
+	memset(pOut, 0, nDataSize);
+	return false;
+}
+
+bool CFrameCipher::BeginOpen(const uint8_t* arrHeader, const uint8_t* arrSequence, SOpenState& oState) const
+{
+	oState.nSequence = GetUInt64(arrSequence);
+	if (!m_bSession || oState.nSequence <= m_nReceiveSequence)
+		return false;
+
+	BeginMessage(m_oReceiveKey, m_bInitiator ? c_nReaderDirection : c_nWriterDirection, arrHeader, arrSequence, oState.oGcm);
+	return true;
+}
+
+void CFrameCipher::Decrypt(SOpenState& oState, void* pData, size_t nSize) const
+{
+	m_oReceiveKey.Decrypt(oState.oGcm, pData, pData, nSize);
+}
+
+bool CFrameCipher::EndOpen(SOpenState& oState, const uint8_t* arrTag)
+{
+	if (!m_oReceiveKey.Verify(oState.oGcm, arrTag))
+		return false;
+
+	m_nReceiveSequence = oState.nSequence;
+	return true;
+}
+
+void CFrameCipher::DeriveKeys()
+{
+	// The key of a direction is the shared key's encryption of the salt marked by the direction and the block
+	uint8_t arrKeys[2][32];
+	for (uint32_t nDirection = 0; nDirection < 2; ++nDirection)
+		for (size_t nBlock = 0; nBlock * CAesGcm::c_nBlockSize < m_nKeySize; ++nBlock)
+		{
+			uint8_t arrInput[CAesGcm::c_nBlockSize];
+			memcpy(arrInput, m_arrSalt, sizeof(arrInput));
+			arrInput[CAesGcm::c_nBlockSize - 1] ^= uint8_t(((nDirection + 1) << 4) | nBlock);
+			m_oKey.EncryptBlock(arrInput, arrKeys[nDirection] + nBlock * CAesGcm::c_nBlockSize);
+		}
+
+	const int nSend = m_bInitiator ? 0 : 1;
+	m_oSendKey.SetKey(arrKeys[nSend], m_nKeySize);
+	m_oReceiveKey.SetKey(arrKeys[1 - nSend], m_nKeySize);
+	volatile uint8_t* pWipe = &arrKeys[0][0];
+	for (size_t i = 0; i < sizeof(arrKeys); ++i)
+		pWipe[i] = 0;
+
+	m_bSession = true;
+	m_nSendSequence = 0;
+	m_nReceiveSequence = 0;
+}
+
+void CFrameCipher::BeginMessage(const CAesGcm& oKey, uint32_t nDirection, const uint8_t* arrHeader, const uint8_t* arrSequence,
+	CAesGcm::SState& oState) const
+{
+	// Nonce: the direction (u32) and the sequence number, both big-endian
+	uint8_t arrNonce[CAesGcm::c_nNonceSize];
+	for (int i = 0; i < 4; ++i)
+		arrNonce[i] = uint8_t(nDirection >> (24 - 8 * i));
+	const uint64_t nSequence = GetUInt64(arrSequence);
+	for (int i = 0; i < 8; ++i)
+		arrNonce[4 + i] = uint8_t(nSequence >> (56 - 8 * i));
+
+	uint8_t arrAad[c_nAadSize];
+	memcpy(arrAad, arrHeader, c_nFrameHeaderSize);
+	memcpy(arrAad + c_nFrameHeaderSize, arrSequence, c_nFrameSequenceSize);
+	oKey.Begin(oState, arrNonce, arrAad, sizeof(arrAad));
+}
@@ -0,0 +1,82 @@
+/*
+Declaration file for the frame cipher
+
+Seals the frames of one connection by AES-GCM. Both sides hold the same 16 or 32 byte key, given
+out of band. The writer starts every session by the session frame with a random salt and both
+sides derive the keys of the two directions from the key and the salt, so every session (every
+connection of the writer, the reconnects too) has its own keys. The nonce is the direction and the
+sequence number of the frame, the header and the sequence number are authenticated along with the
+payload. The sequence grows with every sealed frame and the receiver takes only the greater ones,
+so the frames can't be replayed or reordered within the session. The reader adds nothing to the
+keys, so a recorded session as a whole could still be played to it again.
+*/
+
+
+//! Include guard
+#pragma once
+
+
+//! Includes
+#include "aes_gcm.h"
+#include "pipe_frame.h"
+
+
+//! Class CFrameCipher
+class CFrameCipher
+{
+public: //! Types
+	// Frame being opened in parts
+	struct SOpenState
+	{
+		CAesGcm::SState	oGcm;
+		uint64_t		nSequence = 0;
+	};
+
+public: //! Constructors and destructor
+	CFrameCipher();
+
+public: //! Interface
+	// Sets the shared key (16 or 32 bytes), null turns the encryption off. Returns false for another size
+	bool SetKey(const void* pKey, size_t nKeySize);
+	// Returns true if the key is set
+	bool IsEnabled() const;
+	// Returns true if the keys of the session are derived
+	bool HasSession() const;
+	// Returns true if the frames of the type are sealed (the protocol frames carry no data and are not)
+	static bool IsSealedType(uint16_t nType);
+
+	// Writer: starts a new session by a random salt and writes its frame of c_nSessionFrameSize bytes
+	void StartSession(uint8_t* pFrame);
+	// Reader: derives the keys of the session from its frame, returns false if the frame is malformed
+	bool AcceptSession(const SFrameHeader& oHeader, const uint8_t* pPayload);
+	// Forgets the keys of the session
+	void EndSession();
+
+	// Writes the sequence number, the ciphertext and the tag (nSize + c_nFrameCipherOverhead bytes) to pOut.
+	// The header is the encoded one of the sealed frame
+	void Seal(const uint8_t* arrHeader, const void* pData, size_t nSize, uint8_t* pOut);
+	// Decrypts the sealed payload of nSize bytes to pOut, which may be pPayload. Returns false if it doesn't
+	// authenticate or its sequence number is not greater than the last one
+	bool Open(const uint8_t* arrHeader, const uint8_t* pPayload, size_t nSize, uint8_t* pOut);
+	// Same as above in parts: the sequence number, the ciphertext decrypted in place and the tag
+	bool BeginOpen(const uint8_t* arrHeader, const uint8_t* arrSequence, SOpenState& oState) const;
+	void Decrypt(SOpenState& oState, void* pData, size_t nSize) const;
+	bool EndOpen(SOpenState& oState, const uint8_t* arrTag);
+
+private: //! Implementation
+	void DeriveKeys();
+	// Starts the message of the direction, the additional data is the header and the sequence number
+	void BeginMessage(const CAesGcm& oKey, uint32_t nDirection, const uint8_t* arrHeader, const uint8_t* arrSequence,
+		CAesGcm::SState& oState) const;
+
+private: //! Members
+	CAesGcm		m_oKey;					// Shared key, derives the session keys
+	size_t		m_nKeySize;
+	CAesGcm		m_oSendKey;
+	CAesGcm		m_oReceiveKey;
+	uint8_t		m_arrSalt[c_nSessionSaltSize];
+	bool		m_bSession;
+	bool		m_bInitiator;			// The session was started by this side (writer)
+	uint64_t	m_nSendSequence;		// Last sealed frame
+	uint64_t	m_nReceiveSequence;		// Last opened frame
+};
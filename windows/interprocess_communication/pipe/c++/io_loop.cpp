@@ -0,0 +1,305 @@
+/*
+Implementation file for the I/O loop
+*/
+
+
+//! Includes
+#include "io_loop.h"
+#ifndef _WIN32
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+
+//! Loop constants
+static const uint64_t	c_nWakeupKey = 0;		// Key of the posted tasks wakeup (registration ids start from 1)
+#ifndef _WIN32
+static const int		c_nMaxEvents = 64;		// Events handled per wait
+#endif
+
+
+CIoLoop::CIoLoop()
+	: m_bRunning(false),
+	  m_nNextId(0)
+#ifdef _WIN32
+	  , m_hCompletionPort(NULL)
+#else
+	  , m_nPoll(-1),
+	  m_nWakeup(-1)
+#endif
+{
+}
+
+CIoLoop::~CIoLoop()
+{
+	Stop();
+}
+
+bool CIoLoop::Start()
+{
+	if (IsRunning())
+		return false;
+
+#ifdef _WIN32
+	m_hCompletionPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+	if (m_hCompletionPort == NULL)
+		return false;
+#else
+	m_nPoll = epoll_create1(EPOLL_CLOEXEC);
+	m_nWakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	epoll_event oEvent = {};
+	oEvent.events = EPOLLIN;
+	oEvent.data.u64 = c_nWakeupKey;
+	if (m_nPoll < 0 || m_nWakeup < 0 || epoll_ctl(m_nPoll, EPOLL_CTL_ADD, m_nWakeup, &oEvent) != 0)
+	{
+		if (m_nPoll >= 0)
+			close(m_nPoll);
+		if (m_nWakeup >= 0)
+			close(m_nWakeup);
+		m_nPoll = m_nWakeup = -1;
+		return false;
+	}
+#endif
+
+	m_bRunning = true;
+	m_oLoop = std::thread(&CIoLoop::Run, this);
+
+	return true;
+}
+
+void CIoLoop::Stop()
+{
+	if (!IsRunning())
+		return;
+
+	m_bRunning = false;
+	Wakeup();
+	if (m_oLoop.joinable())
+		m_oLoop.join();
+
+	// Run the tasks posted before the stop, so no operation is lost
+	for (;;)
+	{
+		{
+			std::lock_guard<std::mutex> oLock(m_mtxTasks);
+			m_vecRunning.swap(m_vecTasks);
+		}
+		if (m_vecRunning.empty())
+			break;
+		for (TTask& fnTask : m_vecRunning)
+			fnTask();
+		m_vecRunning.clear();
+	}
+
+	// Let the handlers fail their pending operations, they may release the last references
+	std::vector<IHandlerPtr> vecHandlers;
+	for (const auto& oItem : m_mapHandlers)
+		vecHandlers.push_back(oItem.second.pHandler);
+	m_mapHandlers.clear();
+	m_mapTimers.clear();
+	m_mapTimerDeadlines.clear();
+	for (const IHandlerPtr& pHandler : vecHandlers)
+		pHandler->OnStop();
+	vecHandlers.clear();
+
+#ifdef _WIN32
+	CloseHandle(m_hCompletionPort);
+	m_hCompletionPort = NULL;
+#else
+	close(m_nPoll);
+	close(m_nWakeup);
+	m_nPoll = m_nWakeup = -1;
+#endif
+}
+
+bool CIoLoop::IsRunning() const
+{
+	return m_bRunning;
+}
+
+bool CIoLoop::IsLoopThread() const
+{
+	return (m_oLoop.get_id() == std::this_thread::get_id());
+}
+
+void CIoLoop::Post(TTask fnTask)
+{
+	bool bWakeup = false;
+	{
+		std::lock_guard<std::mutex> oLock(m_mtxTasks);
+		// Loop is woken up once per batch of tasks
+		bWakeup = m_vecTasks.empty();
+		m_vecTasks.push_back(std::move(fnTask));
+	}
+
+	if (bWakeup && !IsLoopThread())
+		Wakeup();
+}
+
+uint64_t CIoLoop::AddTimer(uint32_t nDelayMs, TTask fnTask)
+{
+	const uint64_t nId = ++m_nNextId;
+	const TTimePoint tpDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(nDelayMs);
+	m_mapTimers[std::make_pair(tpDeadline, nId)] = std::move(fnTask);
+	m_mapTimerDeadlines[nId] = tpDeadline;
+
+	return nId;
+}
+
+void CIoLoop::CancelTimer(uint64_t nTimerId)
+{
+	auto itDeadline = m_mapTimerDeadlines.find(nTimerId);
+	if (itDeadline == m_mapTimerDeadlines.end())
+		return;
+
+	m_mapTimers.erase(std::make_pair(itDeadline->second, nTimerId));
+	m_mapTimerDeadlines.erase(itDeadline);
+}
+
+#ifdef _WIN32
+uint64_t CIoLoop::Register(HANDLE hHandle, IHandlerPtr pHandler)
+{
+	const uint64_t nId = ++m_nNextId;
+	if (CreateIoCompletionPort(hHandle, m_hCompletionPort, ULONG_PTR(nId), 0) == NULL)
+		return 0;
+
+	m_mapHandlers[nId].pHandler = pHandler;
+	return nId;
+}
+
+void CIoLoop::Unregister(uint64_t nId)
+{
+	// The handle stays attached to the port until it is closed, its late completions are ignored
+	m_mapHandlers.erase(nId);
+}
+#else
+uint64_t CIoLoop::Register(int nFd, IHandlerPtr pHandler)
+{
+	const uint64_t nId = ++m_nNextId;
+	epoll_event oEvent = {};
+	oEvent.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	oEvent.data.u64 = nId;
+	if (epoll_ctl(m_nPoll, EPOLL_CTL_ADD, nFd, &oEvent) != 0)
+		return 0;
+
+	SRegistration& oRegistration = m_mapHandlers[nId];
+	oRegistration.pHandler = pHandler;
+	oRegistration.nFd = nFd;
+	return nId;
+}
+
+void CIoLoop::Unregister(uint64_t nId)
+{
+	auto itHandler = m_mapHandlers.find(nId);
+	if (itHandler == m_mapHandlers.end())
+		return;
+
+	epoll_ctl(m_nPoll, EPOLL_CTL_DEL, itHandler->second.nFd, nullptr);
+	m_mapHandlers.erase(itHandler);
+}
+#endif
+
+int CIoLoop::RunPending()
+{
+	{
+		std::lock_guard<std::mutex> oLock(m_mtxTasks);
+		m_vecRunning.swap(m_vecTasks);
+	}
+	for (TTask& fnTask : m_vecRunning)
+		fnTask();
+	m_vecRunning.clear();
+
+	const TTimePoint tpNow = std::chrono::steady_clock::now();
+	while (!m_mapTimers.empty() && m_mapTimers.begin()->first.first <= tpNow)
+	{
+		TTask fnTask = std::move(m_mapTimers.begin()->second);
+		m_mapTimerDeadlines.erase(m_mapTimers.begin()->first.second);
+		m_mapTimers.erase(m_mapTimers.begin());
+		fnTask();
+	}
+
+	// Tasks posted meanwhile must not wait for the I/O
+	{
+		std::lock_guard<std::mutex> oLock(m_mtxTasks);
+		if (!m_vecTasks.empty())
+			return 0;
+	}
+	if (m_mapTimers.empty())
+		return -1;
+
+	const auto nDelay = std::chrono::duration_cast<std::chrono::milliseconds>(m_mapTimers.begin()->first.first - tpNow).count();
+	return int(nDelay + 1);
+}
+
+#ifdef _WIN32
+
+void CIoLoop::Run()
+{
+	while (m_bRunning)
+	{
+		const int nTimeout = RunPending();
+		DWORD nBytes = 0;
+		ULONG_PTR nKey = 0;
+		LPOVERLAPPED pOverlapped = NULL;
+		BOOL bOk = GetQueuedCompletionStatus(m_hCompletionPort, &nBytes, &nKey, &pOverlapped, nTimeout < 0 ? INFINITE : DWORD(nTimeout));
+		const DWORD nError = bOk ? 0 : GetLastError();
+		if (pOverlapped == NULL || nKey == c_nWakeupKey)
+			continue;
+
+		// Hold the handler, it may unregister itself
+		auto itHandler = m_mapHandlers.find(uint64_t(nKey));
+		if (itHandler == m_mapHandlers.end())
+			continue;
+		IHandlerPtr pHandler = itHandler->second.pHandler;
+		pHandler->OnComplete(pOverlapped, nBytes, nError);
+	}
+}
+
+void CIoLoop::Wakeup()
+{
+	PostQueuedCompletionStatus(m_hCompletionPort, 0, c_nWakeupKey, NULL);
+}
+
+#else
+
+void CIoLoop::Run()
+{
+	epoll_event arrEvents[c_nMaxEvents];
+	while (m_bRunning)
+	{
+		const int nTimeout = RunPending();
+		int nCount = epoll_wait(m_nPoll, arrEvents, c_nMaxEvents, nTimeout);
+		if (nCount < 0 && errno != EINTR)
+			break;
+
+		for (int i = 0; i < nCount; ++i)
+		{
+			const uint64_t nKey = arrEvents[i].data.u64;
+			if (nKey == c_nWakeupKey)
+			{
+				uint64_t nValue = 0;
+				ssize_t nResult = read(m_nWakeup, &nValue, sizeof(nValue));
+				(void)nResult;
+				continue;
+			}
+
+			// The handler may have been released by an earlier event of this batch
+			auto itHandler = m_mapHandlers.find(nKey);
+			if (itHandler == m_mapHandlers.end())
+				continue;
+			IHandlerPtr pHandler = itHandler->second.pHandler;
+			pHandler->OnReady(itHandler->second.nFd, arrEvents[i].events);
+		}
+	}
+}
+
+void CIoLoop::Wakeup()
+{
+	uint64_t nSignal = 1;
+	ssize_t nResult = write(m_nWakeup, &nSignal, sizeof(nSignal));
+	(void)nResult;
+}
+
+#endif
@@ -0,0 +1,120 @@
+/*
+Declaration file for the I/O loop
+
+One thread waits for the I/O of all the registered handlers (completion port on Win32,
+edge-triggered epoll on Linux), runs the posted tasks and the expired timers.
+*/
+
+
+//! Include guard
+#pragma once
+
+
+//! Includes
+#include "pipe_transport.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+//! Type declarations
+class CIoLoop;
+typedef std::shared_ptr<CIoLoop> CIoLoopPtr;
+
+
+//! Class CIoLoop
+class CIoLoop
+{
+public: //! Types
+	typedef std::function<void()> TTask;
+
+	// Registered object, called on the loop thread
+	class IHandler
+	{
+	public:
+		virtual ~IHandler() = default;
+#ifdef _WIN32
+		// Overlapped operation of the registered handle has completed
+		virtual void OnComplete(OVERLAPPED* pOverlapped, DWORD nBytes, DWORD nError) = 0;
+#else
+		// Registered descriptor is ready (EPOLLIN, EPOLLOUT, ...)
+		virtual void OnReady(int nFd, uint32_t nEvents) = 0;
+#endif
+		// The loop has stopped, called on the stopping thread
+		virtual void OnStop() {}
+	};
+	typedef std::shared_ptr<IHandler> IHandlerPtr;
+
+public: //! Constructors and destructor
+	CIoLoop();
+	~CIoLoop();
+
+public: //! Interface
+	// Starts the loop thread
+	bool Start();
+	// Stops the loop thread and releases all the handlers
+	void Stop();
+	// Returns true if the loop is running
+	bool IsRunning() const;
+	// Returns true if called on the loop thread
+	bool IsLoopThread() const;
+
+	// Runs the task on the loop thread (may be called on any thread)
+	void Post(TTask fnTask);
+
+	// Loop thread only
+	// Runs the task after the delay, returns the timer id
+	uint64_t AddTimer(uint32_t nDelayMs, TTask fnTask);
+	// Cancels the timer which has not fired yet
+	void CancelTimer(uint64_t nTimerId);
+#ifdef _WIN32
+	// Attaches the overlapped handle, returns the registration id (zero on failure)
+	uint64_t Register(HANDLE hHandle, IHandlerPtr pHandler);
+#else
+	// Watches the non-blocking descriptor, returns the registration id (zero on failure)
+	uint64_t Register(int nFd, IHandlerPtr pHandler);
+#endif
+	// Releases the handler (on Win32 it must have no pending I/O on the handle)
+	void Unregister(uint64_t nId);
+
+private: //! Types
+	struct SRegistration
+	{
+		IHandlerPtr		pHandler;
+#ifndef _WIN32
+		int				nFd = -1;
+#endif
+	};
+	typedef std::chrono::steady_clock::time_point TTimePoint;
+
+private: //! Implementation
+	// Loop thread function
+	void Run();
+	// Runs the posted tasks and the expired timers, returns the wait timeout in milliseconds (-1 for infinite)
+	int RunPending();
+	// Wakes the loop thread up
+	void Wakeup();
+
+private: //! Members
+	std::thread										m_oLoop;
+	std::atomic<bool>								m_bRunning;
+	std::mutex										m_mtxTasks;
+	std::vector<TTask>								m_vecTasks;			// Posted tasks
+	std::vector<TTask>								m_vecRunning;		// Tasks being run, swapped with the posted ones
+	std::unordered_map<uint64_t, SRegistration>		m_mapHandlers;		// Owned by the loop thread
+	std::map<std::pair<TTimePoint, uint64_t>, TTask>	m_mapTimers;		// Ordered by the deadline
+	std::unordered_map<uint64_t, TTimePoint>		m_mapTimerDeadlines;
+	uint64_t										m_nNextId;
+#ifdef _WIN32
+	HANDLE											m_hCompletionPort;
+#else
+	int												m_nPoll;			// epoll instance
+	int												m_nWakeup;			// eventfd of the posted tasks
+#endif
+};
@@ -1,151 +1,1441 @@
 /*
-Declaration file for named pipe
+Implementation file for the named pipe
 */
 
 
 //! Includes
 #include "named_pipe.h"
+#include "crc32c.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#ifndef _WIN32
+#include <cerrno>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 
 CNamedPipe::CNamedPipe(const std::string& sName, EMode eMode)
-	: m_eMode(eMode),
-	  m_sName(sName),
-	  m_hHandler(INVALID_HANDLE_VALUE)
+	: CNamedPipe(sName.empty() ? nullptr : CreatePipeTransport(sName, eMode))
+{
+	// Without the transport the mode can't be taken from it
+	m_eMode = eMode;
+}
+
+CNamedPipe::CNamedPipe(ITransportPtr pTransport)
+	: m_pTransport(pTransport),
+	  m_pBufferPool(CBufferPool::Create()),
+	  m_eMode(pTransport ? pTransport->GetMode() : EMode::Read),
+	  m_nMaxMessageSize(c_nFrameDefaultMaxLength),
+	  m_eLastError(EPipeError::None),
+	  m_bSessionMode(false),
+	  m_bConnected(false),
+	  m_bAutoReconnect(false),
+	  m_bReconnectPending(false),
+	  m_nReconnectTimeoutMs(0),
+	  m_nReconnectCount(0),
+	  m_bStreamSending(false),
+	  m_nStreamConnection(0),
+	  m_bStreamReceiving(false),
+#ifndef _WIN32
+	  m_nDescriptor(-1),
+#endif
+	  m_bChecksum(false),
+	  m_nPartialWriteBase(0),
+	  m_nReceiveStart(0),
+	  m_nCaptureId(0),
+	  m_bBatching(false),
+	  m_nBatchLimit(0),
+	  m_nBatchDelayMs(0),
+	  m_nBatchFrames(0),
+	  m_eBatchError(EPipeError::None),
+	  m_bStopFlusher(false),
+	  m_bFlowControl(false),
+	  m_eFlowPolicy(EFlowPolicy::Block),
+	  m_nPendingLimit(0),
+	  m_bCreditRequested(false),
+	  m_bCreditGranted(false),
+	  m_bUnlimitedCredit(false),
+	  m_nCredits(0),
+	  m_oCreditAssembler(c_nCreditFrameSize),
+	  m_nPendingBytes(0),
+	  m_nDroppedCount(0),
+	  m_nReceiveWindow(0),
+	  m_bPeerFlowControl(false),
+	  m_nConsumed(0)
 {
 }
 
 CNamedPipe::~CNamedPipe()
 {
+	StopFlusher();
 	if (IsOpen())
 		Close();
+#ifndef _WIN32
+	if (m_nDescriptor >= 0)
+		close(m_nDescriptor);
+#endif
 }
 
 bool CNamedPipe::IsOpen()
 {
-	return (m_hHandler != INVALID_HANDLE_VALUE);
+	return (m_pTransport != nullptr && m_pTransport->IsOpen());
 }
 
 bool CNamedPipe::Open()
 {
-	if (IsOpen())
+	if (m_pTransport == nullptr || IsOpen())
 		return false;
 
-	if (!m_sName.empty())
-		m_hHandler = CreatePipe(m_sName, m_eMode);
+	ResetCredits();
+	m_bStreamSending = m_bStreamReceiving = false;
+	if (!m_pTransport->Open())
+		return false;
 
-	return (m_hHandler != INVALID_HANDLE_VALUE);
+	// Every connection of the writer has its own session
+	if (!SendSession())
+	{
+		m_pTransport->Close();
+		return false;
+	}
+	return true;
 }
 
 bool CNamedPipe::Close()
 {
+	// Queued frames go out first, the ones kept for credits are dropped
+	if (m_bBatching)
+		FlushBatch();
+
+	std::lock_guard<std::mutex> oLock(m_mtxWrite);
+	m_bReconnectPending = false;
 	if (!IsOpen())
 		return false;
 
-	if (CloseHandle(m_hHandler))
-		m_hHandler = INVALID_HANDLE_VALUE;
-
-	return (m_hHandler == INVALID_HANDLE_VALUE);
+	m_bConnected = false;
+	return m_pTransport->Close();
 }
 
 bool CNamedPipe::SendData(const std::vector<byte>& vecData)
 {
-	bool bOk = false;
-	if (m_hHandler != INVALID_HANDLE_VALUE && m_eMode == EMode::Write)
+	return SendFrame(uint16_t(EFrameType::Data), FrameFlagNone, vecData.data(), vecData.size());
+}
+
+bool CNamedPipe::SendData(const void* pData, size_t nSize)
+{
+	return SendFrame(uint16_t(EFrameType::Data), FrameFlagNone, pData, nSize);
+}
+
+bool CNamedPipe::ReceiveData(std::vector<byte>& vecData)
+{
+	SFrameHeader oHeader;
+	return ReceiveFrame(oHeader, vecData);
+}
+
+bool CNamedPipe::SendFrame(uint16_t nType, uint16_t nFlags, const void* pData, size_t nSize, uint16_t nChannel)
+{
+	if (m_eMode != EMode::Write)
+		return Fail(EPipeError::InvalidMode);
+	if (nSize > m_nMaxMessageSize)
+		return Fail(EPipeError::FrameTooLarge);
+
+	const uint64_t nStart = (m_pMetrics != nullptr) ? CPipeMetrics::Now() : 0;
+	const uint64_t nCaptureTime = (m_pCapture != nullptr) ? m_pCapture->Now() : 0;
+	SFrameHeader oHeader;
+	oHeader.nType = nType;
+	oHeader.nFlags = nFlags;
+	oHeader.nChannel = nChannel;
+	oHeader.nLength = uint32_t(nSize);
+
+	const bool bOk = m_bFlowControl ? SendControlled(oHeader, pData, nSize) : WriteFrame(oHeader, pData, nSize);
+	// The capture keeps the plaintext, timed by the send call
+	if (bOk && m_pCapture != nullptr)
+		m_pCapture->Record(nCaptureTime, m_nCaptureId, oHeader, pData, nSize);
+
+	return CountSent(bOk, nStart, nSize);
+}
+
+const byte* CNamedPipe::EncodeFrame(SFrameHeader& oHeader, byte* arrHeader, const void*& pData, size_t& nSize, CPooledBuffer& oSealed,
+	byte* arrTrailer)
+{
+	// The payload is sealed with the final header, the checksum covers the bytes on the wire
+	const bool bSeal = m_oCipher.IsEnabled() && CFrameCipher::IsSealedType(oHeader.nType);
+	if (m_bChecksum)
+		oHeader.nFlags |= FrameFlagChecksum;
+	if (bSeal)
+		oHeader.nFlags |= FrameFlagEncrypted;
+	oHeader.nLength = uint32_t(nSize + (bSeal ? c_nFrameCipherOverhead : 0));
+	oHeader.Encode(arrHeader);
+	if (bSeal)
+	{
+		oSealed = m_pBufferPool->Acquire(oHeader.nLength);
+		m_oCipher.Seal(arrHeader, pData, nSize, oSealed.GetData());
+		pData = oSealed.GetData();
+		nSize = oHeader.nLength;
+	}
+	if (!m_bChecksum)
+		return nullptr;
+
+	EncodeChecksum(arrTrailer, GetFrameChecksum(arrHeader, pData, nSize));
+	return arrTrailer;
+}
+
+size_t CNamedPipe::GetWireSize(const SFrameHeader& oHeader, size_t nSize) const
+{
+	const bool bSeal = m_oCipher.IsEnabled() && CFrameCipher::IsSealedType(oHeader.nType);
+	return c_nFrameHeaderSize + nSize + (bSeal ? c_nFrameCipherOverhead : 0) + (m_bChecksum ? c_nFrameChecksumSize : 0);
+}
+
+template <class TSend>
+EIoStatus CNamedPipe::TransmitFrame(const SFrameHeader& oHeader, const void* pData, size_t nSize, TSend fnSend)
+{
+	SFrameHeader oWire = oHeader;
+	byte arrHeader[c_nFrameHeaderSize];
+	byte arrTrailer[c_nFrameChecksumSize];
+	CPooledBuffer oSealed;
+	const byte* pTrailer = EncodeFrame(oWire, arrHeader, pData, nSize, oSealed, arrTrailer);
+
+	// Header, payload and trailer go as one gather, so the transport can send them by a single call
+	SIoBuffer arrBuffers[3];
+	return fnSend(arrBuffers, MakeFrameBuffers(arrBuffers, arrHeader, pData, nSize, pTrailer));
+}
+
+bool CNamedPipe::WriteFrame(const SFrameHeader& oHeader, const void* pData, size_t nSize)
+{
+	if (m_bBatching)
+		return QueueFrame(oHeader, pData, nSize);
+
+	const EPipeError eWritable = EnsureWritable();
+	if (eWritable != EPipeError::None)
+		return Fail(eWritable);
+
+	auto fnSend = [this](const SIoBuffer* arrBuffers, size_t nCount) { return m_pTransport->Send(arrBuffers, nCount); };
+	EIoStatus eStatus = TransmitFrame(oHeader, pData, nSize, fnSend);
+	// The reconnected reader has a session of its own, the frame is sealed again for it
+	if (eStatus == EIoStatus::Disconnected && m_bAutoReconnect && Reconnect())
+		eStatus = TransmitFrame(oHeader, pData, nSize, fnSend);
+
+	return Check(eStatus);
+}
+
+bool CNamedPipe::ReceiveFrame(SFrameHeader& oHeader, std::vector<byte>& vecData)
+{
+	if (!BeginReceive(oHeader))
+		return false;
+
+	// Payload is read straight into the caller's buffer
+	vecData.resize(oHeader.GetPayloadSize());
+	return EndReceive(ReadPayload(oHeader, vecData.data()));
+}
+
+bool CNamedPipe::ReceiveFrame(SFrameHeader& oHeader, CPooledBuffer& oBuffer)
+{
+	if (!BeginReceive(oHeader))
+		return false;
+
+	oBuffer = m_pBufferPool->Acquire(oHeader.GetPayloadSize());
+	return EndReceive(ReadPayload(oHeader, oBuffer.GetData()));
+}
+
+bool CNamedPipe::ReceiveFrame(SFrameHeader& oHeader, void* pBuffer, size_t nCapacity, SByteSpan& oPayload)
+{
+	oPayload = SByteSpan();
+	if (!BeginReceive(oHeader))
+		return false;
+
+	if (oHeader.GetPayloadSize() > nCapacity)
 	{
-		void const* pBuffer = vecData.data();
-		const DWORD nBufferSize = DWORD(vecData.size());
-		DWORD nBufferWritten = 0;
-		while (nBufferWritten != nBufferSize)
+		// The frame is consumed, so the session stays usable
+		if (!EndReceive(Skip(oHeader.GetFrameSize() - c_nFrameHeaderSize)))
+			return false;
+		return Fail(EPipeError::FrameTooLarge);
+	}
+
+	if (!EndReceive(ReadPayload(oHeader, pBuffer)))
+		return false;
+
+	oPayload.pData = static_cast<const byte*>(pBuffer);
+	oPayload.nSize = oHeader.nLength;
+	return true;
+}
+
+bool CNamedPipe::SendStreamChunk(const void* pData, size_t nSize, bool bLast)
+{
+	if (!SendStreamFrame(NextStreamFlags(bLast), pData, nSize))
+	{
+		m_bStreamSending = false;
+		return false;
+	}
+
+	return true;
+}
+
+#ifdef _WIN32
+bool CNamedPipe::SendStream(HANDLE hFile)
+#else
+bool CNamedPipe::SendStream(int nFd)
+#endif
+{
+	if (m_eMode != EMode::Write)
+		return Fail(EPipeError::InvalidMode);
+
+#ifndef _WIN32
+	// Regular file goes from the page cache straight to the pipe, its position moves to the end like by the reads
+	struct stat oStat;
+	const off_t nStart = lseek(nFd, 0, SEEK_CUR);
+	if (!m_bFlowControl && m_pTransport != nullptr && m_pTransport->CanSendFile() && nStart >= 0 && fstat(nFd, &oStat) == 0 &&
+		S_ISREG(oStat.st_mode))
+	{
+		const uint64_t nEnd = (std::max)(uint64_t(oStat.st_size), uint64_t(nStart));
+		for (uint64_t nOffset = uint64_t(nStart);;)
 		{
-			DWORD nWritten = 0;
-			WriteFile(m_hHandler, pBuffer, nBufferSize - nBufferWritten, &nWritten, NULL);
-			nBufferWritten += nWritten;
-			pBuffer = ((byte*)pBuffer) + nWritten;
-			nWritten = 0;
+			const size_t nChunk = size_t((std::min)(uint64_t(c_nStreamChunkSize), nEnd - nOffset));
+			const bool bLast = (nOffset + nChunk == nEnd);
+			if (!SendFileFrame(NextStreamFlags(bLast), nFd, nOffset, nChunk))
+			{
+				m_bStreamSending = false;
+				return false;
+			}
+			nOffset += nChunk;
+			if (bLast)
+			{
+				lseek(nFd, off_t(nEnd), SEEK_SET);
+				return true;
+			}
+		}
+	}
+#endif
+
+	// One buffer of the pool is reused for all the chunks, the end goes as an empty chunk
+	CPooledBuffer oChunk = m_pBufferPool->Acquire(c_nStreamChunkSize);
+	for (;;)
+	{
+#ifdef _WIN32
+		DWORD nRead = 0;
+		if (!ReadFile(hFile, oChunk.GetData(), DWORD(c_nStreamChunkSize), &nRead, NULL))
+#else
+		ssize_t nRead = read(nFd, oChunk.GetData(), c_nStreamChunkSize);
+		if (nRead < 0 && errno == EINTR)
+			continue;
+		if (nRead < 0)
+#endif
+		{
+			AbortStream();
+			return Fail(EPipeError::IoFailure);
 		}
-		bOk = (nBufferWritten == nBufferSize);
+		if (!SendStreamChunk(oChunk.GetData(), size_t(nRead), nRead == 0))
+			return false;
+		if (nRead == 0)
+			return true;
+	}
+}
+
+bool CNamedPipe::AbortStream()
+{
+	if (!m_bStreamSending)
+		return true;
+
+	m_bStreamSending = false;
+	return SendStreamFrame(uint16_t(FrameFlagContinued | FrameFlagAborted), nullptr, 0);
+}
+
+uint16_t CNamedPipe::NextStreamFlags(bool bLast)
+{
+	uint16_t nFlags = bLast ? uint16_t(FrameFlagNone) : uint16_t(FrameFlagMore);
+	if (m_bStreamSending)
+		nFlags |= FrameFlagContinued;
+	else
+		m_nStreamConnection = m_nReconnectCount;
+
+	m_bStreamSending = !bLast;
+	return nFlags;
+}
+
+bool CNamedPipe::SendStreamFrame(uint16_t nFlags, const void* pData, size_t nSize)
+{
+	if (!SendFrame(uint16_t(EFrameType::Data), nFlags, pData, nSize))
+		return false;
+
+	return CheckStreamConnection(nFlags);
+}
+
+bool CNamedPipe::CheckStreamConnection(uint16_t nFlags)
+{
+	// The chunk resent to the reconnected reader misses the start of its stream, the reader drops it
+	if ((nFlags & FrameFlagContinued) != 0 && m_nStreamConnection != m_nReconnectCount)
+		return Fail(EPipeError::Disconnected);
+
+	return true;
+}
+
+#ifndef _WIN32
+bool CNamedPipe::SendFile(int nFd, uint64_t nOffset, size_t nSize)
+{
+	if (m_eMode != EMode::Write)
+		return Fail(EPipeError::InvalidMode);
+	if (nSize > m_nMaxMessageSize)
+		return Fail(EPipeError::FrameTooLarge);
+
+	return SendFileFrame(FrameFlagNone, nFd, nOffset, nSize);
+}
+
+bool CNamedPipe::SendDescriptor(int nFd, const void* pData, size_t nSize)
+{
+	if (m_eMode != EMode::Write)
+		return Fail(EPipeError::InvalidMode);
+	if (nSize > m_nMaxMessageSize)
+		return Fail(EPipeError::FrameTooLarge);
+	// Frames queued or kept for credits go first
+	if (!Flush())
+		return false;
+
+	const uint64_t nStart = (m_pMetrics != nullptr) ? CPipeMetrics::Now() : 0;
+	SFrameHeader oHeader;
+	oHeader.nType = uint16_t(EFrameType::Descriptor);
+	oHeader.nLength = uint32_t(nSize);
+
+	std::lock_guard<std::mutex> oLock(m_mtxWrite);
+	const EPipeError eWritable = EnsureWritable();
+	if (eWritable != EPipeError::None)
+		return Fail(eWritable);
+	if (!m_pTransport->CanPassDescriptors())
+		return Fail(EPipeError::InvalidMode);
+
+	auto fnSend = [this, nFd](const SIoBuffer* arrBuffers, size_t nCount) { return m_pTransport->SendDescriptor(nFd, arrBuffers, nCount); };
+	EIoStatus eStatus = TransmitFrame(oHeader, pData, nSize, fnSend);
+	if (eStatus == EIoStatus::Disconnected && m_bAutoReconnect && Reconnect())
+		eStatus = TransmitFrame(oHeader, pData, nSize, fnSend);
+
+	return CountSent(Check(eStatus), nStart, nSize);
+}
+
+int CNamedPipe::TakeDescriptor()
+{
+	const int nFd = m_nDescriptor;
+	m_nDescriptor = -1;
+	return nFd;
+}
+
+bool CNamedPipe::SendFileFrame(uint16_t nFlags, int nFd, uint64_t nOffset, size_t nSize)
+{
+	// The header promises the whole range, so a short file must not start the frame
+	struct stat oStat;
+	if (fstat(nFd, &oStat) != 0 || (S_ISREG(oStat.st_mode) && nOffset + nSize > uint64_t(oStat.st_size)))
+		return Fail(EPipeError::IoFailure);
+
+	if (m_bFlowControl || m_bChecksum || m_oCipher.IsEnabled() || m_pTransport == nullptr || !m_pTransport->CanSendFile())
+	{
+		// Credits are taken, the payload is sealed and the checksum is computed per buffered frame,
+		// the file is read into a buffer of the pool then
+		CPooledBuffer oBuffer = m_pBufferPool->Acquire(nSize);
+		for (size_t nRead = 0; nRead < nSize;)
+		{
+			const ssize_t nResult = pread(nFd, oBuffer.GetData() + nRead, nSize - nRead, off_t(nOffset + nRead));
+			if (nResult < 0 && errno == EINTR)
+				continue;
+			if (nResult <= 0)
+				return Fail(EPipeError::IoFailure);
+			nRead += size_t(nResult);
+		}
+		return SendStreamFrame(nFlags, oBuffer.GetData(), nSize);
+	}
+
+	const uint64_t nStart = (m_pMetrics != nullptr) ? CPipeMetrics::Now() : 0;
+	const uint64_t nCaptureTime = (m_pCapture != nullptr) ? m_pCapture->Now() : 0;
+	SFrameHeader oHeader;
+	oHeader.nType = uint16_t(EFrameType::Data);
+	oHeader.nFlags = nFlags;
+	oHeader.nLength = uint32_t(nSize);
+	byte arrHeader[c_nFrameHeaderSize];
+	oHeader.Encode(arrHeader);
+	if (!CountSent(WriteFileFrame(arrHeader, nFd, nOffset, nSize), nStart, nSize))
+		return false;
+	// The payload never comes to the memory, the length is recorded only
+	if (m_pCapture != nullptr)
+		m_pCapture->Record(nCaptureTime, m_nCaptureId, oHeader, nullptr, nSize);
+
+	return CheckStreamConnection(nFlags);
+}
+
+bool CNamedPipe::WriteFileFrame(const byte* arrHeader, int nFd, uint64_t nOffset, size_t nSize)
+{
+	// Queued frames go first, the file frame follows them directly
+	if (m_bBatching && !FlushBatch())
+		return false;
+
+	std::lock_guard<std::mutex> oLock(m_mtxWrite);
+	const EPipeError eWritable = EnsureWritable();
+	if (eWritable != EPipeError::None)
+		return Fail(eWritable);
+
+	SIoBuffer oHeader;
+	oHeader.pData = arrHeader;
+	oHeader.nSize = c_nFrameHeaderSize;
+	auto fnSend = [&]()
+	{
+		EIoStatus eStatus = m_pTransport->Send(&oHeader, 1);
+		return (eStatus == EIoStatus::Ok) ? m_pTransport->SendFile(nFd, nOffset, nSize) : eStatus;
+	};
+
+	EIoStatus eStatus = fnSend();
+	if (eStatus == EIoStatus::Disconnected && m_bAutoReconnect && Reconnect())
+		eStatus = fnSend();
+
+	return Check(eStatus);
+}
+#endif
+
+bool CNamedPipe::ReceiveStreamChunk(CPooledBuffer& oChunk, bool& bLast)
+{
+	for (;;)
+	{
+		// A failed receive drops the writer, so the next one starts with no stream
+		const bool bContinuing = m_bStreamReceiving;
+		SFrameHeader oHeader;
+		if (!ReceiveFrame(oHeader, oChunk))
+			return false;
+		if (oHeader.nType != uint16_t(EFrameType::Data))
+			continue;
+
+		if ((oHeader.nFlags & FrameFlagContinued) != 0 && !bContinuing)
+		{
+			// Rest of the stream whose start has gone with the previous writer
+			m_bStreamReceiving = false;
+			continue;
+		}
+		if ((oHeader.nFlags & FrameFlagAborted) != 0)
+		{
+			m_bStreamReceiving = false;
+			return Fail(EPipeError::Cancelled);
+		}
+
+		bLast = (oHeader.nFlags & FrameFlagMore) == 0;
+		return true;
+	}
+}
+
+bool CNamedPipe::ReceiveStream(const TStreamSink& fnSink)
+{
+	bool bSkipping = false;
+	for (;;)
+	{
+		CPooledBuffer oChunk;
+		bool bLast = false;
+		if (!ReceiveStreamChunk(oChunk, bLast))
+			return false;
+
+		if (!bSkipping && !fnSink(oChunk.GetData(), oChunk.GetSize()))
+			bSkipping = true;
+		if (bLast)
+			return bSkipping ? Fail(EPipeError::Cancelled) : true;
+	}
+}
+
+void CNamedPipe::SetSessionMode(bool bEnable)
+{
+	m_bSessionMode = bEnable;
+}
+
+void CNamedPipe::SetAutoReconnect(bool bEnable, uint32_t nTimeoutMs)
+{
+	m_bAutoReconnect = bEnable;
+	m_nReconnectTimeoutMs = nTimeoutMs;
+}
+
+bool CNamedPipe::SetBatching(bool bEnable, size_t nMaxBytes, uint32_t nMaxDelayMs)
+{
+	if (m_eMode != EMode::Write)
+		return Fail(EPipeError::InvalidMode);
+
+	// Queued frames are written with the old settings
+	bool bOk = (!m_bBatching || Flush());
+	StopFlusher();
+	m_bBatching = bEnable;
+	if (!bEnable)
+		return bOk;
+
+	m_nBatchLimit = (std::max)(nMaxBytes, c_nFrameHeaderSize);
+	m_nBatchDelayMs = nMaxDelayMs;
+	m_vecBatch.reserve(m_nBatchLimit);
+	m_vecFlushing.reserve(m_nBatchLimit);
+	if (m_nBatchDelayMs > 0)
+	{
+		m_bStopFlusher = false;
+		m_oFlusher = std::thread(&CNamedPipe::RunFlusher, this);
 	}
 
 	return bOk;
 }
 
-bool CNamedPipe::ReceiveData(std::vector<byte>& vecData)
+bool CNamedPipe::Flush()
+{
+	// Frames kept for credits go first
+	if (m_bFlowControl && !SendPending(true))
+		return false;
+
+	return !m_bBatching || FlushBatch();
+}
+
+bool CNamedPipe::SetFlowControl(bool bEnable, EFlowPolicy ePolicy, size_t nQueueLimit)
+{
+	if (m_eMode != EMode::Write)
+		return Fail(EPipeError::InvalidMode);
+
+	// Kept frames are sent with the old settings
+	bool bOk = SendPending(true);
+	m_bFlowControl = bEnable;
+	m_eFlowPolicy = ePolicy;
+	m_nPendingLimit = nQueueLimit;
+
+	return bOk;
+}
+
+int64_t CNamedPipe::GetCredits() const
+{
+	if (!m_bFlowControl || m_bUnlimitedCredit)
+		return INT64_MAX;
+
+	return m_nCredits;
+}
+
+uint64_t CNamedPipe::GetDroppedCount() const
+{
+	return m_nDroppedCount;
+}
+
+void CNamedPipe::SetReceiveWindow(uint32_t nBytes)
+{
+	m_nReceiveWindow = nBytes;
+}
+
+bool CNamedPipe::FlushBatch()
 {
-	bool bOk = false;
-	if (m_hHandler != INVALID_HANDLE_VALUE && m_eMode == EMode::Read)
+	EPipeError eError = EPipeError::None;
 	{
-		// Wait for someone to connect to the pipe
-		if (ConnectNamedPipe(m_hHandler, NULL) != FALSE)
+		// Failure of the background write comes first
+		std::lock_guard<std::mutex> oLock(m_mtxBatch);
+		std::swap(eError, m_eBatchError);
+	}
+	if (eError == EPipeError::None)
+		eError = WriteBatch(nullptr, nullptr, 0);
+
+	return (eError == EPipeError::None) || Fail(eError);
+}
+
+bool CNamedPipe::IsConnected() const
+{
+	if (m_pTransport == nullptr || !m_pTransport->IsOpen())
+		return false;
+
+	return (m_eMode == EMode::Write) || m_bConnected;
+}
+
+void CNamedPipe::SetChecksum(bool bEnable)
+{
+	m_bChecksum = bEnable;
+}
+
+bool CNamedPipe::SetEncryption(const void* pKey, size_t nKeySize)
+{
+	// The writer starts the session by Open
+	if (IsOpen())
+		return Fail(EPipeError::InvalidMode);
+
+	return m_oCipher.SetKey(pKey, nKeySize);
+}
+
+bool CNamedPipe::EnableMetrics(bool bEnable)
+{
+	// The hot paths test the pointer without a lock
+	if (IsOpen())
+		return Fail(EPipeError::InvalidMode);
+
+	m_pMetrics = bEnable ? CPipeMetrics::Create() : nullptr;
+	m_nPartialWriteBase = (m_pTransport != nullptr) ? m_pTransport->GetPartialWriteCount() : 0;
+	return true;
+}
+
+bool CNamedPipe::GetMetrics(SPipeMetrics& oMetrics) const
+{
+	CPipeMetricsPtr pMetrics = m_pMetrics;
+	if (pMetrics == nullptr)
+		return false;
+
+	// The transport counts its partial writes itself, the credits are sampled now
+	oMetrics = pMetrics->Snapshot();
+	if (m_pTransport != nullptr)
+		oMetrics.arrCounters[size_t(EPipeCounter::PartialWrites)] = m_pTransport->GetPartialWriteCount() - m_nPartialWriteBase;
+	if (m_eMode == EMode::Write)
+		oMetrics.arrGauges[size_t(EPipeGauge::Credits)] = GetCredits();
+	return true;
+}
+
+bool CNamedPipe::SetCapture(CPipeCapturePtr pCapture, uint64_t nConnectionId)
+{
+	// Read without a lock, like the metrics
+	if (IsOpen())
+		return Fail(EPipeError::InvalidMode);
+
+	m_pCapture = pCapture;
+	m_nCaptureId = nConnectionId;
+	return true;
+}
+
+void CNamedPipe::SetWaitStrategy(const SWaitStrategy& oStrategy)
+{
+	if (m_pTransport != nullptr)
+		m_pTransport->SetWaitStrategy(oStrategy);
+}
+
+void CNamedPipe::SetMaxMessageSize(uint32_t nMaxSize)
+{
+	m_nMaxMessageSize = nMaxSize;
+}
+
+CNamedPipe::EPipeError CNamedPipe::GetLastPipeError() const
+{
+	return m_eLastError;
+}
+
+std::string CNamedPipe::ToString(const std::vector<byte>& vecData)
+{
+	return std::string(reinterpret_cast<const char*>(vecData.data()), vecData.size());
+}
+
+std::vector<byte> CNamedPipe::FromString(const std::string& sStr)
+{
+	const byte* pData = reinterpret_cast<const byte*>(sStr.data());
+	return std::vector<byte>(pData, pData + sStr.size());
+}
+
+bool CNamedPipe::ReadExact(void* pData, size_t nSize)
+{
+	byte* pBuffer = static_cast<byte*>(pData);
+	while (nSize > 0)
+	{
+		size_t nRead = 0;
+		if (!Check(m_pTransport->Receive(pBuffer, nSize, nRead)))
+			return false;
+		pBuffer += nRead;
+		nSize -= nRead;
+	}
+
+	return true;
+}
+
+bool CNamedPipe::ReadPayload(SFrameHeader& oHeader, void* pData)
+{
+	const bool bChecksum = (oHeader.nFlags & FrameFlagChecksum) != 0;
+	const bool bSealed = (oHeader.nFlags & FrameFlagEncrypted) != 0;
+	if (!bChecksum && !bSealed)
+		return ReadExact(pData, oHeader.nLength) && CountReceived(oHeader, pData);
+
+	// Every received part is summed and decrypted while it's still in the cache
+	byte arrHeader[c_nFrameHeaderSize];
+	oHeader.Encode(arrHeader);
+	const uint32_t nSize = oHeader.GetPayloadSize();
+	uint32_t nChecksum = bChecksum ? Crc32c(0, arrHeader, c_nFrameHeaderSize) : 0;
+	CFrameCipher::SOpenState oState;
+	bool bAuthentic = true;
+	byte arrSequence[c_nFrameSequenceSize];
+	if (bSealed)
+	{
+		if (!ReadExact(arrSequence, c_nFrameSequenceSize))
+			return false;
+		if (bChecksum)
+			nChecksum = Crc32c(nChecksum, arrSequence, c_nFrameSequenceSize);
+		bAuthentic = m_oCipher.BeginOpen(arrHeader, arrSequence, oState);
+	}
+
+	// The plaintext of the frame that fails is not left to the caller
+	auto fnFail = [&](EPipeError eError)
+	{
+		if (bSealed)
+			memset(pData, 0, nSize);
+		return (eError == EPipeError::None) ? false : Fail(eError);
+	};
+
+	byte* pBuffer = static_cast<byte*>(pData);
+	for (size_t nLeft = nSize; nLeft > 0;)
+	{
+		size_t nRead = 0;
+		if (!Check(m_pTransport->Receive(pBuffer, nLeft, nRead)))
+			return fnFail(EPipeError::None);
+		if (bChecksum)
+			nChecksum = Crc32c(nChecksum, pBuffer, nRead);
+		if (bAuthentic && bSealed)
+			m_oCipher.Decrypt(oState, pBuffer, nRead);
+		pBuffer += nRead;
+		nLeft -= nRead;
+	}
+
+	byte arrTag[c_nFrameTagSize];
+	if (bSealed)
+	{
+		if (!ReadExact(arrTag, c_nFrameTagSize))
+			return fnFail(EPipeError::None);
+		if (bChecksum)
+			nChecksum = Crc32c(nChecksum, arrTag, c_nFrameTagSize);
+	}
+	if (bChecksum)
+	{
+		byte arrTrailer[c_nFrameChecksumSize];
+		if (!ReadExact(arrTrailer, c_nFrameChecksumSize))
+			return fnFail(EPipeError::None);
+		if (DecodeChecksum(arrTrailer) != nChecksum)
+			return fnFail(EPipeError::ChecksumMismatch);
+	}
+	if (!bSealed)
+		return CountReceived(oHeader, pData);
+	if (!bAuthentic || !m_oCipher.EndOpen(oState, arrTag))
+		return fnFail(EPipeError::AuthenticationFailed);
+
+	// The header describes the opened payload from now on
+	oHeader.nFlags &= uint16_t(~FrameFlagEncrypted);
+	oHeader.nLength = nSize;
+	return CountReceived(oHeader, pData);
+}
+
+bool CNamedPipe::BeginReceive(SFrameHeader& oHeader)
+{
+	if (!IsOpen())
+		return Fail(EPipeError::NotOpen);
+	if (m_eMode != EMode::Read)
+		return Fail(EPipeError::InvalidMode);
+
+	if (!EnsureConnected())
+		return false;
+
+	for (;;)
+	{
+		byte arrHeader[c_nFrameHeaderSize];
+		if (!ReadExact(arrHeader, c_nFrameHeaderSize))
+			return EndReceive(false);
+
+		if (m_pMetrics != nullptr)
+			m_nReceiveStart = CPipeMetrics::Now();
+		oHeader.Decode(arrHeader);
+		if (!oHeader.IsValid(m_nMaxMessageSize))
+		{
+			Fail(EPipeError::InvalidFrame);
+			return EndReceive(false);
+		}
+		if (oHeader.nType == uint16_t(EFrameType::Session))
 		{
-			void* pBuffer = new byte[1024];
-			DWORD nBufferRead = 0;
-			bool bRead = true;
-			while (bRead)
+			// The keys of the writer's session, the reader without the key ignores it
+			byte arrSession[c_nSessionSaltSize + c_nFrameChecksumSize];
+			if (oHeader.GetFrameSize() - c_nFrameHeaderSize > sizeof(arrSession))
 			{
-				DWORD nRead = 0;
-				BOOL bResult = ReadFile(m_hHandler, pBuffer, DWORD(1024), &nRead, NULL);
-				if (!bResult && GetLastError() == ERROR_MORE_DATA)
-					continue;
-				if (bResult)
-				{
-					nBufferRead += nRead;
-					nRead = 0;
-				}
-				bRead = false;
+				Fail(EPipeError::InvalidFrame);
+				return EndReceive(false);
 			}
-			bOk = (nBufferRead > 0);
-			if (bOk)
+			if (!ReadExact(arrSession, oHeader.GetFrameSize() - c_nFrameHeaderSize))
+				return EndReceive(false);
+			if (m_oCipher.IsEnabled() && !m_oCipher.AcceptSession(oHeader, arrSession))
 			{
-				byte* pData = (byte*)(pBuffer);
-				vecData.clear();
-				vecData.resize(nBufferRead);
-				for (size_t i = 0; i < nBufferRead; ++i)
-					vecData[i] = pData[i];
+				Fail(EPipeError::InvalidFrame);
+				return EndReceive(false);
 			}
-			delete[] pBuffer;
+			continue;
 		}
-		DisconnectNamedPipe(m_hHandler);
+		if (oHeader.nType != uint16_t(EFrameType::FlowControl))
+			break;
+
+		// The request is answered here, it is not a message
+		m_bPeerFlowControl = true;
+		m_nConsumed = 0;
+		if (!Skip(oHeader.GetFrameSize() - c_nFrameHeaderSize) || !GrantCredit(m_nReceiveWindow == 0 ? c_nUnlimitedCredit : m_nReceiveWindow))
+			return EndReceive(false);
+	}
+
+	// The reader with the key takes only the sealed frames, the one without it can't open them
+	const bool bSealed = (oHeader.nFlags & FrameFlagEncrypted) != 0;
+	if (bSealed ? !m_oCipher.HasSession() : (m_oCipher.IsEnabled() && CFrameCipher::IsSealedType(oHeader.nType)))
+	{
+		Fail(EPipeError::AuthenticationFailed);
+		return EndReceive(false);
+	}
+
+	if (m_bPeerFlowControl)
+		m_nConsumed += oHeader.GetFrameSize();
+	m_bStreamReceiving = (oHeader.nFlags & FrameFlagMore) != 0;
+#ifndef _WIN32
+	// The descriptor has come with the first byte of the frame, the one nobody has taken is closed
+	if (oHeader.nType == uint16_t(EFrameType::Descriptor))
+	{
+		if (m_nDescriptor >= 0)
+			close(m_nDescriptor);
+		m_nDescriptor = m_pTransport->TakeDescriptor();
+	}
+#endif
+	return true;
+}
+
+bool CNamedPipe::EndReceive(bool bOk)
+{
+	// Broken stream can't be resynchronized, so the writer is dropped on any failure.
+	// Outside the session mode the writer is kept until its stream of chunks ends
+	if (!bOk || (!m_bSessionMode && !m_bStreamReceiving))
+		DropConnection();
+
+	// Credits go back once half of the window is consumed, so the writer rarely waits for them
+	if (m_bConnected && m_bPeerFlowControl && m_nReceiveWindow > 0 && m_nConsumed >= m_nReceiveWindow / 2)
+	{
+		GrantCredit(uint32_t((std::min)(m_nConsumed, size_t(c_nUnlimitedCredit - 1))));
+		m_nConsumed = 0;
 	}
 
 	return bOk;
 }
 
-std::string CNamedPipe::ToString(const std::vector<byte>& vecData)
+bool CNamedPipe::Skip(size_t nSize)
 {
-	std::string sStr;
-	sStr.resize(vecData.size());
-	for (size_t i = 0; i < vecData.size(); ++i)
-		sStr[i] = char(vecData[i]);
+	byte arrBuffer[4096];
+	while (nSize > 0)
+	{
+		const size_t nChunk = (std::min)(nSize, sizeof(arrBuffer));
+		if (!ReadExact(arrBuffer, nChunk))
+			return false;
+		nSize -= nChunk;
+	}
 
-	return sStr;
+	return true;
 }
 
-std::vector<byte> CNamedPipe::FromString(const std::string& sStr)
+bool CNamedPipe::EnsureConnected()
+{
+	if (m_bConnected)
+		return true;
+
+	// Wait for someone to connect to the pipe
+	if (!m_pTransport->Accept())
+		return Fail(EPipeError::IoFailure);
+
+	// Every writer asks for its own credits and starts its own session
+	m_oCipher.EndSession();
+	m_bConnected = true;
+	m_bPeerFlowControl = false;
+	m_nConsumed = 0;
+	if (m_pMetrics != nullptr)
+	{
+		m_pMetrics->Add(EPipeCounter::Connections);
+		m_pMetrics->SetGauge(EPipeGauge::ActiveConnections, 1);
+	}
+	return true;
+}
+
+void CNamedPipe::DropConnection()
 {
-	std::vector<byte> vecData;
-	vecData.resize(sStr.size());
-	for (size_t i = 0; i < sStr.size(); ++i)
-		vecData[i] = byte(sStr[i]);
+	if (!m_bConnected)
+		return;
 
-	return vecData;
+	m_pTransport->Disconnect();
+	m_bConnected = false;
+	m_bStreamReceiving = false;
+	if (m_pMetrics != nullptr)
+		m_pMetrics->SetGauge(EPipeGauge::ActiveConnections, 0);
 }
 
-HANDLE CNamedPipe::CreatePipe(const std::string& sName, EMode eMode)
+bool CNamedPipe::Reconnect()
 {
-	// Set security
-	PSECURITY_DESCRIPTOR psd = NULL;
-	BYTE sd[SECURITY_DESCRIPTOR_MIN_LENGTH];
-	psd = (PSECURITY_DESCRIPTOR)sd;
-	InitializeSecurityDescriptor(psd, SECURITY_DESCRIPTOR_REVISION);
-	SetSecurityDescriptorDacl(psd, TRUE, (PACL)NULL, FALSE);
-	SECURITY_ATTRIBUTES sa = { sizeof(sa), psd, FALSE };
+	m_pTransport->Close();
 
-	std::string sPath = R"(\\.\pipe\)" + sName;
-	HANDLE hHandler = INVALID_HANDLE_VALUE;
-	if (eMode == EMode::Read)
-		hHandler = CreateNamedPipeA(sPath.c_str(), PIPE_ACCESS_INBOUND, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT, 1, 1024 * 16, 1024 * 16, NMPWAIT_USE_DEFAULT_WAIT, &sa);
-	else
-		hHandler = CreateFileA(sPath.c_str(), GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, &sa);
+	// Back off exponentially, the reader may be restarting
+	const auto tpDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_nReconnectTimeoutMs);
+	for (uint32_t nDelayMs = 1;; nDelayMs = (std::min)(nDelayMs * 2, 100u))
+	{
+		// A new session, the frames queued or kept for credits are sealed by its keys when they're written
+		if (m_pTransport->Open())
+		{
+			if (SendSession())
+			{
+				++m_nReconnectCount;
+				Count(EPipeCounter::Reconnects);
+				ResetCredits();
+				m_bReconnectPending = false;
+				return true;
+			}
+			m_pTransport->Close();
+		}
+		if (std::chrono::steady_clock::now() >= tpDeadline)
+		{
+			m_bReconnectPending = true;
+			return false;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(nDelayMs));
+	}
+}
+
+CNamedPipe::EPipeError CNamedPipe::EnsureWritable()
+{
+	// The reader may have come back since the last failed reconnect
+	if (IsOpen() || (m_bReconnectPending && Reconnect()))
+		return EPipeError::None;
+
+	return m_bReconnectPending ? EPipeError::Disconnected : EPipeError::NotOpen;
+}
+
+bool CNamedPipe::SendSession()
+{
+	if (m_eMode != EMode::Write || !m_oCipher.IsEnabled())
+		return true;
+
+	byte arrSession[c_nSessionFrameSize];
+	m_oCipher.StartSession(arrSession);
+	SIoBuffer oSession;
+	oSession.pData = arrSession;
+	oSession.nSize = c_nSessionFrameSize;
+
+	return Check(m_pTransport->Send(&oSession, 1));
+}
+
+bool CNamedPipe::QueueFrame(const SFrameHeader& oHeader, const void* pData, size_t nSize)
+{
+	if (GetWireSize(oHeader, nSize) < m_nBatchLimit)
+	{
+		bool bFull = false;
+		{
+			std::lock_guard<std::mutex> oLock(m_mtxBatch);
+			if (m_eBatchError != EPipeError::None)
+			{
+				EPipeError eError = EPipeError::None;
+				std::swap(eError, m_eBatchError);
+				return Fail(eError);
+			}
+
+			// Small frames are copied, so the whole batch goes by a single write
+			if (m_vecBatch.empty())
+			{
+				m_tpBatchStart = std::chrono::steady_clock::now();
+				m_cvBatch.notify_one();
+			}
+			const size_t nQueued = m_vecBatch.size();
+			if (m_oCipher.IsEnabled())
+				AppendPlainFrame(m_vecBatch, oHeader, pData, nSize);
+			else
+			{
+				// Not sealed, so the frame is encoded now and the batch is written as it is
+				SFrameHeader oWire = oHeader;
+				byte arrHeader[c_nFrameHeaderSize];
+				byte arrTrailer[c_nFrameChecksumSize];
+				CPooledBuffer oSealed;
+				const void* pPayload = pData;
+				size_t nPayloadSize = nSize;
+				const byte* pTrailer = EncodeFrame(oWire, arrHeader, pPayload, nPayloadSize, oSealed, arrTrailer);
+				m_vecBatch.insert(m_vecBatch.end(), arrHeader, arrHeader + c_nFrameHeaderSize);
+				m_vecBatch.insert(m_vecBatch.end(), static_cast<const byte*>(pPayload), static_cast<const byte*>(pPayload) + nPayloadSize);
+				if (pTrailer != nullptr)
+					m_vecBatch.insert(m_vecBatch.end(), pTrailer, pTrailer + c_nFrameChecksumSize);
+			}
+			++m_nBatchFrames;
+			CountQueued(1, int64_t(m_vecBatch.size() - nQueued));
+			bFull = (m_vecBatch.size() >= m_nBatchLimit);
+		}
+
+		return !bFull || FlushBatch();
+	}
+
+	// Large frame is not copied, it follows the queued ones in the same gather
+	EPipeError eError = WriteBatch(&oHeader, pData, nSize);
+
+	return (eError == EPipeError::None) || Fail(eError);
+}
+
+bool CNamedPipe::SendControlled(const SFrameHeader& oHeader, const void* pData, size_t nSize)
+{
+	const size_t nFrameSize = GetWireSize(oHeader, nSize);
+
+	// Kept frames go first, so the order is preserved
+	if (!SendPending(false))
+		return false;
+	bool bTaken = false;
+	if (m_deqPending.empty() && !TakeCredit(nFrameSize, false, bTaken))
+		return false;
+	if (bTaken)
+		return WriteFrame(oHeader, pData, nSize);
+
+	switch (m_eFlowPolicy)
+	{
+	case EFlowPolicy::Error:
+		return Fail(EPipeError::NoCredit);
+
+	case EFlowPolicy::DropOldest:
+	{
+		// Kept as plaintext, sealed when it's sent
+		std::vector<byte> vecFrame;
+		AppendPlainFrame(vecFrame, oHeader, pData, nSize);
+		const size_t nKept = vecFrame.size();
+		m_deqPending.push_back(std::move(vecFrame));
+		m_nPendingBytes += nKept;
+		CountQueued(1, int64_t(nKept));
+		while (m_nPendingBytes > m_nPendingLimit && m_deqPending.size() > 1)
+		{
+			const size_t nDropped = m_deqPending.front().size();
+			m_nPendingBytes -= nDropped;
+			m_deqPending.pop_front();
+			++m_nDroppedCount;
+			Count(EPipeCounter::FramesDropped);
+			CountQueued(-1, -int64_t(nDropped));
+		}
+		return true;
+	}
+
+	default:
+		// The reader grants more only once it gets the batched frames
+		Count(EPipeCounter::CreditWaits);
+		if (m_bBatching && !FlushBatch())
+			return false;
+		if (!TakeCredit(nFrameSize, true, bTaken))
+			return false;
+		return WriteFrame(oHeader, pData, nSize);
+	}
+}
 
-	return hHandler;
+bool CNamedPipe::TakeCredit(size_t nFrameSize, bool bWait, bool& bTaken)
+{
+	std::lock_guard<std::mutex> oLock(m_mtxWrite);
+	bTaken = false;
+	if (!ReadCredits(bWait))
+		return false;
+
+	if (HasCredit())
+	{
+		m_nCredits -= int64_t(nFrameSize);
+		bTaken = true;
+	}
+	return true;
+}
+
+bool CNamedPipe::ReadCredits(bool bWait)
+{
+	for (;;)
+	{
+		const EPipeError eWritable = EnsureWritable();
+		if (eWritable != EPipeError::None)
+			return Fail(eWritable);
+
+		if (!m_bCreditRequested)
+		{
+			// Asked once per connection, the writer sends nothing until answered
+			if (!m_pTransport->IsDuplex())
+				return Fail(EPipeError::InvalidMode);
+			byte arrRequest[c_nFrameHeaderSize];
+			EncodeFlowControl(arrRequest);
+			SIoBuffer oRequest;
+			oRequest.pData = arrRequest;
+			oRequest.nSize = c_nFrameHeaderSize;
+			EIoStatus eStatus = m_pTransport->Send(&oRequest, 1);
+			if (eStatus == EIoStatus::Disconnected && m_bAutoReconnect && Reconnect())
+				continue;
+			if (!Check(eStatus))
+				return false;
+			m_bCreditRequested = true;
+		}
+
+		SFrameHeader oHeader;
+		const uint8_t* pPayload = nullptr;
+		CFrameAssembler::EResult eResult = CFrameAssembler::EResult::Incomplete;
+		while ((eResult = m_oCreditAssembler.Next(oHeader, pPayload)) == CFrameAssembler::EResult::Frame)
+		{
+			uint32_t nCredit = 0;
+			if (!DecodeCredit(oHeader, pPayload, nCredit))
+				continue;
+			m_bCreditGranted = true;
+			if (nCredit == c_nUnlimitedCredit)
+				m_bUnlimitedCredit = true;
+			else
+				m_nCredits += nCredit;
+		}
+		if (eResult == CFrameAssembler::EResult::Invalid)
+			return Fail(EPipeError::InvalidFrame);
+		if (eResult == CFrameAssembler::EResult::Corrupted)
+			return Fail(EPipeError::ChecksumMismatch);
+
+		// The credits left are used up before the reader is polled again
+		if (m_bCreditGranted && HasCredit())
+			return true;
+
+		const size_t nChunk = 16 * c_nCreditFrameSize;
+		byte* pBuffer = m_oCreditAssembler.GetWriteBuffer(nChunk);
+		size_t nRead = 0;
+		EIoStatus eStatus = (bWait || !m_bCreditGranted) ? m_pTransport->Receive(pBuffer, nChunk, nRead) : m_pTransport->TryReceive(pBuffer, nChunk, nRead);
+		if (eStatus == EIoStatus::Disconnected && m_bAutoReconnect && Reconnect())
+			continue;
+		if (!Check(eStatus))
+			return false;
+		if (nRead == 0)
+			return true;
+		m_oCreditAssembler.CommitWrite(nRead);
+	}
+}
+
+bool CNamedPipe::SendPending(bool bWait)
+{
+	while (!m_deqPending.empty())
+	{
+		SFrameHeader oHeader;
+		oHeader.Decode(m_deqPending.front().data());
+		const size_t nFrameSize = GetWireSize(oHeader, oHeader.nLength);
+		bool bTaken = false;
+		if (!TakeCredit(nFrameSize, false, bTaken))
+			return false;
+		if (!bTaken)
+		{
+			if (!bWait)
+				return true;
+			Count(EPipeCounter::CreditWaits);
+			if ((m_bBatching && !FlushBatch()) || !TakeCredit(nFrameSize, true, bTaken))
+				return false;
+		}
+
+		std::vector<byte> vecFrame = std::move(m_deqPending.front());
+		m_deqPending.pop_front();
+		m_nPendingBytes -= vecFrame.size();
+		CountQueued(-1, -int64_t(vecFrame.size()));
+		if (!WriteFrame(oHeader, vecFrame.data() + c_nFrameHeaderSize, oHeader.nLength))
+			return false;
+	}
+
+	return true;
+}
+
+bool CNamedPipe::HasCredit() const
+{
+	return (m_bUnlimitedCredit || m_nCredits > 0);
+}
+
+void CNamedPipe::ResetCredits()
+{
+	m_bCreditRequested = false;
+	m_bCreditGranted = false;
+	m_bUnlimitedCredit = false;
+	m_nCredits = 0;
+	m_oCreditAssembler.Reset();
+}
+
+bool CNamedPipe::GrantCredit(uint32_t nCredit)
+{
+	byte arrCredit[c_nCreditFrameSize];
+	EncodeCredit(arrCredit, nCredit);
+	SIoBuffer oCredit;
+	oCredit.pData = arrCredit;
+	oCredit.nSize = c_nCreditFrameSize;
+
+	return Check(m_pTransport->Send(&oCredit, 1));
+}
+
+CNamedPipe::EPipeError CNamedPipe::WriteBatch(const SFrameHeader* pHeader, const void* pData, size_t nSize)
+{
+	std::lock_guard<std::mutex> oWriteLock(m_mtxWrite);
+	size_t nFrames = 0;
+	{
+		// Producers keep queueing into the other buffer meanwhile
+		std::lock_guard<std::mutex> oLock(m_mtxBatch);
+		m_vecFlushing.swap(m_vecBatch);
+		std::swap(nFrames, m_nBatchFrames);
+	}
+	if (m_vecFlushing.empty() && pHeader == nullptr)
+		return EPipeError::None;
+
+	Count(EPipeCounter::BatchFlushes);
+	CountQueued(-int64_t(nFrames), -int64_t(m_vecFlushing.size()));
+
+	EPipeError eError = EnsureWritable();
+	if (eError == EPipeError::None)
+	{
+		auto fnWrite = [&]()
+		{
+			// The queued frames are sealed before the frame that follows them, the sequence numbers keep the order
+			SIoBuffer arrGather[4];
+			size_t nGather = 0;
+			if (!m_vecFlushing.empty())
+			{
+				const std::vector<byte>& vecFrames = m_oCipher.IsEnabled() ? SealBatch() : m_vecFlushing;
+				arrGather[nGather].pData = vecFrames.data();
+				arrGather[nGather].nSize = vecFrames.size();
+				++nGather;
+			}
+			if (pHeader == nullptr)
+				return m_pTransport->Send(arrGather, nGather);
+
+			return TransmitFrame(*pHeader, pData, nSize, [&](const SIoBuffer* arrBuffers, size_t nCount)
+			{
+				for (size_t i = 0; i < nCount; ++i)
+					arrGather[nGather + i] = arrBuffers[i];
+				return m_pTransport->Send(arrGather, nGather + nCount);
+			});
+		};
+
+		// The reconnected reader has a session of its own, the frames are sealed again for it
+		EIoStatus eStatus = fnWrite();
+		if (eStatus == EIoStatus::Disconnected && m_bAutoReconnect && Reconnect())
+			eStatus = fnWrite();
+		eError = ToPipeError(eStatus);
+	}
+	m_vecFlushing.clear();
+
+	return eError;
+}
+
+const std::vector<byte>& CNamedPipe::SealBatch()
+{
+	m_vecSealed.clear();
+	for (size_t nOffset = 0; nOffset < m_vecFlushing.size();)
+	{
+		SFrameHeader oHeader;
+		oHeader.Decode(m_vecFlushing.data() + nOffset);
+		const void* pData = m_vecFlushing.data() + nOffset + c_nFrameHeaderSize;
+		size_t nSize = oHeader.nLength;
+		nOffset += c_nFrameHeaderSize + nSize;
+
+		byte arrHeader[c_nFrameHeaderSize];
+		byte arrTrailer[c_nFrameChecksumSize];
+		CPooledBuffer oSealed;
+		const byte* pTrailer = EncodeFrame(oHeader, arrHeader, pData, nSize, oSealed, arrTrailer);
+		m_vecSealed.insert(m_vecSealed.end(), arrHeader, arrHeader + c_nFrameHeaderSize);
+		m_vecSealed.insert(m_vecSealed.end(), static_cast<const byte*>(pData), static_cast<const byte*>(pData) + nSize);
+		if (pTrailer != nullptr)
+			m_vecSealed.insert(m_vecSealed.end(), pTrailer, pTrailer + c_nFrameChecksumSize);
+	}
+
+	return m_vecSealed;
+}
+
+void CNamedPipe::AppendPlainFrame(std::vector<byte>& vecFrames, const SFrameHeader& oHeader, const void* pData, size_t nSize)
+{
+	SFrameHeader oPlain = oHeader;
+	oPlain.nLength = uint32_t(nSize);
+	const size_t nOffset = vecFrames.size();
+	vecFrames.resize(nOffset + c_nFrameHeaderSize);
+	oPlain.Encode(vecFrames.data() + nOffset);
+	vecFrames.insert(vecFrames.end(), static_cast<const byte*>(pData), static_cast<const byte*>(pData) + nSize);
+}
+
+void CNamedPipe::RunFlusher()
+{
+	std::unique_lock<std::mutex> oLock(m_mtxBatch);
+	while (!m_bStopFlusher)
+	{
+		if (m_vecBatch.empty())
+		{
+			m_cvBatch.wait(oLock);
+			continue;
+		}
+		const auto tpDeadline = m_tpBatchStart + std::chrono::milliseconds(m_nBatchDelayMs);
+		if (std::chrono::steady_clock::now() < tpDeadline)
+		{
+			m_cvBatch.wait_until(oLock, tpDeadline);
+			continue;
+		}
+
+		oLock.unlock();
+		EPipeError eError = WriteBatch(nullptr, nullptr, 0);
+		oLock.lock();
+		if (eError != EPipeError::None && m_eBatchError == EPipeError::None)
+			m_eBatchError = eError;
+	}
+}
+
+void CNamedPipe::StopFlusher()
+{
+	if (!m_oFlusher.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> oLock(m_mtxBatch);
+		m_bStopFlusher = true;
+	}
+	m_cvBatch.notify_one();
+	m_oFlusher.join();
+}
+
+size_t CNamedPipe::MakeFrameBuffers(SIoBuffer* arrBuffers, const byte* arrHeader, const void* pData, size_t nSize, const byte* arrTrailer)
+{
+	arrBuffers[0].pData = arrHeader;
+	arrBuffers[0].nSize = c_nFrameHeaderSize;
+	arrBuffers[1].pData = pData;
+	arrBuffers[1].nSize = nSize;
+	if (arrTrailer == nullptr)
+		return 2;
+
+	arrBuffers[2].pData = arrTrailer;
+	arrBuffers[2].nSize = c_nFrameChecksumSize;
+	return 3;
+}
+
+bool CNamedPipe::CountSent(bool bOk, uint64_t nStart, size_t nSize)
+{
+	if (bOk && m_pMetrics != nullptr)
+	{
+		m_pMetrics->Add(EPipeCounter::MessagesSent);
+		m_pMetrics->Add(EPipeCounter::BytesSent, nSize);
+		m_pMetrics->Record(EPipeLatency::Send, nStart);
+	}
+	return bOk;
+}
+
+bool CNamedPipe::CountReceived(const SFrameHeader& oHeader, const void* pData)
+{
+	if (m_pMetrics != nullptr)
+	{
+		m_pMetrics->Add(EPipeCounter::MessagesReceived);
+		m_pMetrics->Add(EPipeCounter::BytesReceived, oHeader.nLength);
+		m_pMetrics->Record(EPipeLatency::Receive, m_nReceiveStart);
+	}
+	// The descriptor that came with the frame can't be replayed
+	if (m_pCapture != nullptr && oHeader.nType != uint16_t(EFrameType::Descriptor))
+		m_pCapture->Record(m_pCapture->Now(), m_nCaptureId, oHeader, pData, oHeader.nLength);
+	return true;
+}
+
+void CNamedPipe::Count(EPipeCounter eCounter, uint64_t nValue)
+{
+	if (m_pMetrics != nullptr)
+		m_pMetrics->Add(eCounter, nValue);
+}
+
+void CNamedPipe::CountQueued(int64_t nFrames, int64_t nBytes)
+{
+	if (m_pMetrics == nullptr)
+		return;
+
+	m_pMetrics->AddGauge(EPipeGauge::QueuedFrames, nFrames);
+	m_pMetrics->AddGauge(EPipeGauge::QueuedBytes, nBytes);
+}
+
+bool CNamedPipe::Fail(EPipeError eError)
+{
+	m_eLastError = eError;
+	if (m_pMetrics != nullptr)
+	{
+		m_pMetrics->Add(EPipeCounter::Failures);
+		if (eError == EPipeError::Disconnected)
+			m_pMetrics->Add(EPipeCounter::Disconnects);
+		else if (eError == EPipeError::ChecksumMismatch)
+			m_pMetrics->Add(EPipeCounter::ChecksumFailures);
+		else if (eError == EPipeError::AuthenticationFailed)
+			m_pMetrics->Add(EPipeCounter::AuthenticationFailures);
+	}
+	return false;
+}
+
+bool CNamedPipe::Check(EIoStatus eStatus)
+{
+	EPipeError eError = ToPipeError(eStatus);
+	return (eError == EPipeError::None) || Fail(eError);
+}
+
+CNamedPipe::EPipeError CNamedPipe::ToPipeError(EIoStatus eStatus)
+{
+	switch (eStatus)
+	{
+	case EIoStatus::Ok:
+		return EPipeError::None;
+	case EIoStatus::Disconnected:
+		return EPipeError::Disconnected;
+	default:
+		return EPipeError::IoFailure;
+	}
 }
\ No newline at end of file
@@ -1,5 +1,7 @@
 /*
-Declaration file for named pipe
+Declaration file for the named pipe
+Framed messages over any transport (ITransport): sessions and reconnects, batching, flow control,
+checksums, encryption, metrics and capture
 */
 
 
@@ -8,23 +10,62 @@ Declaration file for named pipe
 
 
 //! Includes
+#include "buffer_pool.h"
+#include "pipe_capture.h"
+#include "frame_cipher.h"
+#include "pipe_frame.h"
+#include "pipe_metrics.h"
+#include "pipe_transport.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
-#include <windows.h>
 
 
 //! Class CNamedPipe
 class CNamedPipe
 {
 public: //! Types
-	enum class EMode
+	typedef EPipeMode EMode;
+
+	// Reason of the last failure
+	enum class EPipeError
 	{
-		Read,
-		Write
+		None,
+		NotOpen,			// The pipe is not opened
+		InvalidMode,		// The operation doesn't match the pipe mode
+		IoFailure,			// The system call failed
+		Disconnected,		// The other side has closed the connection
+		InvalidFrame,		// Received bytes are not a valid frame
+		FrameTooLarge,		// Payload exceeds the maximum message size
+		Cancelled,			// Asynchronous operation has been cancelled
+		TimedOut,			// Asynchronous operation has not completed in time
+		NoCredit,			// The reader hasn't granted enough credits (flow control)
+		ChecksumMismatch,	// The checksum of the received frame doesn't match its bytes
+		AuthenticationFailed,	// The frame is not sealed by the key of the session or is replayed
+		Overrun				// The subscriber has fallen a whole ring behind the publisher (CBroadcastPipe)
 	};
 
+	// What the writer does when the flow control credits run out
+	enum class EFlowPolicy
+	{
+		Block,				// Waits for the reader to grant more
+		DropOldest,			// Keeps the frame and drops the oldest kept ones beyond the queue limit
+		Error				// Fails with EPipeError::NoCredit
+	};
+
+	// Consumes the chunk of the received stream, returns false to skip the rest of it
+	typedef std::function<bool(const byte* pData, size_t nSize)> TStreamSink;
+
 public: //! Constructors and destructor
 	CNamedPipe(const std::string& sName, EMode eMode);
+	// Uses the specified transport instead of the default one of the platform
+	explicit CNamedPipe(ITransportPtr pTransport);
 	~CNamedPipe();
 
 public: //! Interface
@@ -37,18 +78,254 @@ public: //! Interface
 
 	// Sends data
 	bool SendData(const std::vector<byte>& vecData);
+	bool SendData(const void* pData, size_t nSize);
 	// Waits until data will be received
 	bool ReceiveData(std::vector<byte>& vecData);
 
+	// Sends one frame of the specified type
+	bool SendFrame(uint16_t nType, uint16_t nFlags, const void* pData, size_t nSize, uint16_t nChannel = 0);
+	// Waits until a whole frame will be received
+	bool ReceiveFrame(SFrameHeader& oHeader, std::vector<byte>& vecData);
+	// Receives the payload into a buffer of the pipe's pool, the buffer goes back to the pool once released
+	bool ReceiveFrame(SFrameHeader& oHeader, CPooledBuffer& oBuffer);
+	// Receives the payload into the caller's buffer, oPayload points to the received bytes.
+	// Too large payload is skipped and reported as EPipeError::FrameTooLarge
+	bool ReceiveFrame(SFrameHeader& oHeader, void* pBuffer, size_t nCapacity, SByteSpan& oPayload);
+
+	// Streaming: a large payload goes as a sequence of chunk frames (FrameFlagMore on all but the last one),
+	// so neither side holds more than one chunk. Writer: sends the next chunk of the stream
+	bool SendStreamChunk(const void* pData, size_t nSize, bool bLast);
+	// Writer: sends the file from its current position to the end in chunks of c_nStreamChunkSize
+#ifdef _WIN32
+	bool SendStream(HANDLE hFile);
+#else
+	bool SendStream(int nFd);
+#endif
+	// Writer: ends the unfinished stream, the reader fails it with EPipeError::Cancelled
+	bool AbortStream();
+	// Reader: receives the next chunk of the stream into a buffer of the pipe's pool, bLast marks its end.
+	// A frame sent by SendData comes as a stream of one chunk
+	bool ReceiveStreamChunk(CPooledBuffer& oChunk, bool& bLast);
+	// Reader: passes the chunks of the next stream to the sink until the last one. The stream the sink
+	// refuses is skipped to its end and fails with EPipeError::Cancelled
+	bool ReceiveStream(const TStreamSink& fnSink);
+
+#ifndef _WIN32
+	// Zero-copy file transfer: sends nSize bytes of the file from nOffset as one data frame, the transport
+	// moves them from the page cache by sendfile (SendStream of a regular file does the same per chunk).
+	// Under flow control or on the transports without sendfile the file is read through a pooled buffer
+	bool SendFile(int nFd, uint64_t nOffset, size_t nSize);
+	// Passes the descriptor (file, memfd) to the reader by SCM_RIGHTS with a descriptor frame of the payload,
+	// so the content never crosses the pipe. The writer keeps its own descriptor, the frame takes no credits
+	bool SendDescriptor(int nFd, const void* pData = nullptr, size_t nSize = 0);
+	// Reader: takes the descriptor of the last received descriptor frame (-1 if none), the caller closes it
+	int TakeDescriptor();
+#endif
+
+	// Session mode: the reader keeps the writer connected between the messages and
+	// reports EPipeError::Disconnected when the writer leaves (next receive accepts a new writer)
+	void SetSessionMode(bool bEnable);
+	// Writer reopens the pipe and resends the message when the reader has gone
+	void SetAutoReconnect(bool bEnable, uint32_t nTimeoutMs = 5000);
+	// Returns true if the other side is connected
+	bool IsConnected() const;
+
+	// Batching writer: the frames are queued and written together once nMaxBytes are queued,
+	// the oldest one has waited nMaxDelayMs (zero disables the deadline) or on Flush.
+	// Failures of the background writes are reported by the next SendFrame or Flush
+	bool SetBatching(bool bEnable, size_t nMaxBytes = 64 * 1024, uint32_t nMaxDelayMs = 1);
+	// Writes the queued frames
+	bool Flush();
+
+	// Flow control: the writer asks the reader for a window of bytes once per connection and
+	// sends while it has credits left, the reader grants more as it consumes the frames.
+	// A frame is sent while any credit is left, so one frame may exceed the window.
+	// Frames kept by the drop-oldest policy go out by the next SendFrame or Flush, the latter waits for credits
+	bool SetFlowControl(bool bEnable, EFlowPolicy ePolicy = EFlowPolicy::Block, size_t nQueueLimit = 1024 * 1024);
+	// Writer: returns the bytes the reader has granted and the writer hasn't used, INT64_MAX if unlimited
+	int64_t GetCredits() const;
+	// Writer: returns the number of frames dropped by the drop-oldest policy
+	uint64_t GetDroppedCount() const;
+	// Reader: sets the window granted to the writers that ask for it, zero doesn't limit them
+	void SetReceiveWindow(uint32_t nBytes);
+
+	// Writer: appends the CRC32C of the header and the payload to every frame sent. The readers verify
+	// the frames that carry it whatever their own setting, a mismatch fails the receive with
+	// EPipeError::ChecksumMismatch and drops the writer. SendFile reads the file through a buffer then
+	void SetChecksum(bool bEnable);
+
+	// Encryption: seals the payloads by AES-GCM with the keys of the connection derived from the shared
+	// 16 or 32 byte key (see CFrameCipher), null turns it off. Both sides set the same key before Open.
+	// The reader with the key takes only the sealed frames, the one without it none of them,
+	// others fail the receive with EPipeError::AuthenticationFailed and drop the writer
+	bool SetEncryption(const void* pKey, size_t nKeySize);
+
+	// Sets how the receiving thread waits for the data: blocking, polling for a while first or polling only,
+	// optionally pinned to a CPU. Polling saves the wakeup latency at the cost of a busy CPU
+	void SetWaitStrategy(const SWaitStrategy& oStrategy);
+
+	// Metrics: counts the messages, bytes, failures, reconnects and queued frames and records the send and
+	// receive latencies (see CPipeMetrics), the pipe without them only tests a pointer. Fails while open
+	bool EnableMetrics(bool bEnable);
+	// Returns the metrics recorded since they were enabled (any thread), false if they are disabled
+	bool GetMetrics(SPipeMetrics& oMetrics) const;
+
+	// Capture: records the frames sent (writer) or received (reader) into the trace under the connection id
+	// (see CPipeCapture), null stops it. Descriptor frames are not recorded, file frames without their payload.
+	// Fails while open
+	bool SetCapture(CPipeCapturePtr pCapture, uint64_t nConnectionId = 0);
+
+	// Sets the maximum accepted payload size
+	void SetMaxMessageSize(uint32_t nMaxSize);
+	// Returns the reason of the last failure
+	EPipeError GetLastPipeError() const;
+
 public: //! Static helpers
 	static std::string ToString(const std::vector<byte>& vecData);
 	static std::vector<byte> FromString(const std::string& sStr);
 
-protected: //! Static helpers
-	static HANDLE CreatePipe(const std::string& sName, EMode eMode);
+private: //! Implementation
+	// Reads exactly the specified number of bytes
+	bool ReadExact(void* pData, size_t nSize);
+	// Reader: reads the payload of the frame and verifies its checksum trailer if it has one. The sealed payload
+	// is opened in place, its size (GetPayloadSize) is left in the length of the header
+	bool ReadPayload(SFrameHeader& oHeader, void* pData);
+	// Reader: reads and validates the next frame header
+	bool BeginReceive(SFrameHeader& oHeader);
+	// Reader: completes the frame, drops the writer on failure or outside the session mode
+	bool EndReceive(bool bOk);
+	// Reads and discards the specified number of bytes
+	bool Skip(size_t nSize);
+	// Reader: waits for the writer unless connected
+	bool EnsureConnected();
+	// Reader: drops the writer
+	void DropConnection();
+	// Writer: returns the flags of the next chunk and advances the stream state
+	uint16_t NextStreamFlags(bool bLast);
+	// Writer: sends the frame of the stream, fails if the pipe has reconnected since the stream started
+	bool SendStreamFrame(uint16_t nFlags, const void* pData, size_t nSize);
+	// Writer: fails the continued chunk if the pipe has reconnected since its stream started
+	bool CheckStreamConnection(uint16_t nFlags);
+#ifndef _WIN32
+	// Writer: sends the frame whose payload is the range of the file
+	bool SendFileFrame(uint16_t nFlags, int nFd, uint64_t nOffset, size_t nSize);
+	// Writer: writes the header and the file range directly, after the queued frames
+	bool WriteFileFrame(const byte* arrHeader, int nFd, uint64_t nOffset, size_t nSize);
+#endif
+	// Writer: starts a new session of the connection and sends its frame if encrypting
+	bool SendSession();
+	// Writer: reconnects if the pipe is closed and a reconnect is pending, returns why the pipe can't write (None if it can)
+	EPipeError EnsureWritable();
+	// Writer: reopens the transport until the reader accepts it or the timeout expires
+	bool Reconnect();
+	// Writer: fills the header and encodes it, seals the payload into oSealed (pData and nSize move to it) if encrypting
+	// and computes the checksum trailer. Returns the trailer or null
+	const byte* EncodeFrame(SFrameHeader& oHeader, byte* arrHeader, const void*& pData, size_t& nSize, CPooledBuffer& oSealed,
+		byte* arrTrailer);
+	// Writer: returns the bytes of the frame on the wire, with the cipher overhead and the checksum trailer
+	size_t GetWireSize(const SFrameHeader& oHeader, size_t nSize) const;
+	// Writer: encodes the frame (sealed by the current session) and passes its buffers to fnSend
+	template <class TSend>
+	EIoStatus TransmitFrame(const SFrameHeader& oHeader, const void* pData, size_t nSize, TSend fnSend);
+	// Writer: sends the plaintext frame directly or through the batch
+	bool WriteFrame(const SFrameHeader& oHeader, const void* pData, size_t nSize);
+	// Writer: queues the frame of the batching mode
+	bool QueueFrame(const SFrameHeader& oHeader, const void* pData, size_t nSize);
+	// Writer: sends the frame within the credits, applies the flow policy when they run out
+	bool SendControlled(const SFrameHeader& oHeader, const void* pData, size_t nSize);
+	// Writer: takes the credits of the frame if any is left, bWait blocks until some is granted
+	bool TakeCredit(size_t nFrameSize, bool bWait, bool& bTaken);
+	// Writer: reads the credits sent back, bWait blocks until any is left (called under m_mtxWrite)
+	bool ReadCredits(bool bWait);
+	// Writer: sends the kept frames while there are credits, bWait blocks until all are sent
+	bool SendPending(bool bWait);
+	// Writer: returns true if a frame may be sent
+	bool HasCredit() const;
+	// Writer: forgets the credits of the previous connection
+	void ResetCredits();
+	// Reader: grants the writer more bytes to send
+	bool GrantCredit(uint32_t nCredit);
+	// Writer: writes the frames queued by the batching mode
+	bool FlushBatch();
+	// Writer: writes the queued frames followed by the frame of pHeader (may be null)
+	EPipeError WriteBatch(const SFrameHeader* pHeader, const void* pData, size_t nSize);
+	// Writer: seals the queued plaintext frames being written into m_vecSealed
+	const std::vector<byte>& SealBatch();
+	// Appends the plaintext header and the payload to the frames kept for the later seal
+	static void AppendPlainFrame(std::vector<byte>& vecFrames, const SFrameHeader& oHeader, const void* pData, size_t nSize);
+	// Flusher thread function
+	void RunFlusher();
+	void StopFlusher();
+	// Records the sent message of nSize payload bytes started at nStart (CPipeMetrics::Now), returns bOk
+	bool CountSent(bool bOk, uint64_t nStart, size_t nSize);
+	// Records the received message into the metrics and the capture, returns true
+	bool CountReceived(const SFrameHeader& oHeader, const void* pData);
+	// Adds to the counter if the metrics are enabled
+	void Count(EPipeCounter eCounter, uint64_t nValue = 1);
+	// Adds to the queue gauges if the metrics are enabled
+	void CountQueued(int64_t nFrames, int64_t nBytes);
+	// Fills the gather of the frame parts, returns their number
+	static size_t MakeFrameBuffers(SIoBuffer* arrBuffers, const byte* arrHeader, const void* pData, size_t nSize, const byte* arrTrailer);
+	// Remembers the failure reason and returns false
+	bool Fail(EPipeError eError);
+	// Converts the transport status to the result
+	bool Check(EIoStatus eStatus);
+	static EPipeError ToPipeError(EIoStatus eStatus);
 
 private: // Members
-	std::string			m_sName;
+	ITransportPtr		m_pTransport;		// Underlying byte stream
+	CBufferPoolPtr		m_pBufferPool;		// Slabs for the pooled receive
 	EMode				m_eMode;
-	HANDLE				m_hHandler;
+	uint32_t			m_nMaxMessageSize;	// Maximum accepted payload size
+	EPipeError			m_eLastError;		// Reason of the last failure
+	bool				m_bSessionMode;		// Reader keeps the writer between the messages
+	bool				m_bConnected;		// Reader has accepted the writer
+	bool				m_bAutoReconnect;	// Writer reconnects when the reader has gone
+	bool				m_bReconnectPending;	// Writer has lost the reader and failed to reconnect yet
+	uint32_t			m_nReconnectTimeoutMs;
+	uint64_t			m_nReconnectCount;	// Writer: connections opened by Reconnect
+	// Streaming
+	bool				m_bStreamSending;	// Writer: a stream is started and not finished
+	uint64_t			m_nStreamConnection;	// Writer: reconnect count when the stream started
+	bool				m_bStreamReceiving;	// Reader: the last frame has more chunks to follow
+#ifndef _WIN32
+	int					m_nDescriptor;		// Reader: descriptor of the last descriptor frame
+#endif
+	bool				m_bChecksum;		// Writer: frames carry the CRC32C trailer
+	CFrameCipher		m_oCipher;			// Seals or opens the payloads when the key is set
+	CPipeMetricsPtr		m_pMetrics;			// Null unless enabled
+	uint64_t			m_nPartialWriteBase;	// Partial writes of the transport when the metrics were enabled
+	uint64_t			m_nReceiveStart;	// Reader: when the header of the frame being received came (metrics)
+	CPipeCapturePtr		m_pCapture;			// Null unless capturing
+	uint64_t			m_nCaptureId;		// Connection id of the recorded frames
+	// Batching writer
+	bool						m_bBatching;
+	size_t						m_nBatchLimit;		// Queued bytes written at once
+	uint32_t					m_nBatchDelayMs;	// Longest wait of the queued frame
+	std::mutex					m_mtxBatch;			// Guards the queued frames
+	std::mutex					m_mtxWrite;			// Keeps the batches in order
+	std::condition_variable		m_cvBatch;
+	std::vector<byte>			m_vecBatch;			// Queued frames, plaintext ones (header and payload) if encrypting
+	size_t						m_nBatchFrames;		// Their number
+	std::vector<byte>			m_vecFlushing;		// Frames being written, swapped with the queued ones
+	std::vector<byte>			m_vecSealed;		// The frames being written sealed by the current session
+	std::chrono::steady_clock::time_point	m_tpBatchStart;	// When the oldest queued frame came
+	EPipeError					m_eBatchError;		// Failure of the background write
+	bool						m_bStopFlusher;
+	std::thread					m_oFlusher;
+	// Flow control
+	bool						m_bFlowControl;
+	EFlowPolicy					m_eFlowPolicy;
+	size_t						m_nPendingLimit;	// Bytes kept by the drop-oldest policy
+	bool						m_bCreditRequested;	// Writer has asked the reader on this connection
+	bool						m_bCreditGranted;	// Reader has answered the request
+	std::atomic<bool>			m_bUnlimitedCredit;
+	std::atomic<int64_t>		m_nCredits;			// Granted bytes left, negative after a frame beyond them
+	CFrameAssembler				m_oCreditAssembler;	// Frames sent back by the reader
+	std::deque<std::vector<byte>>	m_deqPending;	// Plaintext frames waiting for credits
+	size_t						m_nPendingBytes;
+	std::atomic<uint64_t>		m_nDroppedCount;
+	uint32_t					m_nReceiveWindow;	// Reader: bytes granted to the writer, zero for unlimited
+	bool						m_bPeerFlowControl;	// Reader: the writer has asked for credits
+	size_t						m_nConsumed;		// Reader: frame bytes received since the last grant
 };
\ No newline at end of file
@@ -0,0 +1,558 @@
+/*
+Benchmark of the pipe transports
+
+Runs the matrix of transports, message sizes, concurrency levels, batching modes, reader wait
+strategies, frame checksums, encryption and metrics. Every case first streams the messages as fast
+as possible (throughput), then sends them one at a time, the next one after the previous has arrived
+(one-way latency). Each concurrent client has its own reader and writer, or its own connection to one
+CPipeServer. Results go to stdout as CSV or JSON lines, one line per case, so runs before and after
+a change can be compared by a script.
+The wait strategies (block, spin for --spin-us then block, busy poll) apply to the readers of their own
+pipes, which are pinned to --cpu and the next CPUs when it's given; the server cases run blocking only.
+
+Usage: pipe_benchmark [--transports pipe,seqpacket,fifo,shm,server] [--sizes 16,4096,1048576]
+                      [--clients 1,4] [--batching 0,1] [--bytes 67108864] [--messages 100000]
+                      [--samples 1000] [--wait block,spin,poll] [--spin-us 50] [--cpu -1]
+                      [--checksum 0,1] [--encrypt 0,1] [--metrics 0,1] [--format csv|json]
+*/
+
+
+//! Includes
+#include "named_pipe.h"
+#include "pipe_server.h"
+#include "shared_memory_transport.h"
+#ifndef _WIN32
+#include "posix_pipe_transport.h"
+#include <unistd.h>
+#endif
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+//! Benchmark constants
+static const uint16_t	c_nLastFlag = 0x8000;			// Marks the last message of the phase
+static const size_t		c_nStampSize = 12;				// Send time (8 bytes) and client index (4 bytes)
+static const size_t		c_nBatchBytes = 64 * 1024;		// Batching writer threshold
+static const uint32_t	c_nBatchDelayMs = 1;			// Batching writer deadline
+static const uint32_t	c_nLatencyBudgetMs = 1000;		// Longest latency phase of one case
+static const uint8_t	c_arrKey[16] = { 0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+										 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };	// Key of the encrypted cases
+
+static const char		c_szUsage[] =
+	"Usage: pipe_benchmark [--transports pipe,seqpacket,fifo,shm,server] [--sizes 16,4096,1048576]\n"
+	"                      [--clients 1,4] [--batching 0,1] [--bytes 67108864] [--messages 100000]\n"
+	"                      [--samples 1000] [--wait block,spin,poll] [--spin-us 50] [--cpu -1]\n"
+	"                      [--checksum 0,1] [--encrypt 0,1] [--metrics 0,1] [--format csv|json]\n";
+
+
+//! Types
+typedef std::chrono::steady_clock TClock;
+
+// Benchmark settings
+struct SSettings
+{
+	std::vector<std::string>	vecTransports;
+	std::vector<size_t>			vecSizes;
+	std::vector<size_t>			vecClients;
+	std::vector<bool>			vecBatching;
+	std::vector<std::string>	vecWaits;
+	std::vector<bool>			vecChecksums;
+	std::vector<bool>			vecEncryptions;
+	std::vector<bool>			vecMetrics;
+	uint32_t					nSpinUs = SWaitStrategy().nSpinUs;	// Polling time of the spin wait
+	int							nCpu = -1;							// CPU of the first reader, -1 doesn't pin
+	uint64_t					nBytesPerCase = 64 * 1024 * 1024;	// Streamed bytes per case (split among the clients)
+	uint64_t					nMaxMessages = 100000;				// Streamed messages per case at most
+	uint64_t					nMinMessages = 16;					// Streamed messages per case at least
+	size_t						nSamples = 1000;					// Latency samples per client at most
+	bool						bJson = false;
+};
+
+// One case of the matrix
+struct SCase
+{
+	std::string		sTransport;
+	size_t			nSize = 0;
+	size_t			nClients = 0;
+	bool			bBatching = false;
+	std::string		sWait;
+	bool			bChecksum = false;
+	bool			bEncrypt = false;
+	bool			bMetrics = false;
+};
+
+// Receiving side of one client
+struct SClientState
+{
+	std::atomic<uint64_t>	nAcknowledged{ 0 };		// Latency messages received
+	std::atomic<bool>		bStreamDone{ false };	// Last streamed message received
+	std::atomic<bool>		bFinished{ false };		// Last latency message received
+	std::atomic<bool>		bFailed{ false };
+	TClock::time_point		tpStreamEnd;
+	std::vector<uint64_t>	vecLatencyNs;
+};
+
+// Result of one case
+struct SResult
+{
+	uint64_t	nMessages = 0;
+	uint64_t	nBytes = 0;
+	double		dSeconds = 0;
+	double		dP50Us = 0;
+	double		dP99Us = 0;
+	double		dP999Us = 0;
+	size_t		nErrors = 0;
+};
+
+typedef std::vector<std::unique_ptr<SClientState>> TClientStates;
+
+
+//! Helpers
+static uint64_t GetNowNs()
+{
+	return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(TClock::now().time_since_epoch()).count());
+}
+
+static uint32_t GetProcessId()
+{
+#ifdef _WIN32
+	return uint32_t(GetCurrentProcessId());
+#else
+	return uint32_t(getpid());
+#endif
+}
+
+static std::vector<std::string> SplitList(const std::string& sList)
+{
+	std::vector<std::string> vecItems;
+	size_t nStart = 0;
+	while (nStart <= sList.size())
+	{
+		size_t nEnd = sList.find(',', nStart);
+		if (nEnd == std::string::npos)
+			nEnd = sList.size();
+		if (nEnd > nStart)
+			vecItems.push_back(sList.substr(nStart, nEnd - nStart));
+		nStart = nEnd + 1;
+	}
+
+	return vecItems;
+}
+
+static std::vector<size_t> SplitNumbers(const std::string& sList)
+{
+	std::vector<size_t> vecNumbers;
+	for (const std::string& sItem : SplitList(sList))
+		vecNumbers.push_back(size_t(std::strtoull(sItem.c_str(), nullptr, 10)));
+
+	return vecNumbers;
+}
+
+static double GetPercentileUs(const std::vector<uint64_t>& vecSorted, double dPercentile)
+{
+	if (vecSorted.empty())
+		return 0;
+
+	const size_t nIndex = (std::min)(vecSorted.size() - 1, size_t(dPercentile * double(vecSorted.size())));
+	return double(vecSorted[nIndex]) / 1000.0;
+}
+
+// Parses the wait strategy name, returns false for the unknown ones
+static bool ParseWaitMode(const std::string& sWait, EWaitMode& eMode)
+{
+	if (sWait == "block")
+		eMode = EWaitMode::Block;
+	else if (sWait == "spin")
+		eMode = EWaitMode::SpinThenBlock;
+	else if (sWait == "poll")
+		eMode = EWaitMode::BusyPoll;
+	else
+		return false;
+
+	return true;
+}
+
+// Creates the transport of the benchmark kind, nullptr for the unknown ones
+static ITransportPtr CreateTransport(const std::string& sKind, const std::string& sName, EPipeMode eMode)
+{
+	if (sKind == "pipe")
+		return CreatePipeTransport(sName, eMode);
+	if (sKind == "shm")
+		return ITransportPtr(new CSharedMemoryTransport(sName, eMode));
+#ifndef _WIN32
+	if (sKind == "seqpacket")
+		return ITransportPtr(new CPosixPipeTransport(sName, eMode, CPosixPipeTransport::EKind::SeqPacket));
+	if (sKind == "fifo")
+		return ITransportPtr(new CPosixPipeTransport(sName, eMode, CPosixPipeTransport::EKind::Fifo));
+#endif
+
+	return nullptr;
+}
+
+
+//! Receiving side
+// Accounts one received message of the client
+static void OnReceived(SClientState& oState, const SFrameHeader& oHeader, const byte* pPayload)
+{
+	if (!oState.bStreamDone)
+	{
+		if (oHeader.nFlags & c_nLastFlag)
+		{
+			oState.tpStreamEnd = TClock::now();
+			oState.bStreamDone = true;
+		}
+		return;
+	}
+
+	uint64_t nSentNs = 0;
+	memcpy(&nSentNs, pPayload, sizeof(nSentNs));
+	oState.vecLatencyNs.push_back(GetNowNs() - nSentNs);
+	if (oHeader.nFlags & c_nLastFlag)
+		oState.bFinished = true;
+	++oState.nAcknowledged;
+}
+
+// Reader thread of the client with its own pipe
+static void RunReader(CNamedPipe& oReader, SClientState& oState)
+{
+	SFrameHeader oHeader;
+	CPooledBuffer oPayload;
+	while (!oState.bFinished)
+	{
+		if (!oReader.ReceiveFrame(oHeader, oPayload))
+		{
+			oState.bFailed = true;
+			return;
+		}
+		OnReceived(oState, oHeader, oPayload.GetData());
+	}
+}
+
+// Server handler, the client index travels in the payload
+class CBenchmarkHandler : public CPipeServer::IMessageHandler
+{
+public:
+	explicit CBenchmarkHandler(TClientStates& vecStates)
+		: m_vecStates(vecStates)
+	{
+	}
+
+	void OnMessage(uint64_t /*nConnectionId*/, const SFrameHeader& oHeader, const std::vector<byte>& vecPayload) override
+	{
+		uint32_t nClient = 0;
+		memcpy(&nClient, vecPayload.data() + sizeof(uint64_t), sizeof(nClient));
+		if (nClient < m_vecStates.size())
+			OnReceived(*m_vecStates[nClient], oHeader, vecPayload.data());
+	}
+
+private:
+	TClientStates&	m_vecStates;
+};
+
+
+//! Sending side
+// Writer thread of one client: streams nMessages, then sends the latency messages one at a time
+static bool RunWriter(CNamedPipe& oWriter, SClientState& oState, uint32_t nClient, size_t nSize, uint64_t nMessages,
+	size_t nSamples, const std::atomic<bool>& bStart)
+{
+	std::vector<byte> vecPayload(nSize, byte(0x5A));
+	memcpy(vecPayload.data() + sizeof(uint64_t), &nClient, sizeof(nClient));
+	while (!bStart)
+		std::this_thread::yield();
+
+	for (uint64_t i = 0; i < nMessages; ++i)
+	{
+		const uint16_t nFlags = (i + 1 == nMessages) ? c_nLastFlag : uint16_t(FrameFlagNone);
+		if (!oWriter.SendFrame(uint16_t(EFrameType::Data), nFlags, vecPayload.data(), nSize))
+			return false;
+	}
+	if (!oWriter.Flush())
+		return false;
+
+	// Latency phase is bounded by time as well, the slow cases stop early
+	while (!oState.bStreamDone && !oState.bFailed)
+		std::this_thread::yield();
+	const TClock::time_point tpDeadline = TClock::now() + std::chrono::milliseconds(c_nLatencyBudgetMs);
+	for (size_t i = 0; i < nSamples; ++i)
+	{
+		const bool bLast = (i + 1 == nSamples || TClock::now() >= tpDeadline);
+		const uint64_t nNowNs = GetNowNs();
+		memcpy(vecPayload.data(), &nNowNs, sizeof(nNowNs));
+		if (!oWriter.SendFrame(uint16_t(EFrameType::Data), bLast ? c_nLastFlag : uint16_t(FrameFlagNone), vecPayload.data(), nSize))
+			return false;
+		while (oState.nAcknowledged <= i && !oState.bFailed)
+			std::this_thread::yield();
+		if (bLast)
+			break;
+	}
+
+	return !oState.bFailed;
+}
+
+
+//! Case runner
+static SResult RunCase(const SSettings& oSettings, const SCase& oCase, size_t nCaseIndex)
+{
+	SResult oResult;
+	const size_t nSize = (std::max)(oCase.nSize, c_nStampSize);
+	uint64_t nMessages = oSettings.nBytesPerCase / (uint64_t(nSize) * oCase.nClients);
+	nMessages = (std::max)(oSettings.nMinMessages, (std::min)(oSettings.nMaxMessages / oCase.nClients, nMessages));
+
+	TClientStates vecStates;
+	for (size_t i = 0; i < oCase.nClients; ++i)
+		vecStates.emplace_back(new SClientState());
+
+	// Every case gets its own names, so no endpoint of the previous one is in the way
+	const std::string sBase = "bench-" + std::to_string(GetProcessId()) + "-" + std::to_string(nCaseIndex);
+	const bool bServer = (oCase.sTransport == "server");
+	std::unique_ptr<CPipeServer> pServer;
+	std::vector<std::unique_ptr<CNamedPipe>> vecReaders;
+	std::vector<std::unique_ptr<CNamedPipe>> vecWriters;
+	std::vector<std::thread> vecReaderThreads;
+	if (bServer)
+	{
+		pServer.reset(new CPipeServer(sBase));
+		pServer->SetEncryption(oCase.bEncrypt ? c_arrKey : nullptr, sizeof(c_arrKey));
+		pServer->EnableMetrics(oCase.bMetrics);
+		if (!pServer->Start(std::make_shared<CBenchmarkHandler>(vecStates)))
+		{
+			oResult.nErrors = oCase.nClients;
+			return oResult;
+		}
+	}
+	for (size_t i = 0; i < oCase.nClients; ++i)
+	{
+		const std::string sName = bServer ? sBase : sBase + "-" + std::to_string(i);
+		if (!bServer)
+		{
+			vecReaders.emplace_back(new CNamedPipe(CreateTransport(oCase.sTransport, sName, EPipeMode::Read)));
+			vecReaders.back()->SetSessionMode(true);
+			vecReaders.back()->SetEncryption(oCase.bEncrypt ? c_arrKey : nullptr, sizeof(c_arrKey));
+			vecReaders.back()->EnableMetrics(oCase.bMetrics);
+			SWaitStrategy oStrategy;
+			ParseWaitMode(oCase.sWait, oStrategy.eMode);
+			oStrategy.nSpinUs = oSettings.nSpinUs;
+			oStrategy.nCpu = (oSettings.nCpu < 0) ? -1 : oSettings.nCpu + int(i);
+			vecReaders.back()->SetWaitStrategy(oStrategy);
+			if (!vecReaders.back()->Open())
+				vecStates[i]->bFailed = true;
+			else
+				vecReaderThreads.emplace_back(RunReader, std::ref(*vecReaders.back()), std::ref(*vecStates[i]));
+		}
+		vecWriters.emplace_back(new CNamedPipe(bServer ? CreatePipeTransport(sName, EPipeMode::Write) : CreateTransport(oCase.sTransport, sName, EPipeMode::Write)));
+		vecWriters.back()->SetChecksum(oCase.bChecksum);
+		vecWriters.back()->SetEncryption(oCase.bEncrypt ? c_arrKey : nullptr, sizeof(c_arrKey));
+		vecWriters.back()->EnableMetrics(oCase.bMetrics);
+		if (vecStates[i]->bFailed || !vecWriters.back()->Open())
+			vecStates[i]->bFailed = true;
+		else if (oCase.bBatching)
+			vecWriters.back()->SetBatching(true, c_nBatchBytes, c_nBatchDelayMs);
+	}
+
+	std::atomic<bool> bStart(false);
+	std::atomic<size_t> nWriterErrors(0);
+	std::vector<std::thread> vecWriterThreads;
+	for (size_t i = 0; i < oCase.nClients; ++i)
+	{
+		if (vecStates[i]->bFailed)
+			continue;
+		vecWriterThreads.emplace_back([&, i]()
+		{
+			if (!RunWriter(*vecWriters[i], *vecStates[i], uint32_t(i), nSize, nMessages, oSettings.nSamples, bStart))
+			{
+				vecStates[i]->bFailed = true;
+				++nWriterErrors;
+			}
+		});
+	}
+
+	const TClock::time_point tpStart = TClock::now();
+	bStart = true;
+	for (std::thread& oThread : vecWriterThreads)
+		oThread.join();
+
+	// Writers leave first, so the blocked readers see the disconnect
+	for (std::unique_ptr<CNamedPipe>& pWriter : vecWriters)
+		pWriter->Close();
+	for (std::thread& oThread : vecReaderThreads)
+		oThread.join();
+	if (pServer)
+		pServer->Stop();
+
+	TClock::time_point tpEnd = tpStart;
+	std::vector<uint64_t> vecLatencyNs;
+	for (const std::unique_ptr<SClientState>& pState : vecStates)
+	{
+		if (pState->bFailed)
+		{
+			++oResult.nErrors;
+			continue;
+		}
+		oResult.nMessages += nMessages;
+		tpEnd = (std::max)(tpEnd, pState->tpStreamEnd);
+		vecLatencyNs.insert(vecLatencyNs.end(), pState->vecLatencyNs.begin(), pState->vecLatencyNs.end());
+	}
+	oResult.nBytes = oResult.nMessages * nSize;
+	oResult.dSeconds = std::chrono::duration<double>(tpEnd - tpStart).count();
+	std::sort(vecLatencyNs.begin(), vecLatencyNs.end());
+	oResult.dP50Us = GetPercentileUs(vecLatencyNs, 0.50);
+	oResult.dP99Us = GetPercentileUs(vecLatencyNs, 0.99);
+	oResult.dP999Us = GetPercentileUs(vecLatencyNs, 0.999);
+
+	return oResult;
+}
+
+
+//! Output
+static void PrintHeader(const SSettings& oSettings)
+{
+	if (!oSettings.bJson)
+		printf("transport,size,clients,batching,wait,checksum,encrypt,metrics,messages,seconds,msgs_per_sec,mb_per_sec,p50_us,p99_us,p999_us,errors\n");
+}
+
+static void PrintResult(const SSettings& oSettings, const SCase& oCase, const SResult& oResult)
+{
+	const double dMessagesPerSecond = (oResult.dSeconds > 0) ? double(oResult.nMessages) / oResult.dSeconds : 0;
+	const double dMegabytesPerSecond = (oResult.dSeconds > 0) ? double(oResult.nBytes) / oResult.dSeconds / 1e6 : 0;
+	if (oSettings.bJson)
+		printf("{\"transport\":\"%s\",\"size\":%zu,\"clients\":%zu,\"batching\":%s,\"wait\":\"%s\",\"checksum\":%s,\"encrypt\":%s,\"metrics\":%s,\"messages\":%llu,\"seconds\":%.6f,"
+			"\"msgs_per_sec\":%.1f,\"mb_per_sec\":%.3f,\"p50_us\":%.3f,\"p99_us\":%.3f,\"p999_us\":%.3f,\"errors\":%zu}\n",
+			oCase.sTransport.c_str(), oCase.nSize, oCase.nClients, oCase.bBatching ? "true" : "false", oCase.sWait.c_str(), oCase.bChecksum ? "true" : "false",
+			oCase.bEncrypt ? "true" : "false", oCase.bMetrics ? "true" : "false", (unsigned long long)oResult.nMessages,
+			oResult.dSeconds, dMessagesPerSecond, dMegabytesPerSecond, oResult.dP50Us, oResult.dP99Us, oResult.dP999Us, oResult.nErrors);
+	else
+		printf("%s,%zu,%zu,%d,%s,%d,%d,%d,%llu,%.6f,%.1f,%.3f,%.3f,%.3f,%.3f,%zu\n",
+			oCase.sTransport.c_str(), oCase.nSize, oCase.nClients, oCase.bBatching ? 1 : 0, oCase.sWait.c_str(), oCase.bChecksum ? 1 : 0,
+			oCase.bEncrypt ? 1 : 0, oCase.bMetrics ? 1 : 0, (unsigned long long)oResult.nMessages,
+			oResult.dSeconds, dMessagesPerSecond, dMegabytesPerSecond, oResult.dP50Us, oResult.dP99Us, oResult.dP999Us, oResult.nErrors);
+	fflush(stdout);
+}
+
+
+int main(int argc, char* argv[])
+{
+	SSettings oSettings;
+#ifdef _WIN32
+	oSettings.vecTransports = { "pipe", "shm", "server" };
+#else
+	oSettings.vecTransports = { "pipe", "seqpacket", "fifo", "shm", "server" };
+#endif
+	oSettings.vecSizes = { 16, 256, 4096, 65536, 1024 * 1024, 16 * 1024 * 1024 };
+	oSettings.vecClients = { 1, 4 };
+	oSettings.vecBatching = { false, true };
+	oSettings.vecWaits = { "block" };
+	oSettings.vecChecksums = { false };
+	oSettings.vecEncryptions = { false };
+	oSettings.vecMetrics = { false };
+
+	// Every option takes a value
+	if (argc % 2 == 0)
+	{
+		fprintf(stderr, "%s", c_szUsage);
+		return 1;
+	}
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		const std::string sOption = argv[i];
+		const std::string sValue = argv[i + 1];
+		if (sOption == "--transports")
+			oSettings.vecTransports = SplitList(sValue);
+		else if (sOption == "--sizes")
+			oSettings.vecSizes = SplitNumbers(sValue);
+		else if (sOption == "--clients")
+			oSettings.vecClients = SplitNumbers(sValue);
+		else if (sOption == "--batching")
+		{
+			oSettings.vecBatching.clear();
+			for (size_t nValue : SplitNumbers(sValue))
+				oSettings.vecBatching.push_back(nValue != 0);
+		}
+		else if (sOption == "--checksum")
+		{
+			oSettings.vecChecksums.clear();
+			for (size_t nValue : SplitNumbers(sValue))
+				oSettings.vecChecksums.push_back(nValue != 0);
+		}
+		else if (sOption == "--encrypt")
+		{
+			oSettings.vecEncryptions.clear();
+			for (size_t nValue : SplitNumbers(sValue))
+				oSettings.vecEncryptions.push_back(nValue != 0);
+		}
+		else if (sOption == "--metrics")
+		{
+			oSettings.vecMetrics.clear();
+			for (size_t nValue : SplitNumbers(sValue))
+				oSettings.vecMetrics.push_back(nValue != 0);
+		}
+		else if (sOption == "--wait")
+			oSettings.vecWaits = SplitList(sValue);
+		else if (sOption == "--spin-us")
+			oSettings.nSpinUs = uint32_t(std::strtoul(sValue.c_str(), nullptr, 10));
+		else if (sOption == "--cpu")
+			oSettings.nCpu = int(std::strtol(sValue.c_str(), nullptr, 10));
+		else if (sOption == "--bytes")
+			oSettings.nBytesPerCase = std::strtoull(sValue.c_str(), nullptr, 10);
+		else if (sOption == "--messages")
+			oSettings.nMaxMessages = std::strtoull(sValue.c_str(), nullptr, 10);
+		else if (sOption == "--samples")
+			oSettings.nSamples = size_t(std::strtoull(sValue.c_str(), nullptr, 10));
+		else if (sOption == "--format")
+			oSettings.bJson = (sValue == "json");
+		else
+		{
+			fprintf(stderr, "Unknown option %s\n%s", sOption.c_str(), c_szUsage);
+			return 1;
+		}
+	}
+
+	PrintHeader(oSettings);
+	size_t nCaseIndex = 0;
+	for (const std::string& sTransport : oSettings.vecTransports)
+	{
+		if (sTransport != "server" && CreateTransport(sTransport, "probe", EPipeMode::Read) == nullptr)
+		{
+			fprintf(stderr, "Unknown transport %s\n", sTransport.c_str());
+			continue;
+		}
+		for (size_t nSize : oSettings.vecSizes)
+			for (size_t nClients : oSettings.vecClients)
+				for (bool bBatching : oSettings.vecBatching)
+					for (const std::string& sWait : oSettings.vecWaits)
+						for (bool bChecksum : oSettings.vecChecksums)
+							for (bool bEncrypt : oSettings.vecEncryptions)
+								for (bool bMetrics : oSettings.vecMetrics)
+								{
+									EWaitMode eMode;
+									if (!ParseWaitMode(sWait, eMode))
+									{
+										fprintf(stderr, "Unknown wait strategy %s\n", sWait.c_str());
+										continue;
+									}
+									// The server loop waits in epoll or IOCP
+									if (sTransport == "server" && eMode != EWaitMode::Block)
+										continue;
+									SCase oCase;
+									oCase.sTransport = sTransport;
+									oCase.nSize = nSize;
+									oCase.nClients = (std::max)(nClients, size_t(1));
+									oCase.bBatching = bBatching;
+									oCase.sWait = sWait;
+									oCase.bChecksum = bChecksum;
+									oCase.bEncrypt = bEncrypt;
+									oCase.bMetrics = bMetrics;
+									PrintResult(oSettings, oCase, RunCase(oSettings, oCase, nCaseIndex++));
+								}
+	}
+
+	return 0;
+}
@@ -0,0 +1,217 @@
+/*
+Implementation file for the pipe capture
+*/
+
+
+//! Includes
+#include "pipe_capture.h"
+#include <algorithm>
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+CPipeCapture::CPipeCapture(const std::string& sPath, bool bPayloads)
+	: m_sPath(sPath),
+	  m_bPayloads(bPayloads),
+	  m_nLastTimeNs(0),
+	  m_nFrameCount(0),
+	  m_bRecording(false),
+#ifdef _WIN32
+	  m_hFile(INVALID_HANDLE_VALUE)
+#else
+	  m_nFd(-1)
+#endif
+{
+}
+
+CPipeCapture::~CPipeCapture()
+{
+	Close();
+}
+
+bool CPipeCapture::IsOpen() const
+{
+	std::lock_guard<std::mutex> oLock(m_mtxWrite);
+#ifdef _WIN32
+	return m_hFile != INVALID_HANDLE_VALUE;
+#else
+	return m_nFd >= 0;
+#endif
+}
+
+bool CPipeCapture::Open()
+{
+	std::lock_guard<std::mutex> oWriteLock(m_mtxWrite);
+#ifdef _WIN32
+	if (m_hFile != INVALID_HANDLE_VALUE)
+		return false;
+	// Not shared, the trace holds the plaintext of the decrypted frames
+	m_hFile = CreateFileA(m_sPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m_hFile == INVALID_HANDLE_VALUE)
+		return false;
+#else
+	if (m_nFd >= 0)
+		return false;
+	// Owner only, the trace holds the plaintext of the decrypted frames. A replaced trace keeps
+	// its mode through the truncation, so it's narrowed too
+	m_nFd = open(m_sPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (m_nFd < 0)
+		return false;
+	if (fchmod(m_nFd, 0600) != 0)
+	{
+		close(m_nFd);
+		m_nFd = -1;
+		return false;
+	}
+#endif
+
+	// Little-endian like the frames
+	const uint64_t nWallClockNs = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count());
+	const uint16_t nFlags = m_bPayloads ? c_nTraceFlagPayloads : 0;
+	std::vector<byte> vecHeader(c_nTraceHeaderSize);
+	for (size_t i = 0; i < 4; ++i)
+		vecHeader[i] = byte(c_nTraceMagic >> (8 * i));
+	for (size_t i = 0; i < 2; ++i)
+	{
+		vecHeader[4 + i] = byte(c_nTraceVersion >> (8 * i));
+		vecHeader[6 + i] = byte(nFlags >> (8 * i));
+	}
+	for (size_t i = 0; i < 8; ++i)
+		vecHeader[8 + i] = byte(nWallClockNs >> (8 * i));
+
+	std::lock_guard<std::mutex> oLock(m_mtxBuffer);
+	m_tpStart = std::chrono::steady_clock::now();
+	m_nLastTimeNs = 0;
+	m_nFrameCount = 0;
+	m_vecBuffer = std::move(vecHeader);
+	m_bRecording = true;
+	return true;
+}
+
+bool CPipeCapture::Close()
+{
+	if (!IsOpen())
+		return false;
+
+	const bool bOk = FlushBuffer();
+	std::lock_guard<std::mutex> oWriteLock(m_mtxWrite);
+	{
+		std::lock_guard<std::mutex> oLock(m_mtxBuffer);
+		m_bRecording = false;
+	}
+#ifdef _WIN32
+	CloseHandle(m_hFile);
+	m_hFile = INVALID_HANDLE_VALUE;
+#else
+	close(m_nFd);
+	m_nFd = -1;
+#endif
+	return bOk;
+}
+
+bool CPipeCapture::Flush()
+{
+	return IsOpen() && FlushBuffer();
+}
+
+uint64_t CPipeCapture::Now() const
+{
+	return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_tpStart).count());
+}
+
+void CPipeCapture::Record(uint64_t nTimeNs, uint64_t nConnectionId, const SFrameHeader& oHeader, const void* pPayload, size_t nSize)
+{
+	{
+		std::lock_guard<std::mutex> oLock(m_mtxBuffer);
+		if (!m_bRecording)
+			return;
+
+		// The threads take the time before the lock, so a record may come a bit late
+		nTimeNs = (std::max)(nTimeNs, m_nLastTimeNs);
+		const bool bOmitted = (pPayload == nullptr || !m_bPayloads);
+		AppendVarint(m_vecBuffer, nTimeNs - m_nLastTimeNs);
+		AppendVarint(m_vecBuffer, nConnectionId);
+		AppendVarint(m_vecBuffer, oHeader.nType);
+		AppendVarint(m_vecBuffer, uint16_t(oHeader.nFlags & ~c_nTraceWireFlags));
+		AppendVarint(m_vecBuffer, oHeader.nChannel);
+		AppendVarint(m_vecBuffer, (uint64_t(nSize) << 1) | (bOmitted ? 1 : 0));
+		if (!bOmitted)
+		{
+			const byte* pBytes = static_cast<const byte*>(pPayload);
+			m_vecBuffer.insert(m_vecBuffer.end(), pBytes, pBytes + nSize);
+		}
+		m_nLastTimeNs = nTimeNs;
+		++m_nFrameCount;
+		if (m_vecBuffer.size() < c_nBufferSize)
+			return;
+	}
+
+	FlushBuffer();
+}
+
+uint64_t CPipeCapture::GetFrameCount() const
+{
+	std::lock_guard<std::mutex> oLock(m_mtxBuffer);
+	return m_nFrameCount;
+}
+
+bool CPipeCapture::WriteBuffer(const std::vector<byte>& vecBuffer)
+{
+	const byte* pData = vecBuffer.data();
+	size_t nLeft = vecBuffer.size();
+	while (nLeft > 0)
+	{
+#ifdef _WIN32
+		DWORD nWritten = 0;
+		if (!WriteFile(m_hFile, pData, DWORD((std::min)(nLeft, size_t(0x40000000))), &nWritten, NULL))
+			return false;
+#else
+		const ssize_t nWritten = write(m_nFd, pData, nLeft);
+		if (nWritten < 0 && errno == EINTR)
+			continue;
+		if (nWritten <= 0)
+			return false;
+#endif
+		pData += nWritten;
+		nLeft -= size_t(nWritten);
+	}
+
+	return true;
+}
+
+bool CPipeCapture::FlushBuffer()
+{
+	std::lock_guard<std::mutex> oWriteLock(m_mtxWrite);
+	{
+		std::lock_guard<std::mutex> oLock(m_mtxBuffer);
+		if (!m_bRecording)
+			return false;
+		m_vecWriting.swap(m_vecBuffer);
+	}
+
+	// The recording threads fill the other buffer meanwhile
+	const bool bOk = WriteBuffer(m_vecWriting);
+	m_vecWriting.clear();
+	if (!bOk)
+	{
+		std::lock_guard<std::mutex> oLock(m_mtxBuffer);
+		m_bRecording = false;
+		m_vecBuffer.clear();
+	}
+	return bOk;
+}
+
+void CPipeCapture::AppendVarint(std::vector<byte>& vecBuffer, uint64_t nValue)
+{
+	while (nValue >= 0x80)
+	{
+		vecBuffer.push_back(byte(nValue | 0x80));
+		nValue >>= 7;
+	}
+	vecBuffer.push_back(byte(nValue));
+}
@@ -0,0 +1,103 @@
+/*
+Declaration file for the pipe capture
+
+Records the frames a pipe sends or receives into a trace file, so the traffic can be replayed later
+(see CPipeReplayer) with their original sizes, types and timing. The file header is followed by one
+record per frame, all the record fields are LEB128 varints (most are one byte):
+	+-------+---------+-------+------------------+
+	| magic | version | flags | wall clock start |
+	|  u32  |   u16   |  u16  |  u64 (Unix, ns)  |
+	+-------+---------+-------+------------------+
+	+------------+---------------+------+-------+---------+-----------------------+---------+
+	| time delta | connection id | type | flags | channel | length << 1 | omitted | payload |
+	+------------+---------------+------+-------+---------+-----------------------+---------+
+The time delta is the distance from the previous record in nanoseconds. A record without its payload
+(the trace of the lengths only, a frame sent from a file) is replayed as zeros of the same length.
+*/
+
+
+//! Include guard
+#pragma once
+
+
+//! Includes
+#include "pipe_frame.h"
+#include "pipe_transport.h"
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+//! Trace constants
+const uint32_t	c_nTraceMagic = 0x5254584C;					// "LXTR"
+const uint16_t	c_nTraceVersion = 1;
+const size_t	c_nTraceHeaderSize = 16;
+const uint16_t	c_nTraceFlagPayloads = 0x0001;				// The records carry the payloads
+const uint16_t	c_nTraceWireFlags = FrameFlagChecksum | FrameFlagEncrypted;	// Flags of the wire, not of the frame
+
+
+//! Type declarations
+class CPipeCapture;
+typedef std::shared_ptr<CPipeCapture> CPipeCapturePtr;
+
+
+//! Class CPipeCapture
+// Thread safe, one capture may record the frames of several pipes (told apart by the connection id)
+class CPipeCapture
+{
+public: //! Constants
+	static const size_t c_nBufferSize = 1024 * 1024;		// Records buffered before they are written
+
+public: //! Constructors and destructor
+	// bPayloads false records the frame lengths only: the trace stays small and holds no data
+	CPipeCapture(const std::string& sPath, bool bPayloads = true);
+	~CPipeCapture();
+	CPipeCapture(const CPipeCapture&) = delete;
+	CPipeCapture& operator=(const CPipeCapture&) = delete;
+
+public: //! Interface
+	// Returns true if the trace file is opened
+	bool IsOpen() const;
+	// Creates the trace file (replaces an existing one), the capture time starts now
+	bool Open();
+	// Writes the buffered records and closes the file
+	bool Close();
+	// Writes the buffered records
+	bool Flush();
+
+	// Returns the time since Open in nanoseconds, the time of a record
+	uint64_t Now() const;
+	// Appends the frame of the connection at nTimeNs (Now), null pPayload records its length only.
+	// The records of a late time are put at the time of the previous one. Failures stop the capture,
+	// Flush and Close report them
+	void Record(uint64_t nTimeNs, uint64_t nConnectionId, const SFrameHeader& oHeader, const void* pPayload, size_t nSize);
+
+	// Returns the number of frames recorded
+	uint64_t GetFrameCount() const;
+
+private: //! Implementation
+	// Writes the swapped out records to the file (under m_mtxWrite)
+	bool WriteBuffer(const std::vector<byte>& vecBuffer);
+	// Moves the buffered records to the file, returns false once a write has failed or after Close
+	bool FlushBuffer();
+	static void AppendVarint(std::vector<byte>& vecBuffer, uint64_t nValue);
+
+private: //! Members
+	std::string								m_sPath;
+	bool									m_bPayloads;
+	std::chrono::steady_clock::time_point	m_tpStart;
+	mutable std::mutex						m_mtxBuffer;		// Guards the buffered records
+	mutable std::mutex						m_mtxWrite;			// Keeps the writes in order, guards the file
+	std::vector<byte>						m_vecBuffer;		// Records not written yet
+	std::vector<byte>						m_vecWriting;		// Records being written, swapped with the buffered ones
+	uint64_t								m_nLastTimeNs;		// Time of the previous record
+	uint64_t								m_nFrameCount;
+	bool									m_bRecording;		// Opened and no write has failed, the records are kept
+#ifdef _WIN32
+	HANDLE									m_hFile;
+#else
+	int										m_nFd;
+#endif
+};
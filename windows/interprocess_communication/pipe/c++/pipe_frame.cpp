@@ -0,0 +1,279 @@
+/*
+Implementation file for the pipe frame (wire protocol)
+*/
+
+
+//! Includes
+#include "pipe_frame.h"
+#include "crc32c.h"
+#include <cstring>
+
+
+namespace
+{
+	void PutUInt16(uint8_t* pBuffer, uint16_t nValue)
+	{
+		pBuffer[0] = uint8_t(nValue);
+		pBuffer[1] = uint8_t(nValue >> 8);
+	}
+
+	void PutUInt32(uint8_t* pBuffer, uint32_t nValue)
+	{
+		pBuffer[0] = uint8_t(nValue);
+		pBuffer[1] = uint8_t(nValue >> 8);
+		pBuffer[2] = uint8_t(nValue >> 16);
+		pBuffer[3] = uint8_t(nValue >> 24);
+	}
+
+	void PutUInt64(uint8_t* pBuffer, uint64_t nValue)
+	{
+		PutUInt32(pBuffer, uint32_t(nValue));
+		PutUInt32(pBuffer + 4, uint32_t(nValue >> 32));
+	}
+
+	uint16_t GetUInt16(const uint8_t* pBuffer)
+	{
+		return uint16_t(pBuffer[0] | (pBuffer[1] << 8));
+	}
+
+	uint32_t GetUInt32(const uint8_t* pBuffer)
+	{
+		return uint32_t(pBuffer[0]) | (uint32_t(pBuffer[1]) << 8) | (uint32_t(pBuffer[2]) << 16) | (uint32_t(pBuffer[3]) << 24);
+	}
+
+	uint64_t GetUInt64(const uint8_t* pBuffer)
+	{
+		return uint64_t(GetUInt32(pBuffer)) | (uint64_t(GetUInt32(pBuffer + 4)) << 32);
+	}
+}
+
+
+void SFrameHeader::Encode(uint8_t* pBuffer) const
+{
+	PutUInt16(pBuffer + 0, nMagic);
+	PutUInt16(pBuffer + 2, nType);
+	PutUInt16(pBuffer + 4, nFlags);
+	PutUInt16(pBuffer + 6, nChannel);
+	PutUInt32(pBuffer + 8, nLength);
+}
+
+void SFrameHeader::Decode(const uint8_t* pBuffer)
+{
+	nMagic = GetUInt16(pBuffer + 0);
+	nType = GetUInt16(pBuffer + 2);
+	nFlags = GetUInt16(pBuffer + 4);
+	nChannel = GetUInt16(pBuffer + 6);
+	nLength = GetUInt32(pBuffer + 8);
+}
+
+bool SFrameHeader::IsValid(uint32_t nMaxLength) const
+{
+	if (nMagic != c_nFrameMagic || nType == uint16_t(EFrameType::Invalid))
+		return false;
+
+	// The limit applies to the payload, the encryption overhead comes on top of it
+	if ((nFlags & FrameFlagEncrypted) != 0)
+		return (nLength >= c_nFrameCipherOverhead && nLength - c_nFrameCipherOverhead <= nMaxLength);
+	return (nLength <= nMaxLength);
+}
+
+size_t SFrameHeader::GetFrameSize() const
+{
+	return c_nFrameHeaderSize + nLength + (((nFlags & FrameFlagChecksum) != 0) ? c_nFrameChecksumSize : 0);
+}
+
+uint32_t SFrameHeader::GetPayloadSize() const
+{
+	return ((nFlags & FrameFlagEncrypted) != 0) ? nLength - uint32_t(c_nFrameCipherOverhead) : nLength;
+}
+
+
+void SRpcHeader::Encode(uint8_t* pBuffer) const
+{
+	PutUInt64(pBuffer + 0, nCallId);
+	PutUInt32(pBuffer + 8, nCode);
+	PutUInt32(pBuffer + 12, nTimeoutMs);
+}
+
+bool SRpcHeader::Decode(const SFrameHeader& oHeader, const uint8_t* pPayload)
+{
+	if ((oHeader.nType != uint16_t(EFrameType::Request) && oHeader.nType != uint16_t(EFrameType::Response)) ||
+		oHeader.nLength < c_nRpcHeaderSize)
+		return false;
+
+	nCallId = GetUInt64(pPayload + 0);
+	nCode = GetUInt32(pPayload + 8);
+	nTimeoutMs = GetUInt32(pPayload + 12);
+	return true;
+}
+
+void EncodeFlowControl(uint8_t* pBuffer)
+{
+	SFrameHeader oHeader;
+	oHeader.nType = uint16_t(EFrameType::FlowControl);
+	oHeader.Encode(pBuffer);
+}
+
+void EncodeCredit(uint8_t* pBuffer, uint32_t nCredit)
+{
+	SFrameHeader oHeader;
+	oHeader.nType = uint16_t(EFrameType::Credit);
+	oHeader.nLength = 4;
+	oHeader.Encode(pBuffer);
+	PutUInt32(pBuffer + c_nFrameHeaderSize, nCredit);
+}
+
+bool DecodeCredit(const SFrameHeader& oHeader, const uint8_t* pPayload, uint32_t& nCredit)
+{
+	if (oHeader.nType != uint16_t(EFrameType::Credit) || oHeader.nLength != 4)
+		return false;
+
+	nCredit = GetUInt32(pPayload);
+	return true;
+}
+
+void EncodeSequence(uint8_t* pBuffer, uint64_t nSpoolId, uint64_t nSequence)
+{
+	SFrameHeader oHeader;
+	oHeader.nType = uint16_t(EFrameType::Sequence);
+	oHeader.nLength = 16;
+	oHeader.Encode(pBuffer);
+	PutUInt64(pBuffer + c_nFrameHeaderSize, nSpoolId);
+	PutUInt64(pBuffer + c_nFrameHeaderSize + 8, nSequence);
+}
+
+bool DecodeSequence(const SFrameHeader& oHeader, const uint8_t* pPayload, uint64_t& nSpoolId, uint64_t& nSequence)
+{
+	if (oHeader.nType != uint16_t(EFrameType::Sequence) || oHeader.nLength != 16)
+		return false;
+
+	nSpoolId = GetUInt64(pPayload);
+	nSequence = GetUInt64(pPayload + 8);
+	return true;
+}
+
+void EncodeAcknowledge(uint8_t* pBuffer, uint64_t nSequence)
+{
+	SFrameHeader oHeader;
+	oHeader.nType = uint16_t(EFrameType::Acknowledge);
+	oHeader.nLength = 8;
+	oHeader.Encode(pBuffer);
+	PutUInt64(pBuffer + c_nFrameHeaderSize, nSequence);
+}
+
+bool DecodeAcknowledge(const SFrameHeader& oHeader, const uint8_t* pPayload, uint64_t& nSequence)
+{
+	if (oHeader.nType != uint16_t(EFrameType::Acknowledge) || oHeader.nLength != 8)
+		return false;
+
+	nSequence = GetUInt64(pPayload);
+	return true;
+}
+
+void EncodeChecksum(uint8_t* pBuffer, uint32_t nChecksum)
+{
+	PutUInt32(pBuffer, nChecksum);
+}
+
+uint32_t DecodeChecksum(const uint8_t* pBuffer)
+{
+	return GetUInt32(pBuffer);
+}
+
+uint32_t GetFrameChecksum(const uint8_t* pHeader, const void* pPayload, size_t nSize)
+{
+	return Crc32c(Crc32c(0, pHeader, c_nFrameHeaderSize), pPayload, nSize);
+}
+
+void EncodeSession(uint8_t* pBuffer, const uint8_t* pSalt)
+{
+	SFrameHeader oHeader;
+	oHeader.nType = uint16_t(EFrameType::Session);
+	oHeader.nLength = uint32_t(c_nSessionSaltSize);
+	oHeader.Encode(pBuffer);
+	memcpy(pBuffer + c_nFrameHeaderSize, pSalt, c_nSessionSaltSize);
+}
+
+bool DecodeSession(const SFrameHeader& oHeader, const uint8_t* pPayload, uint8_t* pSalt)
+{
+	if (oHeader.nType != uint16_t(EFrameType::Session) || oHeader.nLength != c_nSessionSaltSize)
+		return false;
+
+	memcpy(pSalt, pPayload, c_nSessionSaltSize);
+	return true;
+}
+
+
+CFrameAssembler::CFrameAssembler(uint32_t nMaxLength)
+	: m_nReadOffset(0),
+	  m_nWriteOffset(0),
+	  m_nMaxLength(nMaxLength)
+{
+}
+
+uint8_t* CFrameAssembler::GetWriteBuffer(size_t nMinSize)
+{
+	if (m_nReadOffset == m_nWriteOffset)
+		m_nReadOffset = m_nWriteOffset = 0;
+
+	if (m_vecBuffer.size() - m_nWriteOffset < nMinSize)
+	{
+		// Move the unparsed tail to the front, grow only if that is not enough
+		const size_t nPending = m_nWriteOffset - m_nReadOffset;
+		if (m_nReadOffset > 0)
+		{
+			memmove(m_vecBuffer.data(), m_vecBuffer.data() + m_nReadOffset, nPending);
+			m_nReadOffset = 0;
+			m_nWriteOffset = nPending;
+		}
+		if (m_vecBuffer.size() - m_nWriteOffset < nMinSize)
+			m_vecBuffer.resize(m_nWriteOffset + nMinSize);
+	}
+
+	return m_vecBuffer.data() + m_nWriteOffset;
+}
+
+void CFrameAssembler::CommitWrite(size_t nSize)
+{
+	m_nWriteOffset += nSize;
+}
+
+CFrameAssembler::EResult CFrameAssembler::Next(SFrameHeader& oHeader, std::vector<uint8_t>& vecPayload)
+{
+	const uint8_t* pPayload = nullptr;
+	EResult eResult = Next(oHeader, pPayload);
+	if (eResult == EResult::Frame)
+		vecPayload.assign(pPayload, pPayload + oHeader.nLength);
+
+	return eResult;
+}
+
+CFrameAssembler::EResult CFrameAssembler::Next(SFrameHeader& oHeader, const uint8_t*& pPayload)
+{
+	const size_t nPending = m_nWriteOffset - m_nReadOffset;
+	if (nPending < c_nFrameHeaderSize)
+		return EResult::Incomplete;
+
+	const uint8_t* pFrame = m_vecBuffer.data() + m_nReadOffset;
+	oHeader.Decode(pFrame);
+	if (!oHeader.IsValid(m_nMaxLength))
+		return EResult::Invalid;
+	const size_t nFrameSize = oHeader.GetFrameSize();
+	if (nPending < nFrameSize)
+		return EResult::Incomplete;
+
+	// Offsets are rewound by the next GetWriteBuffer only, so the bytes stay in place
+	pPayload = pFrame + c_nFrameHeaderSize;
+	m_nReadOffset += nFrameSize;
+	if ((oHeader.nFlags & FrameFlagChecksum) != 0 &&
+		DecodeChecksum(pPayload + oHeader.nLength) != GetFrameChecksum(pFrame, pPayload, oHeader.nLength))
+		return EResult::Corrupted;
+
+	return EResult::Frame;
+}
+
+void CFrameAssembler::Reset()
+{
+	m_nReadOffset = 0;
+	m_nWriteOffset = 0;
+}
@@ -0,0 +1,185 @@
+/*
+Declaration file for the pipe frame (wire protocol)
+
+Every message is sent as a fixed size header followed by the payload:
+	+-------+------+-------+----------+--------+----------------+
+	| magic | type | flags | channel  | length | payload ...    |
+	|  u16  | u16  |  u16  |   u16    |  u32   | length bytes   |
+	+-------+------+-------+----------+--------+----------------+
+A frame with the checksum flag is followed by the CRC32C of its header and payload (u32,
+not counted in the length). The payload of a frame with the encrypted flag is sealed by AES-GCM
+(see CFrameCipher), the length counts the sequence number and the tag:
+	+----------+------------+-----+
+	| sequence | ciphertext | tag |
+	|   u64    |            | 16  |
+	+----------+------------+-----+
+All the header fields are little-endian. The request and response frames of the RPC layer
+start the payload with SRpcHeader:
+	+---------+------+---------+--------------------+
+	| call id | code | timeout | arguments / result |
+	|   u64   | u32  |   u32   |                    |
+	+---------+------+---------+--------------------+
+*/
+
+
+//! Include guard
+#pragma once
+
+
+//! Includes
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+//! Frame types
+enum class EFrameType : uint16_t
+{
+	Invalid = 0,
+	Data = 1,
+	FlowControl = 2,	// Writer asks the reader for credits (no payload)
+	Credit = 3,			// Reader grants the writer bytes to send (u32 payload)
+	Request = 4,		// RPC call (SRpcHeader and the arguments)
+	Response = 5,		// RPC reply (SRpcHeader and the result)
+	Descriptor = 6,		// Carries a file descriptor passed along by SCM_RIGHTS (POSIX)
+	Sequence = 7,		// Spool writer: the spool id and the sequence number of the next data frame (u64, u64)
+	Acknowledge = 8,	// Spool reader: the sequence number of the last consumed data frame (u64)
+	Session = 9			// Encrypting writer: the salt the keys of the connection are derived from (16 bytes)
+};
+
+
+//! Frame flags (may be combined)
+enum EFrameFlag : uint16_t
+{
+	FrameFlagNone = 0x0000,
+	FrameFlagMore = 0x0001,			// More chunks of the message follow on the channel
+	FrameFlagContinued = 0x0002,	// The chunk continues the message started on the channel
+	FrameFlagAborted = 0x0004,		// The stream ends unfinished (empty chunk)
+	FrameFlagAckRequest = 0x0008,	// The spool writer waits for the acknowledgement of the frames sent so far
+	FrameFlagChecksum = 0x0010,		// The payload is followed by the CRC32C trailer
+	FrameFlagEncrypted = 0x0020		// The payload is sealed by AES-GCM
+};
+
+
+//! Frame constants
+const uint16_t	c_nFrameMagic = 0x584C;						// "LX"
+const size_t	c_nFrameHeaderSize = 12;					// Encoded header size
+const uint32_t	c_nFrameDefaultMaxLength = 256 * 1024 * 1024;	// Default payload limit
+const size_t	c_nCreditFrameSize = c_nFrameHeaderSize + 4;	// Encoded credit frame size
+const uint32_t	c_nUnlimitedCredit = 0xFFFFFFFF;			// Credit of the reader that doesn't limit the writer
+const size_t	c_nRpcHeaderSize = 16;						// Encoded RPC header size
+const size_t	c_nStreamChunkSize = 1024 * 1024;			// Chunk of the streamed file
+const size_t	c_nSequenceFrameSize = c_nFrameHeaderSize + 16;	// Encoded sequence frame size
+const size_t	c_nAcknowledgeFrameSize = c_nFrameHeaderSize + 8;	// Encoded acknowledge frame size
+const size_t	c_nFrameChecksumSize = 4;					// Checksum trailer size
+const size_t	c_nSessionSaltSize = 16;					// Salt of the encrypted connection
+const size_t	c_nSessionFrameSize = c_nFrameHeaderSize + c_nSessionSaltSize;	// Encoded session frame size
+const size_t	c_nFrameSequenceSize = 8;					// Sequence number of the encrypted frame
+const size_t	c_nFrameTagSize = 16;						// Authentication tag of the encrypted frame
+const size_t	c_nFrameCipherOverhead = c_nFrameSequenceSize + c_nFrameTagSize;	// Length the encryption adds
+
+
+//! Struct SFrameHeader
+struct SFrameHeader
+{
+	uint16_t	nMagic = c_nFrameMagic;		// Frame magic, used to detect stream desynchronization
+	uint16_t	nType = 0;					// Frame type (EFrameType)
+	uint16_t	nFlags = FrameFlagNone;		// Frame flags (EFrameFlag combination)
+	uint16_t	nChannel = 0;				// Logical channel (CChannelPipe), zero by default
+	uint32_t	nLength = 0;				// Payload length
+
+	// Writes the header into the buffer of c_nFrameHeaderSize bytes
+	void Encode(uint8_t* pBuffer) const;
+	// Reads the header from the buffer of c_nFrameHeaderSize bytes
+	void Decode(const uint8_t* pBuffer);
+	// Returns true if the header is well-formed and the payload fits the limit
+	bool IsValid(uint32_t nMaxLength) const;
+	// Returns the size of the frame on the wire (header, payload and the checksum trailer if any)
+	size_t GetFrameSize() const;
+	// Returns the size of the payload the frame carries (the length less the encryption overhead)
+	uint32_t GetPayloadSize() const;
+};
+
+
+//! Struct SRpcHeader
+struct SRpcHeader
+{
+	uint64_t	nCallId = 0;		// Correlation id chosen by the caller, the response echoes it
+	uint32_t	nCode = 0;			// Method of the request, status of the response
+	uint32_t	nTimeoutMs = 0;		// Request: how long the caller waits for the response (zero forever)
+
+	// Writes the header into the buffer of c_nRpcHeaderSize bytes
+	void Encode(uint8_t* pBuffer) const;
+	// Reads the header from the payload of the request or response frame
+	bool Decode(const SFrameHeader& oHeader, const uint8_t* pPayload);
+};
+
+
+//! Control frames
+// Writes the flow control request of c_nFrameHeaderSize bytes
+void EncodeFlowControl(uint8_t* pBuffer);
+// Writes the credit frame of c_nCreditFrameSize bytes
+void EncodeCredit(uint8_t* pBuffer, uint32_t nCredit);
+// Reads the credit from the payload of the credit frame
+bool DecodeCredit(const SFrameHeader& oHeader, const uint8_t* pPayload, uint32_t& nCredit);
+// Writes the sequence frame of c_nSequenceFrameSize bytes
+void EncodeSequence(uint8_t* pBuffer, uint64_t nSpoolId, uint64_t nSequence);
+// Reads the spool id and the sequence number from the payload of the sequence frame
+bool DecodeSequence(const SFrameHeader& oHeader, const uint8_t* pPayload, uint64_t& nSpoolId, uint64_t& nSequence);
+// Writes the acknowledge frame of c_nAcknowledgeFrameSize bytes
+void EncodeAcknowledge(uint8_t* pBuffer, uint64_t nSequence);
+// Reads the sequence number from the payload of the acknowledge frame
+bool DecodeAcknowledge(const SFrameHeader& oHeader, const uint8_t* pPayload, uint64_t& nSequence);
+
+
+//! Checksum trailer
+// Writes the trailer of c_nFrameChecksumSize bytes
+void EncodeChecksum(uint8_t* pBuffer, uint32_t nChecksum);
+// Reads the trailer of c_nFrameChecksumSize bytes
+uint32_t DecodeChecksum(const uint8_t* pBuffer);
+// Returns the checksum of the encoded header and the payload
+uint32_t GetFrameChecksum(const uint8_t* pHeader, const void* pPayload, size_t nSize);
+
+
+//! Session frame
+// Writes the session frame of c_nSessionFrameSize bytes
+void EncodeSession(uint8_t* pBuffer, const uint8_t* pSalt);
+// Reads the salt of c_nSessionSaltSize bytes, returns false if it's not a session frame
+bool DecodeSession(const SFrameHeader& oHeader, const uint8_t* pPayload, uint8_t* pSalt);
+
+
+//! Class CFrameAssembler
+// Collects the bytes of a non-blocking stream and cuts them into whole frames
+class CFrameAssembler
+{
+public: //! Types
+	enum class EResult
+	{
+		Incomplete,		// More bytes are needed
+		Frame,			// One frame has been extracted
+		Invalid,		// The stream is not a valid frame sequence
+		Corrupted		// The checksum of the frame doesn't match, the stream can't be trusted further
+	};
+
+public: //! Constructors and destructor
+	explicit CFrameAssembler(uint32_t nMaxLength = c_nFrameDefaultMaxLength);
+
+public: //! Interface
+	// Returns the space of at least nMinSize bytes to receive into
+	uint8_t* GetWriteBuffer(size_t nMinSize);
+	// Commits the bytes received into the write buffer
+	void CommitWrite(size_t nSize);
+	// Extracts the next complete frame
+	EResult Next(SFrameHeader& oHeader, std::vector<uint8_t>& vecPayload);
+	// Extracts the next complete frame without copying, the payload stays valid until GetWriteBuffer.
+	// The checksum trailer is verified and isn't part of the payload
+	EResult Next(SFrameHeader& oHeader, const uint8_t*& pPayload);
+	// Drops all the collected bytes
+	void Reset();
+
+private: //! Members
+	std::vector<uint8_t>	m_vecBuffer;
+	size_t					m_nReadOffset;		// Start of the unparsed bytes
+	size_t					m_nWriteOffset;		// End of the received bytes
+	uint32_t				m_nMaxLength;		// Payload limit
+};
@@ -0,0 +1,294 @@
+/*
+Implementation file for the pipe metrics
+*/
+
+
+//! Includes
+#include "pipe_metrics.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+
+//! Metrics constants
+static const double		c_arrPercentiles[] = { 0.5, 0.9, 0.99, 0.999 };
+static const int64_t	c_nCalibrationNs = 10 * 1000 * 1000;	// Shortest time the tick rate is measured over
+
+
+namespace
+{
+	uint64_t GetSteadyNs()
+	{
+		return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+	}
+
+	unsigned GetHighestBit(uint64_t nValue)
+	{
+#if defined(_MSC_VER) && defined(_M_X64)
+		unsigned long nIndex = 0;
+		_BitScanReverse64(&nIndex, nValue);
+		return unsigned(nIndex);
+#elif defined(_MSC_VER)
+		unsigned long nIndex = 0;
+		if (_BitScanReverse(&nIndex, (unsigned long)(nValue >> 32)))
+			return unsigned(nIndex) + 32;
+		_BitScanReverse(&nIndex, (unsigned long)nValue);
+		return unsigned(nIndex);
+#else
+		return 63 - unsigned(__builtin_clzll(nValue));
+#endif
+	}
+
+	// Nanoseconds per tick. The time stamp counter runs at a constant rate on the processors of the last
+	// decade, the rate is measured against the steady clock since the first metrics were created
+	class CTickClock
+	{
+	public:
+		static CTickClock& Get()
+		{
+			static CTickClock s_oClock;
+			return s_oClock;
+		}
+
+		double GetNsPerTick()
+		{
+#ifdef PIPE_METRICS_TSC
+			int64_t nElapsedNs = int64_t(GetSteadyNs() - m_nStartNs);
+			if (nElapsedNs < c_nCalibrationNs)
+			{
+				// Only the snapshot right after the start waits
+				std::this_thread::sleep_for(std::chrono::nanoseconds(c_nCalibrationNs - nElapsedNs));
+				nElapsedNs = int64_t(GetSteadyNs() - m_nStartNs);
+			}
+			const uint64_t nTicks = CPipeMetrics::Now() - m_nStartTicks;
+			return (nTicks == 0) ? 1.0 : double(nElapsedNs) / double(nTicks);
+#else
+			return 1.0;
+#endif
+		}
+
+	private:
+		CTickClock()
+			: m_nStartNs(GetSteadyNs()),
+			  m_nStartTicks(CPipeMetrics::Now())
+		{
+		}
+
+		uint64_t	m_nStartNs;
+		uint64_t	m_nStartTicks;
+	};
+}
+
+
+CPipeMetricsPtr CPipeMetrics::Create()
+{
+	// The clock starts measuring its rate with the first metrics
+	CTickClock::Get();
+	return CPipeMetricsPtr(new CPipeMetrics());
+}
+
+CPipeMetrics::CPipeMetrics()
+{
+	for (SShard& oShard : m_arrShards)
+		for (std::atomic<uint64_t>& nCounter : oShard.arrCounters)
+			nCounter.store(0, std::memory_order_relaxed);
+	for (std::atomic<int64_t>& nGauge : m_arrGauges)
+		nGauge.store(0, std::memory_order_relaxed);
+	for (SHistogram& oHistogram : m_arrHistograms)
+	{
+		oHistogram.nSum.store(0, std::memory_order_relaxed);
+		oHistogram.nMin.store(UINT64_MAX, std::memory_order_relaxed);
+		oHistogram.nMax.store(0, std::memory_order_relaxed);
+		for (std::atomic<uint64_t>& nBucket : oHistogram.arrBuckets)
+			nBucket.store(0, std::memory_order_relaxed);
+	}
+}
+
+void CPipeMetrics::RecordTicks(EPipeLatency eLatency, uint64_t nTicks)
+{
+	SHistogram& oHistogram = m_arrHistograms[size_t(eLatency)];
+
+	// The extremes rarely move, so they are mostly only read
+	uint64_t nMin = oHistogram.nMin.load(std::memory_order_relaxed);
+	while (nTicks < nMin && !oHistogram.nMin.compare_exchange_weak(nMin, nTicks, std::memory_order_relaxed))
+		;
+	uint64_t nMax = oHistogram.nMax.load(std::memory_order_relaxed);
+	while (nTicks > nMax && !oHistogram.nMax.compare_exchange_weak(nMax, nTicks, std::memory_order_relaxed))
+		;
+
+	oHistogram.nSum.fetch_add(nTicks, std::memory_order_relaxed);
+	oHistogram.arrBuckets[GetBucket(nTicks)].fetch_add(1, std::memory_order_relaxed);
+}
+
+SPipeMetrics CPipeMetrics::Snapshot() const
+{
+	SPipeMetrics oMetrics;
+	for (const SShard& oShard : m_arrShards)
+		for (size_t i = 0; i < size_t(EPipeCounter::Count); ++i)
+			oMetrics.arrCounters[i] += oShard.arrCounters[i].load(std::memory_order_relaxed);
+	for (size_t i = 0; i < size_t(EPipeGauge::Count); ++i)
+		oMetrics.arrGauges[i] = m_arrGauges[i].load(std::memory_order_relaxed);
+
+	const double dNsPerTick = CTickClock::Get().GetNsPerTick();
+	auto fnToNs = [dNsPerTick](uint64_t nTicks) { return uint64_t(double(nTicks) * dNsPerTick + 0.5); };
+	for (size_t i = 0; i < size_t(EPipeLatency::Count); ++i)
+	{
+		const SHistogram& oHistogram = m_arrHistograms[i];
+		SLatencySummary& oSummary = oMetrics.arrLatencies[i];
+
+		// The count is the sum of the buckets, so the percentiles agree with it while the records go on
+		uint64_t arrBuckets[c_nBuckets];
+		uint64_t nCount = 0;
+		for (size_t j = 0; j < c_nBuckets; ++j)
+		{
+			arrBuckets[j] = oHistogram.arrBuckets[j].load(std::memory_order_relaxed);
+			nCount += arrBuckets[j];
+		}
+		if (nCount == 0)
+			continue;
+
+		// The record that is still going on may have counted its bucket only
+		uint64_t nMin = oHistogram.nMin.load(std::memory_order_relaxed);
+		uint64_t nMax = oHistogram.nMax.load(std::memory_order_relaxed);
+		if (nMin > nMax)
+		{
+			nMin = 0;
+			nMax = GetBucketValue(c_nBuckets - 1);
+		}
+		oSummary.nCount = nCount;
+		oSummary.nMin = fnToNs(nMin);
+		oSummary.nMax = fnToNs(nMax);
+		oSummary.nMean = fnToNs(oHistogram.nSum.load(std::memory_order_relaxed) / nCount);
+
+		uint64_t* arrValues[] = { &oSummary.nP50, &oSummary.nP90, &oSummary.nP99, &oSummary.nP999 };
+		size_t nBucket = 0;
+		uint64_t nSeen = arrBuckets[0];
+		for (size_t j = 0; j < sizeof(c_arrPercentiles) / sizeof(c_arrPercentiles[0]); ++j)
+		{
+			// The value the given share of the records doesn't exceed
+			const uint64_t nRank = (std::max)(uint64_t(c_arrPercentiles[j] * double(nCount) + 0.999999), uint64_t(1));
+			while (nSeen < nRank && nBucket + 1 < c_nBuckets)
+				nSeen += arrBuckets[++nBucket];
+			*arrValues[j] = fnToNs((std::min)((std::max)(GetBucketValue(nBucket), nMin), nMax));
+		}
+	}
+
+	oMetrics.nTimestampNs = GetSteadyNs();
+	return oMetrics;
+}
+
+size_t CPipeMetrics::GetBucket(uint64_t nTicks)
+{
+	if (nTicks < c_nSubBuckets)
+		return size_t(nTicks);
+
+	const uint64_t nLimit = (uint64_t(1) << (c_nMaxExponent + 1)) - 1;
+	nTicks = (std::min)(nTicks, nLimit);
+	const unsigned nExponent = GetHighestBit(nTicks);
+	const unsigned nShift = nExponent - 4;
+	return size_t(nExponent - 3) * c_nSubBuckets + size_t((nTicks >> nShift) & (c_nSubBuckets - 1));
+}
+
+uint64_t CPipeMetrics::GetBucketValue(size_t nBucket)
+{
+	if (nBucket < c_nSubBuckets)
+		return uint64_t(nBucket);
+
+	const unsigned nShift = unsigned(nBucket / c_nSubBuckets) - 1;
+	const uint64_t nLower = uint64_t(c_nSubBuckets + nBucket % c_nSubBuckets) << nShift;
+	return nLower + ((uint64_t(1) << nShift) >> 1);
+}
+
+const char* GetMetricName(EPipeCounter eCounter)
+{
+	switch (eCounter)
+	{
+	case EPipeCounter::MessagesSent:			return "messages_sent";
+	case EPipeCounter::BytesSent:				return "bytes_sent";
+	case EPipeCounter::MessagesReceived:		return "messages_received";
+	case EPipeCounter::BytesReceived:			return "bytes_received";
+	case EPipeCounter::PartialWrites:			return "partial_writes";
+	case EPipeCounter::Reconnects:				return "reconnects";
+	case EPipeCounter::Disconnects:				return "disconnects";
+	case EPipeCounter::Failures:				return "failures";
+	case EPipeCounter::ChecksumFailures:		return "checksum_failures";
+	case EPipeCounter::AuthenticationFailures:	return "authentication_failures";
+	case EPipeCounter::FramesDropped:			return "frames_dropped";
+	case EPipeCounter::CreditWaits:				return "credit_waits";
+	case EPipeCounter::BatchFlushes:			return "batch_flushes";
+	case EPipeCounter::Connections:				return "connections";
+	default:									return "unknown";
+	}
+}
+
+const char* GetMetricName(EPipeGauge eGauge)
+{
+	switch (eGauge)
+	{
+	case EPipeGauge::QueuedFrames:			return "queued_frames";
+	case EPipeGauge::QueuedBytes:			return "queued_bytes";
+	case EPipeGauge::Credits:				return "credits";
+	case EPipeGauge::ActiveConnections:		return "active_connections";
+	default:								return "unknown";
+	}
+}
+
+const char* GetMetricName(EPipeLatency eLatency)
+{
+	switch (eLatency)
+	{
+	case EPipeLatency::Send:		return "send";
+	case EPipeLatency::Receive:		return "receive";
+	case EPipeLatency::Queue:		return "queue";
+	case EPipeLatency::Handler:		return "handler";
+	default:						return "unknown";
+	}
+}
+
+double GetMetricRate(const SPipeMetrics& oFrom, const SPipeMetrics& oTo, EPipeCounter eCounter)
+{
+	if (oTo.nTimestampNs <= oFrom.nTimestampNs || oTo.Get(eCounter) < oFrom.Get(eCounter))
+		return 0.0;
+
+	return double(oTo.Get(eCounter) - oFrom.Get(eCounter)) * 1e9 / double(oTo.nTimestampNs - oFrom.nTimestampNs);
+}
+
+std::string ToJson(const SPipeMetrics& oMetrics)
+{
+	char szBuffer[256];
+	std::string sJson;
+	snprintf(szBuffer, sizeof(szBuffer), "{\"timestamp_ns\":%llu,\"counters\":{", (unsigned long long)oMetrics.nTimestampNs);
+	sJson += szBuffer;
+	for (size_t i = 0; i < size_t(EPipeCounter::Count); ++i)
+	{
+		snprintf(szBuffer, sizeof(szBuffer), "%s\"%s\":%llu", (i > 0) ? "," : "", GetMetricName(EPipeCounter(i)),
+			(unsigned long long)oMetrics.arrCounters[i]);
+		sJson += szBuffer;
+	}
+	sJson += "},\"gauges\":{";
+	for (size_t i = 0; i < size_t(EPipeGauge::Count); ++i)
+	{
+		snprintf(szBuffer, sizeof(szBuffer), "%s\"%s\":%lld", (i > 0) ? "," : "", GetMetricName(EPipeGauge(i)),
+			(long long)oMetrics.arrGauges[i]);
+		sJson += szBuffer;
+	}
+	sJson += "},\"latency_ns\":{";
+	for (size_t i = 0; i < size_t(EPipeLatency::Count); ++i)
+	{
+		const SLatencySummary& oSummary = oMetrics.arrLatencies[i];
+		snprintf(szBuffer, sizeof(szBuffer),
+			"%s\"%s\":{\"count\":%llu,\"min\":%llu,\"max\":%llu,\"mean\":%llu,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu}",
+			(i > 0) ? "," : "", GetMetricName(EPipeLatency(i)), (unsigned long long)oSummary.nCount,
+			(unsigned long long)oSummary.nMin, (unsigned long long)oSummary.nMax, (unsigned long long)oSummary.nMean,
+			(unsigned long long)oSummary.nP50, (unsigned long long)oSummary.nP90, (unsigned long long)oSummary.nP99,
+			(unsigned long long)oSummary.nP999);
+		sJson += szBuffer;
+	}
+	sJson += "}}";
+
+	return sJson;
+}
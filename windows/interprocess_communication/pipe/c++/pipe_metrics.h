@@ -0,0 +1,207 @@
+/*
+Declaration file for the pipe metrics
+
+Counters, gauges and latency histograms of one pipe or connection, recorded on the hot path
+and read by the pull API (Snapshot) from any thread. The counters are sharded by the thread,
+so the threads that record never share a cache line; a record is one relaxed atomic add.
+The histograms keep 16 buckets per power of two (HDR-style, within 1/16 of the value) of the
+processor's time stamp counter ticks, converted to nanoseconds by the snapshot only.
+*/
+
+
+//! Include guard
+#pragma once
+
+
+//! Includes
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PIPE_METRICS_TSC
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#else
+#include <chrono>
+#endif
+
+
+//! Counters (only grow)
+enum class EPipeCounter
+{
+	MessagesSent,			// Frames sent by the user (stream chunks count one by one)
+	BytesSent,				// Their payload bytes
+	MessagesReceived,
+	BytesReceived,
+	PartialWrites,			// Writes the system took only a part of, the rest waited for the buffer space
+	Reconnects,				// Writer: connections reopened after the reader had gone
+	Disconnects,			// Connections dropped or lost
+	Failures,				// Operations failed, whatever the reason
+	ChecksumFailures,		// Frames that didn't match their checksum
+	AuthenticationFailures,	// Frames that didn't open by the key of the session
+	FramesDropped,			// Writer: frames dropped by the flow policy
+	CreditWaits,			// Writer: sends that had to wait for the reader's credits
+	BatchFlushes,			// Writer: batches written
+	Connections,			// Reader: writers accepted
+	Count
+};
+
+//! Gauges (current values)
+enum class EPipeGauge
+{
+	QueuedFrames,			// Frames waiting to be written or handled
+	QueuedBytes,			// Their bytes
+	Credits,				// Writer: bytes granted by the reader and not used yet (INT64_MAX if unlimited)
+	ActiveConnections,		// Reader: writers connected now
+	Count
+};
+
+//! Latency histograms
+enum class EPipeLatency
+{
+	Send,					// Send call until the frame is written (asynchronous: queued until written)
+	Receive,				// CNamedPipe: frame header until the whole payload is read and verified
+	Queue,					// Server: frame dispatched until the worker starts handling it
+	Handler,				// Server: the message handler run
+	Count
+};
+
+
+//! Struct SLatencySummary (nanoseconds, within 1/16 of the value)
+struct SLatencySummary
+{
+	uint64_t	nCount = 0;
+	uint64_t	nMin = 0;
+	uint64_t	nMax = 0;
+	uint64_t	nMean = 0;
+	uint64_t	nP50 = 0;
+	uint64_t	nP90 = 0;
+	uint64_t	nP99 = 0;
+	uint64_t	nP999 = 0;
+};
+
+
+//! Struct SPipeMetrics (snapshot)
+struct SPipeMetrics
+{
+	uint64_t		nTimestampNs = 0;	// Steady clock time of the snapshot
+	uint64_t		arrCounters[size_t(EPipeCounter::Count)] = {};
+	int64_t			arrGauges[size_t(EPipeGauge::Count)] = {};
+	SLatencySummary	arrLatencies[size_t(EPipeLatency::Count)];
+
+	uint64_t Get(EPipeCounter eCounter) const { return arrCounters[size_t(eCounter)]; }
+	int64_t Get(EPipeGauge eGauge) const { return arrGauges[size_t(eGauge)]; }
+	const SLatencySummary& Get(EPipeLatency eLatency) const { return arrLatencies[size_t(eLatency)]; }
+};
+
+
+//! Type declarations
+class CPipeMetrics;
+typedef std::shared_ptr<CPipeMetrics> CPipeMetricsPtr;
+
+
+//! Class CPipeMetrics
+class CPipeMetrics
+{
+public: //! Constants
+	static const size_t		c_nShards = 8;					// Counter copies, threads take them round-robin
+	static const size_t		c_nSubBuckets = 16;				// Histogram buckets per power of two
+	static const unsigned	c_nMaxExponent = 40;			// Longer latencies (2^41 ticks, ~10 minutes) are clamped
+	static const size_t		c_nBuckets = (c_nMaxExponent - 2) * c_nSubBuckets;
+
+public: //! Constructors and destructor
+	static CPipeMetricsPtr Create();
+	CPipeMetrics(const CPipeMetrics&) = delete;
+	CPipeMetrics& operator=(const CPipeMetrics&) = delete;
+
+public: //! Recording (any thread, lock-free)
+	// Returns the current time in ticks, the start of a latency
+	static uint64_t Now()
+	{
+#ifdef PIPE_METRICS_TSC
+		return __rdtsc();
+#else
+		return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+	}
+
+	void Add(EPipeCounter eCounter, uint64_t nValue = 1)
+	{
+		m_arrShards[GetShard()].arrCounters[size_t(eCounter)].fetch_add(nValue, std::memory_order_relaxed);
+	}
+
+	void AddGauge(EPipeGauge eGauge, int64_t nDelta)
+	{
+		m_arrGauges[size_t(eGauge)].fetch_add(nDelta, std::memory_order_relaxed);
+	}
+
+	void SetGauge(EPipeGauge eGauge, int64_t nValue)
+	{
+		m_arrGauges[size_t(eGauge)].store(nValue, std::memory_order_relaxed);
+	}
+
+	// Records the latency from nStart (Now) until now
+	void Record(EPipeLatency eLatency, uint64_t nStart)
+	{
+		const uint64_t nNow = Now();
+		RecordTicks(eLatency, (nNow > nStart) ? nNow - nStart : 0);
+	}
+
+	void RecordTicks(EPipeLatency eLatency, uint64_t nTicks);
+
+public: //! Pull API
+	// Returns the values recorded so far, the latencies in nanoseconds
+	SPipeMetrics Snapshot() const;
+
+private: //! Types
+	// Counters of the threads sharing one shard, on a cache line of their own
+	struct alignas(64) SShard
+	{
+		std::atomic<uint64_t>	arrCounters[size_t(EPipeCounter::Count)];
+	};
+
+	struct alignas(64) SHistogram
+	{
+		std::atomic<uint64_t>	nSum;
+		std::atomic<uint64_t>	nMin;
+		std::atomic<uint64_t>	nMax;
+		std::atomic<uint64_t>	arrBuckets[c_nBuckets];
+	};
+
+private: //! Implementation
+	CPipeMetrics();
+
+	static size_t GetShard()
+	{
+		static std::atomic<size_t> s_nNextShard(0);
+		static thread_local size_t s_nShard = s_nNextShard.fetch_add(1, std::memory_order_relaxed) % c_nShards;
+		return s_nShard;
+	}
+
+	// Bucket of the value: exact below 16, then 16 buckets per power of two
+	static size_t GetBucket(uint64_t nTicks);
+	// Middle of the bucket's range
+	static uint64_t GetBucketValue(size_t nBucket);
+
+private: //! Members
+	SShard					m_arrShards[c_nShards];
+	std::atomic<int64_t>	m_arrGauges[size_t(EPipeGauge::Count)];
+	SHistogram				m_arrHistograms[size_t(EPipeLatency::Count)];
+};
+
+
+//! Names used by the export
+const char* GetMetricName(EPipeCounter eCounter);
+const char* GetMetricName(EPipeGauge eGauge);
+const char* GetMetricName(EPipeLatency eLatency);
+
+//! Returns the per second rate of the counter between two snapshots
+double GetMetricRate(const SPipeMetrics& oFrom, const SPipeMetrics& oTo, EPipeCounter eCounter);
+
+//! Exports the snapshot as a JSON object: {"timestamp_ns":..,"counters":{..},"gauges":{..},"latency_ns":{"send":{"count":..,"p50":..},..}}
+std::string ToJson(const SPipeMetrics& oMetrics);
@@ -0,0 +1,377 @@
+/*
+Replay of a captured trace over the pipe transports
+
+Sends the frames of a trace recorded by CPipeCapture (CNamedPipe::SetCapture, CPipeServer::SetCapture)
+through every transport at every speed, each captured connection over its own reader and writer, and
+measures what the readers see: throughput and one-way latency (p50/p99/p999/max). The latency of a
+frame counts from the time it was due by the schedule of the trace, so a transport that can't keep up
+with the captured rate shows it in the tail instead of hiding it by sending later (the maximum speed
+counts from the send call). Results go to stdout as CSV or JSON lines, one line per case.
+
+Usage: pipe_replay --trace capture.trace [--transports pipe,seqpacket,fifo,shm] [--speed 1,2,0]
+                   [--batching 0,1] [--wait block,spin,poll] [--spin-us 50] [--format csv|json]
+*/
+
+
+//! Includes
+#include "named_pipe.h"
+#include "pipe_replayer.h"
+#include "shared_memory_transport.h"
+#ifndef _WIN32
+#include "posix_pipe_transport.h"
+#include <unistd.h>
+#endif
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+//! Replay constants
+static const size_t		c_nBatchBytes = 64 * 1024;		// Batching writer threshold
+static const uint32_t	c_nBatchDelayMs = 1;			// Batching writer deadline
+static const char		c_szUsage[] =
+	"Usage: pipe_replay --trace capture.trace [--transports pipe,seqpacket,fifo,shm] [--speed 1,2,0]\n"
+	"                   [--batching 0,1] [--wait block,spin,poll] [--spin-us 50] [--format csv|json]\n";
+
+
+//! Types
+// Replay settings
+struct SSettings
+{
+	std::string					sTrace;
+	std::vector<std::string>	vecTransports;
+	std::vector<double>			vecSpeeds;
+	std::vector<bool>			vecBatching;
+	std::vector<std::string>	vecWaits;
+	uint32_t					nSpinUs = 50;
+	bool						bJson = false;
+};
+
+// Case of the matrix
+struct SCase
+{
+	std::string	sTransport;
+	double		dSpeed = 1;
+	bool		bBatching = false;
+	std::string	sWait;
+};
+
+// Reader and writer of one captured connection
+struct SConnectionState
+{
+	std::unique_ptr<CNamedPipe>		pReader;
+	std::shared_ptr<CNamedPipe>		pWriter;
+	std::thread						oReaderThread;
+	uint64_t						nFrames = 0;		// Frames of the connection in the trace
+	std::vector<uint64_t>			vecDueNs;			// Replaying thread: when the frames were due
+	std::vector<uint64_t>			vecReceivedNs;		// Reader thread: when they came
+};
+
+// Result of one case
+struct SResult
+{
+	uint64_t	nFrames = 0;
+	uint64_t	nBytes = 0;
+	double		dSeconds = 0;
+	double		dP50Us = 0;
+	double		dP99Us = 0;
+	double		dP999Us = 0;
+	double		dMaxUs = 0;
+	uint64_t	nLateFrames = 0;
+	double		dMaxLagUs = 0;
+	size_t		nErrors = 0;
+};
+
+
+//! Helpers
+static uint64_t GetNowNs()
+{
+	return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+static uint32_t GetProcessId()
+{
+#ifdef _WIN32
+	return uint32_t(GetCurrentProcessId());
+#else
+	return uint32_t(getpid());
+#endif
+}
+
+static std::vector<std::string> SplitList(const std::string& sList)
+{
+	std::vector<std::string> vecItems;
+	size_t nStart = 0;
+	while (nStart <= sList.size())
+	{
+		size_t nEnd = sList.find(',', nStart);
+		if (nEnd == std::string::npos)
+			nEnd = sList.size();
+		if (nEnd > nStart)
+			vecItems.push_back(sList.substr(nStart, nEnd - nStart));
+		nStart = nEnd + 1;
+	}
+
+	return vecItems;
+}
+
+static double GetPercentileUs(const std::vector<uint64_t>& vecSorted, double dPercentile)
+{
+	if (vecSorted.empty())
+		return 0;
+
+	const size_t nIndex = (std::min)(vecSorted.size() - 1, size_t(dPercentile * double(vecSorted.size())));
+	return double(vecSorted[nIndex]) / 1000.0;
+}
+
+// Parses the wait strategy name, returns false for the unknown ones
+static bool ParseWaitMode(const std::string& sWait, EWaitMode& eMode)
+{
+	if (sWait == "block")
+		eMode = EWaitMode::Block;
+	else if (sWait == "spin")
+		eMode = EWaitMode::SpinThenBlock;
+	else if (sWait == "poll")
+		eMode = EWaitMode::BusyPoll;
+	else
+		return false;
+
+	return true;
+}
+
+// Creates the transport of the replay kind, nullptr for the unknown ones
+static ITransportPtr CreateTransport(const std::string& sKind, const std::string& sName, EPipeMode eMode)
+{
+	if (sKind == "pipe")
+		return CreatePipeTransport(sName, eMode);
+	if (sKind == "shm")
+		return ITransportPtr(new CSharedMemoryTransport(sName, eMode));
+#ifndef _WIN32
+	if (sKind == "seqpacket")
+		return ITransportPtr(new CPosixPipeTransport(sName, eMode, CPosixPipeTransport::EKind::SeqPacket));
+	if (sKind == "fifo")
+		return ITransportPtr(new CPosixPipeTransport(sName, eMode, CPosixPipeTransport::EKind::Fifo));
+#endif
+
+	return nullptr;
+}
+
+// Reader thread of one connection, ends with the last frame of the connection or when the writer leaves
+// (the FIFO reader doesn't see that)
+static void RunReader(SConnectionState& oState)
+{
+	SFrameHeader oHeader;
+	CPooledBuffer oPayload;
+	while (oState.vecReceivedNs.size() < oState.nFrames && oState.pReader->ReceiveFrame(oHeader, oPayload))
+		oState.vecReceivedNs.push_back(GetNowNs());
+}
+
+
+//! Case runner
+static SResult RunCase(const SSettings& oSettings, const SCase& oCase, const CPipeReplayer::STraceInfo& oInfo, size_t nCaseIndex)
+{
+	SResult oResult;
+	SWaitStrategy oStrategy;
+	ParseWaitMode(oCase.sWait, oStrategy.eMode);
+	oStrategy.nSpinUs = oSettings.nSpinUs;
+
+	// All the connections are up before the first frame, so no connect delays the schedule
+	const std::string sBase = "replay-" + std::to_string(GetProcessId()) + "-" + std::to_string(nCaseIndex);
+	std::unordered_map<uint64_t, std::unique_ptr<SConnectionState>> mapStates;
+	for (size_t i = 0; i < oInfo.vecConnections.size(); ++i)
+	{
+		const std::string sName = sBase + "-" + std::to_string(i);
+		std::unique_ptr<SConnectionState>& pState = mapStates[oInfo.vecConnections[i].nConnectionId];
+		pState.reset(new SConnectionState());
+		pState->nFrames = oInfo.vecConnections[i].nFrames;
+		pState->vecDueNs.reserve(size_t(pState->nFrames));
+		pState->vecReceivedNs.reserve(size_t(pState->nFrames));
+		pState->pReader.reset(new CNamedPipe(CreateTransport(oCase.sTransport, sName, EPipeMode::Read)));
+		pState->pReader->SetSessionMode(true);
+		pState->pReader->SetWaitStrategy(oStrategy);
+		pState->pWriter = std::make_shared<CNamedPipe>(CreateTransport(oCase.sTransport, sName, EPipeMode::Write));
+		if (!pState->pReader->Open())
+			continue;
+		pState->oReaderThread = std::thread(RunReader, std::ref(*pState));
+		if (pState->pWriter->Open() && oCase.bBatching)
+			pState->pWriter->SetBatching(true, c_nBatchBytes, c_nBatchDelayMs);
+	}
+
+	CPipeReplayer oReplayer;
+	bool bOk = oReplayer.Open(oSettings.sTrace);
+	oReplayer.SetSpeed(oCase.dSpeed);
+	oReplayer.SetObserver([&mapStates](const CPipeReplayer::SFrame& oFrame, const CPipeReplayer::SSendTimes& oTimes)
+	{
+		mapStates[oFrame.nConnectionId]->vecDueNs.push_back(oTimes.nScheduledNs);
+	});
+	uint64_t nStartNs = GetNowNs();
+	bOk = bOk && oReplayer.Replay([&mapStates](uint64_t nConnectionId) -> CPipeReplayer::CNamedPipePtr
+	{
+		auto itState = mapStates.find(nConnectionId);
+		return (itState != mapStates.end() && itState->second->pWriter->IsOpen()) ? itState->second->pWriter : nullptr;
+	});
+	if (!bOk)
+		++oResult.nErrors;
+
+	// The readers left waiting by a failed replay see the writers leave
+	for (auto& oEntry : mapStates)
+		oEntry.second->pWriter->Close();
+	uint64_t nEndNs = nStartNs;
+	std::vector<uint64_t> vecLatencyNs;
+	for (auto& oEntry : mapStates)
+	{
+		SConnectionState& oState = *oEntry.second;
+		if (oState.oReaderThread.joinable())
+			oState.oReaderThread.join();
+		if (!oState.vecDueNs.empty())
+			nStartNs = (std::min)(nStartNs, oState.vecDueNs.front());
+		if (!oState.vecReceivedNs.empty())
+			nEndNs = (std::max)(nEndNs, oState.vecReceivedNs.back());
+		if (oState.vecReceivedNs.size() != oState.vecDueNs.size())
+			++oResult.nErrors;
+
+		const size_t nCount = (std::min)(oState.vecReceivedNs.size(), oState.vecDueNs.size());
+		for (size_t i = 0; i < nCount; ++i)
+			vecLatencyNs.push_back((oState.vecReceivedNs[i] > oState.vecDueNs[i]) ? oState.vecReceivedNs[i] - oState.vecDueNs[i] : 0);
+	}
+
+	const CPipeReplayer::SReplayStats& oStats = oReplayer.GetStats();
+	oResult.nFrames = oStats.nFrames;
+	oResult.nBytes = oStats.nBytes;
+	oResult.dSeconds = double(nEndNs - nStartNs) / 1e9;
+	oResult.nLateFrames = oStats.nLateFrames;
+	oResult.dMaxLagUs = double(oStats.nMaxLagNs) / 1000.0;
+	std::sort(vecLatencyNs.begin(), vecLatencyNs.end());
+	oResult.dP50Us = GetPercentileUs(vecLatencyNs, 0.50);
+	oResult.dP99Us = GetPercentileUs(vecLatencyNs, 0.99);
+	oResult.dP999Us = GetPercentileUs(vecLatencyNs, 0.999);
+	oResult.dMaxUs = vecLatencyNs.empty() ? 0 : double(vecLatencyNs.back()) / 1000.0;
+
+	return oResult;
+}
+
+
+//! Output
+static void PrintHeader(const SSettings& oSettings)
+{
+	if (!oSettings.bJson)
+		printf("transport,speed,batching,wait,connections,frames,seconds,msgs_per_sec,mb_per_sec,p50_us,p99_us,p999_us,max_us,late_frames,max_lag_us,errors\n");
+}
+
+static void PrintResult(const SSettings& oSettings, const SCase& oCase, size_t nConnections, const SResult& oResult)
+{
+	const double dMessagesPerSecond = (oResult.dSeconds > 0) ? double(oResult.nFrames) / oResult.dSeconds : 0;
+	const double dMegabytesPerSecond = (oResult.dSeconds > 0) ? double(oResult.nBytes) / oResult.dSeconds / 1e6 : 0;
+	if (oSettings.bJson)
+		printf("{\"transport\":\"%s\",\"speed\":%g,\"batching\":%s,\"wait\":\"%s\",\"connections\":%zu,\"frames\":%llu,\"seconds\":%.6f,"
+			"\"msgs_per_sec\":%.1f,\"mb_per_sec\":%.3f,\"p50_us\":%.3f,\"p99_us\":%.3f,\"p999_us\":%.3f,\"max_us\":%.3f,"
+			"\"late_frames\":%llu,\"max_lag_us\":%.3f,\"errors\":%zu}\n",
+			oCase.sTransport.c_str(), oCase.dSpeed, oCase.bBatching ? "true" : "false", oCase.sWait.c_str(), nConnections,
+			(unsigned long long)oResult.nFrames, oResult.dSeconds, dMessagesPerSecond, dMegabytesPerSecond, oResult.dP50Us, oResult.dP99Us,
+			oResult.dP999Us, oResult.dMaxUs, (unsigned long long)oResult.nLateFrames, oResult.dMaxLagUs, oResult.nErrors);
+	else
+		printf("%s,%g,%d,%s,%zu,%llu,%.6f,%.1f,%.3f,%.3f,%.3f,%.3f,%.3f,%llu,%.3f,%zu\n",
+			oCase.sTransport.c_str(), oCase.dSpeed, oCase.bBatching ? 1 : 0, oCase.sWait.c_str(), nConnections,
+			(unsigned long long)oResult.nFrames, oResult.dSeconds, dMessagesPerSecond, dMegabytesPerSecond, oResult.dP50Us, oResult.dP99Us,
+			oResult.dP999Us, oResult.dMaxUs, (unsigned long long)oResult.nLateFrames, oResult.dMaxLagUs, oResult.nErrors);
+	fflush(stdout);
+}
+
+
+int main(int argc, char* argv[])
+{
+	SSettings oSettings;
+#ifdef _WIN32
+	oSettings.vecTransports = { "pipe", "shm" };
+#else
+	oSettings.vecTransports = { "pipe", "seqpacket", "fifo", "shm" };
+#endif
+	oSettings.vecSpeeds = { 1 };
+	oSettings.vecBatching = { false };
+	oSettings.vecWaits = { "block" };
+
+	// Every option takes a value
+	if (argc % 2 == 0)
+	{
+		fprintf(stderr, "%s", c_szUsage);
+		return 1;
+	}
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		const std::string sOption = argv[i];
+		const std::string sValue = argv[i + 1];
+		if (sOption == "--trace")
+			oSettings.sTrace = sValue;
+		else if (sOption == "--transports")
+			oSettings.vecTransports = SplitList(sValue);
+		else if (sOption == "--speed")
+		{
+			oSettings.vecSpeeds.clear();
+			for (const std::string& sSpeed : SplitList(sValue))
+				oSettings.vecSpeeds.push_back(std::strtod(sSpeed.c_str(), nullptr));
+		}
+		else if (sOption == "--batching")
+		{
+			oSettings.vecBatching.clear();
+			for (const std::string& sBatching : SplitList(sValue))
+				oSettings.vecBatching.push_back(sBatching != "0");
+		}
+		else if (sOption == "--wait")
+			oSettings.vecWaits = SplitList(sValue);
+		else if (sOption == "--spin-us")
+			oSettings.nSpinUs = uint32_t(std::strtoul(sValue.c_str(), nullptr, 10));
+		else if (sOption == "--format")
+			oSettings.bJson = (sValue == "json");
+		else
+		{
+			fprintf(stderr, "Unknown option %s\n%s", sOption.c_str(), c_szUsage);
+			return 1;
+		}
+	}
+
+	CPipeReplayer oReplayer;
+	CPipeReplayer::STraceInfo oInfo;
+	if (oSettings.sTrace.empty() || !oReplayer.Open(oSettings.sTrace) || !oReplayer.Scan(oInfo))
+	{
+		fprintf(stderr, "Can't read the trace %s\n", oSettings.sTrace.c_str());
+		return 1;
+	}
+	oReplayer.Close();
+
+	PrintHeader(oSettings);
+	size_t nCaseIndex = 0;
+	for (const std::string& sTransport : oSettings.vecTransports)
+	{
+		if (CreateTransport(sTransport, "probe", EPipeMode::Read) == nullptr)
+		{
+			fprintf(stderr, "Unknown transport %s\n", sTransport.c_str());
+			continue;
+		}
+		for (double dSpeed : oSettings.vecSpeeds)
+			for (bool bBatching : oSettings.vecBatching)
+				for (const std::string& sWait : oSettings.vecWaits)
+				{
+					EWaitMode eMode;
+					if (!ParseWaitMode(sWait, eMode))
+					{
+						fprintf(stderr, "Unknown wait strategy %s\n", sWait.c_str());
+						continue;
+					}
+					SCase oCase;
+					oCase.sTransport = sTransport;
+					oCase.dSpeed = dSpeed;
+					oCase.bBatching = bBatching;
+					oCase.sWait = sWait;
+					PrintResult(oSettings, oCase, oInfo.vecConnections.size(), RunCase(oSettings, oCase, oInfo, nCaseIndex++));
+				}
+	}
+
+	return 0;
+}
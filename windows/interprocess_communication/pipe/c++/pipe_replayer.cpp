@@ -0,0 +1,381 @@
+/*
+Implementation file for the pipe replayer
+*/
+
+
+//! Includes
+#include "pipe_replayer.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <unordered_map>
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+//! Replay constants
+static const uint64_t	c_nSleepMarginNs = 1000000;		// Left to yielding, the sleep may overshoot by this much
+static const int		c_nMaxVarintShift = 63;
+
+
+CPipeReplayer::CPipeReplayer()
+	: m_dSpeed(1),
+	  m_bPayloads(false),
+	  m_eLastError(EPipeError::None),
+	  m_vecBuffer(c_nReadBufferSize),
+	  m_nBufferPos(0),
+	  m_nBufferEnd(0),
+#ifdef _WIN32
+	  m_hFile(INVALID_HANDLE_VALUE)
+#else
+	  m_nFd(-1)
+#endif
+{
+}
+
+CPipeReplayer::~CPipeReplayer()
+{
+	Close();
+}
+
+bool CPipeReplayer::Open(const std::string& sPath)
+{
+	Close();
+#ifdef _WIN32
+	m_hFile = CreateFileA(sPath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (m_hFile == INVALID_HANDLE_VALUE)
+		return Fail(EPipeError::IoFailure);
+#else
+	m_nFd = open(sPath.c_str(), O_RDONLY | O_CLOEXEC);
+	if (m_nFd < 0)
+		return Fail(EPipeError::IoFailure);
+#endif
+
+	byte arrHeader[c_nTraceHeaderSize];
+	if (!ReadBytes(arrHeader, c_nTraceHeaderSize))
+	{
+		Close();
+		return Fail(EPipeError::InvalidFrame);
+	}
+	const uint32_t nMagic = uint32_t(arrHeader[0]) | (uint32_t(arrHeader[1]) << 8) | (uint32_t(arrHeader[2]) << 16) |
+		(uint32_t(arrHeader[3]) << 24);
+	const uint16_t nVersion = uint16_t(arrHeader[4] | (arrHeader[5] << 8));
+	const uint16_t nFlags = uint16_t(arrHeader[6] | (arrHeader[7] << 8));
+	if (nMagic != c_nTraceMagic || nVersion == 0 || nVersion > c_nTraceVersion)
+	{
+		Close();
+		return Fail(EPipeError::InvalidFrame);
+	}
+
+	m_bPayloads = (nFlags & c_nTraceFlagPayloads) != 0;
+	return true;
+}
+
+void CPipeReplayer::Close()
+{
+#ifdef _WIN32
+	if (m_hFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_hFile);
+		m_hFile = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (m_nFd >= 0)
+	{
+		close(m_nFd);
+		m_nFd = -1;
+	}
+#endif
+	m_nBufferPos = m_nBufferEnd = 0;
+}
+
+bool CPipeReplayer::HasPayloads() const
+{
+	return m_bPayloads;
+}
+
+bool CPipeReplayer::Scan(STraceInfo& oInfo)
+{
+	oInfo = STraceInfo();
+	if (!Rewind())
+		return false;
+
+	std::unordered_map<uint64_t, size_t> mapConnections;	// Index in the info
+	uint64_t nFirstTimeNs = 0;
+	for (SFrame oFrame;;)
+	{
+		bool bEnd = false;
+		if (!ReadFrame(oFrame, bEnd, false))
+			return false;
+		if (bEnd)
+			return true;
+
+		if (oInfo.nFrames++ == 0)
+			nFirstTimeNs = oFrame.nTimeNs;
+		oInfo.nBytes += oFrame.oHeader.nLength;
+		oInfo.nDurationNs = oFrame.nTimeNs - nFirstTimeNs;
+		auto itConnection = mapConnections.emplace(oFrame.nConnectionId, oInfo.vecConnections.size()).first;
+		if (itConnection->second == oInfo.vecConnections.size())
+		{
+			oInfo.vecConnections.emplace_back();
+			oInfo.vecConnections.back().nConnectionId = oFrame.nConnectionId;
+		}
+		SConnectionInfo& oConnection = oInfo.vecConnections[itConnection->second];
+		++oConnection.nFrames;
+		oConnection.nBytes += oFrame.oHeader.nLength;
+	}
+}
+
+void CPipeReplayer::SetSpeed(double dSpeed)
+{
+	m_dSpeed = (std::max)(dSpeed, 0.0);
+}
+
+void CPipeReplayer::SetObserver(const TFrameObserver& fnObserver)
+{
+	m_fnObserver = fnObserver;
+}
+
+bool CPipeReplayer::Replay(CNamedPipe& oPipe)
+{
+	const bool bOk = Run([&oPipe](uint64_t /*nConnectionId*/) { return &oPipe; });
+	// The batching writer still holds the last frames
+	if (!oPipe.Flush() && bOk)
+		return Fail(oPipe.GetLastPipeError());
+
+	return bOk;
+}
+
+bool CPipeReplayer::Replay(const TPipeFactory& fnFactory)
+{
+	std::unordered_map<uint64_t, CNamedPipePtr> mapPipes;
+	bool bOk = Run([&](uint64_t nConnectionId) -> CNamedPipe*
+	{
+		CNamedPipePtr& pPipe = mapPipes[nConnectionId];
+		if (pPipe == nullptr)
+			pPipe = fnFactory(nConnectionId);
+		return pPipe.get();
+	});
+
+	for (auto& oEntry : mapPipes)
+	{
+		if (oEntry.second != nullptr && !oEntry.second->Flush() && bOk)
+			bOk = Fail(oEntry.second->GetLastPipeError());
+	}
+	return bOk;
+}
+
+const CPipeReplayer::SReplayStats& CPipeReplayer::GetStats() const
+{
+	return m_oStats;
+}
+
+CPipeReplayer::EPipeError CPipeReplayer::GetLastPipeError() const
+{
+	return m_eLastError;
+}
+
+template <class TPipe>
+bool CPipeReplayer::Run(TPipe fnPipe)
+{
+	m_oStats = SReplayStats();
+	if (!Rewind())
+		return false;
+
+	// The schedule starts with the first frame, the capture time before it is skipped
+	uint64_t nFirstTimeNs = 0;
+	uint64_t nReplayStartNs = 0;
+	SFrame oFrame;
+	for (;;)
+	{
+		bool bEnd = false;
+		if (!ReadFrame(oFrame, bEnd))
+			return false;
+		if (bEnd)
+			return true;
+
+		oFrame.nIndex = m_oStats.nFrames;
+		CNamedPipe* pPipe = fnPipe(oFrame.nConnectionId);
+		if (pPipe == nullptr)
+			return Fail(EPipeError::NotOpen);
+
+		SSendTimes oTimes;
+		if (oFrame.nIndex == 0)
+		{
+			nFirstTimeNs = oFrame.nTimeNs;
+			nReplayStartNs = GetNowNs();
+		}
+		if (m_dSpeed > 0)
+		{
+			oTimes.nScheduledNs = nReplayStartNs + uint64_t(double(oFrame.nTimeNs - nFirstTimeNs) / m_dSpeed);
+			WaitUntil(oTimes.nScheduledNs);
+		}
+		oTimes.nStartNs = GetNowNs();
+		if (m_dSpeed <= 0)
+			oTimes.nScheduledNs = oTimes.nStartNs;
+
+		const SFrameHeader& oHeader = oFrame.oHeader;
+		if (!pPipe->SendFrame(oHeader.nType, uint16_t(oHeader.nFlags & ~c_nTraceWireFlags), m_vecPayload.data(), oHeader.nLength,
+			oHeader.nChannel))
+			return Fail(pPipe->GetLastPipeError());
+		oTimes.nEndNs = GetNowNs();
+
+		const uint64_t nLagNs = oTimes.nStartNs - oTimes.nScheduledNs;
+		++m_oStats.nFrames;
+		m_oStats.nBytes += oHeader.nLength;
+		m_oStats.nTraceNs = oFrame.nTimeNs - nFirstTimeNs;
+		m_oStats.nElapsedNs = oTimes.nEndNs - nReplayStartNs;
+		m_oStats.nMaxLagNs = (std::max)(m_oStats.nMaxLagNs, nLagNs);
+		if (nLagNs > c_nLateThresholdNs)
+			++m_oStats.nLateFrames;
+		if (m_fnObserver)
+			m_fnObserver(oFrame, oTimes);
+	}
+}
+
+bool CPipeReplayer::ReadFrame(SFrame& oFrame, bool& bEnd, bool bPayload)
+{
+	uint64_t nDelta = 0;
+	if (!ReadVarint(nDelta, &bEnd))
+		return false;
+	if (bEnd)
+		return true;
+
+	uint64_t nConnectionId = 0, nType = 0, nFlags = 0, nChannel = 0, nLength = 0;
+	if (!ReadVarint(nConnectionId) || !ReadVarint(nType) || !ReadVarint(nFlags) || !ReadVarint(nChannel) || !ReadVarint(nLength))
+		return false;
+	const uint64_t nSize = nLength >> 1;
+	if (nType > UINT16_MAX || nFlags > UINT16_MAX || nChannel > UINT16_MAX || nSize > c_nFrameDefaultMaxLength)
+		return Fail(EPipeError::InvalidFrame);
+
+	oFrame.nTimeNs += nDelta;
+	oFrame.nConnectionId = nConnectionId;
+	oFrame.oHeader.nType = uint16_t(nType);
+	oFrame.oHeader.nFlags = uint16_t(nFlags);
+	oFrame.oHeader.nChannel = uint16_t(nChannel);
+	oFrame.oHeader.nLength = uint32_t(nSize);
+	oFrame.bOmitted = (nLength & 1) != 0;
+	if (!bPayload)
+		return oFrame.bOmitted || ReadBytes(nullptr, size_t(nSize));
+	if (oFrame.bOmitted)
+	{
+		m_vecPayload.assign(size_t(nSize), byte(0));
+		return true;
+	}
+
+	m_vecPayload.resize(size_t(nSize));
+	return ReadBytes(m_vecPayload.data(), size_t(nSize));
+}
+
+bool CPipeReplayer::ReadVarint(uint64_t& nValue, bool* pEnd)
+{
+	nValue = 0;
+	for (int nShift = 0; nShift <= c_nMaxVarintShift; nShift += 7)
+	{
+		byte nByte = 0;
+		if (!ReadBytes(&nByte, 1, (nShift == 0) ? pEnd : nullptr))
+			return false;
+		if (pEnd != nullptr && *pEnd)
+			return true;
+		nValue |= uint64_t(nByte & 0x7F) << nShift;
+		if ((nByte & 0x80) == 0)
+			return true;
+	}
+
+	return Fail(EPipeError::InvalidFrame);
+}
+
+bool CPipeReplayer::ReadBytes(void* pData, size_t nSize, bool* pEnd)
+{
+	if (pEnd != nullptr)
+		*pEnd = false;
+
+	byte* pBytes = static_cast<byte*>(pData);
+	size_t nDone = 0;
+	while (nDone < nSize)
+	{
+		if (m_nBufferPos == m_nBufferEnd)
+		{
+#ifdef _WIN32
+			DWORD nRead = 0;
+			if (!ReadFile(m_hFile, m_vecBuffer.data(), DWORD(m_vecBuffer.size()), &nRead, NULL))
+				return Fail(EPipeError::IoFailure);
+#else
+			const ssize_t nRead = read(m_nFd, m_vecBuffer.data(), m_vecBuffer.size());
+			if (nRead < 0 && errno == EINTR)
+				continue;
+			if (nRead < 0)
+				return Fail(EPipeError::IoFailure);
+#endif
+			if (nRead == 0)
+			{
+				// The end between the records is the end of the trace, inside one it's cut off
+				if (pEnd != nullptr && nDone == 0)
+				{
+					*pEnd = true;
+					return true;
+				}
+				return Fail(EPipeError::InvalidFrame);
+			}
+			m_nBufferPos = 0;
+			m_nBufferEnd = size_t(nRead);
+		}
+
+		const size_t nCopy = (std::min)(nSize - nDone, m_nBufferEnd - m_nBufferPos);
+		if (pBytes != nullptr)
+			memcpy(pBytes + nDone, m_vecBuffer.data() + m_nBufferPos, nCopy);
+		m_nBufferPos += nCopy;
+		nDone += nCopy;
+	}
+
+	return true;
+}
+
+bool CPipeReplayer::Rewind()
+{
+#ifdef _WIN32
+	LARGE_INTEGER oPosition;
+	oPosition.QuadPart = int64_t(c_nTraceHeaderSize);
+	if (m_hFile == INVALID_HANDLE_VALUE)
+		return Fail(EPipeError::NotOpen);
+	if (!SetFilePointerEx(m_hFile, oPosition, NULL, FILE_BEGIN))
+		return Fail(EPipeError::IoFailure);
+#else
+	if (m_nFd < 0)
+		return Fail(EPipeError::NotOpen);
+	if (lseek(m_nFd, off_t(c_nTraceHeaderSize), SEEK_SET) < 0)
+		return Fail(EPipeError::IoFailure);
+#endif
+	m_nBufferPos = m_nBufferEnd = 0;
+	return true;
+}
+
+void CPipeReplayer::WaitUntil(uint64_t nTimeNs)
+{
+	for (;;)
+	{
+		const uint64_t nNowNs = GetNowNs();
+		if (nNowNs >= nTimeNs)
+			return;
+		if (nTimeNs - nNowNs > 2 * c_nSleepMarginNs)
+			std::this_thread::sleep_for(std::chrono::nanoseconds(nTimeNs - nNowNs - c_nSleepMarginNs));
+		else
+			std::this_thread::yield();
+	}
+}
+
+uint64_t CPipeReplayer::GetNowNs()
+{
+	return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+bool CPipeReplayer::Fail(EPipeError eError)
+{
+	m_eLastError = eError;
+	return false;
+}
@@ -0,0 +1,150 @@
+/*
+Declaration file for the pipe replayer
+
+Sends the frames of a trace recorded by CPipeCapture through any writer pipe (CNamedPipe over any
+transport) with their recorded types, sizes and spacing: at the original speed, scaled by a factor
+or as fast as the pipe takes them. The frames go in the order of the trace from one thread, the time
+the replay falls behind the schedule is measured per frame.
+*/
+
+
+//! Include guard
+#pragma once
+
+
+//! Includes
+#include "named_pipe.h"
+#include "pipe_capture.h"
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+//! Class CPipeReplayer
+class CPipeReplayer
+{
+public: //! Types
+	typedef CNamedPipe::EPipeError EPipeError;
+	typedef std::shared_ptr<CNamedPipe> CNamedPipePtr;
+
+	// Frame of the trace
+	struct SFrame
+	{
+		uint64_t		nIndex = 0;			// Position in the trace
+		uint64_t		nTimeNs = 0;		// Capture time
+		uint64_t		nConnectionId = 0;
+		SFrameHeader	oHeader;			// Type, flags, channel and the payload length
+		bool			bOmitted = false;	// The trace has no payload, zeros are sent
+	};
+
+	// Times of the sent frame, steady clock nanoseconds (time_since_epoch)
+	struct SSendTimes
+	{
+		uint64_t	nScheduledNs = 0;		// When the frame was due (the send start at the maximum speed)
+		uint64_t	nStartNs = 0;			// When the send started
+		uint64_t	nEndNs = 0;				// When the send returned
+	};
+
+	// Result of the last replay
+	struct SReplayStats
+	{
+		uint64_t	nFrames = 0;
+		uint64_t	nBytes = 0;				// Payload bytes
+		uint64_t	nTraceNs = 0;			// Capture time between the first and the last frame
+		uint64_t	nElapsedNs = 0;			// Replay time of the same frames
+		uint64_t	nLateFrames = 0;		// Frames sent more than c_nLateThresholdNs behind the schedule
+		uint64_t	nMaxLagNs = 0;			// Longest delay behind the schedule
+	};
+
+	// Connection of the trace
+	struct SConnectionInfo
+	{
+		uint64_t	nConnectionId = 0;
+		uint64_t	nFrames = 0;
+		uint64_t	nBytes = 0;				// Payload bytes
+	};
+
+	// Content of the trace
+	struct STraceInfo
+	{
+		uint64_t						nFrames = 0;
+		uint64_t						nBytes = 0;			// Payload bytes
+		uint64_t						nDurationNs = 0;	// Capture time between the first and the last frame
+		std::vector<SConnectionInfo>	vecConnections;		// In the order of their first frames
+	};
+
+	// Returns the opened writer for the connection of the trace, null fails the replay
+	typedef std::function<CNamedPipePtr(uint64_t nConnectionId)> TPipeFactory;
+	// Called after every sent frame on the replaying thread
+	typedef std::function<void(const SFrame& oFrame, const SSendTimes& oTimes)> TFrameObserver;
+
+public: //! Constants
+	static const uint64_t	c_nLateThresholdNs = 1000000;	// Lag counted as late
+	static const size_t		c_nReadBufferSize = 1024 * 1024;
+
+public: //! Constructors and destructor
+	CPipeReplayer();
+	~CPipeReplayer();
+	CPipeReplayer(const CPipeReplayer&) = delete;
+	CPipeReplayer& operator=(const CPipeReplayer&) = delete;
+
+public: //! Interface
+	// Opens the trace file and reads its header, fails with EPipeError::InvalidFrame if it's not a trace
+	bool Open(const std::string& sPath);
+	void Close();
+	// Returns true if the trace carries the payloads
+	bool HasPayloads() const;
+	// Reads the whole trace without sending it
+	bool Scan(STraceInfo& oInfo);
+
+	// Scales the time between the frames: 1 is the original speed (default), 2 twice as fast, zero doesn't wait
+	void SetSpeed(double dSpeed);
+	void SetObserver(const TFrameObserver& fnObserver);
+
+	// Sends all the frames of the trace through the writer, whatever connection they came from
+	bool Replay(CNamedPipe& oPipe);
+	// Sends the frames of every connection of the trace through a writer of its own,
+	// made by the factory on the first frame of the connection
+	bool Replay(const TPipeFactory& fnFactory);
+
+	// Returns the statistics of the last replay (also of the failed one, up to the failure)
+	const SReplayStats& GetStats() const;
+	// Returns the reason of the last failure: the trace is broken (InvalidFrame), unreadable (IoFailure)
+	// or the error of the pipe
+	EPipeError GetLastPipeError() const;
+
+private: //! Implementation
+	// Sends the frames, fnPipe returns the writer of the frame
+	template <class TPipe>
+	bool Run(TPipe fnPipe);
+	// Reads the next frame and its payload (zeros if omitted) unless bPayload is false, bEnd reports the end of the trace
+	bool ReadFrame(SFrame& oFrame, bool& bEnd, bool bPayload = true);
+	// Reads the varint or the bytes (null pData skips them), *pEnd is set if the trace ends before the first byte
+	bool ReadVarint(uint64_t& nValue, bool* pEnd = nullptr);
+	bool ReadBytes(void* pData, size_t nSize, bool* pEnd = nullptr);
+	// Moves to the first record
+	bool Rewind();
+	// Waits until the steady clock time
+	static void WaitUntil(uint64_t nTimeNs);
+	static uint64_t GetNowNs();
+
+	// Remembers the failure reason and returns false
+	bool Fail(EPipeError eError);
+
+private: //! Members
+	double				m_dSpeed;
+	TFrameObserver		m_fnObserver;
+	bool				m_bPayloads;
+	SReplayStats		m_oStats;
+	EPipeError			m_eLastError;
+	std::vector<byte>	m_vecBuffer;		// Bytes read ahead
+	size_t				m_nBufferPos;
+	size_t				m_nBufferEnd;
+	std::vector<byte>	m_vecPayload;		// Payload of the current frame
+#ifdef _WIN32
+	HANDLE				m_hFile;
+#else
+	int					m_nFd;
+#endif
+};
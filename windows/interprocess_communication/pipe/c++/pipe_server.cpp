@@ -0,0 +1,667 @@
+/*
+Implementation file for the multi-client pipe server
+*/
+
+
+//! Includes
+#include "pipe_server.h"
+#include <cstring>
+#ifndef _WIN32
+#include "posix_pipe_transport.h"
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+
+//! Server constants
+static const size_t		c_nReadChunk = 64 * 1024;		// Bytes received per read
+#ifdef _WIN32
+static const DWORD		c_nPipeBufferSize = 64 * 1024;	// Kernel buffer of every pipe instance
+#else
+static const uint64_t	c_nListenerKey = 0;				// epoll key of the listening socket
+static const uint64_t	c_nWakeupKey = UINT64_MAX;		// epoll key of the stop event
+static const int		c_nMaxEvents = 64;				// Events handled per wait
+#endif
+
+
+//! Connected writer
+struct CPipeServer::SConnection
+{
+	SConnection(uint32_t nMaxMessageSize, const CFrameCipher& oKey)
+		: oAssembler(nMaxMessageSize),
+		  oCipher(oKey)
+	{
+	}
+
+#ifdef _WIN32
+	OVERLAPPED			oOverlapped = {};					// Pending connect or read
+	OVERLAPPED			oWriteOverlapped = {};				// Pending credit reply
+	HANDLE				hPipe = INVALID_HANDLE_VALUE;
+	bool				bConnected = false;					// False while waiting for the writer
+	bool				bWritePending = false;
+	byte				arrCredit[c_nCreditFrameSize] = {};	// Reply being written
+#else
+	int					nSocket = -1;
+#endif
+	uint64_t			nId = 0;
+	CFrameAssembler		oAssembler;
+	CFrameCipher		oCipher;							// Opens the sealed frames of the writer's session
+	CPipeMetricsPtr		pMetrics;							// Null unless the metrics are enabled
+};
+
+
+CPipeServer::CPipeServer(const std::string& sName)
+	: m_sName(sName),
+	  m_nMaxMessageSize(c_nFrameDefaultMaxLength),
+	  m_bRunning(false),
+	  m_nConnectionCount(0),
+	  m_nNextConnectionId(0)
+#ifdef _WIN32
+	  , m_hCompletionPort(NULL),
+	  m_pPending(nullptr)
+#else
+	  , m_nListener(-1),
+	  m_nPoll(-1),
+	  m_nWakeup(-1)
+#endif
+{
+}
+
+CPipeServer::~CPipeServer()
+{
+	Stop();
+}
+
+bool CPipeServer::Start(IMessageHandlerPtr pHandler, size_t nWorkers)
+{
+	if (IsRunning() || pHandler == nullptr || m_sName.empty())
+		return false;
+
+	m_pHandler = pHandler;
+	if (!OpenListener())
+	{
+		CloseListener();
+		m_pHandler.reset();
+		return false;
+	}
+
+	m_oWorkers.Start(nWorkers);
+	m_bRunning = true;
+	m_oLoop = std::thread(&CPipeServer::Run, this);
+
+	return true;
+}
+
+void CPipeServer::Stop()
+{
+	if (!IsRunning())
+		return;
+
+	// Wake the loop up and wait for it
+	m_bRunning = false;
+#ifdef _WIN32
+	PostQueuedCompletionStatus(m_hCompletionPort, 0, 0, NULL);
+#else
+	uint64_t nSignal = 1;
+	ssize_t nResult = write(m_nWakeup, &nSignal, sizeof(nSignal));
+	(void)nResult;
+#endif
+	if (m_oLoop.joinable())
+		m_oLoop.join();
+
+	std::vector<uint64_t> vecIds;
+	for (const auto& oItem : m_mapConnections)
+		vecIds.push_back(oItem.first);
+	for (uint64_t nId : vecIds)
+		CloseConnection(nId);
+
+	CloseListener();
+
+	// Let the workers finish the queued messages
+	m_oWorkers.Stop();
+	m_pHandler.reset();
+}
+
+bool CPipeServer::IsRunning() const
+{
+	return m_bRunning;
+}
+
+size_t CPipeServer::GetConnectionCount() const
+{
+	return m_nConnectionCount;
+}
+
+void CPipeServer::SetMaxMessageSize(uint32_t nMaxSize)
+{
+	m_nMaxMessageSize = nMaxSize;
+}
+
+bool CPipeServer::SetEncryption(const void* pKey, size_t nKeySize)
+{
+	if (IsRunning())
+		return false;
+
+	return m_oCipher.SetKey(pKey, nKeySize);
+}
+
+bool CPipeServer::EnableMetrics(bool bEnable)
+{
+	if (IsRunning())
+		return false;
+
+	std::lock_guard<std::mutex> oLock(m_mtxMetrics);
+	m_pMetrics = bEnable ? CPipeMetrics::Create() : nullptr;
+	return true;
+}
+
+bool CPipeServer::GetMetrics(SPipeMetrics& oMetrics) const
+{
+	CPipeMetricsPtr pMetrics;
+	{
+		std::lock_guard<std::mutex> oLock(m_mtxMetrics);
+		pMetrics = m_pMetrics;
+	}
+	if (pMetrics == nullptr)
+		return false;
+
+	oMetrics = pMetrics->Snapshot();
+	return true;
+}
+
+bool CPipeServer::GetConnectionMetrics(std::vector<std::pair<uint64_t, SPipeMetrics>>& vecMetrics) const
+{
+	vecMetrics.clear();
+	std::vector<std::pair<uint64_t, CPipeMetricsPtr>> vecConnections;
+	{
+		std::lock_guard<std::mutex> oLock(m_mtxMetrics);
+		if (m_pMetrics == nullptr)
+			return false;
+		vecConnections.assign(m_mapMetrics.begin(), m_mapMetrics.end());
+	}
+
+	// The snapshots are taken outside the lock, the loop thread doesn't wait for them
+	for (const auto& oItem : vecConnections)
+		vecMetrics.emplace_back(oItem.first, oItem.second->Snapshot());
+	return true;
+}
+
+bool CPipeServer::SetCapture(CPipeCapturePtr pCapture)
+{
+	// The loop thread records without a lock
+	if (IsRunning())
+		return false;
+
+	m_pCapture = pCapture;
+	return true;
+}
+
+bool CPipeServer::DispatchFrames(SConnection& oConnection)
+{
+	for (;;)
+	{
+		SFrameHeader oHeader;
+		std::vector<byte> vecPayload;
+		CFrameAssembler::EResult eResult = oConnection.oAssembler.Next(oHeader, vecPayload);
+		if (eResult == CFrameAssembler::EResult::Incomplete)
+			return true;
+		if (eResult == CFrameAssembler::EResult::Invalid)
+			return CountFailure(oConnection, EPipeCounter::Failures);
+		if (eResult == CFrameAssembler::EResult::Corrupted)
+			return CountFailure(oConnection, EPipeCounter::ChecksumFailures);
+		if (oHeader.nType == uint16_t(EFrameType::FlowControl))
+		{
+			if (!SendCredit(oConnection))
+				return false;
+			continue;
+		}
+		CFrameCipher& oCipher = oConnection.oCipher;
+		if (oHeader.nType == uint16_t(EFrameType::Session))
+		{
+			// The server without the key ignores the session, the sealed frames that follow break the connection
+			if (oCipher.IsEnabled() && !oCipher.AcceptSession(oHeader, vecPayload.data()))
+				return false;
+			continue;
+		}
+		const bool bSealed = (oHeader.nFlags & FrameFlagEncrypted) != 0;
+		if (bSealed ? !oCipher.HasSession() : (oCipher.IsEnabled() && CFrameCipher::IsSealedType(oHeader.nType)))
+			return CountFailure(oConnection, EPipeCounter::AuthenticationFailures);
+		if (bSealed)
+		{
+			// Opened in place, the handler gets the plaintext and the header that describes it
+			byte arrHeader[c_nFrameHeaderSize];
+			oHeader.Encode(arrHeader);
+			if (!oCipher.Open(arrHeader, vecPayload.data(), vecPayload.size(), vecPayload.data()))
+				return CountFailure(oConnection, EPipeCounter::AuthenticationFailures);
+			vecPayload.resize(oHeader.GetPayloadSize());
+			oHeader.nFlags &= uint16_t(~FrameFlagEncrypted);
+			oHeader.nLength = uint32_t(vecPayload.size());
+		}
+
+		IMessageHandlerPtr pHandler = m_pHandler;
+		const uint64_t nId = oConnection.nId;
+		if (m_pCapture != nullptr)
+			m_pCapture->Record(m_pCapture->Now(), nId, oHeader, vecPayload.data(), vecPayload.size());
+		if (oConnection.pMetrics == nullptr)
+		{
+			m_oWorkers.Post(nId, [pHandler, nId, oHeader, vecPayload = std::move(vecPayload)]()
+			{
+				pHandler->OnMessage(nId, oHeader, vecPayload);
+			});
+			continue;
+		}
+
+		// The message is timed in the queue and in the handler, by the connection and by the server
+		const int64_t nSize = int64_t(vecPayload.size());
+		CPipeMetrics* arrMetrics[] = { oConnection.pMetrics.get(), m_pMetrics.get() };
+		for (CPipeMetrics* pMetrics : arrMetrics)
+		{
+			pMetrics->Add(EPipeCounter::MessagesReceived);
+			pMetrics->Add(EPipeCounter::BytesReceived, uint64_t(nSize));
+			pMetrics->AddGauge(EPipeGauge::QueuedFrames, 1);
+			pMetrics->AddGauge(EPipeGauge::QueuedBytes, nSize);
+		}
+		m_oWorkers.Post(nId, [pHandler, nId, oHeader, vecPayload = std::move(vecPayload), pConnectionMetrics = oConnection.pMetrics,
+			pServerMetrics = m_pMetrics, nQueued = CPipeMetrics::Now()]()
+		{
+			CPipeMetrics* arrMetrics[] = { pConnectionMetrics.get(), pServerMetrics.get() };
+			const int64_t nSize = int64_t(vecPayload.size());
+			const uint64_t nStart = CPipeMetrics::Now();
+			for (CPipeMetrics* pMetrics : arrMetrics)
+			{
+				pMetrics->RecordTicks(EPipeLatency::Queue, (nStart > nQueued) ? nStart - nQueued : 0);
+				pMetrics->AddGauge(EPipeGauge::QueuedFrames, -1);
+				pMetrics->AddGauge(EPipeGauge::QueuedBytes, -nSize);
+			}
+			pHandler->OnMessage(nId, oHeader, vecPayload);
+			const uint64_t nEnd = CPipeMetrics::Now();
+			for (CPipeMetrics* pMetrics : arrMetrics)
+				pMetrics->RecordTicks(EPipeLatency::Handler, (nEnd > nStart) ? nEnd - nStart : 0);
+		});
+	}
+}
+
+void CPipeServer::CloseConnection(uint64_t nConnectionId)
+{
+	auto itConnection = m_mapConnections.find(nConnectionId);
+	if (itConnection == m_mapConnections.end())
+		return;
+
+	SConnection& oConnection = *itConnection->second;
+	bool bConnected = true;
+#ifdef _WIN32
+	bConnected = oConnection.bConnected;
+	if (oConnection.hPipe != INVALID_HANDLE_VALUE)
+	{
+		// Make sure no I/O refers to the connection any more
+		DWORD nBytes = 0;
+		if (CancelIoEx(oConnection.hPipe, NULL))
+			GetOverlappedResult(oConnection.hPipe, &oConnection.oOverlapped, &nBytes, TRUE);
+		if (oConnection.bWritePending)
+			GetOverlappedResult(oConnection.hPipe, &oConnection.oWriteOverlapped, &nBytes, TRUE);
+		CloseHandle(oConnection.hPipe);
+	}
+	if (m_pPending == &oConnection)
+		m_pPending = nullptr;
+#else
+	epoll_ctl(m_nPoll, EPOLL_CTL_DEL, oConnection.nSocket, nullptr);
+	close(oConnection.nSocket);
+#endif
+
+	if (bConnected && m_pMetrics != nullptr)
+	{
+		{
+			std::lock_guard<std::mutex> oLock(m_mtxMetrics);
+			m_mapMetrics.erase(nConnectionId);
+		}
+		Count(oConnection, EPipeCounter::Disconnects);
+		m_pMetrics->AddGauge(EPipeGauge::ActiveConnections, -1);
+	}
+	m_mapConnections.erase(itConnection);
+
+	if (bConnected)
+	{
+		--m_nConnectionCount;
+		IMessageHandlerPtr pHandler = m_pHandler;
+		m_oWorkers.Post(nConnectionId, [pHandler, nConnectionId]() { pHandler->OnDisconnect(nConnectionId); });
+	}
+}
+
+void CPipeServer::AddConnectionMetrics(SConnection& oConnection)
+{
+	if (m_pMetrics == nullptr)
+		return;
+
+	oConnection.pMetrics = CPipeMetrics::Create();
+	{
+		std::lock_guard<std::mutex> oLock(m_mtxMetrics);
+		m_mapMetrics[oConnection.nId] = oConnection.pMetrics;
+	}
+	Count(oConnection, EPipeCounter::Connections);
+	m_pMetrics->AddGauge(EPipeGauge::ActiveConnections, 1);
+}
+
+void CPipeServer::Count(SConnection& oConnection, EPipeCounter eCounter, uint64_t nValue)
+{
+	if (oConnection.pMetrics == nullptr)
+		return;
+
+	oConnection.pMetrics->Add(eCounter, nValue);
+	m_pMetrics->Add(eCounter, nValue);
+}
+
+bool CPipeServer::CountFailure(SConnection& oConnection, EPipeCounter eReason)
+{
+	Count(oConnection, EPipeCounter::Failures);
+	if (eReason != EPipeCounter::Failures)
+		Count(oConnection, eReason);
+	return false;
+}
+
+#ifdef _WIN32
+
+void CPipeServer::Run()
+{
+	while (m_bRunning)
+	{
+		DWORD nBytes = 0;
+		ULONG_PTR nKey = 0;
+		LPOVERLAPPED pOverlapped = NULL;
+		BOOL bOk = GetQueuedCompletionStatus(m_hCompletionPort, &nBytes, &nKey, &pOverlapped, INFINITE);
+		if (nKey == 0)
+			break;
+		if (pOverlapped == NULL)
+			continue;
+
+		// The packets of the I/O still queued when its connection closed come after it's gone, they are dropped
+		auto itConnection = m_mapConnections.find(uint64_t(nKey));
+		if (itConnection == m_mapConnections.end())
+			continue;
+		SConnection* pConnection = itConnection->second.get();
+		const uint64_t nId = pConnection->nId;
+		if (!pConnection->bConnected)
+		{
+			// The writer has connected to the pending instance, open the next one for the others
+			if (!bOk && GetLastError() != ERROR_PIPE_CONNECTED)
+			{
+				CloseConnection(nId);
+				CreateInstance();
+				continue;
+			}
+			pConnection->bConnected = true;
+			m_pPending = nullptr;
+			++m_nConnectionCount;
+			AddConnectionMetrics(*pConnection);
+			IMessageHandlerPtr pHandler = m_pHandler;
+			m_oWorkers.Post(nId, [pHandler, nId]() { pHandler->OnConnect(nId); });
+			CreateInstance();
+			if (!IssueRead(*pConnection))
+				CloseConnection(nId);
+			continue;
+		}
+
+		if (pOverlapped == &pConnection->oWriteOverlapped)
+		{
+			pConnection->bWritePending = false;
+			if (!bOk)
+				CloseConnection(nId);
+			continue;
+		}
+
+		// Read has completed
+		if (!bOk || nBytes == 0)
+		{
+			CloseConnection(nId);
+			continue;
+		}
+		pConnection->oAssembler.CommitWrite(nBytes);
+		if (!DispatchFrames(*pConnection) || !IssueRead(*pConnection))
+			CloseConnection(nId);
+	}
+}
+
+bool CPipeServer::OpenListener()
+{
+	m_hCompletionPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+	if (m_hCompletionPort == NULL)
+		return false;
+
+	return CreateInstance();
+}
+
+void CPipeServer::CloseListener()
+{
+	if (m_pPending != nullptr)
+		CloseConnection(m_pPending->nId);
+
+	if (m_hCompletionPort != NULL)
+	{
+		CloseHandle(m_hCompletionPort);
+		m_hCompletionPort = NULL;
+	}
+}
+
+bool CPipeServer::CreateInstance()
+{
+	// Only the user of the process may connect
+	CPipeSecurity oSecurity;
+	if (oSecurity.GetAttributes() == nullptr)
+		return false;
+
+	std::string sPath = R"(\\.\pipe\)" + m_sName;
+	SConnectionPtr pConnection(new SConnection(m_nMaxMessageSize, m_oCipher));
+	pConnection->nId = ++m_nNextConnectionId;
+	pConnection->hPipe = CreateNamedPipeA(sPath.c_str(), PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT,
+		PIPE_UNLIMITED_INSTANCES, c_nPipeBufferSize, c_nPipeBufferSize, NMPWAIT_USE_DEFAULT_WAIT, oSecurity.GetAttributes());
+	if (pConnection->hPipe == INVALID_HANDLE_VALUE)
+		return false;
+
+	// Completions are keyed by the connection id (never zero, the stop key), the loop looks it up
+	const ULONG_PTR nKey = ULONG_PTR(pConnection->nId);
+	if (CreateIoCompletionPort(pConnection->hPipe, m_hCompletionPort, nKey, 0) == NULL)
+	{
+		CloseHandle(pConnection->hPipe);
+		return false;
+	}
+
+	// The writer may be already connected, then no completion is queued and it is posted by hand
+	BOOL bResult = ConnectNamedPipe(pConnection->hPipe, &pConnection->oOverlapped);
+	DWORD nError = GetLastError();
+	if (!bResult && nError != ERROR_IO_PENDING && nError != ERROR_PIPE_CONNECTED)
+	{
+		CloseHandle(pConnection->hPipe);
+		return false;
+	}
+	if (bResult || nError == ERROR_PIPE_CONNECTED)
+		PostQueuedCompletionStatus(m_hCompletionPort, 0, nKey, &pConnection->oOverlapped);
+
+	m_pPending = pConnection.get();
+	m_mapConnections[pConnection->nId] = std::move(pConnection);
+
+	return true;
+}
+
+bool CPipeServer::SendCredit(SConnection& oConnection)
+{
+	// The writer asks once per connection, a repeated request while the reply is in flight needs none
+	if (oConnection.bWritePending)
+		return true;
+
+	EncodeCredit(oConnection.arrCredit, c_nUnlimitedCredit);
+	memset(&oConnection.oWriteOverlapped, 0, sizeof(oConnection.oWriteOverlapped));
+	if (!WriteFile(oConnection.hPipe, oConnection.arrCredit, DWORD(c_nCreditFrameSize), NULL, &oConnection.oWriteOverlapped) && GetLastError() != ERROR_IO_PENDING)
+		return false;
+
+	oConnection.bWritePending = true;
+	return true;
+}
+
+bool CPipeServer::IssueRead(SConnection& oConnection)
+{
+	memset(&oConnection.oOverlapped, 0, sizeof(oConnection.oOverlapped));
+	byte* pBuffer = oConnection.oAssembler.GetWriteBuffer(c_nReadChunk);
+	if (!ReadFile(oConnection.hPipe, pBuffer, DWORD(c_nReadChunk), NULL, &oConnection.oOverlapped) && GetLastError() != ERROR_IO_PENDING)
+		return false;
+
+	return true;
+}
+
+#else
+
+void CPipeServer::Run()
+{
+	epoll_event arrEvents[c_nMaxEvents];
+	while (m_bRunning)
+	{
+		int nCount = epoll_wait(m_nPoll, arrEvents, c_nMaxEvents, -1);
+		if (nCount < 0 && errno != EINTR)
+			break;
+
+		for (int i = 0; i < nCount; ++i)
+		{
+			const uint64_t nKey = arrEvents[i].data.u64;
+			if (nKey == c_nWakeupKey)
+				return;
+			if (nKey == c_nListenerKey)
+			{
+				AcceptConnections();
+				continue;
+			}
+
+			// The connection may have been closed by an earlier event of this batch
+			auto itConnection = m_mapConnections.find(nKey);
+			if (itConnection != m_mapConnections.end())
+				ReadConnection(*itConnection->second);
+		}
+	}
+}
+
+bool CPipeServer::OpenListener()
+{
+	const std::string sPath = CPosixPipeTransport::GetEndpointPath(m_sName);
+	sockaddr_un oAddress = {};
+	oAddress.sun_family = AF_UNIX;
+	if (sPath.size() >= sizeof(oAddress.sun_path))
+		return false;
+	memcpy(oAddress.sun_path, sPath.c_str(), sPath.size() + 1);
+
+	m_nListener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (m_nListener < 0)
+		return false;
+
+	if (!CPosixPipeTransport::Listen(m_nListener, oAddress, SOMAXCONN))
+		return false;
+
+	m_nPoll = epoll_create1(EPOLL_CLOEXEC);
+	m_nWakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (m_nPoll < 0 || m_nWakeup < 0)
+		return false;
+
+	epoll_event oEvent = {};
+	oEvent.events = EPOLLIN;
+	oEvent.data.u64 = c_nListenerKey;
+	if (epoll_ctl(m_nPoll, EPOLL_CTL_ADD, m_nListener, &oEvent) != 0)
+		return false;
+	oEvent.data.u64 = c_nWakeupKey;
+
+	return (epoll_ctl(m_nPoll, EPOLL_CTL_ADD, m_nWakeup, &oEvent) == 0);
+}
+
+void CPipeServer::CloseListener()
+{
+	if (m_nListener >= 0)
+	{
+		close(m_nListener);
+		unlink(CPosixPipeTransport::GetEndpointPath(m_sName).c_str());
+		m_nListener = -1;
+	}
+	if (m_nPoll >= 0)
+	{
+		close(m_nPoll);
+		m_nPoll = -1;
+	}
+	if (m_nWakeup >= 0)
+	{
+		close(m_nWakeup);
+		m_nWakeup = -1;
+	}
+}
+
+void CPipeServer::AcceptConnections()
+{
+	for (;;)
+	{
+		int nSocket = accept4(m_nListener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (nSocket < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			return;
+		}
+
+		SConnectionPtr pConnection(new SConnection(m_nMaxMessageSize, m_oCipher));
+		pConnection->nId = ++m_nNextConnectionId;
+		pConnection->nSocket = nSocket;
+
+		epoll_event oEvent = {};
+		oEvent.events = EPOLLIN | EPOLLRDHUP;
+		oEvent.data.u64 = pConnection->nId;
+		if (epoll_ctl(m_nPoll, EPOLL_CTL_ADD, nSocket, &oEvent) != 0)
+		{
+			close(nSocket);
+			continue;
+		}
+
+		const uint64_t nId = pConnection->nId;
+		AddConnectionMetrics(*pConnection);
+		m_mapConnections[nId] = std::move(pConnection);
+		++m_nConnectionCount;
+		IMessageHandlerPtr pHandler = m_pHandler;
+		m_oWorkers.Post(nId, [pHandler, nId]() { pHandler->OnConnect(nId); });
+	}
+}
+
+bool CPipeServer::SendCredit(SConnection& oConnection)
+{
+	// Fits the empty socket buffer of the writer that waits for it
+	byte arrCredit[c_nCreditFrameSize];
+	EncodeCredit(arrCredit, c_nUnlimitedCredit);
+	ssize_t nWritten = 0;
+	do
+		nWritten = send(oConnection.nSocket, arrCredit, sizeof(arrCredit), MSG_NOSIGNAL);
+	while (nWritten < 0 && errno == EINTR);
+
+	return (nWritten == ssize_t(sizeof(arrCredit)));
+}
+
+void CPipeServer::ReadConnection(SConnection& oConnection)
+{
+	const uint64_t nId = oConnection.nId;
+	for (;;)
+	{
+		byte* pBuffer = oConnection.oAssembler.GetWriteBuffer(c_nReadChunk);
+		ssize_t nRead = read(oConnection.nSocket, pBuffer, c_nReadChunk);
+		if (nRead > 0)
+		{
+			oConnection.oAssembler.CommitWrite(size_t(nRead));
+			if (!DispatchFrames(oConnection))
+				break;
+			continue;
+		}
+		if (nRead < 0 && errno == EINTR)
+			continue;
+		if (nRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+
+		// End of stream or error
+		break;
+	}
+
+	CloseConnection(nId);
+}
+
+#endif
@@ -0,0 +1,135 @@
+/*
+Declaration file for the multi-client pipe server
+
+One loop thread multiplexes all the connected writers (overlapped I/O and a completion port
+on Win32, epoll on Linux), cuts their streams into frames and hands the whole messages to
+the worker pool. Messages of one connection are handled in order by one worker.
+*/
+
+
+//! Include guard
+#pragma once
+
+
+//! Includes
+#include "frame_cipher.h"
+#include "pipe_capture.h"
+#include "pipe_frame.h"
+#include "pipe_metrics.h"
+#include "pipe_transport.h"
+#include "worker_pool.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+//! Class CPipeServer
+class CPipeServer
+{
+public: //! Type declarations
+	class IMessageHandler;
+	typedef std::shared_ptr<IMessageHandler> IMessageHandlerPtr;
+
+public: //! Constructors and destructor
+	explicit CPipeServer(const std::string& sName);
+	~CPipeServer();
+
+public: //! Interface
+	// Starts accepting the writers, the messages are handled on nWorkers threads (the number of cores if zero)
+	bool Start(IMessageHandlerPtr pHandler, size_t nWorkers = 0);
+	// Stops the server and disconnects all the writers
+	void Stop();
+	// Returns true if the server is running
+	bool IsRunning() const;
+
+	// Returns the number of connected writers
+	size_t GetConnectionCount() const;
+	// Sets the maximum accepted payload size (applies to the next Start)
+	void SetMaxMessageSize(uint32_t nMaxSize);
+	// Takes only the frames sealed by the shared key (see CNamedPipe::SetEncryption), null turns it off.
+	// Applies to the next Start, the writers that don't seal their frames are disconnected
+	bool SetEncryption(const void* pKey, size_t nKeySize);
+
+	// Metrics of the server and of every connection (see CPipeMetrics): received messages and bytes, broken
+	// frames, the messages queued to the workers, their queue and handler latencies. Fails while running
+	bool EnableMetrics(bool bEnable);
+	// Returns the metrics of all the connections so far (any thread), false if they are disabled
+	bool GetMetrics(SPipeMetrics& oMetrics) const;
+	// Returns the metrics of the connected writers by their ids
+	bool GetConnectionMetrics(std::vector<std::pair<uint64_t, SPipeMetrics>>& vecMetrics) const;
+
+	// Records the messages of all the writers into the trace under their connection ids as they are
+	// cut from the streams (see CPipeCapture), null stops it. Fails while running
+	bool SetCapture(CPipeCapturePtr pCapture);
+
+public: //! Type definitions
+	// Message handler interface, called on the worker threads
+	class IMessageHandler
+	{
+	public:
+		virtual ~IMessageHandler() = default;
+		virtual void OnConnect(uint64_t /*nConnectionId*/) {}
+		virtual void OnMessage(uint64_t nConnectionId, const SFrameHeader& oHeader, const std::vector<byte>& vecPayload) = 0;
+		virtual void OnDisconnect(uint64_t /*nConnectionId*/) {}
+	};
+
+private: //! Types
+	struct SConnection;
+	typedef std::unique_ptr<SConnection> SConnectionPtr;
+
+private: //! Implementation
+	// Loop thread function
+	void Run();
+	// Hands the complete frames of the connection to the workers, returns false if the stream is broken
+	bool DispatchFrames(SConnection& oConnection);
+	// Notifies the handler and releases the connection
+	void CloseConnection(uint64_t nConnectionId);
+	// Answers the flow control request, the server doesn't limit the writers
+	bool SendCredit(SConnection& oConnection);
+	// Counts the connected writer and publishes its metrics
+	void AddConnectionMetrics(SConnection& oConnection);
+	// Adds to the counter of the connection and of the server
+	void Count(SConnection& oConnection, EPipeCounter eCounter, uint64_t nValue = 1);
+	// Counts the failure of the connection and its reason (if any more specific), returns false
+	bool CountFailure(SConnection& oConnection, EPipeCounter eReason);
+
+	bool OpenListener();
+	void CloseListener();
+#ifdef _WIN32
+	// Creates the pipe instance the next writer will connect to
+	bool CreateInstance();
+	// Issues the overlapped read of the connection
+	bool IssueRead(SConnection& oConnection);
+#else
+	void AcceptConnections();
+	void ReadConnection(SConnection& oConnection);
+#endif
+
+private: //! Members
+	std::string										m_sName;
+	uint32_t										m_nMaxMessageSize;
+	CFrameCipher									m_oCipher;			// Key the ciphers of the connections start with
+	CPipeMetricsPtr									m_pMetrics;			// Totals of the server, null unless enabled
+	mutable std::mutex								m_mtxMetrics;		// Guards the metrics of the connections
+	std::unordered_map<uint64_t, CPipeMetricsPtr>	m_mapMetrics;		// Metrics of the connected writers
+	CPipeCapturePtr									m_pCapture;			// Null unless capturing
+	IMessageHandlerPtr								m_pHandler;
+	CWorkerPool										m_oWorkers;
+	std::thread										m_oLoop;
+	std::atomic<bool>								m_bRunning;
+	std::atomic<size_t>								m_nConnectionCount;
+	uint64_t										m_nNextConnectionId;
+	std::unordered_map<uint64_t, SConnectionPtr>	m_mapConnections;	// Owned by the loop thread
+#ifdef _WIN32
+	HANDLE											m_hCompletionPort;
+	SConnection*									m_pPending;			// Instance waiting for the next writer
+#else
+	int												m_nListener;		// Listening socket
+	int												m_nPoll;			// epoll instance
+	int												m_nWakeup;			// eventfd to stop the loop
+#endif
+};
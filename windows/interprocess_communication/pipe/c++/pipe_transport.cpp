@@ -0,0 +1,64 @@
+/*
+Implementation file for the pipe transport interface
+*/
+
+
+//! Includes
+#include "pipe_transport.h"
+#ifdef _WIN32
+#include "win32_pipe_transport.h"
+#else
+#include "posix_pipe_transport.h"
+#endif
+
+
+ITransportPtr CreatePipeTransport(const std::string& sName, EPipeMode eMode)
+{
+#ifdef _WIN32
+	return ITransportPtr(new CWin32PipeTransport(sName, eMode));
+#else
+	return ITransportPtr(new CPosixPipeTransport(sName, eMode));
+#endif
+}
+
+
+#ifdef _WIN32
+
+CPipeSecurity::CPipeSecurity()
+	: m_oDescriptor(),
+	  m_oAttributes(),
+	  m_bValid(false)
+{
+	HANDLE hToken = NULL;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &hToken))
+		return;
+	DWORD nSize = 0;
+	GetTokenInformation(hToken, TokenUser, NULL, 0, &nSize);
+	m_vecUser.resize(nSize);
+	const bool bUser = (nSize > 0 && GetTokenInformation(hToken, TokenUser, m_vecUser.data(), nSize, &nSize));
+	CloseHandle(hToken);
+	if (!bUser)
+		return;
+
+	// One ACE, everything else is denied
+	PSID pSid = reinterpret_cast<TOKEN_USER*>(m_vecUser.data())->User.Sid;
+	const DWORD nAclSize = DWORD(sizeof(ACL) + sizeof(ACCESS_ALLOWED_ACE) - sizeof(DWORD) + GetLengthSid(pSid));
+	m_vecAcl.resize(nAclSize);
+	PACL pAcl = reinterpret_cast<PACL>(m_vecAcl.data());
+	if (!InitializeAcl(pAcl, nAclSize, ACL_REVISION) || !AddAccessAllowedAce(pAcl, ACL_REVISION, FILE_ALL_ACCESS, pSid))
+		return;
+	if (!InitializeSecurityDescriptor(&m_oDescriptor, SECURITY_DESCRIPTOR_REVISION) || !SetSecurityDescriptorDacl(&m_oDescriptor, TRUE, pAcl, FALSE))
+		return;
+
+	m_oAttributes.nLength = sizeof(m_oAttributes);
+	m_oAttributes.lpSecurityDescriptor = &m_oDescriptor;
+	m_oAttributes.bInheritHandle = FALSE;
+	m_bValid = true;
+}
+
+SECURITY_ATTRIBUTES* CPipeSecurity::GetAttributes()
+{
+	return m_bValid ? &m_oAttributes : nullptr;
+}
+
+#endif
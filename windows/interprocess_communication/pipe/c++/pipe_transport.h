@@ -0,0 +1,142 @@
+/*
+Declaration file for the pipe transport interface
+*/
+
+
+//! Include guard
+#pragma once
+
+
+//! Includes
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#ifdef _WIN32
+#include <vector>
+#include <windows.h>
+#else
+typedef unsigned char byte;
+#endif
+
+
+//! Pipe mode
+enum class EPipeMode
+{
+	Read,
+	Write
+};
+
+
+//! Result of the transport I/O operation
+enum class EIoStatus
+{
+	Ok,
+	Disconnected,	// The other side has closed the connection
+	Failure			// The system call failed
+};
+
+
+//! Struct SIoBuffer (one element of the gather write)
+struct SIoBuffer
+{
+	const void*	pData = nullptr;
+	size_t		nSize = 0;
+};
+
+
+//! Wait strategy of the receiving thread
+enum class EWaitMode
+{
+	Block,			// Sleeps in the system until the data comes
+	SpinThenBlock,	// Polls for the spin time first, then sleeps
+	BusyPoll		// Polls until the data comes, never sleeps (burns the CPU)
+};
+
+struct SWaitStrategy
+{
+	EWaitMode	eMode = EWaitMode::Block;
+	uint32_t	nSpinUs = 50;		// Polling time of SpinThenBlock
+	int			nCpu = -1;			// CPU the receiving thread is pinned to, -1 keeps its affinity
+};
+
+
+//! Interface ITransport
+// A byte stream between one reader and one writer. The reader owns the endpoint and
+// accepts the writers one by one, the writer connects to the endpoint
+class ITransport
+{
+public:
+	virtual ~ITransport() = default;
+
+	// Returns the side of the transport
+	virtual EPipeMode GetMode() const = 0;
+	// Returns true if the transport is opened
+	virtual bool IsOpen() const = 0;
+	// Reader creates the endpoint, writer connects to the endpoint
+	virtual bool Open() = 0;
+	// Closes the transport
+	virtual bool Close() = 0;
+
+	// Waits for the writer to connect (no-op for the writer)
+	virtual bool Accept() = 0;
+	// Drops the connected writer (no-op for the writer)
+	virtual bool Disconnect() = 0;
+
+	// Writes all the buffers as one contiguous byte sequence
+	virtual EIoStatus Send(const SIoBuffer* arrBuffers, size_t nCount) = 0;
+	// Waits until at least one byte will be received, returns the number of bytes read in nRead
+	virtual EIoStatus Receive(void* pData, size_t nSize, size_t& nRead) = 0;
+	// Same as Receive, but returns at once with zero nRead if no data is available
+	virtual EIoStatus TryReceive(void* pData, size_t nSize, size_t& nRead) = 0;
+	// Returns true if the reader may send back to the writer over the connection
+	virtual bool IsDuplex() const = 0;
+	// Sets how Receive waits for the data, the transports that can't poll keep blocking
+	virtual void SetWaitStrategy(const SWaitStrategy& /*oStrategy*/) {}
+	// Returns the number of writes the system took only a part of, the rest waited for the buffer space (any thread)
+	virtual uint64_t GetPartialWriteCount() const { return 0; }
+
+#ifndef _WIN32
+	// Zero-copy extensions, the transports that can't do them keep the defaults
+	// Returns true if SendFile may be used
+	virtual bool CanSendFile() const { return false; }
+	// Writes nSize bytes of the file from nOffset without copying them through the user space
+	virtual EIoStatus SendFile(int /*nFd*/, uint64_t /*nOffset*/, size_t /*nSize*/) { return EIoStatus::Failure; }
+	// Returns true if the descriptors may be passed to the reader
+	virtual bool CanPassDescriptors() const { return false; }
+	// Writes the buffers with the descriptor attached to their first byte (SCM_RIGHTS)
+	virtual EIoStatus SendDescriptor(int /*nFd*/, const SIoBuffer* /*arrBuffers*/, size_t /*nCount*/) { return EIoStatus::Failure; }
+	// Returns the oldest descriptor received along with the data (-1 if none), the caller owns it
+	virtual int TakeDescriptor() { return -1; }
+#endif
+};
+
+typedef std::shared_ptr<ITransport> ITransportPtr;
+
+
+//! Creates the default transport of the platform (Win32 named pipe or Unix domain socket)
+ITransportPtr CreatePipeTransport(const std::string& sName, EPipeMode eMode);
+
+
+#ifdef _WIN32
+//! Class CPipeSecurity
+// Security of the pipes the readers create: the DACL grants the user of the process and nobody else
+class CPipeSecurity
+{
+public: //! Constructors
+	CPipeSecurity();
+	CPipeSecurity(const CPipeSecurity&) = delete;
+	CPipeSecurity& operator=(const CPipeSecurity&) = delete;
+
+public: //! Interface
+	// Returns the attributes to create the pipe with, null if they couldn't be built
+	SECURITY_ATTRIBUTES* GetAttributes();
+
+private: //! Members
+	std::vector<BYTE>		m_vecUser;			// TOKEN_USER of the process
+	std::vector<BYTE>		m_vecAcl;
+	SECURITY_DESCRIPTOR		m_oDescriptor;
+	SECURITY_ATTRIBUTES		m_oAttributes;
+	bool					m_bValid;
+};
+#endif
@@ -0,0 +1,589 @@
+/*
+Implementation file for the POSIX pipe transport (Unix domain sockets and FIFOs)
+*/
+
+
+//! Includes
+#include "posix_pipe_transport.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+//! Transport constants
+static const size_t		c_nMaxRecordSize = 64 * 1024;	// Largest seqpacket record
+static const int		c_nMaxIov = 64;					// Buffers per gather write
+static const int		c_nListenBacklog = 16;			// Writers waiting for the reader
+static const int		c_nMaxDescriptors = 16;			// Descriptors taken by one receive
+static const uint32_t	c_nBusyPollSliceUs = 1000;		// Busy poll reads the clock and the strategy this often
+
+
+//! Runs the write without raising SIGPIPE when the reader is gone (FIFOs and sendfile have no MSG_NOSIGNAL)
+template <typename TWrite>
+static ssize_t WriteWithoutSigPipe(TWrite fnWrite)
+{
+	sigset_t setPipe, setOld;
+	sigemptyset(&setPipe);
+	sigaddset(&setPipe, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &setPipe, &setOld);
+
+	ssize_t nResult = fnWrite();
+	if (nResult < 0 && errno == EPIPE)
+	{
+		// Consume the signal raised by this write
+		int nError = errno;
+		timespec oTimeout = { 0, 0 };
+		sigtimedwait(&setPipe, nullptr, &oTimeout);
+		errno = nError;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &setOld, nullptr);
+	return nResult;
+}
+
+
+CPosixPipeTransport::CPosixPipeTransport(const std::string& sName, EPipeMode eMode, EKind eKind)
+	: m_sName(sName),
+	  m_sPath(GetEndpointPath(sName)),
+	  m_eMode(eMode),
+	  m_eKind(eKind),
+	  m_eActiveKind(eKind),
+	  m_nEndpoint(-1),
+	  m_nPeer(-1),
+	  m_nFifoHold(-1),
+	  m_nRecordOffset(0),
+	  m_nRecordSize(0),
+	  m_nPartialWrites(0)
+{
+}
+
+CPosixPipeTransport::~CPosixPipeTransport()
+{
+	if (IsOpen())
+		Close();
+}
+
+EPipeMode CPosixPipeTransport::GetMode() const
+{
+	return m_eMode;
+}
+
+bool CPosixPipeTransport::IsOpen() const
+{
+	return (m_nEndpoint >= 0);
+}
+
+bool CPosixPipeTransport::Open()
+{
+	if (IsOpen() || m_sName.empty())
+		return false;
+
+	switch (m_eKind)
+	{
+	case EKind::Stream:
+		return OpenSocket(SOCK_STREAM);
+	case EKind::SeqPacket:
+		return OpenSocket(SOCK_SEQPACKET);
+	case EKind::Fifo:
+		return OpenFifo();
+	default:
+		break;
+	}
+
+	// Auto: prefer the stream socket, use FIFO if sockets are unavailable or the reader is a FIFO
+	if (OpenSocket(SOCK_STREAM))
+		return true;
+
+	struct stat oStat;
+	bool bFifoEndpoint = (stat(m_sPath.c_str(), &oStat) == 0 && S_ISFIFO(oStat.st_mode));
+	if (m_eMode == EPipeMode::Read || bFifoEndpoint)
+		return OpenFifo();
+
+	return false;
+}
+
+bool CPosixPipeTransport::Close()
+{
+	if (!IsOpen())
+		return false;
+
+	Disconnect();
+	close(m_nEndpoint);
+	m_nEndpoint = -1;
+	CloseDescriptors();
+	if (m_nFifoHold >= 0)
+	{
+		close(m_nFifoHold);
+		m_nFifoHold = -1;
+	}
+
+	// The reader owns the endpoint
+	if (m_eMode == EPipeMode::Read)
+		unlink(m_sPath.c_str());
+
+	return true;
+}
+
+bool CPosixPipeTransport::Accept()
+{
+	if (m_eMode != EPipeMode::Read)
+		return true;
+	if (!IsOpen())
+		return false;
+	// FIFO has no connections, the writers share one byte stream
+	if (m_nPeer >= 0 || m_eActiveKind == EKind::Fifo)
+		return true;
+
+	do
+		m_nPeer = accept(m_nEndpoint, nullptr, nullptr);
+	while (m_nPeer < 0 && errno == EINTR);
+
+	if (m_nPeer >= 0)
+		fcntl(m_nPeer, F_SETFD, FD_CLOEXEC);
+
+	return (m_nPeer >= 0);
+}
+
+bool CPosixPipeTransport::Disconnect()
+{
+	if (m_eMode != EPipeMode::Read)
+		return true;
+
+	m_nRecordOffset = 0;
+	m_nRecordSize = 0;
+	CloseDescriptors();
+	if (m_nPeer < 0)
+		return false;
+
+	close(m_nPeer);
+	m_nPeer = -1;
+
+	return true;
+}
+
+EIoStatus CPosixPipeTransport::Send(const SIoBuffer* arrBuffers, size_t nCount)
+{
+	const int nDescriptor = GetDataDescriptor();
+	if (nDescriptor < 0)
+		return EIoStatus::Failure;
+
+	// Seqpacket keeps record boundaries, so the gather is cut into records of the limited size
+	const size_t nRecordLimit = (m_eActiveKind == EKind::SeqPacket) ? c_nMaxRecordSize : SIZE_MAX;
+	size_t nBuffer = 0;
+	size_t nOffset = 0;
+	for (;;)
+	{
+		while (nBuffer < nCount && nOffset == arrBuffers[nBuffer].nSize)
+		{
+			++nBuffer;
+			nOffset = 0;
+		}
+		if (nBuffer == nCount)
+			return EIoStatus::Ok;
+
+		iovec arrIov[c_nMaxIov];
+		int nIov = 0;
+		size_t nBytes = 0;
+		for (size_t i = nBuffer, nFrom = nOffset; i < nCount && nIov < c_nMaxIov && nBytes < nRecordLimit; ++i, nFrom = 0)
+		{
+			const size_t nPart = (std::min)(arrBuffers[i].nSize - nFrom, nRecordLimit - nBytes);
+			if (nPart == 0)
+				continue;
+			arrIov[nIov].iov_base = const_cast<byte*>(static_cast<const byte*>(arrBuffers[i].pData) + nFrom);
+			arrIov[nIov].iov_len = nPart;
+			++nIov;
+			nBytes += nPart;
+		}
+
+		ssize_t nWritten = 0;
+		if (m_eActiveKind == EKind::Fifo)
+			nWritten = WriteWithoutSigPipe([&]() { return writev(nDescriptor, arrIov, nIov); });
+		else
+		{
+			msghdr oMessage = {};
+			oMessage.msg_iov = arrIov;
+			oMessage.msg_iovlen = nIov;
+			nWritten = sendmsg(nDescriptor, &oMessage, MSG_NOSIGNAL);
+		}
+		if (nWritten < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return (errno == EPIPE || errno == ECONNRESET) ? EIoStatus::Disconnected : EIoStatus::Failure;
+		}
+
+		if (size_t(nWritten) < nBytes)
+			m_nPartialWrites.fetch_add(1, std::memory_order_relaxed);
+
+		// Skip the written part of the gather
+		size_t nLeft = size_t(nWritten);
+		while (nLeft > 0)
+		{
+			const size_t nAvailable = arrBuffers[nBuffer].nSize - nOffset;
+			if (nLeft < nAvailable)
+			{
+				nOffset += nLeft;
+				nLeft = 0;
+			}
+			else
+			{
+				nLeft -= nAvailable;
+				++nBuffer;
+				nOffset = 0;
+			}
+		}
+	}
+}
+
+EIoStatus CPosixPipeTransport::Receive(void* pData, size_t nSize, size_t& nRead)
+{
+	nRead = 0;
+	const int nDescriptor = GetDataDescriptor();
+	if (nDescriptor < 0)
+		return EIoStatus::Failure;
+
+	if (m_nRecordOffset == m_nRecordSize)
+		PollReadable(nDescriptor);
+	return ReceiveAvailable(pData, nSize, nRead);
+}
+
+EIoStatus CPosixPipeTransport::ReceiveAvailable(void* pData, size_t nSize, size_t& nRead)
+{
+	nRead = 0;
+	const int nDescriptor = GetDataDescriptor();
+	if (m_eActiveKind == EKind::SeqPacket)
+	{
+		// Large reads take the whole record directly, small ones are served from the record buffer
+		if (m_nRecordOffset == m_nRecordSize && nSize < c_nMaxRecordSize)
+		{
+			EIoStatus eStatus = ReceiveRecord();
+			if (eStatus != EIoStatus::Ok)
+				return eStatus;
+		}
+		if (m_nRecordOffset < m_nRecordSize)
+		{
+			nRead = (std::min)(nSize, m_nRecordSize - m_nRecordOffset);
+			memcpy(pData, m_vecRecord.data() + m_nRecordOffset, nRead);
+			m_nRecordOffset += nRead;
+			return EIoStatus::Ok;
+		}
+	}
+
+	ssize_t nResult = 0;
+	do
+		nResult = (m_eActiveKind == EKind::Fifo) ? read(nDescriptor, pData, nSize) : ReceiveSocket(pData, nSize);
+	while (nResult < 0 && errno == EINTR);
+
+	if (nResult < 0)
+		return (errno == ECONNRESET) ? EIoStatus::Disconnected : EIoStatus::Failure;
+	if (nResult == 0)
+		return EIoStatus::Disconnected;
+
+	nRead = size_t(nResult);
+	return EIoStatus::Ok;
+}
+
+EIoStatus CPosixPipeTransport::TryReceive(void* pData, size_t nSize, size_t& nRead)
+{
+	nRead = 0;
+	const int nDescriptor = GetDataDescriptor();
+	if (nDescriptor < 0)
+		return EIoStatus::Failure;
+
+	// The rest of the seqpacket record is served first, otherwise the descriptor is polled
+	if (m_nRecordOffset == m_nRecordSize)
+	{
+		pollfd oPoll = { nDescriptor, POLLIN, 0 };
+		int nResult = 0;
+		do
+			nResult = poll(&oPoll, 1, 0);
+		while (nResult < 0 && errno == EINTR);
+
+		if (nResult < 0)
+			return EIoStatus::Failure;
+		if (nResult == 0)
+			return EIoStatus::Ok;
+	}
+
+	return ReceiveAvailable(pData, nSize, nRead);
+}
+
+bool CPosixPipeTransport::IsDuplex() const
+{
+	// FIFO carries the bytes one way only
+	return (m_eActiveKind != EKind::Fifo);
+}
+
+void CPosixPipeTransport::SetWaitStrategy(const SWaitStrategy& oStrategy)
+{
+	m_oWaiter.SetStrategy(oStrategy);
+}
+
+uint64_t CPosixPipeTransport::GetPartialWriteCount() const
+{
+	return m_nPartialWrites.load(std::memory_order_relaxed);
+}
+
+bool CPosixPipeTransport::CanSendFile() const
+{
+	// Seqpacket records are limited, the buffered path cuts them
+	return (IsOpen() && m_eActiveKind != EKind::SeqPacket);
+}
+
+EIoStatus CPosixPipeTransport::SendFile(int nFd, uint64_t nOffset, size_t nSize)
+{
+	const int nDescriptor = GetDataDescriptor();
+	if (nDescriptor < 0 || !CanSendFile())
+		return EIoStatus::Failure;
+
+	// The pages go from the page cache to the socket or the FIFO buffer without a user space copy
+	off_t nPosition = off_t(nOffset);
+	while (nSize > 0)
+	{
+		ssize_t nWritten = WriteWithoutSigPipe([&]() { return sendfile(nDescriptor, nFd, &nPosition, nSize); });
+		if (nWritten < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return (errno == EPIPE || errno == ECONNRESET) ? EIoStatus::Disconnected : EIoStatus::Failure;
+		}
+		// The file is shorter than expected
+		if (nWritten == 0)
+			return EIoStatus::Failure;
+		if (size_t(nWritten) < nSize)
+			m_nPartialWrites.fetch_add(1, std::memory_order_relaxed);
+		nSize -= size_t(nWritten);
+	}
+
+	return EIoStatus::Ok;
+}
+
+bool CPosixPipeTransport::CanPassDescriptors() const
+{
+	return (IsOpen() && m_eActiveKind != EKind::Fifo);
+}
+
+EIoStatus CPosixPipeTransport::SendDescriptor(int nFd, const SIoBuffer* arrBuffers, size_t nCount)
+{
+	const int nDescriptor = GetDataDescriptor();
+	if (nDescriptor < 0 || !CanPassDescriptors() || nCount == 0 || arrBuffers[0].nSize == 0)
+		return EIoStatus::Failure;
+
+	// The descriptor rides on the first byte, the rest goes by the ordinary send
+	iovec oIov = { const_cast<void*>(arrBuffers[0].pData), 1 };
+	alignas(cmsghdr) char arrControl[CMSG_SPACE(sizeof(int))] = {};
+	msghdr oMessage = {};
+	oMessage.msg_iov = &oIov;
+	oMessage.msg_iovlen = 1;
+	oMessage.msg_control = arrControl;
+	oMessage.msg_controllen = sizeof(arrControl);
+	cmsghdr* pControl = CMSG_FIRSTHDR(&oMessage);
+	pControl->cmsg_level = SOL_SOCKET;
+	pControl->cmsg_type = SCM_RIGHTS;
+	pControl->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(pControl), &nFd, sizeof(int));
+
+	ssize_t nWritten = 0;
+	do
+		nWritten = sendmsg(nDescriptor, &oMessage, MSG_NOSIGNAL);
+	while (nWritten < 0 && errno == EINTR);
+	if (nWritten < 0)
+		return (errno == EPIPE || errno == ECONNRESET) ? EIoStatus::Disconnected : EIoStatus::Failure;
+
+	std::vector<SIoBuffer> vecRest(arrBuffers, arrBuffers + nCount);
+	vecRest[0].pData = static_cast<const byte*>(vecRest[0].pData) + 1;
+	--vecRest[0].nSize;
+	return Send(vecRest.data(), vecRest.size());
+}
+
+int CPosixPipeTransport::TakeDescriptor()
+{
+	if (m_deqDescriptors.empty())
+		return -1;
+
+	const int nFd = m_deqDescriptors.front();
+	m_deqDescriptors.pop_front();
+	return nFd;
+}
+
+CPosixPipeTransport::EKind CPosixPipeTransport::GetKind() const
+{
+	return m_eActiveKind;
+}
+
+std::string CPosixPipeTransport::GetEndpointPath(const std::string& sName)
+{
+	if (!sName.empty() && sName[0] == '/')
+		return sName;
+
+	return "/tmp/libx-pipe-" + sName;
+}
+
+bool CPosixPipeTransport::Listen(int nSocket, const sockaddr_un& oAddress, int nBacklog)
+{
+	// Replace the endpoint left by the previous reader. No writer connects before listen, so narrowing the mode
+	// in between leaves no window for the other users
+	unlink(oAddress.sun_path);
+	return bind(nSocket, reinterpret_cast<const sockaddr*>(&oAddress), sizeof(oAddress)) == 0 && chmod(oAddress.sun_path, 0600) == 0 &&
+		listen(nSocket, nBacklog) == 0;
+}
+
+bool CPosixPipeTransport::OpenSocket(int nType)
+{
+	sockaddr_un oAddress = {};
+	oAddress.sun_family = AF_UNIX;
+	if (m_sPath.size() >= sizeof(oAddress.sun_path))
+		return false;
+	memcpy(oAddress.sun_path, m_sPath.c_str(), m_sPath.size() + 1);
+
+	int nSocket = socket(AF_UNIX, nType, 0);
+	if (nSocket < 0)
+		return false;
+	fcntl(nSocket, F_SETFD, FD_CLOEXEC);
+
+	bool bOk = false;
+	if (m_eMode == EPipeMode::Read)
+		bOk = Listen(nSocket, oAddress, c_nListenBacklog);
+	else
+		bOk = (connect(nSocket, reinterpret_cast<sockaddr*>(&oAddress), sizeof(oAddress)) == 0);
+
+	if (!bOk)
+	{
+		close(nSocket);
+		return false;
+	}
+
+	m_nEndpoint = nSocket;
+	m_eActiveKind = (nType == SOCK_SEQPACKET) ? EKind::SeqPacket : EKind::Stream;
+	if (m_eActiveKind == EKind::SeqPacket)
+		m_vecRecord.resize(c_nMaxRecordSize);
+
+	return true;
+}
+
+bool CPosixPipeTransport::OpenFifo()
+{
+	if (m_eMode == EPipeMode::Read)
+	{
+		struct stat oStat;
+		if (stat(m_sPath.c_str(), &oStat) == 0 && !S_ISFIFO(oStat.st_mode))
+			unlink(m_sPath.c_str());
+		// Owner only, other users could read the frames or inject their own. The FIFO left by the previous reader keeps
+		// its mode, it's narrowed too (and refused if another user owns it)
+		if ((mkfifo(m_sPath.c_str(), 0600) != 0 && errno != EEXIST) || chmod(m_sPath.c_str(), 0600) != 0)
+			return false;
+
+		// Holding a write end keeps the reads blocking between the writers instead of returning end of file
+		m_nEndpoint = open(m_sPath.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		if (m_nEndpoint >= 0)
+		{
+			m_nFifoHold = open(m_sPath.c_str(), O_WRONLY | O_CLOEXEC);
+			if (m_nFifoHold < 0)
+			{
+				close(m_nEndpoint);
+				m_nEndpoint = -1;
+			}
+			else
+				fcntl(m_nEndpoint, F_SETFL, fcntl(m_nEndpoint, F_GETFL) & ~O_NONBLOCK);
+		}
+	}
+	else
+	{
+		// Fails with ENXIO if there is no reader, like a missing Win32 pipe
+		m_nEndpoint = open(m_sPath.c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+		if (m_nEndpoint >= 0)
+			fcntl(m_nEndpoint, F_SETFL, fcntl(m_nEndpoint, F_GETFL) & ~O_NONBLOCK);
+	}
+
+	if (m_nEndpoint < 0)
+		return false;
+
+	m_eActiveKind = EKind::Fifo;
+	return true;
+}
+
+int CPosixPipeTransport::GetDataDescriptor() const
+{
+	if (m_eMode == EPipeMode::Read && m_eActiveKind != EKind::Fifo)
+		return m_nPeer;
+
+	return m_nEndpoint;
+}
+
+void CPosixPipeTransport::PollReadable(int nDescriptor)
+{
+	m_oWaiter.Prepare();
+	// Readable covers the hang up and the error as well, the read reports them
+	auto fnReadable = [nDescriptor]()
+	{
+		pollfd oPoll = { nDescriptor, POLLIN, 0 };
+		return (poll(&oPoll, 1, 0) != 0);
+	};
+	while (!m_oWaiter.Spin(fnReadable, c_nBusyPollSliceUs) && m_oWaiter.IsBusyPoll())
+		;
+}
+
+EIoStatus CPosixPipeTransport::ReceiveRecord()
+{
+	ssize_t nResult = 0;
+	do
+		nResult = ReceiveSocket(m_vecRecord.data(), m_vecRecord.size());
+	while (nResult < 0 && errno == EINTR);
+
+	if (nResult < 0)
+		return (errno == ECONNRESET) ? EIoStatus::Disconnected : EIoStatus::Failure;
+	if (nResult == 0)
+		return EIoStatus::Disconnected;
+
+	m_nRecordOffset = 0;
+	m_nRecordSize = size_t(nResult);
+	return EIoStatus::Ok;
+}
+
+ssize_t CPosixPipeTransport::ReceiveSocket(void* pData, size_t nSize)
+{
+	iovec oIov = { pData, nSize };
+	alignas(cmsghdr) char arrControl[CMSG_SPACE(sizeof(int) * c_nMaxDescriptors)];
+	msghdr oMessage = {};
+	oMessage.msg_iov = &oIov;
+	oMessage.msg_iovlen = 1;
+	oMessage.msg_control = arrControl;
+	oMessage.msg_controllen = sizeof(arrControl);
+
+	const ssize_t nResult = recvmsg(GetDataDescriptor(), &oMessage, MSG_CMSG_CLOEXEC);
+	if (nResult < 0)
+		return nResult;
+
+	for (cmsghdr* pControl = CMSG_FIRSTHDR(&oMessage); pControl != nullptr; pControl = CMSG_NXTHDR(&oMessage, pControl))
+	{
+		if (pControl->cmsg_level != SOL_SOCKET || pControl->cmsg_type != SCM_RIGHTS)
+			continue;
+		const size_t nCount = (pControl->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (size_t i = 0; i < nCount; ++i)
+		{
+			int nFd = -1;
+			memcpy(&nFd, CMSG_DATA(pControl) + i * sizeof(int), sizeof(int));
+			m_deqDescriptors.push_back(nFd);
+		}
+	}
+
+	return nResult;
+}
+
+void CPosixPipeTransport::CloseDescriptors()
+{
+	for (int nFd : m_deqDescriptors)
+		close(nFd);
+	m_deqDescriptors.clear();
+}
@@ -0,0 +1,100 @@
+/*
+Declaration file for the POSIX pipe transport (Unix domain sockets and FIFOs)
+*/
+
+
+//! Include guard
+#pragma once
+
+
+//! Includes
+#include "pipe_transport.h"
+#include "spin_waiter.h"
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <sys/types.h>
+#include <sys/un.h>
+
+
+//! Class CPosixPipeTransport
+class CPosixPipeTransport : public ITransport
+{
+public: //! Types
+	enum class EKind
+	{
+		Auto,		// Stream socket, falls back to FIFO if sockets are unavailable
+		Stream,		// AF_UNIX SOCK_STREAM
+		SeqPacket,	// AF_UNIX SOCK_SEQPACKET
+		Fifo		// mkfifo
+	};
+
+public: //! Constructors and destructor
+	CPosixPipeTransport(const std::string& sName, EPipeMode eMode, EKind eKind = EKind::Auto);
+	~CPosixPipeTransport();
+
+public: //! Interface (overrides base interface)
+	EPipeMode GetMode() const override;
+	bool IsOpen() const override;
+	bool Open() override;
+	bool Close() override;
+
+	bool Accept() override;
+	bool Disconnect() override;
+
+	EIoStatus Send(const SIoBuffer* arrBuffers, size_t nCount) override;
+	EIoStatus Receive(void* pData, size_t nSize, size_t& nRead) override;
+	EIoStatus TryReceive(void* pData, size_t nSize, size_t& nRead) override;
+	bool IsDuplex() const override;
+	// Polling waits check the descriptor without sleeping, then the read blocks as usual
+	void SetWaitStrategy(const SWaitStrategy& oStrategy) override;
+	uint64_t GetPartialWriteCount() const override;
+
+	bool CanSendFile() const override;
+	EIoStatus SendFile(int nFd, uint64_t nOffset, size_t nSize) override;
+	bool CanPassDescriptors() const override;
+	EIoStatus SendDescriptor(int nFd, const SIoBuffer* arrBuffers, size_t nCount) override;
+	int TakeDescriptor() override;
+
+public: //! Interface
+	// Returns the kind actually used (resolved after Open)
+	EKind GetKind() const;
+
+public: //! Static helpers
+	// Returns the file system path of the endpoint
+	static std::string GetEndpointPath(const std::string& sName);
+	// Binds the socket to the endpoint owner-only (replaces the one left by the previous reader) and listens
+	static bool Listen(int nSocket, const sockaddr_un& oAddress, int nBacklog);
+
+private: //! Implementation
+	bool OpenSocket(int nType);
+	bool OpenFifo();
+	// Returns the descriptor to transfer data through
+	int GetDataDescriptor() const;
+	// Reads what has arrived or blocks until anything does
+	EIoStatus ReceiveAvailable(void* pData, size_t nSize, size_t& nRead);
+	// Polls the descriptor by the wait strategy
+	void PollReadable(int nDescriptor);
+	// Reads the next seqpacket record into the record buffer
+	EIoStatus ReceiveRecord();
+	// Reads from the socket, the descriptors passed along are kept for TakeDescriptor
+	ssize_t ReceiveSocket(void* pData, size_t nSize);
+	// Closes the descriptors nobody has taken
+	void CloseDescriptors();
+
+private: //! Members
+	std::string			m_sName;
+	std::string			m_sPath;
+	EPipeMode			m_eMode;
+	EKind				m_eKind;			// Requested kind
+	EKind				m_eActiveKind;		// Kind in use while opened
+	int					m_nEndpoint;		// Listening socket or FIFO (reader), connected socket or FIFO (writer)
+	int					m_nPeer;			// Accepted socket (reader)
+	int					m_nFifoHold;		// Write end held by the FIFO reader
+	std::vector<byte>	m_vecRecord;		// Seqpacket record buffer
+	size_t				m_nRecordOffset;	// Seqpacket record read position
+	size_t				m_nRecordSize;		// Seqpacket record size
+	std::deque<int>		m_deqDescriptors;	// Received by SCM_RIGHTS and not taken yet
+	CSpinWaiter			m_oWaiter;			// Polling before the blocking read
+	std::atomic<uint64_t>	m_nPartialWrites;
+};
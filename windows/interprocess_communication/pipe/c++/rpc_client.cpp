@@ -0,0 +1,178 @@
+/*
+Implementation file for the RPC client
+*/
+
+
+//! Includes
+#include "rpc_client.h"
+#include <cstring>
+
+
+CRpcClientPtr CRpcClient::Create(CIoLoopPtr pLoop, const std::string& sName)
+{
+	return CRpcClientPtr(new CRpcClient(pLoop, sName));
+}
+
+CRpcClient::CRpcClient(CIoLoopPtr pLoop, const std::string& sName)
+	: m_pLoop(pLoop),
+	  m_pPipe(CAsyncPipe::Create(pLoop, sName, EPipeMode::Write)),
+	  m_nNextCallId(0),
+	  m_nPendingCount(0)
+{
+}
+
+CRpcClient::~CRpcClient()
+{
+}
+
+bool CRpcClient::Open()
+{
+	if (!m_pPipe->Open())
+		return false;
+
+	// Queued after the pipe attaches to the loop
+	ReceiveNext();
+	return true;
+}
+
+void CRpcClient::Close()
+{
+	m_pPipe->Close();
+}
+
+bool CRpcClient::IsOpen() const
+{
+	return m_pPipe->IsOpen();
+}
+
+void CRpcClient::SetMaxMessageSize(uint32_t nMaxSize)
+{
+	m_pPipe->SetMaxMessageSize(nMaxSize);
+}
+
+void CRpcClient::Call(uint32_t nMethod, const void* pData, size_t nSize, TCallback fnCallback, uint32_t nTimeoutMs)
+{
+	if (!m_pLoop->IsRunning())
+	{
+		SResult oResult;
+		oResult.eError = EPipeError::Cancelled;
+		fnCallback(std::move(oResult));
+		return;
+	}
+
+	// The request stays alive until its write completes, even if the call is over by then
+	SRpcHeader oHeader;
+	oHeader.nCallId = ++m_nNextCallId;
+	oHeader.nCode = nMethod;
+	oHeader.nTimeoutMs = nTimeoutMs;
+	std::shared_ptr<std::vector<byte>> pRequest = std::make_shared<std::vector<byte>>(c_nRpcHeaderSize + nSize);
+	oHeader.Encode(pRequest->data());
+	if (nSize > 0)
+		memcpy(pRequest->data() + c_nRpcHeaderSize, pData, nSize);
+
+	CRpcClientPtr pThis = shared_from_this();
+	const uint64_t nCallId = oHeader.nCallId;
+	m_pLoop->Post([pThis, nCallId, pRequest, fnCallback, nTimeoutMs]()
+	{
+		pThis->StartCall(nCallId, pRequest, fnCallback, nTimeoutMs);
+	});
+}
+
+std::future<CRpcClient::SResult> CRpcClient::Call(uint32_t nMethod, const void* pData, size_t nSize, uint32_t nTimeoutMs)
+{
+	std::shared_ptr<std::promise<SResult>> pPromise = std::make_shared<std::promise<SResult>>();
+	std::future<SResult> oFuture = pPromise->get_future();
+	Call(nMethod, pData, nSize, [pPromise](SResult&& oResult) { pPromise->set_value(std::move(oResult)); }, nTimeoutMs);
+
+	return oFuture;
+}
+
+size_t CRpcClient::GetPendingCount() const
+{
+	return m_nPendingCount;
+}
+
+void CRpcClient::StartCall(uint64_t nCallId, std::shared_ptr<std::vector<byte>> pRequest, TCallback fnCallback, uint32_t nTimeoutMs)
+{
+	CRpcClientPtr pThis = shared_from_this();
+	SCall& oCall = m_mapCalls[nCallId];
+	oCall.fnCallback = fnCallback;
+	if (nTimeoutMs > 0)
+	{
+		oCall.nTimerId = m_pLoop->AddTimer(nTimeoutMs, [pThis, nCallId]()
+		{
+			SResult oResult;
+			oResult.eError = EPipeError::TimedOut;
+			pThis->Complete(nCallId, std::move(oResult));
+		});
+	}
+	++m_nPendingCount;
+
+	// The write isn't limited by the deadline, a cut frame would break all the other calls
+	m_pPipe->SendFrameAsync(uint16_t(EFrameType::Request), pRequest->data(), pRequest->size(), [pThis, nCallId, pRequest](EPipeError eError)
+	{
+		if (eError == EPipeError::None)
+			return;
+		SResult oResult;
+		oResult.eError = eError;
+		pThis->Complete(nCallId, std::move(oResult));
+	});
+}
+
+void CRpcClient::ReceiveNext()
+{
+	CRpcClientPtr pThis = shared_from_this();
+	m_pPipe->ReceiveAsync([pThis](CAsyncPipe::SReceiveResult&& oResult) { pThis->OnResponse(std::move(oResult)); });
+}
+
+void CRpcClient::OnResponse(CAsyncPipe::SReceiveResult&& oResult)
+{
+	// The writer is closed by the broken connection
+	if (oResult.eError != EPipeError::None)
+	{
+		FailCalls(oResult.eError);
+		return;
+	}
+
+	SRpcHeader oHeader;
+	if (oHeader.Decode(oResult.oHeader, oResult.oPayload.GetData()) && oResult.oHeader.nType == uint16_t(EFrameType::Response))
+	{
+		// The result is moved to the start of the payload buffer
+		SResult oResponse;
+		oResponse.nStatus = oHeader.nCode;
+		oResponse.oPayload = std::move(oResult.oPayload);
+		const size_t nSize = oResponse.oPayload.GetSize() - c_nRpcHeaderSize;
+		memmove(oResponse.oPayload.GetData(), oResponse.oPayload.GetData() + c_nRpcHeaderSize, nSize);
+		oResponse.oPayload.SetSize(nSize);
+		Complete(oHeader.nCallId, std::move(oResponse));
+	}
+
+	ReceiveNext();
+}
+
+void CRpcClient::Complete(uint64_t nCallId, SResult&& oResult)
+{
+	auto itCall = m_mapCalls.find(nCallId);
+	if (itCall == m_mapCalls.end())
+		return;
+
+	SCall oCall = std::move(itCall->second);
+	m_mapCalls.erase(itCall);
+	--m_nPendingCount;
+	m_pLoop->CancelTimer(oCall.nTimerId);
+	oCall.fnCallback(std::move(oResult));
+}
+
+void CRpcClient::FailCalls(EPipeError eError)
+{
+	std::unordered_map<uint64_t, SCall> mapFailed;
+	mapFailed.swap(m_mapCalls);
+	m_nPendingCount -= mapFailed.size();
+	for (auto& prCall : mapFailed)
+	{
+		m_pLoop->CancelTimer(prCall.second.nTimerId);
+		SResult oResult;
+		oResult.eError = eError;
+		prCall.second.fnCallback(std::move(oResult));
+	}
+}
@@ -0,0 +1,86 @@
+/*
+Declaration file for the RPC client
+
+Calls the methods of CRpcServer over one duplex CAsyncPipe connection. Every request carries
+a correlation id, so any number of calls may be in flight and the responses may come in any
+order. The deadline of a call is kept by a loop timer, a late response is dropped.
+*/
+
+
+//! Include guard
+#pragma once
+
+
+//! Includes
+#include "async_pipe.h"
+#include <atomic>
+#include <unordered_map>
+
+
+//! Type declarations
+class CRpcClient;
+typedef std::shared_ptr<CRpcClient> CRpcClientPtr;
+
+
+//! Class CRpcClient
+class CRpcClient : public std::enable_shared_from_this<CRpcClient>
+{
+public: //! Types
+	typedef CNamedPipe::EPipeError EPipeError;
+
+	struct SResult
+	{
+		EPipeError		eError = EPipeError::None;
+		uint32_t		nStatus = 0;		// Status set by the server
+		CPooledBuffer	oPayload;			// Result set by the server
+	};
+
+	typedef std::function<void(SResult&& oResult)> TCallback;
+
+public: //! Constructors and destructor
+	static CRpcClientPtr Create(CIoLoopPtr pLoop, const std::string& sName);
+	~CRpcClient();
+
+public: //! Interface
+	// Connects to the server (the loop must be running)
+	bool Open();
+	// Closes the connection, the pending calls complete with EPipeError::Cancelled
+	void Close();
+	// Returns true if the connection is opened
+	bool IsOpen() const;
+	// Sets the maximum payload size of the requests and responses (applies to the next Open)
+	void SetMaxMessageSize(uint32_t nMaxSize);
+
+	// Calls the method, the arguments are copied. The callback runs on the loop thread once the response
+	// comes, the deadline passes (EPipeError::TimedOut) or the connection breaks. Zero timeout waits forever
+	void Call(uint32_t nMethod, const void* pData, size_t nSize, TCallback fnCallback, uint32_t nTimeoutMs = 0);
+	std::future<SResult> Call(uint32_t nMethod, const void* pData, size_t nSize, uint32_t nTimeoutMs = 0);
+	// Returns the number of the calls waiting for the response
+	size_t GetPendingCount() const;
+
+private: //! Types
+	struct SCall
+	{
+		TCallback	fnCallback;
+		uint64_t	nTimerId = 0;
+	};
+
+private: //! Implementation
+	CRpcClient(CIoLoopPtr pLoop, const std::string& sName);
+
+	// Loop thread only
+	void StartCall(uint64_t nCallId, std::shared_ptr<std::vector<byte>> pRequest, TCallback fnCallback, uint32_t nTimeoutMs);
+	// Keeps one receive pending while the connection is opened
+	void ReceiveNext();
+	void OnResponse(CAsyncPipe::SReceiveResult&& oResult);
+	// Completes the call if it's still pending
+	void Complete(uint64_t nCallId, SResult&& oResult);
+	void FailCalls(EPipeError eError);
+
+private: //! Members
+	CIoLoopPtr							m_pLoop;
+	CAsyncPipePtr						m_pPipe;		// Writer end of the connection
+	std::atomic<uint64_t>				m_nNextCallId;
+	std::atomic<size_t>					m_nPendingCount;
+	std::unordered_map<uint64_t, SCall>	m_mapCalls;		// Owned by the loop thread
+};
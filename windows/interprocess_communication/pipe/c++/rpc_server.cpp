@@ -0,0 +1,128 @@
+/*
+Implementation file for the RPC server
+*/
+
+
+//! Includes
+#include "rpc_server.h"
+#include <chrono>
+#include <cstring>
+
+
+CRpcServerPtr CRpcServer::Create(CIoLoopPtr pLoop, const std::string& sName)
+{
+	return CRpcServerPtr(new CRpcServer(pLoop, sName));
+}
+
+CRpcServer::CRpcServer(CIoLoopPtr pLoop, const std::string& sName)
+	: m_pLoop(pLoop),
+	  m_pPipe(CAsyncPipe::Create(pLoop, sName, EPipeMode::Read)),
+	  m_bRunning(false)
+{
+}
+
+CRpcServer::~CRpcServer()
+{
+	m_oWorkers.Stop();
+}
+
+bool CRpcServer::Start(IRequestHandlerPtr pHandler, size_t nWorkers)
+{
+	if (pHandler == nullptr || m_bRunning.exchange(true))
+		return false;
+
+	m_pHandler = pHandler;
+	if (!m_oWorkers.Start(nWorkers) || !m_pPipe->Open())
+	{
+		m_oWorkers.Stop();
+		m_bRunning = false;
+		return false;
+	}
+
+	// Queued after the pipe attaches to the loop
+	ReceiveNext();
+	return true;
+}
+
+void CRpcServer::Stop()
+{
+	if (!m_bRunning.exchange(false))
+		return;
+
+	m_pPipe->Close();
+	m_oWorkers.Stop();
+}
+
+bool CRpcServer::IsRunning() const
+{
+	return m_bRunning;
+}
+
+void CRpcServer::SetMaxMessageSize(uint32_t nMaxSize)
+{
+	m_pPipe->SetMaxMessageSize(nMaxSize);
+}
+
+void CRpcServer::ReceiveNext()
+{
+	CRpcServerPtr pThis = shared_from_this();
+	m_pPipe->ReceiveAsync([pThis](CAsyncPipe::SReceiveResult&& oResult) { pThis->OnRequest(std::move(oResult)); });
+}
+
+void CRpcServer::OnRequest(CAsyncPipe::SReceiveResult&& oResult)
+{
+	// A dropped client fails the receive, the pipe waits for the next one
+	if (oResult.eError == EPipeError::Cancelled || oResult.eError == EPipeError::NotOpen || oResult.eError == EPipeError::IoFailure)
+		return;
+	if (oResult.eError != EPipeError::None)
+	{
+		ReceiveNext();
+		return;
+	}
+
+	SRpcHeader oHeader;
+	if (oHeader.Decode(oResult.oHeader, oResult.oPayload.GetData()) && oResult.oHeader.nType == uint16_t(EFrameType::Request))
+	{
+		typedef std::chrono::steady_clock TClock;
+		const TClock::time_point tpDeadline = TClock::now() + std::chrono::milliseconds(oHeader.nTimeoutMs);
+		const bool bDeadline = (oHeader.nTimeoutMs > 0);
+
+		// The response goes only to the client that made the call, the ids of the next one may repeat
+		std::weak_ptr<CAsyncPipe> pPipe = m_pPipe;
+		const uint64_t nConnectionId = oResult.nConnectionId;
+		const uint64_t nCallId = oHeader.nCallId;
+		std::shared_ptr<std::atomic<bool>> pResponded = std::make_shared<std::atomic<bool>>(false);
+		TRespond fnRespond = [pPipe, nConnectionId, nCallId, pResponded](uint32_t nStatus, const void* pData, size_t nSize)
+		{
+			CAsyncPipePtr pTarget = pPipe.lock();
+			if (pTarget == nullptr || pResponded->exchange(true))
+				return;
+
+			SRpcHeader oResponse;
+			oResponse.nCallId = nCallId;
+			oResponse.nCode = nStatus;
+			std::shared_ptr<std::vector<byte>> pBuffer = std::make_shared<std::vector<byte>>(c_nRpcHeaderSize + nSize);
+			oResponse.Encode(pBuffer->data());
+			if (nSize > 0)
+				memcpy(pBuffer->data() + c_nRpcHeaderSize, pData, nSize);
+			pTarget->SendFrameAsync(uint16_t(EFrameType::Response), pBuffer->data(), pBuffer->size(), [pBuffer](EPipeError) {}, 0,
+				nConnectionId);
+		};
+
+		// Spread by the call id, so a slow call holds up no other
+		std::shared_ptr<CPooledBuffer> pRequest = std::make_shared<CPooledBuffer>(std::move(oResult.oPayload));
+		IRequestHandlerPtr pHandler = m_pHandler;
+		const uint32_t nMethod = oHeader.nCode;
+		m_oWorkers.Post(nCallId, [pHandler, pRequest, fnRespond, tpDeadline, bDeadline, nMethod]()
+		{
+			if (bDeadline && TClock::now() >= tpDeadline)
+				return;
+			SByteSpan oArguments = pRequest->GetSpan();
+			oArguments.pData += c_nRpcHeaderSize;
+			oArguments.nSize -= c_nRpcHeaderSize;
+			pHandler->OnRequest(nMethod, oArguments, fnRespond);
+		});
+	}
+
+	ReceiveNext();
+}
@@ -0,0 +1,73 @@
+/*
+Declaration file for the RPC server
+
+Serves the calls of CRpcClient. The requests are read on the loop thread and handled by the
+worker pool, so the calls of one client run in parallel and the responses go back in the order
+they complete. Like CAsyncPipe the server accepts the clients one by one.
+*/
+
+
+//! Include guard
+#pragma once
+
+
+//! Includes
+#include "async_pipe.h"
+#include "worker_pool.h"
+
+
+//! Type declarations
+class CRpcServer;
+typedef std::shared_ptr<CRpcServer> CRpcServerPtr;
+
+
+//! Class CRpcServer
+class CRpcServer : public std::enable_shared_from_this<CRpcServer>
+{
+public: //! Types
+	typedef CNamedPipe::EPipeError EPipeError;
+	// Sends the response, may be called once from any thread (the result is copied)
+	typedef std::function<void(uint32_t nStatus, const void* pData, size_t nSize)> TRespond;
+
+	class IRequestHandler;
+	typedef std::shared_ptr<IRequestHandler> IRequestHandlerPtr;
+
+public: //! Constructors and destructor
+	static CRpcServerPtr Create(CIoLoopPtr pLoop, const std::string& sName);
+	~CRpcServer();
+
+public: //! Interface
+	// Starts serving the clients, the requests are handled on nWorkers threads (the number of cores if zero)
+	bool Start(IRequestHandlerPtr pHandler, size_t nWorkers = 0);
+	// Stops the server, the responses of the calls still running are dropped
+	void Stop();
+	// Returns true if the server is running
+	bool IsRunning() const;
+	// Sets the maximum payload size of the requests and responses (applies to the next Start)
+	void SetMaxMessageSize(uint32_t nMaxSize);
+
+public: //! Type definitions
+	// Request handler interface, called on the worker threads. The arguments are valid during the call only,
+	// the response may be sent later. Requests whose deadline has passed before a worker takes them are skipped
+	class IRequestHandler
+	{
+	public:
+		virtual ~IRequestHandler() = default;
+		virtual void OnRequest(uint32_t nMethod, const SByteSpan& oArguments, TRespond fnRespond) = 0;
+	};
+
+private: //! Implementation
+	CRpcServer(CIoLoopPtr pLoop, const std::string& sName);
+
+	// Loop thread only
+	// Keeps one receive pending while the server is running
+	void ReceiveNext();
+	void OnRequest(CAsyncPipe::SReceiveResult&& oResult);
+
+private: //! Members
+	CIoLoopPtr					m_pLoop;
+	CAsyncPipePtr				m_pPipe;		// Reader end of the connection
+	IRequestHandlerPtr			m_pHandler;
+	CWorkerPool					m_oWorkers;
+	std::atomic<bool>			m_bRunning;
+};
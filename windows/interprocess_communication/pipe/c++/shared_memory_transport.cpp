@@ -0,0 +1,695 @@
+/*
+Implementation file for the shared memory transport
+*/
+
+
+//! Includes
+#include "shared_memory_transport.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <new>
+#ifndef _WIN32
+#include <cerrno>
+#include <climits>
+#include <ctime>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+
+//! Segment constants
+static const uint32_t	c_nSegmentMagic = 0x4D48534C;	// "LSHM"
+static const uint32_t	c_nSegmentVersion = 1;
+static const size_t		c_nCacheLineSize = 64;
+static const uint32_t	c_nLivenessCheckMs = 100;		// Sleepers check the other side at this interval
+
+
+//! Signals the sides sleep on
+enum ESignal
+{
+	SignalForwardData,
+	SignalForwardSpace,
+	SignalBackwardData,
+	SignalBackwardSpace,
+	SignalState,
+	SignalCount
+};
+static_assert(SignalCount == CSharedMemoryTransport::c_nSignalCount, "The events must cover the signals");
+
+
+//! Writer states
+enum EWriterState : uint32_t
+{
+	WriterFree,			// No writer, a new one may attach
+	WriterAttached,		// Writer is connected
+	WriterClosed,		// Writer has left, the reader hasn't disconnected yet
+	WriterDropped		// Reader has disconnected the writer, the writer hasn't closed yet
+};
+
+
+//! Sleeper registration, lives in its own cache line
+struct alignas(c_nCacheLineSize) SSignalWord
+{
+	std::atomic<uint32_t>	nSequence;		// Futex word, bumped on every wake
+	std::atomic<uint32_t>	nWaiting;		// Non-zero while the other side sleeps, the amount it waits for
+};
+
+
+//! Ring positions, the producer and the consumer never share a cache line
+struct CSharedMemoryTransport::SRing
+{
+	alignas(c_nCacheLineSize) std::atomic<uint64_t>	nHead;	// Written by the producer
+	alignas(c_nCacheLineSize) std::atomic<uint64_t>	nTail;	// Written by the consumer
+};
+
+
+//! Segment header, the ring data follows it
+struct CSharedMemoryTransport::SSegment
+{
+	alignas(c_nCacheLineSize) std::atomic<uint32_t>	nMagic;		// Set last, when the segment is ready
+	uint32_t										nVersion;
+	uint64_t										nCapacity;	// Bytes per ring
+
+	alignas(c_nCacheLineSize) std::atomic<uint32_t>	nWriterState;
+	std::atomic<uint32_t>							nReaderClosed;
+	std::atomic<uint32_t>							nWriterPid;
+	std::atomic<uint32_t>							nReaderPid;
+
+	SRing											oForward;	// Writer to reader
+	SRing											oBackward;	// Reader to writer
+	SSignalWord										arrSignals[SignalCount];
+};
+
+
+//! Helpers
+static size_t RoundUpToPowerOfTwo(size_t nValue)
+{
+	size_t nResult = 4096;
+	while (nResult < nValue)
+		nResult <<= 1;
+
+	return nResult;
+}
+
+static uint32_t GetProcessId()
+{
+#ifdef _WIN32
+	return uint32_t(GetCurrentProcessId());
+#else
+	return uint32_t(getpid());
+#endif
+}
+
+static bool IsProcessAlive(uint32_t nPid)
+{
+	if (nPid == 0)
+		return true;
+#ifdef _WIN32
+	HANDLE hProcess = OpenProcess(SYNCHRONIZE, FALSE, DWORD(nPid));
+	if (hProcess == NULL)
+		return (GetLastError() == ERROR_ACCESS_DENIED);
+	bool bAlive = (WaitForSingleObject(hProcess, 0) == WAIT_TIMEOUT);
+	CloseHandle(hProcess);
+	return bAlive;
+#else
+	return (kill(pid_t(nPid), 0) == 0 || errno == EPERM);
+#endif
+}
+
+static std::string GetSegmentName(const std::string& sName)
+{
+#ifdef _WIN32
+	return "Local\\libx-shm-" + sName;
+#else
+	return "/libx-shm-" + sName;
+#endif
+}
+
+
+CSharedMemoryTransport::CSharedMemoryTransport(const std::string& sName, EPipeMode eMode, size_t nCapacity)
+	: m_sName(sName),
+	  m_eMode(eMode),
+	  m_nCapacity(RoundUpToPowerOfTwo(nCapacity)),
+	  m_pSegment(nullptr),
+	  m_nSegmentSize(0),
+	  m_bWriterDropped(false),
+	  m_nPartialWrites(0)
+#ifdef _WIN32
+	  , m_hMapping(NULL)
+#endif
+{
+#ifdef _WIN32
+	for (int i = 0; i < SignalCount; ++i)
+		m_arrEvents[i] = NULL;
+#endif
+}
+
+CSharedMemoryTransport::~CSharedMemoryTransport()
+{
+	if (IsOpen())
+		Close();
+}
+
+EPipeMode CSharedMemoryTransport::GetMode() const
+{
+	return m_eMode;
+}
+
+bool CSharedMemoryTransport::IsOpen() const
+{
+	return (m_pSegment != nullptr);
+}
+
+bool CSharedMemoryTransport::Open()
+{
+	if (IsOpen() || m_sName.empty())
+		return false;
+
+	if (m_eMode == EPipeMode::Read)
+		return CreateSegment();
+
+	if (!AttachSegment())
+		return false;
+
+	// Only one writer at a time, like a single instance pipe
+	uint32_t nExpected = WriterFree;
+	if (m_pSegment->nReaderClosed.load() != 0 || !m_pSegment->nWriterState.compare_exchange_strong(nExpected, WriterAttached))
+	{
+		ReleaseSegment();
+		return false;
+	}
+	m_pSegment->nWriterPid.store(GetProcessId());
+
+	// Drop the replies left for the previous writer
+	m_oInput.pRing->nTail.store(m_oInput.pRing->nHead.load(std::memory_order_acquire), std::memory_order_release);
+	m_oInput.nCachedPosition = m_oInput.pRing->nTail.load(std::memory_order_relaxed);
+	m_oOutput.nCachedPosition = m_oOutput.pRing->nTail.load(std::memory_order_acquire);
+	Notify(SignalState);
+
+	return true;
+}
+
+bool CSharedMemoryTransport::Close()
+{
+	if (!IsOpen())
+		return false;
+
+	if (m_eMode == EPipeMode::Read)
+	{
+		m_pSegment->nReaderClosed.store(1);
+		Notify(SignalForwardSpace);
+		Notify(SignalBackwardData);
+	}
+	else
+	{
+		// Leaves the connection to the reader, attached or dropped
+		m_pSegment->nWriterState.store(WriterClosed);
+		Notify(SignalForwardData);
+		Notify(SignalBackwardSpace);
+		Notify(SignalState);
+	}
+	ReleaseSegment();
+
+	return true;
+}
+
+bool CSharedMemoryTransport::Accept()
+{
+	if (m_eMode != EPipeMode::Read)
+		return true;
+	if (!IsOpen())
+		return false;
+
+	// Wait for the writer to attach (or to leave its data and go)
+	for (;;)
+	{
+		uint32_t nSequence = m_pSegment->arrSignals[SignalState].nSequence.load(std::memory_order_acquire);
+		m_pSegment->arrSignals[SignalState].nWaiting.store(1);
+		uint32_t nState = m_pSegment->nWriterState.load();
+		if (nState == WriterClosed && m_bWriterDropped)
+		{
+			// The dropped writer may have kept writing until it closed, discard that data
+			m_oInput.pRing->nTail.store(m_oInput.pRing->nHead.load(std::memory_order_acquire), std::memory_order_release);
+			m_pSegment->nWriterState.store(WriterFree);
+			m_bWriterDropped = false;
+			continue;
+		}
+		if (nState == WriterAttached || nState == WriterClosed)
+			break;
+		PlatformWait(SignalState, nSequence);
+	}
+	m_pSegment->arrSignals[SignalState].nWaiting.store(0, std::memory_order_relaxed);
+
+	return true;
+}
+
+bool CSharedMemoryTransport::Disconnect()
+{
+	if (m_eMode != EPipeMode::Read)
+		return true;
+	if (!IsOpen())
+		return false;
+
+	// Discard the unread data, the consumer owns the tail so it may skip to the head at any time
+	m_oInput.pRing->nTail.store(m_oInput.pRing->nHead.load(std::memory_order_acquire), std::memory_order_release);
+
+	uint32_t nExpected = WriterAttached;
+	if (m_pSegment->nWriterState.compare_exchange_strong(nExpected, WriterDropped))
+		m_bWriterDropped = true;
+	else if (nExpected == WriterClosed)
+		m_pSegment->nWriterState.store(WriterFree);
+	Notify(SignalForwardSpace);
+	Notify(SignalBackwardData);
+
+	return true;
+}
+
+EIoStatus CSharedMemoryTransport::Send(const SIoBuffer* arrBuffers, size_t nCount)
+{
+	if (!IsOpen())
+		return EIoStatus::Failure;
+	if (!IsPeerAttached())
+		return EIoStatus::Disconnected;
+
+	SRingCursor& oCursor = m_oOutput;
+	SRing* pRing = oCursor.pRing;
+	const uint64_t nMask = m_nCapacity - 1;
+	uint64_t nHead = pRing->nHead.load(std::memory_order_relaxed);
+
+	size_t nTotal = 0;
+	for (size_t i = 0; i < nCount; ++i)
+		nTotal += arrBuffers[i].nSize;
+
+	// A gather that fits the ring is published at once, a larger one is streamed by quarters of the ring
+	const bool bStreaming = (nTotal > m_nCapacity);
+	for (size_t i = 0; i < nCount; ++i)
+	{
+		const byte* pSource = static_cast<const byte*>(arrBuffers[i].pData);
+		size_t nLeft = arrBuffers[i].nSize;
+		while (nLeft > 0)
+		{
+			const size_t nWanted = bStreaming ? (std::min)(nTotal, size_t(m_nCapacity / 4)) : nTotal;
+			if (m_nCapacity - (nHead - oCursor.nCachedPosition) < nWanted)
+			{
+				oCursor.nCachedPosition = pRing->nTail.load(std::memory_order_acquire);
+				if (m_nCapacity - (nHead - oCursor.nCachedPosition) < nWanted)
+				{
+					// Publish what is staged so far, the reader may be waiting for it
+					m_nPartialWrites.fetch_add(1, std::memory_order_relaxed);
+					pRing->nHead.store(nHead, std::memory_order_release);
+					Notify(oCursor.nDataSignal);
+					// Ask to be woken with at least half of the ring free, so the sides don't ping-pong per message
+					const uint32_t nThreshold = uint32_t((std::max)(nWanted, size_t(m_nCapacity / 2)));
+					bool bReady = WaitFor(oCursor.nSpaceSignal, nThreshold, [&]()
+					{
+						oCursor.nCachedPosition = pRing->nTail.load(std::memory_order_acquire);
+						return (m_nCapacity - (nHead - oCursor.nCachedPosition) >= nWanted);
+					});
+					if (!bReady)
+						return EIoStatus::Disconnected;
+				}
+			}
+
+			const size_t nFree = size_t(m_nCapacity - (nHead - oCursor.nCachedPosition));
+			const size_t nOffset = size_t(nHead & nMask);
+			const size_t nPart = (std::min)((std::min)(nLeft, nFree), size_t(m_nCapacity) - nOffset);
+			memcpy(oCursor.pData + nOffset, pSource, nPart);
+			pSource += nPart;
+			nLeft -= nPart;
+			nTotal -= nPart;
+			nHead += nPart;
+		}
+	}
+
+	pRing->nHead.store(nHead, std::memory_order_release);
+	Notify(oCursor.nDataSignal);
+
+	return EIoStatus::Ok;
+}
+
+EIoStatus CSharedMemoryTransport::Receive(void* pData, size_t nSize, size_t& nRead)
+{
+	nRead = 0;
+	if (!IsOpen())
+		return EIoStatus::Failure;
+
+	SRingCursor& oCursor = m_oInput;
+	SRing* pRing = oCursor.pRing;
+	const uint64_t nTail = pRing->nTail.load(std::memory_order_relaxed);
+	if (oCursor.nCachedPosition == nTail)
+	{
+		oCursor.nCachedPosition = pRing->nHead.load(std::memory_order_acquire);
+		if (oCursor.nCachedPosition == nTail)
+		{
+			m_oWaiter.Prepare();
+			bool bReady = WaitFor(oCursor.nDataSignal, 1, [&]()
+			{
+				oCursor.nCachedPosition = pRing->nHead.load(std::memory_order_acquire);
+				return (oCursor.nCachedPosition != nTail);
+			});
+			if (!bReady)
+				return EIoStatus::Disconnected;
+		}
+	}
+
+	const size_t nAvailable = size_t(oCursor.nCachedPosition - nTail);
+	const size_t nOffset = size_t(nTail & (m_nCapacity - 1));
+	const size_t nFirst = (std::min)((std::min)(nSize, nAvailable), size_t(m_nCapacity) - nOffset);
+	memcpy(pData, oCursor.pData + nOffset, nFirst);
+	nRead = nFirst;
+	if (nFirst < nSize && nFirst < nAvailable)
+	{
+		const size_t nSecond = (std::min)(nSize - nFirst, nAvailable - nFirst);
+		memcpy(static_cast<byte*>(pData) + nFirst, oCursor.pData, nSecond);
+		nRead += nSecond;
+	}
+
+	pRing->nTail.store(nTail + nRead, std::memory_order_release);
+	Notify(oCursor.nSpaceSignal, m_nCapacity - (oCursor.nCachedPosition - (nTail + nRead)));
+
+	return EIoStatus::Ok;
+}
+
+EIoStatus CSharedMemoryTransport::TryReceive(void* pData, size_t nSize, size_t& nRead)
+{
+	nRead = 0;
+	if (!IsOpen())
+		return EIoStatus::Failure;
+
+	SRingCursor& oCursor = m_oInput;
+	const uint64_t nTail = oCursor.pRing->nTail.load(std::memory_order_relaxed);
+	if (oCursor.nCachedPosition == nTail)
+	{
+		oCursor.nCachedPosition = oCursor.pRing->nHead.load(std::memory_order_acquire);
+		if (oCursor.nCachedPosition == nTail)
+			return IsPeerAttached() ? EIoStatus::Ok : EIoStatus::Disconnected;
+	}
+
+	return Receive(pData, nSize, nRead);
+}
+
+bool CSharedMemoryTransport::IsDuplex() const
+{
+	return true;
+}
+
+void CSharedMemoryTransport::SetWaitStrategy(const SWaitStrategy& oStrategy)
+{
+	m_oWaiter.SetStrategy(oStrategy);
+}
+
+uint64_t CSharedMemoryTransport::GetPartialWriteCount() const
+{
+	return m_nPartialWrites.load(std::memory_order_relaxed);
+}
+
+bool CSharedMemoryTransport::CreateSegment()
+{
+	m_nSegmentSize = GetDataOffset() + 2 * m_nCapacity;
+	const std::string sSegment = GetSegmentName(m_sName);
+
+#ifdef _WIN32
+	m_hMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, DWORD(uint64_t(m_nSegmentSize) >> 32), DWORD(m_nSegmentSize), sSegment.c_str());
+	if (m_hMapping == NULL)
+		return false;
+	void* pAddress = MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, m_nSegmentSize);
+	if (pAddress == NULL)
+	{
+		CloseHandle(m_hMapping);
+		m_hMapping = NULL;
+		return false;
+	}
+#else
+	// Replace the segment left by the previous reader
+	shm_unlink(sSegment.c_str());
+	// Owner only: whoever maps the segment can read the data and corrupt the positions
+	int nDescriptor = shm_open(sSegment.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (nDescriptor < 0)
+		return false;
+	void* pAddress = MAP_FAILED;
+	if (ftruncate(nDescriptor, off_t(m_nSegmentSize)) == 0)
+		pAddress = mmap(nullptr, m_nSegmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, nDescriptor, 0);
+	close(nDescriptor);
+	if (pAddress == MAP_FAILED)
+	{
+		shm_unlink(sSegment.c_str());
+		return false;
+	}
+#endif
+
+	m_pSegment = new (pAddress) SSegment();
+	m_pSegment->nVersion = c_nSegmentVersion;
+	m_pSegment->nCapacity = m_nCapacity;
+	m_pSegment->nWriterState.store(WriterFree);
+	m_pSegment->nReaderClosed.store(0);
+	m_pSegment->nWriterPid.store(0);
+	m_pSegment->nReaderPid.store(GetProcessId());
+	for (SRing* pRing : { &m_pSegment->oForward, &m_pSegment->oBackward })
+	{
+		pRing->nHead.store(0);
+		pRing->nTail.store(0);
+	}
+	for (int i = 0; i < SignalCount; ++i)
+	{
+		m_pSegment->arrSignals[i].nSequence.store(0);
+		m_pSegment->arrSignals[i].nWaiting.store(0);
+	}
+
+#ifdef _WIN32
+	for (int i = 0; i < SignalCount; ++i)
+		m_arrEvents[i] = CreateEventA(NULL, FALSE, FALSE, (sSegment + "-" + std::to_string(i)).c_str());
+#endif
+
+	SetupCursors();
+	m_pSegment->nMagic.store(c_nSegmentMagic, std::memory_order_release);
+
+	return true;
+}
+
+bool CSharedMemoryTransport::AttachSegment()
+{
+	const std::string sSegment = GetSegmentName(m_sName);
+
+#ifdef _WIN32
+	m_hMapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, sSegment.c_str());
+	if (m_hMapping == NULL)
+		return false;
+	// Map the header first to learn the capacity chosen by the reader
+	SSegment* pHeader = static_cast<SSegment*>(MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(SSegment)));
+	if (pHeader == NULL || pHeader->nMagic.load(std::memory_order_acquire) != c_nSegmentMagic || pHeader->nVersion != c_nSegmentVersion)
+	{
+		if (pHeader != NULL)
+			UnmapViewOfFile(pHeader);
+		CloseHandle(m_hMapping);
+		m_hMapping = NULL;
+		return false;
+	}
+	m_nCapacity = size_t(pHeader->nCapacity);
+	UnmapViewOfFile(pHeader);
+
+	m_nSegmentSize = GetDataOffset() + 2 * m_nCapacity;
+	void* pAddress = MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, m_nSegmentSize);
+	if (pAddress == NULL)
+	{
+		CloseHandle(m_hMapping);
+		m_hMapping = NULL;
+		return false;
+	}
+	for (int i = 0; i < SignalCount; ++i)
+		m_arrEvents[i] = CreateEventA(NULL, FALSE, FALSE, (sSegment + "-" + std::to_string(i)).c_str());
+#else
+	int nDescriptor = shm_open(sSegment.c_str(), O_RDWR | O_CLOEXEC, 0);
+	if (nDescriptor < 0)
+		return false;
+	struct stat oStat;
+	void* pAddress = MAP_FAILED;
+	if (fstat(nDescriptor, &oStat) == 0 && size_t(oStat.st_size) > sizeof(SSegment))
+	{
+		m_nSegmentSize = size_t(oStat.st_size);
+		pAddress = mmap(nullptr, m_nSegmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, nDescriptor, 0);
+	}
+	close(nDescriptor);
+	if (pAddress == MAP_FAILED)
+		return false;
+
+	SSegment* pHeader = static_cast<SSegment*>(pAddress);
+	if (pHeader->nMagic.load(std::memory_order_acquire) != c_nSegmentMagic || pHeader->nVersion != c_nSegmentVersion ||
+		m_nSegmentSize != GetDataOffset() + 2 * size_t(pHeader->nCapacity))
+	{
+		munmap(pAddress, m_nSegmentSize);
+		return false;
+	}
+	m_nCapacity = size_t(pHeader->nCapacity);
+#endif
+
+	m_pSegment = static_cast<SSegment*>(pAddress);
+	SetupCursors();
+
+	return true;
+}
+
+void CSharedMemoryTransport::ReleaseSegment()
+{
+	if (m_pSegment == nullptr)
+		return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(m_pSegment);
+	CloseHandle(m_hMapping);
+	m_hMapping = NULL;
+	for (int i = 0; i < SignalCount; ++i)
+	{
+		if (m_arrEvents[i] != NULL)
+			CloseHandle(m_arrEvents[i]);
+		m_arrEvents[i] = NULL;
+	}
+#else
+	munmap(m_pSegment, m_nSegmentSize);
+	if (m_eMode == EPipeMode::Read)
+		shm_unlink(GetSegmentName(m_sName).c_str());
+#endif
+
+	m_pSegment = nullptr;
+	m_oOutput = SRingCursor();
+	m_oInput = SRingCursor();
+}
+
+void CSharedMemoryTransport::SetupCursors()
+{
+	byte* pBase = reinterpret_cast<byte*>(m_pSegment);
+	byte* pForwardData = pBase + GetDataOffset();
+	byte* pBackwardData = pForwardData + m_nCapacity;
+
+	SRingCursor oForward;
+	oForward.pRing = &m_pSegment->oForward;
+	oForward.pData = pForwardData;
+	oForward.nDataSignal = SignalForwardData;
+	oForward.nSpaceSignal = SignalForwardSpace;
+
+	SRingCursor oBackward;
+	oBackward.pRing = &m_pSegment->oBackward;
+	oBackward.pData = pBackwardData;
+	oBackward.nDataSignal = SignalBackwardData;
+	oBackward.nSpaceSignal = SignalBackwardSpace;
+
+	m_oOutput = (m_eMode == EPipeMode::Write) ? oForward : oBackward;
+	m_oInput = (m_eMode == EPipeMode::Write) ? oBackward : oForward;
+	m_oOutput.nCachedPosition = m_oOutput.pRing->nTail.load(std::memory_order_acquire);
+	m_oInput.nCachedPosition = m_oInput.pRing->nHead.load(std::memory_order_acquire);
+}
+
+size_t CSharedMemoryTransport::GetDataOffset()
+{
+	// Ring data starts at the page boundary after the header
+	return (sizeof(SSegment) + 4095) & ~size_t(4095);
+}
+
+template <class TReady>
+bool CSharedMemoryTransport::WaitFor(int nSignal, uint32_t nAmount, TReady fnReady)
+{
+	SSignalWord& oSignal = m_pSegment->arrSignals[nSignal];
+	for (;;)
+	{
+		// Polling doesn't register as sleeper, so the other side makes no wake call
+		if (fnReady() || m_oWaiter.Spin(fnReady, c_nLivenessCheckMs * 1000))
+			return true;
+		if (m_oWaiter.IsBusyPoll())
+		{
+			if (!IsPeerConnected())
+				return fnReady();
+			continue;
+		}
+
+		// Register as sleeper, then check again: either we see the progress or the other side sees us
+		uint32_t nSequence = oSignal.nSequence.load(std::memory_order_acquire);
+		oSignal.nWaiting.store(nAmount);
+		if (fnReady())
+			break;
+		if (!IsPeerConnected())
+		{
+			oSignal.nWaiting.store(0, std::memory_order_relaxed);
+			return fnReady();
+		}
+		PlatformWait(nSignal, nSequence);
+		oSignal.nWaiting.store(0, std::memory_order_relaxed);
+	}
+	oSignal.nWaiting.store(0, std::memory_order_relaxed);
+
+	return true;
+}
+
+void CSharedMemoryTransport::Notify(int nSignal, uint64_t nAvailable)
+{
+	// Pairs with the sleeper registration, the fast path is one fence and one load
+	SSignalWord& oSignal = m_pSegment->arrSignals[nSignal];
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	const uint32_t nWaiting = oSignal.nWaiting.load(std::memory_order_relaxed);
+	if (nWaiting == 0 || nAvailable < nWaiting)
+		return;
+
+	oSignal.nSequence.fetch_add(1, std::memory_order_release);
+	PlatformWake(nSignal);
+}
+
+bool CSharedMemoryTransport::IsPeerAttached() const
+{
+	if (m_eMode == EPipeMode::Read)
+		return (m_pSegment->nWriterState.load(std::memory_order_relaxed) == WriterAttached);
+
+	return (m_pSegment->nReaderClosed.load(std::memory_order_relaxed) == 0 && m_pSegment->nWriterState.load(std::memory_order_relaxed) == WriterAttached);
+}
+
+bool CSharedMemoryTransport::IsPeerConnected() const
+{
+	if (!IsPeerAttached())
+		return false;
+
+	if (m_eMode == EPipeMode::Read)
+	{
+		if (!IsProcessAlive(m_pSegment->nWriterPid.load()))
+		{
+			// The writer has died without closing
+			uint32_t nExpected = WriterAttached;
+			m_pSegment->nWriterState.compare_exchange_strong(nExpected, WriterClosed);
+			return false;
+		}
+		return true;
+	}
+
+	return IsProcessAlive(m_pSegment->nReaderPid.load());
+}
+
+void CSharedMemoryTransport::PlatformWait(int nSignal, uint32_t nSequence)
+{
+#ifdef _WIN32
+	(void)nSequence;
+	WaitForSingleObject(m_arrEvents[nSignal], c_nLivenessCheckMs);
+#elif defined(__linux__)
+	timespec oTimeout = { 0, long(c_nLivenessCheckMs) * 1000000 };
+	syscall(SYS_futex, &m_pSegment->arrSignals[nSignal].nSequence, FUTEX_WAIT, nSequence, &oTimeout, nullptr, 0);
+#else
+	(void)nSignal;
+	(void)nSequence;
+	timespec oDelay = { 0, 50 * 1000 };
+	nanosleep(&oDelay, nullptr);
+#endif
+}
+
+void CSharedMemoryTransport::PlatformWake(int nSignal)
+{
+#ifdef _WIN32
+	SetEvent(m_arrEvents[nSignal]);
+#elif defined(__linux__)
+	syscall(SYS_futex, &m_pSegment->arrSignals[nSignal].nSequence, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#else
+	(void)nSignal;
+#endif
+}
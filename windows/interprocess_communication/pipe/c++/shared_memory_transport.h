@@ -0,0 +1,99 @@
+/*
+Declaration file for the shared memory transport
+
+The reader creates a named segment with two single-producer/single-consumer byte rings,
+one per direction. The sides sleep only when their ring is empty or full and wake each
+other through futexes (Linux) or named events (Win32).
+*/
+
+
+//! Include guard
+#pragma once
+
+
+//! Includes
+#include "pipe_transport.h"
+#include "spin_waiter.h"
+#include <atomic>
+
+
+//! Class CSharedMemoryTransport
+class CSharedMemoryTransport : public ITransport
+{
+public: //! Constants
+	static const size_t c_nDefaultCapacity = 1024 * 1024;	// Bytes per ring
+	static const int	c_nSignalCount = 5;					// Data and space of both rings, state of the sides
+
+public: //! Constructors and destructor
+	// The capacity is rounded up to the power of two, the writer takes it from the segment
+	CSharedMemoryTransport(const std::string& sName, EPipeMode eMode, size_t nCapacity = c_nDefaultCapacity);
+	~CSharedMemoryTransport();
+
+public: //! Interface (overrides base interface)
+	EPipeMode GetMode() const override;
+	bool IsOpen() const override;
+	bool Open() override;
+	bool Close() override;
+
+	bool Accept() override;
+	bool Disconnect() override;
+
+	EIoStatus Send(const SIoBuffer* arrBuffers, size_t nCount) override;
+	EIoStatus Receive(void* pData, size_t nSize, size_t& nRead) override;
+	EIoStatus TryReceive(void* pData, size_t nSize, size_t& nRead) override;
+	bool IsDuplex() const override;
+	// Polling waits read the ring positions and don't make the writer wake the reader
+	void SetWaitStrategy(const SWaitStrategy& oStrategy) override;
+	// Counts the writes that had to wait for the reader to free the ring
+	uint64_t GetPartialWriteCount() const override;
+
+private: //! Types
+	struct SSegment;
+	struct SRing;
+
+	// One side of the ring
+	struct SRingCursor
+	{
+		SRing*		pRing = nullptr;
+		byte*		pData = nullptr;
+		uint64_t	nCachedPosition = 0;	// Last seen position of the other side
+		int			nDataSignal = 0;		// Signal raised when the ring gets data
+		int			nSpaceSignal = 0;		// Signal raised when the ring gets space
+	};
+
+private: //! Implementation
+	bool CreateSegment();
+	bool AttachSegment();
+	void ReleaseSegment();
+	void SetupCursors();
+	static size_t GetDataOffset();
+
+	// Blocks until fnReady returns true, returns false if the other side is gone
+	template <class TReady>
+	bool WaitFor(int nSignal, uint32_t nAmount, TReady fnReady);
+	// Wakes the other side if it sleeps on the signal and the available amount is enough for it
+	void Notify(int nSignal, uint64_t nAvailable = UINT64_MAX);
+	// Returns true if the other side hasn't closed or been disconnected
+	bool IsPeerAttached() const;
+	// Same as above, also detects the other side died without closing
+	bool IsPeerConnected() const;
+
+	void PlatformWait(int nSignal, uint32_t nSequence);
+	void PlatformWake(int nSignal);
+
+private: //! Members
+	std::string		m_sName;
+	EPipeMode		m_eMode;
+	size_t			m_nCapacity;
+	SSegment*		m_pSegment;		// Mapped segment
+	size_t			m_nSegmentSize;
+	SRingCursor		m_oOutput;		// Ring this side produces
+	SRingCursor		m_oInput;		// Ring this side consumes
+	bool			m_bWriterDropped;	// Reader has disconnected the writer that hasn't closed yet
+	CSpinWaiter		m_oWaiter;		// Polling before the sleep
+	std::atomic<uint64_t>	m_nPartialWrites;
+#ifdef _WIN32
+	HANDLE			m_hMapping;
+	HANDLE			m_arrEvents[c_nSignalCount];
+#endif
+};
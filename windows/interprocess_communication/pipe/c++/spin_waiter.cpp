@@ -0,0 +1,87 @@
+/*
+Implementation file for the spin waiter
+*/
+
+
+//! Includes
+#include "spin_waiter.h"
+#ifdef _WIN32
+#include <intrin.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+CSpinWaiter::CSpinWaiter()
+	: m_eMode(EWaitMode::Block),
+	  m_nSpinUs(SWaitStrategy().nSpinUs),
+	  m_nCpu(-1),
+	  m_nPinnedCpu(-1)
+{
+}
+
+void CSpinWaiter::SetStrategy(const SWaitStrategy& oStrategy)
+{
+	m_nSpinUs = oStrategy.nSpinUs;
+	m_nCpu = oStrategy.nCpu;
+	m_eMode = oStrategy.eMode;
+}
+
+SWaitStrategy CSpinWaiter::GetStrategy() const
+{
+	SWaitStrategy oStrategy;
+	oStrategy.eMode = m_eMode;
+	oStrategy.nSpinUs = m_nSpinUs;
+	oStrategy.nCpu = m_nCpu;
+	return oStrategy;
+}
+
+bool CSpinWaiter::IsBusyPoll() const
+{
+	return (m_eMode.load(std::memory_order_relaxed) == EWaitMode::BusyPoll);
+}
+
+void CSpinWaiter::Prepare()
+{
+	// The thread keeps its affinity after the strategy drops the CPU
+	const int nCpu = m_nCpu.load(std::memory_order_relaxed);
+	if (nCpu < 0 || (nCpu == m_nPinnedCpu && std::this_thread::get_id() == m_idPinned))
+		return;
+
+	PinCurrentThread(nCpu);
+	m_idPinned = std::this_thread::get_id();
+	m_nPinnedCpu = nCpu;
+}
+
+void CSpinWaiter::Relax()
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	_mm_pause();
+#elif defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+bool CSpinWaiter::PinCurrentThread(int nCpu)
+{
+	if (nCpu < 0)
+		return false;
+
+#ifdef _WIN32
+	if (nCpu >= int(sizeof(DWORD_PTR) * 8))
+		return false;
+	return (SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << nCpu) != 0);
+#elif defined(__linux__)
+	if (nCpu >= CPU_SETSIZE)
+		return false;
+	cpu_set_t oSet;
+	CPU_ZERO(&oSet);
+	CPU_SET(nCpu, &oSet);
+	return (pthread_setaffinity_np(pthread_self(), sizeof(oSet), &oSet) == 0);
+#else
+	return false;
+#endif
+}
@@ -0,0 +1,81 @@
+/*
+Declaration file for the spin waiter
+
+Polling part of SWaitStrategy shared by the transports: the receiving thread checks the
+readiness in a loop with the CPU pause hint between the checks and reads the clock only once
+per batch of them. The transport sleeps in the system afterwards unless the mode is BusyPoll.
+*/
+
+
+//! Include guard
+#pragma once
+
+
+//! Includes
+#include "pipe_transport.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+
+//! Class CSpinWaiter
+class CSpinWaiter
+{
+public: //! Constants
+	static const uint32_t c_nChecksPerClock = 64;		// Readiness checks between the clock reads
+
+public: //! Constructors and destructor
+	CSpinWaiter();
+
+public: //! Interface
+	// May be called while the other thread receives, it sees the change on its next wait
+	void SetStrategy(const SWaitStrategy& oStrategy);
+	SWaitStrategy GetStrategy() const;
+	// Returns true if the waits don't sleep in the system
+	bool IsBusyPoll() const;
+
+	// Called by the receiving thread before it waits: pins it to the CPU of the strategy once
+	void Prepare();
+	// Polls fnReady for the spin time (for nSliceUs in the busy poll mode), returns true once it's ready.
+	// Returns false at once in the blocking mode
+	template <class TReady>
+	bool Spin(TReady fnReady, uint32_t nSliceUs);
+
+public: //! Static helpers
+	// Tells the CPU the thread spins (pause on x86, yield on ARM)
+	static void Relax();
+	// Pins the calling thread to the CPU, returns false if the system refuses
+	static bool PinCurrentThread(int nCpu);
+
+private: //! Members
+	std::atomic<EWaitMode>	m_eMode;
+	std::atomic<uint32_t>	m_nSpinUs;
+	std::atomic<int>		m_nCpu;
+	// Receiving thread only
+	std::thread::id			m_idPinned;		// Thread pinned last
+	int						m_nPinnedCpu;
+};
+
+
+//! Template implementation
+template <class TReady>
+bool CSpinWaiter::Spin(TReady fnReady, uint32_t nSliceUs)
+{
+	const EWaitMode eMode = m_eMode.load(std::memory_order_relaxed);
+	if (eMode == EWaitMode::Block)
+		return false;
+
+	const uint32_t nSpinUs = (eMode == EWaitMode::BusyPoll) ? nSliceUs : m_nSpinUs.load(std::memory_order_relaxed);
+	const std::chrono::steady_clock::time_point tpDeadline = std::chrono::steady_clock::now() + std::chrono::microseconds(nSpinUs);
+	for (;;)
+	{
+		for (uint32_t i = 0; i < c_nChecksPerClock; ++i)
+		{
+			if (fnReady())
+				return true;
+			Relax();
+		}
+		if (std::chrono::steady_clock::now() >= tpDeadline)
+			return fnReady();
+	}
+}
@@ -0,0 +1,606 @@
+/*
+Implementation file for the spool
+*/
+
+
+//! Includes
+#include "spool.h"
+#include "crc32c.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <utility>
+#include <vector>
+#ifndef _WIN32
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+//! Spool constants
+static const uint32_t	c_nSpoolMagic = 0x4C50534C;		// "LSPL"
+static const uint32_t	c_nSpoolVersion = 2;				// 2: the records carry the checksum
+static const size_t		c_nHeaderSize = 64;				// Records start after the header
+static const size_t		c_nRecordAlignment = 8;
+static const size_t		c_nRecordLengthSize = 4;
+static const size_t		c_nRecordChecksumSize = 4;
+static const size_t		c_nRecordHeaderSize = c_nRecordLengthSize + c_nRecordChecksumSize;
+static const size_t		c_nPageSize = 4096;
+static const int		c_nCountShift = 40;				// Position: record count above, byte offset below
+static const uint64_t	c_nOffsetMask = (uint64_t(1) << c_nCountShift) - 1;
+static const uint64_t	c_nMaxRecords = (uint64_t(1) << (64 - c_nCountShift)) - 1;	// Per segment
+static const char		c_szSegmentExtension[] = ".spool";
+static const char		c_szTemporaryExtension[] = ".tmp";
+static const size_t		c_nSequenceDigits = 20;
+
+
+//! Segment header, the positions are stored as one aligned word so they are never torn
+struct CSpool::SHeader
+{
+	uint32_t				nMagic;
+	uint32_t				nVersion;
+	uint64_t				nSpoolId;
+	uint64_t				nFirstSequence;
+	std::atomic<uint64_t>	nCommit;		// Appended records, stored after the record bytes
+	std::atomic<uint64_t>	nAcknowledged;	// Acknowledged records (first segment only)
+};
+
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "The positions must be plain words in the file");
+
+
+//! Helpers
+static uint64_t MakePosition(uint64_t nCount, uint64_t nOffset)
+{
+	return (nCount << c_nCountShift) | nOffset;
+}
+
+static uint64_t GetPositionCount(uint64_t nPosition)
+{
+	return (nPosition >> c_nCountShift);
+}
+
+static uint64_t GetPositionOffset(uint64_t nPosition)
+{
+	return (nPosition & c_nOffsetMask);
+}
+
+static size_t AlignUp(size_t nValue, size_t nAlignment)
+{
+	return (nValue + nAlignment - 1) / nAlignment * nAlignment;
+}
+
+static size_t GetRecordSize(size_t nPayloadSize)
+{
+	return AlignUp(c_nRecordHeaderSize + nPayloadSize, c_nRecordAlignment);
+}
+
+// Returns the checksum of the record length and payload
+static uint32_t GetRecordChecksum(uint32_t nLength, const void* pPayload)
+{
+	return Crc32c(Crc32c(0, &nLength, c_nRecordLengthSize), pPayload, nLength);
+}
+
+static bool EndsWith(const std::string& sValue, const char* szSuffix)
+{
+	const size_t nLength = strlen(szSuffix);
+	return (sValue.size() >= nLength && sValue.compare(sValue.size() - nLength, nLength, szSuffix) == 0);
+}
+
+// Returns true if the file name is <sequence>.spool
+static bool ParseSegmentName(const std::string& sName, uint64_t& nSequence)
+{
+	if (sName.size() != c_nSequenceDigits + strlen(c_szSegmentExtension) || !EndsWith(sName, c_szSegmentExtension))
+		return false;
+	for (size_t i = 0; i < c_nSequenceDigits; ++i)
+	{
+		if (sName[i] < '0' || sName[i] > '9')
+			return false;
+	}
+
+	nSequence = strtoull(sName.c_str(), nullptr, 10);
+	return true;
+}
+
+static uint64_t MakeSpoolId()
+{
+	std::random_device oDevice;
+	const uint64_t nRandom = (uint64_t(oDevice()) << 32) | oDevice();
+	return nRandom ^ uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+}
+
+
+CSpool::CSpool(const std::string& sDirectory, size_t nSegmentSize)
+	: m_sDirectory(sDirectory),
+	  m_nSegmentSize(AlignUp((std::max)(nSegmentSize, c_nPageSize), c_nPageSize)),
+	  m_nId(0),
+	  m_bOpen(false)
+{
+}
+
+CSpool::~CSpool()
+{
+	Close();
+}
+
+bool CSpool::IsOpen() const
+{
+	std::lock_guard<std::mutex> oLock(m_mtxSpool);
+	return m_bOpen;
+}
+
+bool CSpool::Open()
+{
+	std::lock_guard<std::mutex> oLock(m_mtxSpool);
+	if (m_bOpen || m_sDirectory.empty())
+		return false;
+
+	// Collect the segments left by the previous run, the unfinished new ones are dropped
+	std::vector<std::pair<uint64_t, std::string>> vecFiles;
+#ifdef _WIN32
+	if (!CreateDirectoryA(m_sDirectory.c_str(), NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+		return false;
+
+	WIN32_FIND_DATAA oData;
+	HANDLE hFind = FindFirstFileA((m_sDirectory + "\\*").c_str(), &oData);
+	if (hFind != INVALID_HANDLE_VALUE)
+	{
+		do
+		{
+			const std::string sName = oData.cFileName;
+			uint64_t nSequence = 0;
+			if (ParseSegmentName(sName, nSequence))
+				vecFiles.emplace_back(nSequence, m_sDirectory + "\\" + sName);
+			else if (EndsWith(sName, c_szTemporaryExtension))
+				DeleteFileA((m_sDirectory + "\\" + sName).c_str());
+		}
+		while (FindNextFileA(hFind, &oData));
+		FindClose(hFind);
+	}
+#else
+	if (mkdir(m_sDirectory.c_str(), 0700) != 0 && errno != EEXIST)
+		return false;
+
+	DIR* pDir = opendir(m_sDirectory.c_str());
+	if (pDir == nullptr)
+		return false;
+	while (dirent* pEntry = readdir(pDir))
+	{
+		const std::string sName = pEntry->d_name;
+		uint64_t nSequence = 0;
+		if (ParseSegmentName(sName, nSequence))
+			vecFiles.emplace_back(nSequence, m_sDirectory + "/" + sName);
+		else if (EndsWith(sName, c_szTemporaryExtension))
+			unlink((m_sDirectory + "/" + sName).c_str());
+	}
+	closedir(pDir);
+#endif
+	std::sort(vecFiles.begin(), vecFiles.end());
+
+	// The headers chain the segments, the records not acknowledged are checked after them
+	bool bOk = true;
+	for (const auto& prFile : vecFiles)
+	{
+		SSegmentPtr pSegment = MapSegment(prFile.second);
+		if (pSegment == nullptr || pSegment->nFirstSequence != prFile.first ||
+			(!m_deqSegments.empty() && (pSegment->pHeader->nSpoolId != m_nId || pSegment->nFirstSequence != GetEndSequence(*m_deqSegments.back()))))
+		{
+			if (pSegment != nullptr)
+				UnmapSegment(*pSegment);
+			bOk = false;
+			break;
+		}
+		m_nId = pSegment->pHeader->nSpoolId;
+		m_deqSegments.push_back(std::move(pSegment));
+	}
+	if (bOk && m_deqSegments.empty())
+	{
+		m_nId = MakeSpoolId();
+		bOk = AddSegment(0, 0);
+	}
+	else if (bOk)
+		TruncateBroken();
+	if (!bOk)
+	{
+		for (SSegmentPtr& pSegment : m_deqSegments)
+			UnmapSegment(*pSegment);
+		m_deqSegments.clear();
+		return false;
+	}
+
+	const SSegment& oFirst = *m_deqSegments.front();
+	const uint64_t nAcknowledged = oFirst.pHeader->nAcknowledged.load(std::memory_order_acquire);
+	m_oAcknowledged.nSegment = 0;
+	m_oAcknowledged.nOffset = GetPositionOffset(nAcknowledged);
+	m_oAcknowledged.nSequence = oFirst.nFirstSequence + GetPositionCount(nAcknowledged);
+	m_oRead = m_oAcknowledged;
+	m_bOpen = true;
+
+	return true;
+}
+
+void CSpool::Close()
+{
+	std::lock_guard<std::mutex> oLock(m_mtxSpool);
+	for (SSegmentPtr& pSegment : m_deqSegments)
+		UnmapSegment(*pSegment);
+	m_deqSegments.clear();
+	m_oAcknowledged = SCursor();
+	m_oRead = SCursor();
+	m_bOpen = false;
+}
+
+bool CSpool::Append(const void* pData, size_t nSize, uint64_t* pSequence)
+{
+	if (nSize > UINT32_MAX)
+		return false;
+
+	std::lock_guard<std::mutex> oLock(m_mtxSpool);
+	if (!m_bOpen)
+		return false;
+
+	const size_t nRecordSize = GetRecordSize(nSize);
+	SSegment* pSegment = m_deqSegments.back().get();
+	uint64_t nCommit = pSegment->pHeader->nCommit.load(std::memory_order_relaxed);
+	if (GetPositionOffset(nCommit) + nRecordSize > pSegment->nSize || GetPositionCount(nCommit) == c_nMaxRecords)
+	{
+		if (!AddSegment(GetEndSequence(*pSegment), nRecordSize))
+			return false;
+		pSegment = m_deqSegments.back().get();
+		nCommit = pSegment->pHeader->nCommit.load(std::memory_order_relaxed);
+	}
+
+	// The commit goes after the record, so a process crash in between leaves the record out. A power loss
+	// may store the commit alone, the checksum tells the recovery
+	const uint64_t nOffset = GetPositionOffset(nCommit);
+	const uint32_t nLength = uint32_t(nSize);
+	const uint32_t nChecksum = GetRecordChecksum(nLength, pData);
+	memcpy(pSegment->pBase + nOffset, &nLength, c_nRecordLengthSize);
+	memcpy(pSegment->pBase + nOffset + c_nRecordLengthSize, &nChecksum, c_nRecordChecksumSize);
+	if (nSize > 0)
+		memcpy(pSegment->pBase + nOffset + c_nRecordHeaderSize, pData, nSize);
+	pSegment->pHeader->nCommit.store(MakePosition(GetPositionCount(nCommit) + 1, nOffset + nRecordSize), std::memory_order_release);
+
+	if (pSequence != nullptr)
+		*pSequence = pSegment->nFirstSequence + GetPositionCount(nCommit);
+	return true;
+}
+
+bool CSpool::ReadNext(uint64_t& nSequence, SByteSpan& oRecord)
+{
+	std::lock_guard<std::mutex> oLock(m_mtxSpool);
+	if (!m_bOpen || !NextRecord(m_oRead))
+		return false;
+
+	const byte* pRecord = m_deqSegments[m_oRead.nSegment]->pBase + m_oRead.nOffset;
+	uint32_t nLength = 0;
+	memcpy(&nLength, pRecord, c_nRecordLengthSize);
+	oRecord.pData = pRecord + c_nRecordHeaderSize;
+	oRecord.nSize = nLength;
+	nSequence = m_oRead.nSequence;
+
+	m_oRead.nOffset += GetRecordSize(nLength);
+	++m_oRead.nSequence;
+	return true;
+}
+
+void CSpool::Rewind()
+{
+	std::lock_guard<std::mutex> oLock(m_mtxSpool);
+	m_oRead = m_oAcknowledged;
+}
+
+bool CSpool::Acknowledge(uint64_t nSequence)
+{
+	std::lock_guard<std::mutex> oLock(m_mtxSpool);
+	if (!m_bOpen)
+		return false;
+
+	// Only the read records may be acknowledged
+	const uint64_t nTarget = (std::min)(nSequence + 1, m_oRead.nSequence);
+	if (nTarget <= m_oAcknowledged.nSequence)
+		return true;
+
+	while (m_oAcknowledged.nSequence < nTarget && NextRecord(m_oAcknowledged))
+	{
+		const byte* pRecord = m_deqSegments[m_oAcknowledged.nSegment]->pBase + m_oAcknowledged.nOffset;
+		uint32_t nLength = 0;
+		memcpy(&nLength, pRecord, c_nRecordLengthSize);
+		m_oAcknowledged.nOffset += GetRecordSize(nLength);
+		++m_oAcknowledged.nSequence;
+	}
+
+	// The segments left behind are deleted, the cursors of the rest shift down
+	NextRecord(m_oAcknowledged);
+	while (m_oAcknowledged.nSegment > 0)
+	{
+		DeleteSegment(*m_deqSegments.front());
+		m_deqSegments.pop_front();
+		--m_oAcknowledged.nSegment;
+		if (m_oRead.nSegment > 0)
+			--m_oRead.nSegment;
+		else
+			m_oRead = m_oAcknowledged;
+	}
+
+	const SSegment& oFirst = *m_deqSegments.front();
+	oFirst.pHeader->nAcknowledged.store(MakePosition(m_oAcknowledged.nSequence - oFirst.nFirstSequence, m_oAcknowledged.nOffset),
+		std::memory_order_release);
+	return true;
+}
+
+bool CSpool::Sync()
+{
+	std::lock_guard<std::mutex> oLock(m_mtxSpool);
+	if (!m_bOpen)
+		return false;
+
+	bool bOk = true;
+	for (const SSegmentPtr& pSegment : m_deqSegments)
+	{
+#ifdef _WIN32
+		bOk = FlushViewOfFile(pSegment->pBase, 0) && FlushFileBuffers(pSegment->hFile) && bOk;
+#else
+		bOk = (msync(pSegment->pBase, pSegment->nSize, MS_SYNC) == 0) && bOk;
+#endif
+	}
+
+	return bOk;
+}
+
+uint64_t CSpool::GetId() const
+{
+	std::lock_guard<std::mutex> oLock(m_mtxSpool);
+	return m_nId;
+}
+
+uint64_t CSpool::GetAcknowledgedSequence() const
+{
+	std::lock_guard<std::mutex> oLock(m_mtxSpool);
+	return m_oAcknowledged.nSequence;
+}
+
+uint64_t CSpool::GetNextSequence() const
+{
+	std::lock_guard<std::mutex> oLock(m_mtxSpool);
+	return m_deqSegments.empty() ? 0 : GetEndSequence(*m_deqSegments.back());
+}
+
+uint64_t CSpool::GetPendingCount() const
+{
+	std::lock_guard<std::mutex> oLock(m_mtxSpool);
+	return m_deqSegments.empty() ? 0 : GetEndSequence(*m_deqSegments.back()) - m_oAcknowledged.nSequence;
+}
+
+bool CSpool::HasUnread() const
+{
+	std::lock_guard<std::mutex> oLock(m_mtxSpool);
+	SCursor oCursor = m_oRead;
+	return m_bOpen && NextRecord(oCursor);
+}
+
+bool CSpool::AddSegment(uint64_t nFirstSequence, size_t nMinSize)
+{
+	const size_t nSize = (std::max)(m_nSegmentSize, AlignUp(c_nHeaderSize + nMinSize, c_nPageSize));
+	const std::string sTemporary = GetSegmentPath(nFirstSequence, true);
+	const std::string sPath = GetSegmentPath(nFirstSequence, false);
+
+	SHeader oHeader;
+	memset(static_cast<void*>(&oHeader), 0, sizeof(oHeader));
+	oHeader.nMagic = c_nSpoolMagic;
+	oHeader.nVersion = c_nSpoolVersion;
+	oHeader.nSpoolId = m_nId;
+	oHeader.nFirstSequence = nFirstSequence;
+	oHeader.nCommit.store(MakePosition(0, c_nHeaderSize));
+	oHeader.nAcknowledged.store(MakePosition(0, c_nHeaderSize));
+
+	// The file appears under its name only when it's complete
+#ifdef _WIN32
+	HANDLE hFile = CreateFileA(sTemporary.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+	DWORD nWritten = 0;
+	LARGE_INTEGER oSize;
+	oSize.QuadPart = int64_t(nSize);
+	bool bOk = WriteFile(hFile, &oHeader, DWORD(sizeof(oHeader)), &nWritten, NULL) && nWritten == sizeof(oHeader) &&
+		SetFilePointerEx(hFile, oSize, NULL, FILE_BEGIN) && SetEndOfFile(hFile);
+	CloseHandle(hFile);
+	bOk = bOk && MoveFileExA(sTemporary.c_str(), sPath.c_str(), MOVEFILE_REPLACE_EXISTING);
+	if (!bOk)
+	{
+		DeleteFileA(sTemporary.c_str());
+		return false;
+	}
+#else
+	int nFd = open(sTemporary.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (nFd < 0)
+		return false;
+#ifdef __linux__
+	// The blocks are allocated now, a full disk fails here instead of faulting the mapped write
+	bool bOk = (posix_fallocate(nFd, 0, off_t(nSize)) == 0);
+#else
+	bool bOk = (ftruncate(nFd, off_t(nSize)) == 0);
+#endif
+	bOk = bOk && pwrite(nFd, &oHeader, sizeof(oHeader), 0) == ssize_t(sizeof(oHeader));
+	close(nFd);
+	bOk = bOk && rename(sTemporary.c_str(), sPath.c_str()) == 0;
+	if (!bOk)
+	{
+		unlink(sTemporary.c_str());
+		return false;
+	}
+#endif
+
+	SSegmentPtr pSegment = MapSegment(sPath);
+	if (pSegment == nullptr)
+		return false;
+	m_deqSegments.push_back(std::move(pSegment));
+
+	return true;
+}
+
+CSpool::SSegmentPtr CSpool::MapSegment(const std::string& sPath)
+{
+	static_assert(sizeof(SHeader) <= c_nHeaderSize, "The header must fit its space");
+
+	SSegmentPtr pSegment(new SSegment);
+	pSegment->sPath = sPath;
+#ifdef _WIN32
+	pSegment->hFile = CreateFileA(sPath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	LARGE_INTEGER oSize;
+	if (pSegment->hFile == INVALID_HANDLE_VALUE || !GetFileSizeEx(pSegment->hFile, &oSize) || oSize.QuadPart < int64_t(c_nHeaderSize))
+	{
+		UnmapSegment(*pSegment);
+		return nullptr;
+	}
+	pSegment->nSize = size_t(oSize.QuadPart);
+	pSegment->hMapping = CreateFileMappingA(pSegment->hFile, NULL, PAGE_READWRITE, 0, 0, NULL);
+	if (pSegment->hMapping != NULL)
+		pSegment->pBase = static_cast<byte*>(MapViewOfFile(pSegment->hMapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+#else
+	pSegment->nFd = open(sPath.c_str(), O_RDWR | O_CLOEXEC);
+	struct stat oStat;
+	if (pSegment->nFd < 0 || fstat(pSegment->nFd, &oStat) != 0 || oStat.st_size < off_t(c_nHeaderSize))
+	{
+		UnmapSegment(*pSegment);
+		return nullptr;
+	}
+	pSegment->nSize = size_t(oStat.st_size);
+	void* pBase = mmap(nullptr, pSegment->nSize, PROT_READ | PROT_WRITE, MAP_SHARED, pSegment->nFd, 0);
+	if (pBase != MAP_FAILED)
+	{
+		pSegment->pBase = static_cast<byte*>(pBase);
+		madvise(pBase, pSegment->nSize, MADV_SEQUENTIAL);
+	}
+#endif
+	if (pSegment->pBase == nullptr)
+	{
+		UnmapSegment(*pSegment);
+		return nullptr;
+	}
+
+	// The positions must point inside the file, a damaged header fails the recovery
+	pSegment->pHeader = reinterpret_cast<SHeader*>(pSegment->pBase);
+	const uint64_t nCommit = pSegment->pHeader->nCommit.load(std::memory_order_acquire);
+	const uint64_t nAcknowledged = pSegment->pHeader->nAcknowledged.load(std::memory_order_acquire);
+	if (pSegment->pHeader->nMagic != c_nSpoolMagic || pSegment->pHeader->nVersion != c_nSpoolVersion ||
+		GetPositionOffset(nCommit) < c_nHeaderSize || GetPositionOffset(nCommit) > pSegment->nSize ||
+		GetPositionOffset(nAcknowledged) < c_nHeaderSize || GetPositionOffset(nAcknowledged) > GetPositionOffset(nCommit) ||
+		GetPositionCount(nAcknowledged) > GetPositionCount(nCommit))
+	{
+		UnmapSegment(*pSegment);
+		return nullptr;
+	}
+	pSegment->nFirstSequence = pSegment->pHeader->nFirstSequence;
+
+	return pSegment;
+}
+
+void CSpool::UnmapSegment(SSegment& oSegment)
+{
+#ifdef _WIN32
+	if (oSegment.pBase != nullptr)
+		UnmapViewOfFile(oSegment.pBase);
+	if (oSegment.hMapping != NULL)
+		CloseHandle(oSegment.hMapping);
+	if (oSegment.hFile != INVALID_HANDLE_VALUE)
+		CloseHandle(oSegment.hFile);
+	oSegment.hMapping = NULL;
+	oSegment.hFile = INVALID_HANDLE_VALUE;
+#else
+	if (oSegment.pBase != nullptr)
+		munmap(oSegment.pBase, oSegment.nSize);
+	if (oSegment.nFd >= 0)
+		close(oSegment.nFd);
+	oSegment.nFd = -1;
+#endif
+	oSegment.pBase = nullptr;
+	oSegment.pHeader = nullptr;
+}
+
+std::string CSpool::GetSegmentPath(uint64_t nFirstSequence, bool bTemporary) const
+{
+	char szName[c_nSequenceDigits + 1];
+	snprintf(szName, sizeof(szName), "%020llu", static_cast<unsigned long long>(nFirstSequence));
+#ifdef _WIN32
+	const char* szSeparator = "\\";
+#else
+	const char* szSeparator = "/";
+#endif
+
+	return m_sDirectory + szSeparator + szName + (bTemporary ? c_szTemporaryExtension : c_szSegmentExtension);
+}
+
+uint64_t CSpool::GetEndSequence(const SSegment& oSegment)
+{
+	return oSegment.nFirstSequence + GetPositionCount(oSegment.pHeader->nCommit.load(std::memory_order_acquire));
+}
+
+void CSpool::TruncateBroken()
+{
+	const uint64_t nAcknowledged = m_deqSegments.front()->pHeader->nAcknowledged.load(std::memory_order_acquire);
+	uint64_t nCount = GetPositionCount(nAcknowledged);
+	uint64_t nOffset = GetPositionOffset(nAcknowledged);
+	for (size_t i = 0; i < m_deqSegments.size(); ++i, nCount = 0, nOffset = c_nHeaderSize)
+	{
+		SSegment& oSegment = *m_deqSegments[i];
+		const uint64_t nCommit = oSegment.pHeader->nCommit.load(std::memory_order_acquire);
+		const uint64_t nEnd = GetPositionOffset(nCommit);
+		while (nOffset < nEnd)
+		{
+			const byte* pRecord = oSegment.pBase + nOffset;
+			uint32_t nLength = 0;
+			uint32_t nChecksum = 0;
+			memcpy(&nLength, pRecord, c_nRecordLengthSize);
+			memcpy(&nChecksum, pRecord + c_nRecordLengthSize, c_nRecordChecksumSize);
+			if (nEnd - nOffset < GetRecordSize(nLength) || GetRecordChecksum(nLength, pRecord + c_nRecordHeaderSize) != nChecksum)
+				break;
+			nOffset += GetRecordSize(nLength);
+			++nCount;
+		}
+		if (nOffset == nEnd && nCount == GetPositionCount(nCommit))
+			continue;
+
+		// The records from the broken one on are dropped, the later segments can't follow it
+		oSegment.pHeader->nCommit.store(MakePosition(nCount, nOffset), std::memory_order_release);
+		while (m_deqSegments.size() > i + 1)
+		{
+			DeleteSegment(*m_deqSegments.back());
+			m_deqSegments.pop_back();
+		}
+		return;
+	}
+}
+
+void CSpool::DeleteSegment(SSegment& oSegment)
+{
+	const std::string sPath = oSegment.sPath;
+	UnmapSegment(oSegment);
+#ifdef _WIN32
+	DeleteFileA(sPath.c_str());
+#else
+	unlink(sPath.c_str());
+#endif
+}
+
+bool CSpool::NextRecord(SCursor& oCursor) const
+{
+	for (;;)
+	{
+		const SSegment& oSegment = *m_deqSegments[oCursor.nSegment];
+		if (oCursor.nOffset < GetPositionOffset(oSegment.pHeader->nCommit.load(std::memory_order_acquire)))
+			return true;
+		if (oCursor.nSegment + 1 == m_deqSegments.size())
+			return false;
+
+		++oCursor.nSegment;
+		oCursor.nOffset = c_nHeaderSize;
+	}
+}
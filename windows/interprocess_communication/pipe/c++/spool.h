@@ -0,0 +1,134 @@
+/*
+Declaration file for the spool
+
+Disk-backed log of the messages waiting for the reader. The records are appended to memory-mapped
+segment files of a directory and stay there until they are acknowledged, the segments whose records
+are all acknowledged are deleted. Every segment header keeps the commit position of its records
+and the first one the acknowledged position. The commit is stored after the record, but a power
+loss before Sync may keep it without the record pages, so opening the spool checks the records
+not acknowledged by their checksums and ends the spool before the first broken one.
+
+Segment file (<first sequence>.spool):
+	+--------+----------------------------------------------------------------+
+	| header | record (u32 length, u32 CRC32C, payload, padded to 8) ...      |
+	+--------+----------------------------------------------------------------+
+*/
+
+
+//! Include guard
+#pragma once
+
+
+//! Includes
+#include "buffer_pool.h"
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+
+
+//! Type declarations
+class CSpool;
+typedef std::shared_ptr<CSpool> CSpoolPtr;
+
+
+//! Class CSpool
+// Thread safe, the records may be appended by any thread while another one reads and acknowledges them
+class CSpool
+{
+public: //! Constants
+	static const size_t c_nDefaultSegmentSize = 64 * 1024 * 1024;
+
+public: //! Constructors and destructor
+	// The segments are preallocated of the specified size, a larger record gets a segment of its own
+	CSpool(const std::string& sDirectory, size_t nSegmentSize = c_nDefaultSegmentSize);
+	~CSpool();
+
+public: //! Interface
+	// Returns true if the spool is opened
+	bool IsOpen() const;
+	// Creates the directory or recovers the records left in it
+	bool Open();
+	// Unmaps the segments, the records not acknowledged stay on disk
+	void Close();
+
+	// Appends the record, returns its sequence number in pSequence
+	bool Append(const void* pData, size_t nSize, uint64_t* pSequence = nullptr);
+	// Reads the record after the last read one, returns false if there is none.
+	// The record points into the segment and stays valid until it's acknowledged
+	bool ReadNext(uint64_t& nSequence, SByteSpan& oRecord);
+	// Reads again from the first record not acknowledged
+	void Rewind();
+	// Drops the read records up to the sequence number (inclusive)
+	bool Acknowledge(uint64_t nSequence);
+	// Writes the appended records to the disk. They survive the process crash without it, the records
+	// appended since the last Sync may be lost by a power loss
+	bool Sync();
+
+	// Returns the identity of the spool, kept across the restarts
+	uint64_t GetId() const;
+	// Returns the sequence number of the first record not acknowledged
+	uint64_t GetAcknowledgedSequence() const;
+	// Returns the sequence number the next appended record gets
+	uint64_t GetNextSequence() const;
+	// Returns the number of the records not acknowledged
+	uint64_t GetPendingCount() const;
+	// Returns true if there are records not read since the last Rewind
+	bool HasUnread() const;
+
+private: //! Types
+	struct SHeader;
+
+	// Mapped segment file
+	struct SSegment
+	{
+		std::string		sPath;
+		SHeader*		pHeader = nullptr;
+		byte*			pBase = nullptr;
+		size_t			nSize = 0;
+		uint64_t		nFirstSequence = 0;
+#ifdef _WIN32
+		HANDLE			hFile = INVALID_HANDLE_VALUE;
+		HANDLE			hMapping = NULL;
+#else
+		int				nFd = -1;
+#endif
+	};
+
+	typedef std::unique_ptr<SSegment> SSegmentPtr;
+
+	// Position of a record in the segments
+	struct SCursor
+	{
+		size_t			nSegment = 0;		// Index in m_deqSegments
+		uint64_t		nOffset = 0;
+		uint64_t		nSequence = 0;
+	};
+
+private: //! Implementation
+	// Creates the segment file starting at the sequence number (under m_mtxSpool)
+	bool AddSegment(uint64_t nFirstSequence, size_t nMinSize);
+	// Maps the existing segment file
+	SSegmentPtr MapSegment(const std::string& sPath);
+	static void UnmapSegment(SSegment& oSegment);
+	// Returns the path of the segment file
+	std::string GetSegmentPath(uint64_t nFirstSequence, bool bTemporary) const;
+	// Returns the sequence number after the last record of the segment
+	static uint64_t GetEndSequence(const SSegment& oSegment);
+	// Moves the cursor to the next segment if it has reached the end of its one
+	bool NextRecord(SCursor& oCursor) const;
+	// Checks the records not acknowledged, the spool ends before the first broken one (under m_mtxSpool)
+	void TruncateBroken();
+	// Unmaps the segment and deletes its file
+	static void DeleteSegment(SSegment& oSegment);
+
+private: //! Members
+	std::string					m_sDirectory;
+	size_t						m_nSegmentSize;
+	mutable std::mutex			m_mtxSpool;
+	std::deque<SSegmentPtr>		m_deqSegments;		// Oldest first, the records are appended to the last one
+	uint64_t					m_nId;
+	SCursor						m_oAcknowledged;	// First record not acknowledged
+	SCursor						m_oRead;			// Next record to read
+	bool						m_bOpen;
+};
@@ -0,0 +1,151 @@
+/*
+Implementation file for the spool reader
+*/
+
+
+//! Includes
+#include "spool_reader.h"
+#include <algorithm>
+
+
+CSpoolReader::CSpoolReader(const std::string& sName)
+	: CSpoolReader(CreatePipeTransport(sName, EPipeMode::Read))
+{
+}
+
+CSpoolReader::CSpoolReader(ITransportPtr pTransport)
+	: m_pTransport(pTransport),
+	  m_oPipe(pTransport),
+	  m_eLastError(EPipeError::None),
+	  m_nAcknowledgeInterval(c_nDefaultAcknowledgeInterval),
+	  m_bSequenced(false),
+	  m_nNextSequence(0),
+	  m_nUnacknowledged(0),
+	  m_bAcknowledgeRequested(false),
+	  m_bKnownSpool(false),
+	  m_nSpoolId(0),
+	  m_nDelivered(0)
+{
+	// The acknowledgements go back over the connection the frames came by
+	m_oPipe.SetSessionMode(true);
+}
+
+CSpoolReader::~CSpoolReader()
+{
+}
+
+bool CSpoolReader::IsOpen()
+{
+	return m_oPipe.IsOpen();
+}
+
+bool CSpoolReader::Open()
+{
+	ResetConnection();
+	return m_oPipe.Open();
+}
+
+bool CSpoolReader::Close()
+{
+	return m_oPipe.Close();
+}
+
+bool CSpoolReader::ReceiveData(std::vector<byte>& vecData)
+{
+	for (;;)
+	{
+		// Everything received so far is handed over or skipped, the caller has come back for more
+		if (m_bAcknowledgeRequested || m_nUnacknowledged >= m_nAcknowledgeInterval)
+			Acknowledge();
+
+		SFrameHeader oHeader;
+		if (!m_oPipe.ReceiveFrame(oHeader, m_vecFrame))
+		{
+			ResetConnection();
+			return Fail(m_oPipe.GetLastPipeError());
+		}
+
+		if (oHeader.nType == uint16_t(EFrameType::Sequence))
+		{
+			uint64_t nSpoolId = 0;
+			uint64_t nSequence = 0;
+			if (!DecodeSequence(oHeader, m_vecFrame.data(), nSpoolId, nSequence))
+				continue;
+			if (!m_bKnownSpool || nSpoolId != m_nSpoolId)
+			{
+				m_bKnownSpool = true;
+				m_nSpoolId = nSpoolId;
+				m_nDelivered = nSequence;
+			}
+			m_bSequenced = true;
+			m_nNextSequence = nSequence;
+			m_nUnacknowledged = 0;
+			m_bAcknowledgeRequested = false;
+			continue;
+		}
+		if (oHeader.nType != uint16_t(EFrameType::Data))
+			continue;
+		if (!m_bSequenced)
+		{
+			vecData.swap(m_vecFrame);
+			return true;
+		}
+
+		const uint64_t nSequence = m_nNextSequence++;
+		++m_nUnacknowledged;
+		if ((oHeader.nFlags & FrameFlagAckRequest) != 0)
+			m_bAcknowledgeRequested = true;
+		// Sent again because the acknowledgement was lost with the previous connection
+		if (nSequence < m_nDelivered)
+			continue;
+
+		m_nDelivered = nSequence + 1;
+		vecData.swap(m_vecFrame);
+		return true;
+	}
+}
+
+void CSpoolReader::SetAcknowledgeInterval(uint32_t nMessages)
+{
+	m_nAcknowledgeInterval = (std::max)(nMessages, uint32_t(1));
+}
+
+void CSpoolReader::SetMaxMessageSize(uint32_t nMaxSize)
+{
+	m_oPipe.SetMaxMessageSize(nMaxSize);
+}
+
+CSpoolReader::EPipeError CSpoolReader::GetLastPipeError() const
+{
+	return m_eLastError;
+}
+
+void CSpoolReader::Acknowledge()
+{
+	if (m_bSequenced && m_nUnacknowledged > 0 && m_pTransport->IsDuplex())
+	{
+		// A failure drops the connection, the next receive reports it
+		byte arrAcknowledge[c_nAcknowledgeFrameSize];
+		EncodeAcknowledge(arrAcknowledge, m_nNextSequence - 1);
+		SIoBuffer oAcknowledge;
+		oAcknowledge.pData = arrAcknowledge;
+		oAcknowledge.nSize = c_nAcknowledgeFrameSize;
+		m_pTransport->Send(&oAcknowledge, 1);
+	}
+	m_nUnacknowledged = 0;
+	m_bAcknowledgeRequested = false;
+}
+
+void CSpoolReader::ResetConnection()
+{
+	m_bSequenced = false;
+	m_nNextSequence = 0;
+	m_nUnacknowledged = 0;
+	m_bAcknowledgeRequested = false;
+}
+
+bool CSpoolReader::Fail(EPipeError eError)
+{
+	m_eLastError = eError;
+	return false;
+}
@@ -0,0 +1,76 @@
+/*
+Declaration file for the spool reader
+
+Reader end of CSpoolWriter. The writer numbers its data frames, the reader acknowledges them
+once they are handed over and the caller comes back for the next message, so the writer keeps
+every message the caller may not have processed. The messages the writer sends again after
+a lost acknowledgement are skipped. Frames of a plain CNamedPipe writer are passed through.
+*/
+
+
+//! Include guard
+#pragma once
+
+
+//! Includes
+#include "named_pipe.h"
+
+
+//! Class CSpoolReader
+class CSpoolReader
+{
+public: //! Types
+	typedef CNamedPipe::EPipeError EPipeError;
+
+public: //! Constants
+	static const uint32_t c_nDefaultAcknowledgeInterval = 1024;
+
+public: //! Constructors and destructor
+	explicit CSpoolReader(const std::string& sName);
+	// Uses the specified transport instead of the default one of the platform
+	explicit CSpoolReader(ITransportPtr pTransport);
+	~CSpoolReader();
+
+public: //! Interface
+	// Returns true if the pipe is opened and ready to use
+	bool IsOpen();
+	// Opens pipe and get ready to use
+	bool Open();
+	// Closes pipe
+	bool Close();
+
+	// Acknowledges the messages received before and waits for the next one.
+	// Reports EPipeError::Disconnected when the writer leaves, the next call waits for a new one
+	bool ReceiveData(std::vector<byte>& vecData);
+	// Sets the number of the messages acknowledged at once unless the writer asks earlier
+	void SetAcknowledgeInterval(uint32_t nMessages);
+
+	// Sets the maximum accepted message size
+	void SetMaxMessageSize(uint32_t nMaxSize);
+	// Returns the reason of the last failure
+	EPipeError GetLastPipeError() const;
+
+private: //! Implementation
+	// Acknowledges the data frames received on the connection
+	void Acknowledge();
+	// Forgets the state of the connection
+	void ResetConnection();
+	// Remembers the failure reason and returns false
+	bool Fail(EPipeError eError);
+
+private: //! Members
+	ITransportPtr			m_pTransport;
+	CNamedPipe				m_oPipe;
+	std::atomic<EPipeError>	m_eLastError;
+	uint32_t				m_nAcknowledgeInterval;
+	std::vector<byte>		m_vecFrame;
+	// Connection
+	bool					m_bSequenced;			// The writer numbers its frames
+	uint64_t				m_nNextSequence;		// Sequence number of the next data frame
+	uint32_t				m_nUnacknowledged;		// Data frames received since the last acknowledgement
+	bool					m_bAcknowledgeRequested;
+	// Spool of the last writer, kept across its connections
+	bool					m_bKnownSpool;
+	uint64_t				m_nSpoolId;
+	uint64_t				m_nDelivered;			// Sequence number after the last handed over message
+};
@@ -0,0 +1,357 @@
+/*
+Implementation file for the spool writer
+*/
+
+
+//! Includes
+#include "spool_writer.h"
+#include <algorithm>
+
+
+//! Sender constants
+static const size_t		c_nBatchFrames = 256;				// Records sent by one gather write
+static const size_t		c_nBatchBytes = 4 * 1024 * 1024;
+static const uint32_t	c_nAcknowledgePollMs = 1;			// First wait for the acknowledgements, doubled while none comes
+
+
+CSpoolWriter::CSpoolWriter(const std::string& sName, const std::string& sDirectory, size_t nSegmentSize)
+	: CSpoolWriter(CreatePipeTransport(sName, EPipeMode::Write), sDirectory, nSegmentSize)
+{
+}
+
+CSpoolWriter::CSpoolWriter(ITransportPtr pTransport, const std::string& sDirectory, size_t nSegmentSize)
+	: m_oSpool(sDirectory, nSegmentSize),
+	  m_pTransport(pTransport),
+	  m_nMaxMessageSize(c_nFrameDefaultMaxLength),
+	  m_eLastError(EPipeError::None),
+	  m_nWindow(c_nDefaultWindow),
+	  m_nRetryIntervalMs(c_nDefaultRetryIntervalMs),
+	  m_bOpen(false),
+	  m_bStop(false),
+	  m_bWake(false),
+	  m_bIdle(false),
+	  m_bConnected(false),
+	  m_nInFlightBytes(0),
+	  m_oAcknowledgeAssembler(c_nAcknowledgeFrameSize)
+{
+}
+
+CSpoolWriter::~CSpoolWriter()
+{
+	Close();
+}
+
+bool CSpoolWriter::IsOpen() const
+{
+	std::lock_guard<std::mutex> oLock(m_mtxState);
+	return m_bOpen;
+}
+
+bool CSpoolWriter::Open()
+{
+	std::lock_guard<std::mutex> oLock(m_mtxState);
+	if (m_bOpen)
+		return false;
+	if (m_pTransport == nullptr || !m_oSpool.Open())
+		return Fail(EPipeError::IoFailure);
+
+	m_bOpen = true;
+	m_bStop = false;
+	m_bWake = false;
+	m_oSender = std::thread(&CSpoolWriter::Run, this);
+
+	return true;
+}
+
+bool CSpoolWriter::Close()
+{
+	{
+		std::lock_guard<std::mutex> oLock(m_mtxState);
+		if (!m_bOpen)
+			return false;
+		m_bStop = true;
+	}
+	m_cvState.notify_all();
+	m_oSender.join();
+
+	std::lock_guard<std::mutex> oLock(m_mtxState);
+	m_oSpool.Close();
+	m_bOpen = false;
+	m_cvState.notify_all();
+
+	return true;
+}
+
+bool CSpoolWriter::SendData(const void* pData, size_t nSize)
+{
+	if (nSize > m_nMaxMessageSize)
+		return Fail(EPipeError::FrameTooLarge);
+	if (!m_oSpool.Append(pData, nSize))
+		return Fail(m_oSpool.IsOpen() ? EPipeError::IoFailure : EPipeError::NotOpen);
+
+	// Only the connected sender waits for the records, the one waiting for the reader isn't woken
+	bool bNotify = false;
+	{
+		std::lock_guard<std::mutex> oLock(m_mtxState);
+		m_bWake = true;
+		bNotify = m_bIdle;
+	}
+	if (bNotify)
+		m_cvState.notify_all();
+
+	return true;
+}
+
+bool CSpoolWriter::SendData(const std::vector<byte>& vecData)
+{
+	return SendData(vecData.data(), vecData.size());
+}
+
+bool CSpoolWriter::WaitDelivered(uint32_t nTimeoutMs)
+{
+	std::unique_lock<std::mutex> oLock(m_mtxState);
+	auto fnDelivered = [this]() { return !m_bOpen || m_oSpool.GetPendingCount() == 0; };
+	if (nTimeoutMs == 0)
+		m_cvState.wait(oLock, fnDelivered);
+	else if (!m_cvState.wait_for(oLock, std::chrono::milliseconds(nTimeoutMs), fnDelivered))
+		return Fail(EPipeError::TimedOut);
+
+	return m_bOpen ? true : Fail(EPipeError::NotOpen);
+}
+
+bool CSpoolWriter::Sync()
+{
+	return m_oSpool.Sync() ? true : Fail(m_oSpool.IsOpen() ? EPipeError::IoFailure : EPipeError::NotOpen);
+}
+
+bool CSpoolWriter::IsConnected() const
+{
+	return m_bConnected;
+}
+
+uint64_t CSpoolWriter::GetPendingCount() const
+{
+	return m_oSpool.GetPendingCount();
+}
+
+void CSpoolWriter::SetWindow(size_t nBytes)
+{
+	m_nWindow = nBytes;
+}
+
+void CSpoolWriter::SetRetryInterval(uint32_t nIntervalMs)
+{
+	m_nRetryIntervalMs = (std::max)(nIntervalMs, uint32_t(1));
+}
+
+void CSpoolWriter::SetMaxMessageSize(uint32_t nMaxSize)
+{
+	m_nMaxMessageSize = nMaxSize;
+}
+
+CSpoolWriter::EPipeError CSpoolWriter::GetLastPipeError() const
+{
+	return m_eLastError;
+}
+
+void CSpoolWriter::Run()
+{
+	uint32_t nPollMs = c_nAcknowledgePollMs;
+	for (;;)
+	{
+		uint32_t nWaitMs = m_nRetryIntervalMs;
+		if (m_bConnected || Connect())
+		{
+			bool bSent = false;
+			bool bAcknowledged = false;
+			if (SendRecords(bSent) && ReadAcknowledgements(bAcknowledged))
+			{
+				if (bAcknowledged)
+				{
+					std::lock_guard<std::mutex> oLock(m_mtxState);
+					m_cvState.notify_all();
+				}
+				if (bSent || bAcknowledged)
+					nPollMs = c_nAcknowledgePollMs;
+				if (bSent)
+				{
+					std::lock_guard<std::mutex> oLock(m_mtxState);
+					if (m_bStop)
+						break;
+					continue;
+				}
+				// Nothing to send: the acknowledgements are checked more and more rarely while none comes
+				if (!m_deqInFlight.empty())
+				{
+					nWaitMs = nPollMs;
+					nPollMs = (std::min)(nPollMs * 2, uint32_t(m_nRetryIntervalMs));
+				}
+			}
+			else
+			{
+				// The records not acknowledged go again to the next reader
+				Disconnect();
+			}
+		}
+
+		std::unique_lock<std::mutex> oLock(m_mtxState);
+		m_bIdle = m_bConnected;
+		m_cvState.wait_for(oLock, std::chrono::milliseconds(nWaitMs), [this]() { return m_bStop || (m_bIdle && m_bWake); });
+		m_bIdle = false;
+		m_bWake = false;
+		if (m_bStop)
+			break;
+	}
+
+	Disconnect();
+}
+
+bool CSpoolWriter::Connect()
+{
+	if (!m_pTransport->Open())
+		return false;
+
+	m_oSpool.Rewind();
+	m_deqInFlight.clear();
+	m_nInFlightBytes = 0;
+	m_oAcknowledgeAssembler.Reset();
+
+	// The reader numbers the data frames from here and skips those it has handed over already
+	byte arrSequence[c_nSequenceFrameSize];
+	EncodeSequence(arrSequence, m_oSpool.GetId(), m_oSpool.GetAcknowledgedSequence());
+	SIoBuffer oSequence;
+	oSequence.pData = arrSequence;
+	oSequence.nSize = c_nSequenceFrameSize;
+	if (m_pTransport->Send(&oSequence, 1) != EIoStatus::Ok)
+	{
+		m_pTransport->Close();
+		return false;
+	}
+	m_bConnected = true;
+
+	return true;
+}
+
+void CSpoolWriter::Disconnect()
+{
+	if (!m_bConnected)
+		return;
+
+	m_pTransport->Close();
+	m_bConnected = false;
+}
+
+bool CSpoolWriter::SendRecords(bool& bSent)
+{
+	bSent = false;
+	const size_t nWindow = m_nWindow;
+
+	// Headers are encoded in place, the payloads go straight from the mapped segments
+	m_vecHeaders.resize(c_nBatchFrames * c_nFrameHeaderSize);
+	m_vecBuffers.clear();
+	SFrameHeader oHeader;
+	oHeader.nType = uint16_t(EFrameType::Data);
+	size_t nBatchBytes = 0;
+	while (m_vecBuffers.size() < 2 * c_nBatchFrames && nBatchBytes < c_nBatchBytes && (nWindow == 0 || m_nInFlightBytes < nWindow))
+	{
+		uint64_t nSequence = 0;
+		SByteSpan oRecord;
+		if (!m_oSpool.ReadNext(nSequence, oRecord))
+			break;
+
+		byte* pHeader = m_vecHeaders.data() + m_vecBuffers.size() / 2 * c_nFrameHeaderSize;
+		oHeader.nLength = uint32_t(oRecord.nSize);
+		oHeader.Encode(pHeader);
+		SIoBuffer oBuffer;
+		oBuffer.pData = pHeader;
+		oBuffer.nSize = c_nFrameHeaderSize;
+		m_vecBuffers.push_back(oBuffer);
+		oBuffer.pData = oRecord.pData;
+		oBuffer.nSize = oRecord.nSize;
+		m_vecBuffers.push_back(oBuffer);
+
+		SInFlight oInFlight;
+		oInFlight.nSequence = nSequence;
+		oInFlight.nSize = c_nFrameHeaderSize + oRecord.nSize;
+		m_deqInFlight.push_back(oInFlight);
+		m_nInFlightBytes += oInFlight.nSize;
+		nBatchBytes += oInFlight.nSize;
+	}
+	if (m_vecBuffers.empty())
+		return true;
+
+	// The reader acknowledges on the request once half of the window is used or the spool is drained
+	if ((nWindow != 0 && m_nInFlightBytes >= nWindow / 2) || !m_oSpool.HasUnread())
+	{
+		oHeader.nFlags = FrameFlagAckRequest;
+		oHeader.Encode(m_vecHeaders.data() + (m_vecBuffers.size() / 2 - 1) * c_nFrameHeaderSize);
+	}
+	if (m_pTransport->Send(m_vecBuffers.data(), m_vecBuffers.size()) != EIoStatus::Ok)
+		return false;
+	bSent = true;
+
+	// The reader can't answer over a one way transport, the written records count as delivered
+	if (!m_pTransport->IsDuplex())
+	{
+		m_oSpool.Acknowledge(m_deqInFlight.back().nSequence);
+		m_deqInFlight.clear();
+		m_nInFlightBytes = 0;
+		std::lock_guard<std::mutex> oLock(m_mtxState);
+		m_cvState.notify_all();
+	}
+
+	return true;
+}
+
+bool CSpoolWriter::ReadAcknowledgements(bool& bAcknowledged)
+{
+	bAcknowledged = false;
+	if (!m_pTransport->IsDuplex())
+		return true;
+
+	bool bReceived = false;
+	uint64_t nAcknowledged = 0;
+	for (;;)
+	{
+		SFrameHeader oHeader;
+		const uint8_t* pPayload = nullptr;
+		CFrameAssembler::EResult eResult;
+		while ((eResult = m_oAcknowledgeAssembler.Next(oHeader, pPayload)) == CFrameAssembler::EResult::Frame)
+		{
+			uint64_t nSequence = 0;
+			if (DecodeAcknowledge(oHeader, pPayload, nSequence) && (!bReceived || nSequence > nAcknowledged))
+			{
+				nAcknowledged = nSequence;
+				bReceived = true;
+			}
+		}
+		if (eResult == CFrameAssembler::EResult::Invalid || eResult == CFrameAssembler::EResult::Corrupted)
+			return false;
+
+		const size_t nChunk = 16 * c_nAcknowledgeFrameSize;
+		size_t nRead = 0;
+		if (m_pTransport->TryReceive(m_oAcknowledgeAssembler.GetWriteBuffer(nChunk), nChunk, nRead) != EIoStatus::Ok)
+			return false;
+		if (nRead == 0)
+			break;
+		m_oAcknowledgeAssembler.CommitWrite(nRead);
+	}
+	if (!bReceived)
+		return true;
+
+	m_oSpool.Acknowledge(nAcknowledged);
+	while (!m_deqInFlight.empty() && m_deqInFlight.front().nSequence <= nAcknowledged)
+	{
+		m_nInFlightBytes -= m_deqInFlight.front().nSize;
+		m_deqInFlight.pop_front();
+	}
+	bAcknowledged = true;
+
+	return true;
+}
+
+bool CSpoolWriter::Fail(EPipeError eError)
+{
+	m_eLastError = eError;
+	return false;
+}
@@ -0,0 +1,108 @@
+/*
+Declaration file for the spool writer
+
+Store-and-forward writer: the messages are appended to a CSpool and return at once, whether the
+reader is connected or not. A background thread connects to the reader whenever it's there and
+sends the spooled records in gather writes straight from the mapped segments. The records are
+dropped from the spool once CSpoolReader acknowledges them, the ones sent and not acknowledged
+are sent again after the reconnect (the reader skips those it has already handed over).
+*/
+
+
+//! Include guard
+#pragma once
+
+
+//! Includes
+#include "named_pipe.h"
+#include "spool.h"
+
+
+//! Class CSpoolWriter
+class CSpoolWriter
+{
+public: //! Types
+	typedef CNamedPipe::EPipeError EPipeError;
+
+public: //! Constants
+	static const size_t c_nDefaultWindow = 16 * 1024 * 1024;		// Bytes sent and not acknowledged
+	static const uint32_t c_nDefaultRetryIntervalMs = 100;
+
+public: //! Constructors and destructor
+	CSpoolWriter(const std::string& sName, const std::string& sDirectory, size_t nSegmentSize = CSpool::c_nDefaultSegmentSize);
+	// Uses the specified transport instead of the default one of the platform
+	CSpoolWriter(ITransportPtr pTransport, const std::string& sDirectory, size_t nSegmentSize = CSpool::c_nDefaultSegmentSize);
+	~CSpoolWriter();
+
+public: //! Interface
+	// Returns true if the spool is opened
+	bool IsOpen() const;
+	// Recovers the spool and starts sending its records, the reader may come later
+	bool Open();
+	// Stops sending, the records not acknowledged stay in the spool for the next Open
+	bool Close();
+
+	// Appends the message to the spool, doesn't wait for the reader
+	bool SendData(const void* pData, size_t nSize);
+	bool SendData(const std::vector<byte>& vecData);
+	// Waits until the reader acknowledges all the spooled messages, zero timeout waits forever
+	bool WaitDelivered(uint32_t nTimeoutMs = 0);
+	// Writes the spooled messages to the disk (they survive the process crash without it)
+	bool Sync();
+
+	// Returns true if the reader is connected
+	bool IsConnected() const;
+	// Returns the number of the messages the reader hasn't acknowledged
+	uint64_t GetPendingCount() const;
+	// Sets the bytes sent ahead of the acknowledgements, zero doesn't limit them
+	void SetWindow(size_t nBytes);
+	// Sets how often the writer tries to connect while the reader is not there
+	void SetRetryInterval(uint32_t nIntervalMs);
+	// Sets the maximum accepted message size
+	void SetMaxMessageSize(uint32_t nMaxSize);
+	// Returns the reason of the last failure
+	EPipeError GetLastPipeError() const;
+
+private: //! Types
+	// Record sent and not acknowledged
+	struct SInFlight
+	{
+		uint64_t	nSequence = 0;
+		size_t		nSize = 0;		// Frame bytes
+	};
+
+private: //! Implementation
+	// Sender thread function
+	void Run();
+	// Connects to the reader and tells it where the records start
+	bool Connect();
+	void Disconnect();
+	// Sends the next records within the window, bSent is false if there was nothing to send
+	bool SendRecords(bool& bSent);
+	// Drops the acknowledged records from the spool, true if some were
+	bool ReadAcknowledgements(bool& bAcknowledged);
+	// Remembers the failure reason and returns false
+	bool Fail(EPipeError eError);
+
+private: //! Members
+	CSpool						m_oSpool;
+	ITransportPtr				m_pTransport;
+	std::atomic<uint32_t>		m_nMaxMessageSize;
+	std::atomic<EPipeError>		m_eLastError;
+	std::atomic<size_t>			m_nWindow;
+	std::atomic<uint32_t>		m_nRetryIntervalMs;
+	mutable std::mutex			m_mtxState;
+	std::condition_variable		m_cvState;			// Wakes the sender and the delivery waiters
+	bool						m_bOpen;
+	bool						m_bStop;
+	bool						m_bWake;			// Records have been appended
+	bool						m_bIdle;			// The connected sender waits for the records
+	std::thread					m_oSender;
+	std::atomic<bool>			m_bConnected;
+	// Sender thread only
+	std::deque<SInFlight>		m_deqInFlight;
+	size_t						m_nInFlightBytes;
+	CFrameAssembler				m_oAcknowledgeAssembler;	// Frames sent back by the reader
+	std::vector<byte>			m_vecHeaders;
+	std::vector<SIoBuffer>		m_vecBuffers;
+};
@@ -0,0 +1,214 @@
+/*
+Implementation file for the Win32 named pipe transport
+*/
+
+
+//! Includes
+#include "win32_pipe_transport.h"
+#include <algorithm>
+#include <cstring>
+
+
+//! Transport constants
+static const size_t	c_nCoalesceLimit = 64 * 1024;	// Gathers up to this size are staged to be sent by a single write
+static const DWORD	c_nPipeBufferSize = 64 * 1024;	// Kernel buffer of the pipe, the flow control window bounds the rest
+static const uint32_t	c_nBusyPollSliceUs = 1000;	// Busy poll reads the clock and the strategy this often
+
+
+CWin32PipeTransport::CWin32PipeTransport(const std::string& sName, EPipeMode eMode)
+	: m_sName(sName),
+	  m_eMode(eMode),
+	  m_hHandler(INVALID_HANDLE_VALUE),
+	  m_nPartialWrites(0)
+{
+}
+
+CWin32PipeTransport::~CWin32PipeTransport()
+{
+	if (IsOpen())
+		Close();
+}
+
+EPipeMode CWin32PipeTransport::GetMode() const
+{
+	return m_eMode;
+}
+
+bool CWin32PipeTransport::IsOpen() const
+{
+	return (m_hHandler != INVALID_HANDLE_VALUE);
+}
+
+bool CWin32PipeTransport::Open()
+{
+	if (IsOpen())
+		return false;
+
+	if (!m_sName.empty())
+		m_hHandler = CreatePipe(m_sName, m_eMode);
+
+	// All instances are busy, wait a bit for the reader to free one
+	if (m_hHandler == INVALID_HANDLE_VALUE && m_eMode == EPipeMode::Write && GetLastError() == ERROR_PIPE_BUSY)
+	{
+		std::string sPath = R"(\\.\pipe\)" + m_sName;
+		if (WaitNamedPipeA(sPath.c_str(), NMPWAIT_USE_DEFAULT_WAIT))
+			m_hHandler = CreatePipe(m_sName, m_eMode);
+	}
+
+	return (m_hHandler != INVALID_HANDLE_VALUE);
+}
+
+bool CWin32PipeTransport::Close()
+{
+	if (!IsOpen())
+		return false;
+
+	if (CloseHandle(m_hHandler))
+		m_hHandler = INVALID_HANDLE_VALUE;
+
+	return (m_hHandler == INVALID_HANDLE_VALUE);
+}
+
+bool CWin32PipeTransport::Accept()
+{
+	if (m_eMode != EPipeMode::Read)
+		return true;
+
+	// Wait for someone to connect to the pipe
+	return (ConnectNamedPipe(m_hHandler, NULL) != FALSE || GetLastError() == ERROR_PIPE_CONNECTED);
+}
+
+bool CWin32PipeTransport::Disconnect()
+{
+	if (m_eMode != EPipeMode::Read)
+		return true;
+
+	return (DisconnectNamedPipe(m_hHandler) != FALSE);
+}
+
+EIoStatus CWin32PipeTransport::Send(const SIoBuffer* arrBuffers, size_t nCount)
+{
+	size_t nTotal = 0;
+	for (size_t i = 0; i < nCount; ++i)
+		nTotal += arrBuffers[i].nSize;
+
+	// Pipes have no gather write, so small gathers are copied to go by a single WriteFile
+	if (nCount > 1 && nTotal <= c_nCoalesceLimit)
+	{
+		m_vecSendBuffer.resize(nTotal);
+		byte* pBuffer = m_vecSendBuffer.data();
+		for (size_t i = 0; i < nCount; ++i)
+		{
+			if (arrBuffers[i].nSize > 0)
+				memcpy(pBuffer, arrBuffers[i].pData, arrBuffers[i].nSize);
+			pBuffer += arrBuffers[i].nSize;
+		}
+		return WriteAll(m_vecSendBuffer.data(), nTotal);
+	}
+
+	for (size_t i = 0; i < nCount; ++i)
+	{
+		EIoStatus eStatus = WriteAll(arrBuffers[i].pData, arrBuffers[i].nSize);
+		if (eStatus != EIoStatus::Ok)
+			return eStatus;
+	}
+
+	return EIoStatus::Ok;
+}
+
+EIoStatus CWin32PipeTransport::Receive(void* pData, size_t nSize, size_t& nRead)
+{
+	nRead = 0;
+	m_oWaiter.Prepare();
+	// A failed peek (the writer has gone) counts as ready, the read reports it
+	HANDLE hHandler = m_hHandler;
+	auto fnReadable = [hHandler]()
+	{
+		DWORD nAvailable = 0;
+		return (!PeekNamedPipe(hHandler, NULL, 0, NULL, &nAvailable, NULL) || nAvailable > 0);
+	};
+	while (!m_oWaiter.Spin(fnReadable, c_nBusyPollSliceUs) && m_oWaiter.IsBusyPoll())
+		;
+
+	DWORD nResult = 0;
+	const DWORD nChunk = DWORD((std::min)(nSize, size_t(MAXDWORD)));
+	if (!ReadFile(m_hHandler, pData, nChunk, &nResult, NULL))
+		return GetLastIoStatus();
+	if (nResult == 0)
+		return EIoStatus::Disconnected;
+
+	nRead = nResult;
+	return EIoStatus::Ok;
+}
+
+EIoStatus CWin32PipeTransport::TryReceive(void* pData, size_t nSize, size_t& nRead)
+{
+	nRead = 0;
+	DWORD nAvailable = 0;
+	if (!PeekNamedPipe(m_hHandler, NULL, 0, NULL, &nAvailable, NULL))
+		return GetLastIoStatus();
+	if (nAvailable == 0)
+		return EIoStatus::Ok;
+
+	return Receive(pData, (std::min)(nSize, size_t(nAvailable)), nRead);
+}
+
+bool CWin32PipeTransport::IsDuplex() const
+{
+	return true;
+}
+
+void CWin32PipeTransport::SetWaitStrategy(const SWaitStrategy& oStrategy)
+{
+	m_oWaiter.SetStrategy(oStrategy);
+}
+
+uint64_t CWin32PipeTransport::GetPartialWriteCount() const
+{
+	return m_nPartialWrites.load(std::memory_order_relaxed);
+}
+
+HANDLE CWin32PipeTransport::CreatePipe(const std::string& sName, EPipeMode eMode)
+{
+	std::string sPath = R"(\\.\pipe\)" + sName;
+	HANDLE hHandler = INVALID_HANDLE_VALUE;
+	if (eMode == EPipeMode::Read)
+	{
+		// Only the user of the process may open the pipe
+		CPipeSecurity oSecurity;
+		SECURITY_ATTRIBUTES* pAttributes = oSecurity.GetAttributes();
+		if (pAttributes != nullptr)
+			hHandler = CreateNamedPipeA(sPath.c_str(), PIPE_ACCESS_DUPLEX, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT, 1, c_nPipeBufferSize, c_nPipeBufferSize, NMPWAIT_USE_DEFAULT_WAIT, pAttributes);
+	}
+	else
+		hHandler = CreateFileA(sPath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+
+	return hHandler;
+}
+
+EIoStatus CWin32PipeTransport::GetLastIoStatus()
+{
+	DWORD nError = GetLastError();
+	if (nError == ERROR_BROKEN_PIPE || nError == ERROR_NO_DATA || nError == ERROR_PIPE_NOT_CONNECTED)
+		return EIoStatus::Disconnected;
+
+	return EIoStatus::Failure;
+}
+
+EIoStatus CWin32PipeTransport::WriteAll(const void* pData, size_t nSize)
+{
+	const byte* pBuffer = static_cast<const byte*>(pData);
+	while (nSize > 0)
+	{
+		DWORD nWritten = 0;
+		const DWORD nChunk = DWORD((std::min)(nSize, size_t(MAXDWORD)));
+		if (!WriteFile(m_hHandler, pBuffer, nChunk, &nWritten, NULL))
+			return GetLastIoStatus();
+		if (nWritten < nChunk)
+			m_nPartialWrites.fetch_add(1, std::memory_order_relaxed);
+		pBuffer += nWritten;
+		nSize -= nWritten;
+	}
+
+	return EIoStatus::Ok;
+}
@@ -0,0 +1,56 @@
+/*
+Declaration file for the Win32 named pipe transport
+*/
+
+
+//! Include guard
+#pragma once
+
+
+//! Includes
+#include "pipe_transport.h"
+#include "spin_waiter.h"
+#include <atomic>
+#include <vector>
+
+
+//! Class CWin32PipeTransport
+class CWin32PipeTransport : public ITransport
+{
+public: //! Constructors and destructor
+	CWin32PipeTransport(const std::string& sName, EPipeMode eMode);
+	~CWin32PipeTransport();
+
+public: //! Interface (overrides base interface)
+	EPipeMode GetMode() const override;
+	bool IsOpen() const override;
+	bool Open() override;
+	bool Close() override;
+
+	bool Accept() override;
+	bool Disconnect() override;
+
+	EIoStatus Send(const SIoBuffer* arrBuffers, size_t nCount) override;
+	EIoStatus Receive(void* pData, size_t nSize, size_t& nRead) override;
+	EIoStatus TryReceive(void* pData, size_t nSize, size_t& nRead) override;
+	bool IsDuplex() const override;
+	// Polling waits peek the pipe without sleeping, then the read blocks as usual
+	void SetWaitStrategy(const SWaitStrategy& oStrategy) override;
+	uint64_t GetPartialWriteCount() const override;
+
+protected: //! Static helpers
+	static HANDLE CreatePipe(const std::string& sName, EPipeMode eMode);
+	static EIoStatus GetLastIoStatus();
+
+private: //! Implementation
+	// Writes the whole buffer
+	EIoStatus WriteAll(const void* pData, size_t nSize);
+
+private: //! Members
+	std::string			m_sName;
+	EPipeMode			m_eMode;
+	HANDLE				m_hHandler;
+	std::vector<byte>	m_vecSendBuffer;	// Staging buffer to send small gathers by a single write
+	CSpinWaiter			m_oWaiter;			// Polling before the blocking read
+	std::atomic<uint64_t>	m_nPartialWrites;
+};
@@ -0,0 +1,100 @@
+/*
+Implementation file for the worker pool
+*/
+
+
+//! Includes
+#include "worker_pool.h"
+#include <algorithm>
+
+
+CWorkerPool::CWorkerPool()
+{
+}
+
+CWorkerPool::~CWorkerPool()
+{
+	Stop();
+}
+
+bool CWorkerPool::Start(size_t nThreads)
+{
+	if (IsRunning())
+		return false;
+
+	if (nThreads == 0)
+		nThreads = (std::max)(1u, std::thread::hardware_concurrency());
+
+	for (size_t i = 0; i < nThreads; ++i)
+	{
+		m_vecWorkers.emplace_back(new SWorker);
+		SWorker* pWorker = m_vecWorkers.back().get();
+		pWorker->oThread = std::thread(&CWorkerPool::Run, pWorker);
+	}
+
+	return true;
+}
+
+void CWorkerPool::Stop()
+{
+	for (auto& pWorker : m_vecWorkers)
+	{
+		std::lock_guard<std::mutex> oLock(pWorker->mtxQueue);
+		pWorker->bStop = true;
+		pWorker->cvQueue.notify_one();
+	}
+
+	for (auto& pWorker : m_vecWorkers)
+	{
+		if (pWorker->oThread.joinable())
+			pWorker->oThread.join();
+	}
+
+	m_vecWorkers.clear();
+}
+
+bool CWorkerPool::IsRunning() const
+{
+	return !m_vecWorkers.empty();
+}
+
+size_t CWorkerPool::GetThreadCount() const
+{
+	return m_vecWorkers.size();
+}
+
+bool CWorkerPool::Post(uint64_t nKey, TTask fnTask)
+{
+	if (m_vecWorkers.empty())
+		return false;
+
+	SWorker* pWorker = m_vecWorkers[size_t(nKey % m_vecWorkers.size())].get();
+	{
+		std::lock_guard<std::mutex> oLock(pWorker->mtxQueue);
+		pWorker->dqTasks.push_back(std::move(fnTask));
+	}
+	pWorker->cvQueue.notify_one();
+
+	return true;
+}
+
+void CWorkerPool::Run(SWorker* pWorker)
+{
+	std::deque<TTask> dqBatch;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> oLock(pWorker->mtxQueue);
+			pWorker->cvQueue.wait(oLock, [pWorker]() { return pWorker->bStop || !pWorker->dqTasks.empty(); });
+			if (pWorker->dqTasks.empty())
+				return;
+
+			// Take everything queued so far to run it without the lock
+			dqBatch.swap(pWorker->dqTasks);
+		}
+
+		for (TTask& fnTask : dqBatch)
+			fnTask();
+		dqBatch.clear();
+	}
+}
@@ -0,0 +1,60 @@
+/*
+Declaration file for the worker pool
+*/
+
+
+//! Include guard
+#pragma once
+
+
+//! Includes
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+//! Class CWorkerPool
+// Every worker has its own queue, the tasks posted with the same key run in order on one worker
+class CWorkerPool
+{
+public: //! Types
+	typedef std::function<void()> TTask;
+
+public: //! Constructors and destructor
+	CWorkerPool();
+	~CWorkerPool();
+
+public: //! Interface
+	// Starts the workers (the number of cores if zero)
+	bool Start(size_t nThreads = 0);
+	// Runs the queued tasks and stops the workers
+	void Stop();
+	// Returns true if the workers are running
+	bool IsRunning() const;
+	// Returns the number of workers
+	size_t GetThreadCount() const;
+
+	// Queues the task on the worker chosen by the key
+	bool Post(uint64_t nKey, TTask fnTask);
+
+private: //! Types
+	struct SWorker
+	{
+		std::mutex					mtxQueue;
+		std::condition_variable		cvQueue;
+		std::deque<TTask>			dqTasks;
+		bool						bStop = false;
+		std::thread					oThread;
+	};
+
+private: //! Implementation
+	static void Run(SWorker* pWorker);
+
+private: //! Members
+	std::vector<std::unique_ptr<SWorker>>	m_vecWorkers;
+};
@@ -0,0 +1,896 @@
+/*
+Python extension module of the named pipe
+
+named_pipe.NamedPipe wraps CNamedPipe, its blocking calls release the GIL. named_pipe.AsyncPipe
+wraps CAsyncPipe driven by one CIoLoop of the module, its calls return asyncio futures completed
+from the loop thread. The writes take any object of the buffer protocol without copying it, the
+reads return bytes, fill the caller's buffer or return a memoryview of a pooled buffer.
+The frames are the same as on the C++ side, so the module talks to the C++ readers and writers.
+*/
+
+
+//! Includes
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include "async_pipe.h"
+#include "named_pipe.h"
+#include <new>
+
+
+//! Module state
+static PyObject*		g_pPipeError = nullptr;		// named_pipe.PipeError
+static PyObject*		g_pComplete = nullptr;		// named_pipe._complete, completes the future on its loop
+static PyObject*		g_pGetRunningLoop = nullptr;	// asyncio.get_running_loop
+static CIoLoopPtr*		g_pIoLoop = nullptr;		// Loop of the asynchronous pipes, started by the first one
+
+
+//! Error helpers
+typedef CNamedPipe::EPipeError EPipeError;
+
+static const char* GetErrorText(EPipeError eError)
+{
+	switch (eError)
+	{
+	case EPipeError::None:			return "no error";
+	case EPipeError::NotOpen:		return "the pipe is not opened";
+	case EPipeError::InvalidMode:	return "the operation doesn't match the pipe mode";
+	case EPipeError::IoFailure:		return "the system call failed";
+	case EPipeError::Disconnected:	return "the other side has closed the connection";
+	case EPipeError::InvalidFrame:	return "received bytes are not a valid frame";
+	case EPipeError::FrameTooLarge:	return "payload exceeds the maximum message size";
+	case EPipeError::Cancelled:		return "the operation has been cancelled";
+	case EPipeError::TimedOut:		return "the operation has not completed in time";
+	case EPipeError::NoCredit:		return "the reader hasn't granted enough credits";
+	case EPipeError::ChecksumMismatch:	return "the checksum of the received frame doesn't match";
+	case EPipeError::AuthenticationFailed:	return "the frame is not sealed by the key of the session";
+	case EPipeError::Overrun:		return "the subscriber has fallen a whole ring behind the publisher";
+	}
+	return "unknown error";
+}
+
+// Returns new PipeError(code, text)
+static PyObject* MakePipeError(EPipeError eError)
+{
+	return PyObject_CallFunction(g_pPipeError, "is", int(eError), GetErrorText(eError));
+}
+
+// Raises PipeError, returns nullptr
+static PyObject* RaisePipeError(EPipeError eError)
+{
+	PyObject* pError = MakePipeError(eError);
+	if (pError != nullptr)
+	{
+		PyErr_SetObject(g_pPipeError, pError);
+		Py_DECREF(pError);
+	}
+	return nullptr;
+}
+
+static bool ParseMode(int nMode, EPipeMode& eMode)
+{
+	if (nMode != int(EPipeMode::Read) && nMode != int(EPipeMode::Write))
+	{
+		PyErr_SetString(PyExc_ValueError, "mode must be named_pipe.READ or named_pipe.WRITE");
+		return false;
+	}
+	eMode = EPipeMode(nMode);
+	return true;
+}
+
+// Passes the key (bytes-like or None) to the setter, raises PipeError if the pipe is opened
+static PyObject* SetEncryptionKey(PyObject* pKey, bool bOpen, const std::function<bool(const void*, size_t)>& fnSetKey)
+{
+	if (bOpen)
+		return RaisePipeError(EPipeError::InvalidMode);
+	if (pKey == Py_None)
+	{
+		fnSetKey(nullptr, 0);
+		Py_RETURN_NONE;
+	}
+
+	Py_buffer oKey;
+	if (PyObject_GetBuffer(pKey, &oKey, PyBUF_SIMPLE) != 0)
+		return nullptr;
+	const bool bOk = fnSetKey(oKey.buf, size_t(oKey.len));
+	PyBuffer_Release(&oKey);
+	if (!bOk)
+	{
+		PyErr_SetString(PyExc_ValueError, "key must be 16 or 32 bytes");
+		return nullptr;
+	}
+	Py_RETURN_NONE;
+}
+
+
+// Returns the dictionary of the metrics snapshot: counters, gauges and latency_ns by their names
+static PyObject* MakeMetricsDict(const SPipeMetrics& oMetrics)
+{
+	PyObject* pCounters = PyDict_New();
+	PyObject* pGauges = PyDict_New();
+	PyObject* pLatencies = PyDict_New();
+	bool bOk = (pCounters != nullptr) && (pGauges != nullptr) && (pLatencies != nullptr);
+	for (size_t nIndex = 0; bOk && nIndex < size_t(EPipeCounter::Count); ++nIndex)
+	{
+		PyObject* pValue = PyLong_FromUnsignedLongLong(oMetrics.arrCounters[nIndex]);
+		bOk = (pValue != nullptr) && PyDict_SetItemString(pCounters, GetMetricName(EPipeCounter(nIndex)), pValue) == 0;
+		Py_XDECREF(pValue);
+	}
+	for (size_t nIndex = 0; bOk && nIndex < size_t(EPipeGauge::Count); ++nIndex)
+	{
+		PyObject* pValue = PyLong_FromLongLong(oMetrics.arrGauges[nIndex]);
+		bOk = (pValue != nullptr) && PyDict_SetItemString(pGauges, GetMetricName(EPipeGauge(nIndex)), pValue) == 0;
+		Py_XDECREF(pValue);
+	}
+	for (size_t nIndex = 0; bOk && nIndex < size_t(EPipeLatency::Count); ++nIndex)
+	{
+		const SLatencySummary& oLatency = oMetrics.arrLatencies[nIndex];
+		PyObject* pValue = Py_BuildValue("{sKsKsKsKsKsKsKsK}", "count", oLatency.nCount, "min", oLatency.nMin, "max", oLatency.nMax,
+			"mean", oLatency.nMean, "p50", oLatency.nP50, "p90", oLatency.nP90, "p99", oLatency.nP99, "p999", oLatency.nP999);
+		bOk = (pValue != nullptr) && PyDict_SetItemString(pLatencies, GetMetricName(EPipeLatency(nIndex)), pValue) == 0;
+		Py_XDECREF(pValue);
+	}
+
+	PyObject* pResult = bOk ? Py_BuildValue("{sKsOsOsO}", "timestamp_ns", oMetrics.nTimestampNs, "counters", pCounters,
+		"gauges", pGauges, "latency_ns", pLatencies) : nullptr;
+	Py_XDECREF(pCounters);
+	Py_XDECREF(pGauges);
+	Py_XDECREF(pLatencies);
+	return pResult;
+}
+
+
+//! Buffer object: owns the pooled buffer of a received payload, exported as a memoryview
+struct SBufferObject
+{
+	PyObject_HEAD
+	CPooledBuffer	oBuffer;
+};
+
+static PyTypeObject g_oBufferType = { PyVarObject_HEAD_INIT(nullptr, 0) "named_pipe.Buffer" };
+
+static void Buffer_Dealloc(SBufferObject* pSelf)
+{
+	pSelf->oBuffer.~CPooledBuffer();
+	Py_TYPE(pSelf)->tp_free(reinterpret_cast<PyObject*>(pSelf));
+}
+
+static int Buffer_GetBuffer(SBufferObject* pSelf, Py_buffer* pView, int nFlags)
+{
+	return PyBuffer_FillInfo(pView, reinterpret_cast<PyObject*>(pSelf), pSelf->oBuffer.GetData(), Py_ssize_t(pSelf->oBuffer.GetSize()), 0, nFlags);
+}
+
+static PyBufferProcs g_oBufferProcs = { reinterpret_cast<getbufferproc>(Buffer_GetBuffer), nullptr };
+
+// Returns the memoryview of the payload, the pooled buffer goes back to the pool with the last view
+static PyObject* MakeMemoryView(CPooledBuffer&& oPayload)
+{
+	SBufferObject* pBuffer = PyObject_New(SBufferObject, &g_oBufferType);
+	if (pBuffer == nullptr)
+		return nullptr;
+	new (&pBuffer->oBuffer) CPooledBuffer(std::move(oPayload));
+
+	PyObject* pView = PyMemoryView_FromObject(reinterpret_cast<PyObject*>(pBuffer));
+	Py_DECREF(pBuffer);
+	return pView;
+}
+
+
+//! NamedPipe object
+struct SNamedPipeObject
+{
+	PyObject_HEAD
+	CNamedPipe*		pPipe;
+};
+
+static PyTypeObject g_oNamedPipeType = { PyVarObject_HEAD_INIT(nullptr, 0) "named_pipe.NamedPipe" };
+
+static int NamedPipe_Init(SNamedPipeObject* pSelf, PyObject* pArgs, PyObject* pKeywords)
+{
+	static const char* arrKeywords[] = { "name", "mode", nullptr };
+	const char* szName = nullptr;
+	int nMode = 0;
+	EPipeMode eMode;
+	if (!PyArg_ParseTupleAndKeywords(pArgs, pKeywords, "si", const_cast<char**>(arrKeywords), &szName, &nMode) || !ParseMode(nMode, eMode))
+		return -1;
+
+	delete pSelf->pPipe;
+	pSelf->pPipe = new CNamedPipe(szName, eMode);
+	return 0;
+}
+
+static void NamedPipe_Dealloc(SNamedPipeObject* pSelf)
+{
+	delete pSelf->pPipe;
+	Py_TYPE(pSelf)->tp_free(reinterpret_cast<PyObject*>(pSelf));
+}
+
+static CNamedPipe* GetPipe(SNamedPipeObject* pSelf)
+{
+	if (pSelf->pPipe == nullptr)
+		PyErr_SetString(PyExc_RuntimeError, "NamedPipe.__init__ has not been called");
+	return pSelf->pPipe;
+}
+
+static PyObject* NamedPipe_Open(SNamedPipeObject* pSelf, PyObject*)
+{
+	CNamedPipe* pPipe = GetPipe(pSelf);
+	if (pPipe == nullptr)
+		return nullptr;
+
+	bool bOk;
+	Py_BEGIN_ALLOW_THREADS
+	bOk = pPipe->Open();
+	Py_END_ALLOW_THREADS
+	return PyBool_FromLong(bOk);
+}
+
+static PyObject* NamedPipe_Close(SNamedPipeObject* pSelf, PyObject*)
+{
+	CNamedPipe* pPipe = GetPipe(pSelf);
+	if (pPipe == nullptr)
+		return nullptr;
+
+	bool bOk;
+	Py_BEGIN_ALLOW_THREADS
+	bOk = pPipe->Close();
+	Py_END_ALLOW_THREADS
+	return PyBool_FromLong(bOk);
+}
+
+static PyObject* NamedPipe_IsOpen(SNamedPipeObject* pSelf, PyObject*)
+{
+	CNamedPipe* pPipe = GetPipe(pSelf);
+	return (pPipe != nullptr) ? PyBool_FromLong(pPipe->IsOpen()) : nullptr;
+}
+
+static PyObject* NamedPipe_IsConnected(SNamedPipeObject* pSelf, PyObject*)
+{
+	CNamedPipe* pPipe = GetPipe(pSelf);
+	return (pPipe != nullptr) ? PyBool_FromLong(pPipe->IsConnected()) : nullptr;
+}
+
+static PyObject* NamedPipe_Send(SNamedPipeObject* pSelf, PyObject* pArgs)
+{
+	CNamedPipe* pPipe = GetPipe(pSelf);
+	Py_buffer oData;
+	if (pPipe == nullptr || !PyArg_ParseTuple(pArgs, "y*", &oData))
+		return nullptr;
+
+	// The payload is written straight from the caller's object
+	bool bOk;
+	Py_BEGIN_ALLOW_THREADS
+	bOk = pPipe->SendData(oData.buf, size_t(oData.len));
+	Py_END_ALLOW_THREADS
+	PyBuffer_Release(&oData);
+	if (!bOk)
+		return RaisePipeError(pPipe->GetLastPipeError());
+
+	Py_RETURN_NONE;
+}
+
+// Receives the next data frame into a pooled buffer (GIL released)
+static bool ReceivePooled(CNamedPipe* pPipe, CPooledBuffer& oPayload)
+{
+	bool bOk;
+	Py_BEGIN_ALLOW_THREADS
+	SFrameHeader oHeader;
+	while ((bOk = pPipe->ReceiveFrame(oHeader, oPayload)) && oHeader.nType != uint16_t(EFrameType::Data))
+		oPayload.Release();
+	Py_END_ALLOW_THREADS
+	return bOk;
+}
+
+static PyObject* NamedPipe_Receive(SNamedPipeObject* pSelf, PyObject*)
+{
+	CNamedPipe* pPipe = GetPipe(pSelf);
+	if (pPipe == nullptr)
+		return nullptr;
+
+	CPooledBuffer oPayload;
+	if (!ReceivePooled(pPipe, oPayload))
+		return RaisePipeError(pPipe->GetLastPipeError());
+
+	return PyBytes_FromStringAndSize(reinterpret_cast<const char*>(oPayload.GetData()), Py_ssize_t(oPayload.GetSize()));
+}
+
+static PyObject* NamedPipe_ReceiveBuffer(SNamedPipeObject* pSelf, PyObject*)
+{
+	CNamedPipe* pPipe = GetPipe(pSelf);
+	if (pPipe == nullptr)
+		return nullptr;
+
+	CPooledBuffer oPayload;
+	if (!ReceivePooled(pPipe, oPayload))
+		return RaisePipeError(pPipe->GetLastPipeError());
+
+	return MakeMemoryView(std::move(oPayload));
+}
+
+static PyObject* NamedPipe_ReceiveInto(SNamedPipeObject* pSelf, PyObject* pArgs)
+{
+	CNamedPipe* pPipe = GetPipe(pSelf);
+	Py_buffer oBuffer;
+	if (pPipe == nullptr || !PyArg_ParseTuple(pArgs, "w*", &oBuffer))
+		return nullptr;
+
+	// The payload is read straight into the caller's object, too large one is skipped
+	bool bOk;
+	SByteSpan oPayload;
+	Py_BEGIN_ALLOW_THREADS
+	SFrameHeader oHeader;
+	while ((bOk = pPipe->ReceiveFrame(oHeader, oBuffer.buf, size_t(oBuffer.len), oPayload)) && oHeader.nType != uint16_t(EFrameType::Data))
+		;
+	Py_END_ALLOW_THREADS
+	PyBuffer_Release(&oBuffer);
+	if (!bOk)
+		return RaisePipeError(pPipe->GetLastPipeError());
+
+	return PyLong_FromSize_t(oPayload.nSize);
+}
+
+static PyObject* NamedPipe_SetSessionMode(SNamedPipeObject* pSelf, PyObject* pArgs)
+{
+	CNamedPipe* pPipe = GetPipe(pSelf);
+	int bEnable = 0;
+	if (pPipe == nullptr || !PyArg_ParseTuple(pArgs, "p", &bEnable))
+		return nullptr;
+
+	pPipe->SetSessionMode(bEnable != 0);
+	Py_RETURN_NONE;
+}
+
+static PyObject* NamedPipe_SetChecksum(SNamedPipeObject* pSelf, PyObject* pArgs)
+{
+	CNamedPipe* pPipe = GetPipe(pSelf);
+	int bEnable = 0;
+	if (pPipe == nullptr || !PyArg_ParseTuple(pArgs, "p", &bEnable))
+		return nullptr;
+
+	pPipe->SetChecksum(bEnable != 0);
+	Py_RETURN_NONE;
+}
+
+static PyObject* NamedPipe_SetEncryption(SNamedPipeObject* pSelf, PyObject* pArgs)
+{
+	CNamedPipe* pPipe = GetPipe(pSelf);
+	PyObject* pKey = nullptr;
+	if (pPipe == nullptr || !PyArg_ParseTuple(pArgs, "O", &pKey))
+		return nullptr;
+
+	return SetEncryptionKey(pKey, pPipe->IsOpen(), [pPipe](const void* pData, size_t nSize) { return pPipe->SetEncryption(pData, nSize); });
+}
+
+static PyObject* NamedPipe_SetAutoReconnect(SNamedPipeObject* pSelf, PyObject* pArgs)
+{
+	CNamedPipe* pPipe = GetPipe(pSelf);
+	int bEnable = 0;
+	unsigned int nTimeoutMs = 5000;
+	if (pPipe == nullptr || !PyArg_ParseTuple(pArgs, "p|I", &bEnable, &nTimeoutMs))
+		return nullptr;
+
+	pPipe->SetAutoReconnect(bEnable != 0, nTimeoutMs);
+	Py_RETURN_NONE;
+}
+
+static PyObject* NamedPipe_SetMaxMessageSize(SNamedPipeObject* pSelf, PyObject* pArgs)
+{
+	CNamedPipe* pPipe = GetPipe(pSelf);
+	unsigned int nMaxSize = 0;
+	if (pPipe == nullptr || !PyArg_ParseTuple(pArgs, "I", &nMaxSize))
+		return nullptr;
+
+	pPipe->SetMaxMessageSize(nMaxSize);
+	Py_RETURN_NONE;
+}
+
+static PyObject* NamedPipe_EnableMetrics(SNamedPipeObject* pSelf, PyObject* pArgs)
+{
+	CNamedPipe* pPipe = GetPipe(pSelf);
+	int bEnable = 0;
+	if (pPipe == nullptr || !PyArg_ParseTuple(pArgs, "p", &bEnable))
+		return nullptr;
+
+	if (!pPipe->EnableMetrics(bEnable != 0))
+		return RaisePipeError(pPipe->GetLastPipeError());
+	Py_RETURN_NONE;
+}
+
+static PyObject* NamedPipe_Metrics(SNamedPipeObject* pSelf, PyObject*)
+{
+	CNamedPipe* pPipe = GetPipe(pSelf);
+	if (pPipe == nullptr)
+		return nullptr;
+
+	SPipeMetrics oMetrics;
+	if (!pPipe->GetMetrics(oMetrics))
+		Py_RETURN_NONE;
+	return MakeMetricsDict(oMetrics);
+}
+
+static PyObject* NamedPipe_Enter(SNamedPipeObject* pSelf, PyObject*)
+{
+	Py_INCREF(pSelf);
+	return reinterpret_cast<PyObject*>(pSelf);
+}
+
+static PyObject* NamedPipe_Exit(SNamedPipeObject* pSelf, PyObject*)
+{
+	PyObject* pResult = NamedPipe_Close(pSelf, nullptr);
+	if (pResult == nullptr)
+		return nullptr;
+	Py_DECREF(pResult);
+	Py_RETURN_FALSE;
+}
+
+static PyMethodDef g_arrNamedPipeMethods[] =
+{
+	{ "open", reinterpret_cast<PyCFunction>(NamedPipe_Open), METH_NOARGS, "Opens the pipe, returns False if it's opened or fails" },
+	{ "close", reinterpret_cast<PyCFunction>(NamedPipe_Close), METH_NOARGS, "Closes the pipe" },
+	{ "is_open", reinterpret_cast<PyCFunction>(NamedPipe_IsOpen), METH_NOARGS, "Returns True if the pipe is opened" },
+	{ "is_connected", reinterpret_cast<PyCFunction>(NamedPipe_IsConnected), METH_NOARGS, "Returns True if the other side is connected" },
+	{ "send", reinterpret_cast<PyCFunction>(NamedPipe_Send), METH_VARARGS, "send(data): writes the bytes-like object as one message" },
+	{ "receive", reinterpret_cast<PyCFunction>(NamedPipe_Receive), METH_NOARGS, "Waits for the next message, returns bytes" },
+	{ "receive_buffer", reinterpret_cast<PyCFunction>(NamedPipe_ReceiveBuffer), METH_NOARGS,
+		"Waits for the next message, returns a memoryview of the pooled buffer it was read into" },
+	{ "receive_into", reinterpret_cast<PyCFunction>(NamedPipe_ReceiveInto), METH_VARARGS,
+		"receive_into(buffer): waits for the next message, reads it into the writable buffer and returns its size" },
+	{ "set_session_mode", reinterpret_cast<PyCFunction>(NamedPipe_SetSessionMode), METH_VARARGS,
+		"set_session_mode(enable): the reader keeps the writer connected between the messages" },
+	{ "set_checksum", reinterpret_cast<PyCFunction>(NamedPipe_SetChecksum), METH_VARARGS,
+		"set_checksum(enable): the writer appends the CRC32C of every frame, the reader checks any it gets" },
+	{ "set_encryption", reinterpret_cast<PyCFunction>(NamedPipe_SetEncryption), METH_VARARGS,
+		"set_encryption(key): seals the messages by AES-GCM with the shared 16 or 32 byte key, None turns it off (before open)" },
+	{ "set_auto_reconnect", reinterpret_cast<PyCFunction>(NamedPipe_SetAutoReconnect), METH_VARARGS,
+		"set_auto_reconnect(enable, timeout_ms=5000): the writer reopens the pipe when the reader has gone" },
+	{ "set_max_message_size", reinterpret_cast<PyCFunction>(NamedPipe_SetMaxMessageSize), METH_VARARGS,
+		"set_max_message_size(size): sets the maximum accepted payload size" },
+	{ "enable_metrics", reinterpret_cast<PyCFunction>(NamedPipe_EnableMetrics), METH_VARARGS,
+		"enable_metrics(enable): turns the counters and latency histograms on or off (before open)" },
+	{ "metrics", reinterpret_cast<PyCFunction>(NamedPipe_Metrics), METH_NOARGS,
+		"Returns the metrics snapshot as a dict (counters, gauges, latency_ns), None if they are off" },
+	{ "__enter__", reinterpret_cast<PyCFunction>(NamedPipe_Enter), METH_NOARGS, nullptr },
+	{ "__exit__", reinterpret_cast<PyCFunction>(NamedPipe_Exit), METH_VARARGS, nullptr },
+	{ nullptr, nullptr, 0, nullptr }
+};
+
+
+//! Completion of the asyncio futures
+// References of the future and its loop, released under the GIL
+struct SCompletion
+{
+	PyObject*	pLoop = nullptr;
+	PyObject*	pFuture = nullptr;
+	Py_buffer	oData;				// Send: the payload being written
+	bool		bData = false;
+};
+
+typedef std::shared_ptr<SCompletion> SCompletionPtr;
+
+// Creates the future of the running asyncio loop, returns nullptr with the exception set
+static SCompletionPtr MakeCompletion()
+{
+	PyObject* pLoop = PyObject_CallNoArgs(g_pGetRunningLoop);
+	if (pLoop == nullptr)
+		return nullptr;
+	PyObject* pFuture = PyObject_CallMethod(pLoop, "create_future", nullptr);
+	if (pFuture == nullptr)
+	{
+		Py_DECREF(pLoop);
+		return nullptr;
+	}
+
+	SCompletionPtr pCompletion = std::make_shared<SCompletion>();
+	pCompletion->pLoop = pLoop;
+	pCompletion->pFuture = pFuture;
+	return pCompletion;
+}
+
+// Hands the result or the exception (steals the reference) to the loop of the future, called under the GIL
+static void Complete(SCompletion& oCompletion, PyObject* pResult, PyObject* pException)
+{
+	if (pResult == nullptr && pException == nullptr)
+	{
+		// Building the result has failed, the future gets that exception
+		PyObject* pType = nullptr;
+		PyObject* pTraceback = nullptr;
+		PyErr_Fetch(&pType, &pException, &pTraceback);
+		PyErr_NormalizeException(&pType, &pException, &pTraceback);
+		Py_XDECREF(pType);
+		Py_XDECREF(pTraceback);
+	}
+
+	PyObject* pCall = PyObject_CallMethod(oCompletion.pLoop, "call_soon_threadsafe", "OOOO", g_pComplete, oCompletion.pFuture,
+		pResult != nullptr ? pResult : Py_None, pException != nullptr ? pException : Py_None);
+	// The loop may be closed already, nobody waits for the future then
+	if (pCall == nullptr)
+		PyErr_Clear();
+	Py_XDECREF(pCall);
+	Py_XDECREF(pResult);
+	Py_XDECREF(pException);
+
+	if (oCompletion.bData)
+		PyBuffer_Release(&oCompletion.oData);
+	oCompletion.bData = false;
+	Py_CLEAR(oCompletion.pFuture);
+	Py_CLEAR(oCompletion.pLoop);
+}
+
+// _complete(future, result, exception): runs on the loop of the future
+static PyObject* Module_Complete(PyObject*, PyObject* pArgs)
+{
+	PyObject* pFuture = nullptr;
+	PyObject* pResult = nullptr;
+	PyObject* pException = nullptr;
+	if (!PyArg_ParseTuple(pArgs, "OOO", &pFuture, &pResult, &pException))
+		return nullptr;
+
+	// The awaiting task may have been cancelled
+	PyObject* pDone = PyObject_CallMethod(pFuture, "done", nullptr);
+	if (pDone == nullptr)
+		return nullptr;
+	const int nDone = PyObject_IsTrue(pDone);
+	Py_DECREF(pDone);
+	if (nDone != 0)
+	{
+		if (nDone < 0)
+			return nullptr;
+		Py_RETURN_NONE;
+	}
+
+	PyObject* pCall = (pException != Py_None) ? PyObject_CallMethod(pFuture, "set_exception", "O", pException) :
+		PyObject_CallMethod(pFuture, "set_result", "O", pResult);
+	if (pCall == nullptr)
+		return nullptr;
+	Py_DECREF(pCall);
+	Py_RETURN_NONE;
+}
+
+static CIoLoopPtr GetIoLoop()
+{
+	if (g_pIoLoop == nullptr)
+	{
+		CIoLoopPtr pLoop = std::make_shared<CIoLoop>();
+		if (!pLoop->Start())
+			return nullptr;
+		g_pIoLoop = new CIoLoopPtr(pLoop);
+	}
+	return *g_pIoLoop;
+}
+
+// _shutdown(): stops the loop of the asynchronous pipes, their pending futures fail with CANCELLED
+static PyObject* Module_Shutdown(PyObject*, PyObject*)
+{
+	if (g_pIoLoop != nullptr)
+	{
+		CIoLoopPtr pLoop = *g_pIoLoop;
+		delete g_pIoLoop;
+		g_pIoLoop = nullptr;
+		// The completions of the stopped operations take the GIL
+		Py_BEGIN_ALLOW_THREADS
+		pLoop->Stop();
+		Py_END_ALLOW_THREADS
+	}
+	Py_RETURN_NONE;
+}
+
+
+//! AsyncPipe object
+struct SAsyncPipeObject
+{
+	PyObject_HEAD
+	CAsyncPipePtr	pPipe;
+};
+
+static PyTypeObject g_oAsyncPipeType = { PyVarObject_HEAD_INIT(nullptr, 0) "named_pipe.AsyncPipe" };
+
+static PyObject* AsyncPipe_New(PyTypeObject* pType, PyObject*, PyObject*)
+{
+	SAsyncPipeObject* pSelf = reinterpret_cast<SAsyncPipeObject*>(pType->tp_alloc(pType, 0));
+	if (pSelf != nullptr)
+		new (&pSelf->pPipe) CAsyncPipePtr();
+	return reinterpret_cast<PyObject*>(pSelf);
+}
+
+static int AsyncPipe_Init(SAsyncPipeObject* pSelf, PyObject* pArgs, PyObject* pKeywords)
+{
+	static const char* arrKeywords[] = { "name", "mode", nullptr };
+	const char* szName = nullptr;
+	int nMode = 0;
+	EPipeMode eMode;
+	if (!PyArg_ParseTupleAndKeywords(pArgs, pKeywords, "si", const_cast<char**>(arrKeywords), &szName, &nMode) || !ParseMode(nMode, eMode))
+		return -1;
+
+	CIoLoopPtr pLoop = GetIoLoop();
+	if (pLoop == nullptr)
+	{
+		PyErr_SetString(PyExc_RuntimeError, "failed to start the I/O loop");
+		return -1;
+	}
+	if (pSelf->pPipe != nullptr)
+		pSelf->pPipe->Close();
+	pSelf->pPipe = CAsyncPipe::Create(pLoop, szName, eMode);
+	return 0;
+}
+
+static void AsyncPipe_Dealloc(SAsyncPipeObject* pSelf)
+{
+	if (pSelf->pPipe != nullptr)
+		pSelf->pPipe->Close();
+	pSelf->pPipe.~CAsyncPipePtr();
+	Py_TYPE(pSelf)->tp_free(reinterpret_cast<PyObject*>(pSelf));
+}
+
+static CAsyncPipePtr GetPipe(SAsyncPipeObject* pSelf)
+{
+	if (pSelf->pPipe == nullptr)
+		PyErr_SetString(PyExc_RuntimeError, "AsyncPipe.__init__ has not been called");
+	return pSelf->pPipe;
+}
+
+static PyObject* AsyncPipe_Open(SAsyncPipeObject* pSelf, PyObject*)
+{
+	CAsyncPipePtr pPipe = GetPipe(pSelf);
+	if (pPipe == nullptr)
+		return nullptr;
+
+	bool bOk;
+	Py_BEGIN_ALLOW_THREADS
+	bOk = pPipe->Open();
+	Py_END_ALLOW_THREADS
+	return PyBool_FromLong(bOk);
+}
+
+static PyObject* AsyncPipe_Close(SAsyncPipeObject* pSelf, PyObject*)
+{
+	CAsyncPipePtr pPipe = GetPipe(pSelf);
+	if (pPipe == nullptr)
+		return nullptr;
+
+	pPipe->Close();
+	Py_RETURN_NONE;
+}
+
+static PyObject* AsyncPipe_IsOpen(SAsyncPipeObject* pSelf, PyObject*)
+{
+	CAsyncPipePtr pPipe = GetPipe(pSelf);
+	return (pPipe != nullptr) ? PyBool_FromLong(pPipe->IsOpen()) : nullptr;
+}
+
+static PyObject* AsyncPipe_Cancel(SAsyncPipeObject* pSelf, PyObject*)
+{
+	CAsyncPipePtr pPipe = GetPipe(pSelf);
+	if (pPipe == nullptr)
+		return nullptr;
+
+	pPipe->Cancel();
+	Py_RETURN_NONE;
+}
+
+static PyObject* AsyncPipe_Receive(SAsyncPipeObject* pSelf, PyObject* pArgs, PyObject* pKeywords)
+{
+	static const char* arrKeywords[] = { "timeout_ms", nullptr };
+	unsigned int nTimeoutMs = 0;
+	CAsyncPipePtr pPipe = GetPipe(pSelf);
+	if (pPipe == nullptr || !PyArg_ParseTupleAndKeywords(pArgs, pKeywords, "|I", const_cast<char**>(arrKeywords), &nTimeoutMs))
+		return nullptr;
+	SCompletionPtr pCompletion = MakeCompletion();
+	if (pCompletion == nullptr)
+		return nullptr;
+
+	PyObject* pFuture = pCompletion->pFuture;
+	Py_INCREF(pFuture);
+	pPipe->ReceiveAsync([pCompletion](CAsyncPipe::SReceiveResult&& oResult)
+	{
+		if (!Py_IsInitialized())
+			return;
+		PyGILState_STATE eState = PyGILState_Ensure();
+		if (oResult.eError == EPipeError::None)
+			Complete(*pCompletion, MakeMemoryView(std::move(oResult.oPayload)), nullptr);
+		else
+			Complete(*pCompletion, nullptr, MakePipeError(oResult.eError));
+		PyGILState_Release(eState);
+	}, nTimeoutMs);
+
+	return pFuture;
+}
+
+static PyObject* AsyncPipe_Send(SAsyncPipeObject* pSelf, PyObject* pArgs, PyObject* pKeywords)
+{
+	static const char* arrKeywords[] = { "data", "timeout_ms", nullptr };
+	unsigned int nTimeoutMs = 0;
+	Py_buffer oData;
+	CAsyncPipePtr pPipe = GetPipe(pSelf);
+	if (pPipe == nullptr || !PyArg_ParseTupleAndKeywords(pArgs, pKeywords, "y*|I", const_cast<char**>(arrKeywords), &oData, &nTimeoutMs))
+		return nullptr;
+	SCompletionPtr pCompletion = MakeCompletion();
+	if (pCompletion == nullptr)
+	{
+		PyBuffer_Release(&oData);
+		return nullptr;
+	}
+
+	// The caller's object is held and written from until the send completes
+	pCompletion->oData = oData;
+	pCompletion->bData = true;
+	PyObject* pFuture = pCompletion->pFuture;
+	Py_INCREF(pFuture);
+	pPipe->SendAsync(oData.buf, size_t(oData.len), [pCompletion](EPipeError eError)
+	{
+		if (!Py_IsInitialized())
+			return;
+		PyGILState_STATE eState = PyGILState_Ensure();
+		if (eError == EPipeError::None)
+		{
+			Py_INCREF(Py_None);
+			Complete(*pCompletion, Py_None, nullptr);
+		}
+		else
+			Complete(*pCompletion, nullptr, MakePipeError(eError));
+		PyGILState_Release(eState);
+	}, nTimeoutMs);
+
+	return pFuture;
+}
+
+static PyObject* AsyncPipe_SetMaxMessageSize(SAsyncPipeObject* pSelf, PyObject* pArgs)
+{
+	CAsyncPipePtr pPipe = GetPipe(pSelf);
+	unsigned int nMaxSize = 0;
+	if (pPipe == nullptr || !PyArg_ParseTuple(pArgs, "I", &nMaxSize))
+		return nullptr;
+
+	pPipe->SetMaxMessageSize(nMaxSize);
+	Py_RETURN_NONE;
+}
+
+static PyObject* AsyncPipe_SetEncryption(SAsyncPipeObject* pSelf, PyObject* pArgs)
+{
+	CAsyncPipePtr pPipe = GetPipe(pSelf);
+	PyObject* pKey = nullptr;
+	if (pPipe == nullptr || !PyArg_ParseTuple(pArgs, "O", &pKey))
+		return nullptr;
+
+	return SetEncryptionKey(pKey, pPipe->IsOpen(), [pPipe](const void* pData, size_t nSize) { return pPipe->SetEncryption(pData, nSize); });
+}
+
+static PyObject* AsyncPipe_EnableMetrics(SAsyncPipeObject* pSelf, PyObject* pArgs)
+{
+	CAsyncPipePtr pPipe = GetPipe(pSelf);
+	int bEnable = 0;
+	if (pPipe == nullptr || !PyArg_ParseTuple(pArgs, "p", &bEnable))
+		return nullptr;
+
+	if (!pPipe->EnableMetrics(bEnable != 0))
+		return RaisePipeError(EPipeError::InvalidMode);
+	Py_RETURN_NONE;
+}
+
+static PyObject* AsyncPipe_Metrics(SAsyncPipeObject* pSelf, PyObject*)
+{
+	CAsyncPipePtr pPipe = GetPipe(pSelf);
+	if (pPipe == nullptr)
+		return nullptr;
+
+	SPipeMetrics oMetrics;
+	if (!pPipe->GetMetrics(oMetrics))
+		Py_RETURN_NONE;
+	return MakeMetricsDict(oMetrics);
+}
+
+static PyMethodDef g_arrAsyncPipeMethods[] =
+{
+	{ "open", reinterpret_cast<PyCFunction>(AsyncPipe_Open), METH_NOARGS, "Opens the pipe, returns False if it's opened or fails" },
+	{ "close", reinterpret_cast<PyCFunction>(AsyncPipe_Close), METH_NOARGS, "Closes the pipe, the pending futures fail with CANCELLED" },
+	{ "is_open", reinterpret_cast<PyCFunction>(AsyncPipe_IsOpen), METH_NOARGS, "Returns True if the pipe is opened" },
+	{ "cancel", reinterpret_cast<PyCFunction>(AsyncPipe_Cancel), METH_NOARGS, "Fails the pending futures with CANCELLED" },
+	{ "receive", reinterpret_cast<PyCFunction>(AsyncPipe_Receive), METH_VARARGS | METH_KEYWORDS,
+		"receive(timeout_ms=0): returns the future of the next message (memoryview of a pooled buffer). "
+		"A timed out receive loses no data, a cancelled awaiting task may lose the message that completes it" },
+	{ "send", reinterpret_cast<PyCFunction>(AsyncPipe_Send), METH_VARARGS | METH_KEYWORDS,
+		"send(data, timeout_ms=0): returns the future of writing the bytes-like object as one message" },
+	{ "set_max_message_size", reinterpret_cast<PyCFunction>(AsyncPipe_SetMaxMessageSize), METH_VARARGS,
+		"set_max_message_size(size): sets the maximum accepted payload size (applies to the next open)" },
+	{ "set_encryption", reinterpret_cast<PyCFunction>(AsyncPipe_SetEncryption), METH_VARARGS,
+		"set_encryption(key): seals the messages by AES-GCM with the shared 16 or 32 byte key, None turns it off (before open)" },
+	{ "enable_metrics", reinterpret_cast<PyCFunction>(AsyncPipe_EnableMetrics), METH_VARARGS,
+		"enable_metrics(enable): turns the counters and latency histograms on or off (before open)" },
+	{ "metrics", reinterpret_cast<PyCFunction>(AsyncPipe_Metrics), METH_NOARGS,
+		"Returns the metrics snapshot as a dict (counters, gauges, latency_ns), None if they are off" },
+	{ nullptr, nullptr, 0, nullptr }
+};
+
+
+//! Module
+static PyMethodDef g_arrModuleMethods[] =
+{
+	{ "_complete", Module_Complete, METH_VARARGS, nullptr },
+	{ "_shutdown", Module_Shutdown, METH_NOARGS, nullptr },
+	{ nullptr, nullptr, 0, nullptr }
+};
+
+static PyModuleDef g_oModule =
+{
+	PyModuleDef_HEAD_INIT, "named_pipe", "Named pipe of the C++ side: blocking, asyncio and zero-copy reads and writes", -1,
+	g_arrModuleMethods
+};
+
+static bool AddInteger(PyObject* pModule, const char* szName, long nValue)
+{
+	return PyModule_AddIntConstant(pModule, szName, nValue) == 0;
+}
+
+PyMODINIT_FUNC PyInit_named_pipe()
+{
+	g_oBufferType.tp_basicsize = sizeof(SBufferObject);
+	g_oBufferType.tp_dealloc = reinterpret_cast<destructor>(Buffer_Dealloc);
+	g_oBufferType.tp_as_buffer = &g_oBufferProcs;
+	g_oBufferType.tp_flags = Py_TPFLAGS_DEFAULT;
+	g_oBufferType.tp_doc = "Pooled buffer of a received message";
+
+	g_oNamedPipeType.tp_basicsize = sizeof(SNamedPipeObject);
+	g_oNamedPipeType.tp_dealloc = reinterpret_cast<destructor>(NamedPipe_Dealloc);
+	g_oNamedPipeType.tp_flags = Py_TPFLAGS_DEFAULT;
+	g_oNamedPipeType.tp_doc = "NamedPipe(name, mode): blocking pipe, the calls release the GIL";
+	g_oNamedPipeType.tp_methods = g_arrNamedPipeMethods;
+	g_oNamedPipeType.tp_init = reinterpret_cast<initproc>(NamedPipe_Init);
+	g_oNamedPipeType.tp_new = PyType_GenericNew;
+
+	g_oAsyncPipeType.tp_basicsize = sizeof(SAsyncPipeObject);
+	g_oAsyncPipeType.tp_dealloc = reinterpret_cast<destructor>(AsyncPipe_Dealloc);
+	g_oAsyncPipeType.tp_flags = Py_TPFLAGS_DEFAULT;
+	g_oAsyncPipeType.tp_doc = "AsyncPipe(name, mode): pipe driven by the I/O loop of the module, the calls return asyncio futures";
+	g_oAsyncPipeType.tp_methods = g_arrAsyncPipeMethods;
+	g_oAsyncPipeType.tp_init = reinterpret_cast<initproc>(AsyncPipe_Init);
+	g_oAsyncPipeType.tp_new = AsyncPipe_New;
+
+	if (PyType_Ready(&g_oBufferType) < 0 || PyType_Ready(&g_oNamedPipeType) < 0 || PyType_Ready(&g_oAsyncPipeType) < 0)
+		return nullptr;
+
+	PyObject* pModule = PyModule_Create(&g_oModule);
+	if (pModule == nullptr)
+		return nullptr;
+
+	// PipeError(code, text), the code is one of the error constants
+	g_pPipeError = PyErr_NewException("named_pipe.PipeError", PyExc_OSError, nullptr);
+	g_pComplete = PyObject_GetAttrString(pModule, "_complete");
+	PyObject* pAsyncio = PyImport_ImportModule("asyncio");
+	if (pAsyncio != nullptr)
+	{
+		g_pGetRunningLoop = PyObject_GetAttrString(pAsyncio, "get_running_loop");
+		Py_DECREF(pAsyncio);
+	}
+	// The loop thread is stopped before the interpreter goes down
+	PyObject* pAtexit = PyImport_ImportModule("atexit");
+	PyObject* pShutdown = PyObject_GetAttrString(pModule, "_shutdown");
+	PyObject* pRegistered = (pAtexit != nullptr && pShutdown != nullptr) ? PyObject_CallMethod(pAtexit, "register", "O", pShutdown) : nullptr;
+	Py_XDECREF(pRegistered);
+	Py_XDECREF(pShutdown);
+	Py_XDECREF(pAtexit);
+
+	Py_INCREF(&g_oNamedPipeType);
+	Py_INCREF(&g_oAsyncPipeType);
+	Py_XINCREF(g_pPipeError);
+	if (g_pPipeError == nullptr || g_pComplete == nullptr || g_pGetRunningLoop == nullptr || pRegistered == nullptr ||
+		PyModule_AddObject(pModule, "NamedPipe", reinterpret_cast<PyObject*>(&g_oNamedPipeType)) < 0 ||
+		PyModule_AddObject(pModule, "AsyncPipe", reinterpret_cast<PyObject*>(&g_oAsyncPipeType)) < 0 ||
+		PyModule_AddObject(pModule, "PipeError", g_pPipeError) < 0 ||
+		!AddInteger(pModule, "READ", long(EPipeMode::Read)) || !AddInteger(pModule, "WRITE", long(EPipeMode::Write)) ||
+		!AddInteger(pModule, "NOT_OPEN", long(EPipeError::NotOpen)) ||
+		!AddInteger(pModule, "INVALID_MODE", long(EPipeError::InvalidMode)) ||
+		!AddInteger(pModule, "IO_FAILURE", long(EPipeError::IoFailure)) ||
+		!AddInteger(pModule, "DISCONNECTED", long(EPipeError::Disconnected)) ||
+		!AddInteger(pModule, "INVALID_FRAME", long(EPipeError::InvalidFrame)) ||
+		!AddInteger(pModule, "FRAME_TOO_LARGE", long(EPipeError::FrameTooLarge)) ||
+		!AddInteger(pModule, "CANCELLED", long(EPipeError::Cancelled)) ||
+		!AddInteger(pModule, "TIMED_OUT", long(EPipeError::TimedOut)) ||
+		!AddInteger(pModule, "NO_CREDIT", long(EPipeError::NoCredit)) ||
+		!AddInteger(pModule, "CHECKSUM_MISMATCH", long(EPipeError::ChecksumMismatch)) ||
+		!AddInteger(pModule, "AUTHENTICATION_FAILED", long(EPipeError::AuthenticationFailed)) ||
+		!AddInteger(pModule, "OVERRUN", long(EPipeError::Overrun)))
+	{
+		Py_DECREF(pModule);
+		return nullptr;
+	}
+
+	return pModule;
+}
@@ -0,0 +1,50 @@
+"""
+Build script of the named_pipe extension module
+
+python setup.py build_ext --inplace
+"""
+
+
+import sys
+from setuptools import setup, Extension
+
+
+SOURCE_DIR = '../c++'
+SOURCES = ['named_pipe_module.cpp'] + [SOURCE_DIR + '/' + name for name in (
+    'aes_gcm.cpp',
+    'async_pipe.cpp',
+    'buffer_pool.cpp',
+    'crc32c.cpp',
+    'frame_cipher.cpp',
+    'io_loop.cpp',
+    'named_pipe.cpp',
+    'pipe_capture.cpp',
+    'pipe_frame.cpp',
+    'pipe_metrics.cpp',
+    'pipe_transport.cpp',
+    'shared_memory_transport.cpp',
+    'spin_waiter.cpp',
+    'win32_pipe_transport.cpp' if sys.platform == 'win32' else 'posix_pipe_transport.cpp',
+)]
+
+if sys.platform == 'win32':
+    COMPILE_ARGS = ['/std:c++17', '/O2', '/EHsc']
+    LINK_ARGS = []
+else:
+    COMPILE_ARGS = ['-std=c++17', '-O2', '-pthread']
+    LINK_ARGS = ['-pthread']
+
+
+setup(
+    name='named_pipe',
+    version='1.0',
+    description='Named pipe of the C++ side: blocking, asyncio and zero-copy reads and writes',
+    ext_modules=[Extension(
+        'named_pipe',
+        sources=SOURCES,
+        include_dirs=[SOURCE_DIR],
+        language='c++',
+        extra_compile_args=COMPILE_ARGS,
+        extra_link_args=LINK_ARGS,
+    )],
+)